@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Measures how apply_step scales with the number of threads.
+#
+# Usage: scaling.sh <solver> <map> [engine] [end_time]
+#
+# Runs the solver with 1, 2, 4, 8, 16 and 32 threads, writing only
+# the first frame, and prints the wall clock time of every run
+# along with the speedup over a single thread.
+
+SOLVER=${1:-./solver}
+MAP=${2:-../data/three_islands.dat}
+ENGINE=${3:-soa}
+END_TIME=${4:-20}
+OUTPUT=$(mktemp -d)
+
+echo "threads seconds speedup"
+for threads in 1 2 4 8 16 32; do
+    start=$(date +%s.%N)
+    "$SOLVER" "$MAP" --engine "$ENGINE" --threads "$threads" \
+        -e "$END_TIME" -p 1000000000 -n -1 \
+        -f gnuplot -o "$OUTPUT/hares" -u "$OUTPUT/pumas" > /dev/null
+    end=$(date +%s.%N)
+
+    elapsed=$(awk "BEGIN { print $end - $start }")
+    if [ "$threads" -eq 1 ]; then serial=$elapsed; fi
+    awk "BEGIN { printf \"%7d %7.3f %7.2f\\n\", $threads, $elapsed, $serial / $elapsed }"
+done
+
+rm -rf "$OUTPUT"
@@ -0,0 +1,152 @@
+#ifndef PUMA_BatchSimulator_hpp
+#define PUMA_BatchSimulator_hpp
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "helpers.hpp"
+#include "Components.hpp"
+#include "kernels.hpp"
+#include "Topology.hpp"
+#include "WorkerPool.hpp"
+
+namespace PUMA {
+
+    class InitialDistribution;
+
+    /** \brief Steps many simulations of the same land map,
+     *      each with its own parameters, in a single pass
+     *
+     *  Every simulation is a lane. The densities of all the
+     *  lanes of a cell are stored next to each other in padded
+     *  arrays laid out like the ones of SoASimulator, so the
+     *  Topology is read once per cell for all the lanes and the
+     *  kernels vectorise over the lanes. Each lane gives results
+     *  bit-identical to a Simulator with the same parameters.
+     *
+     *  The lanes are padded to a multiple of the widest kernel;
+     *  the padding lanes have zero densities and parameters.
+     */
+    class BatchSimulator {
+    private:
+        /// X and Y sizes of the simulation area
+        size_t size_x, size_y;
+
+        /// Number of lanes asked for and the number stored
+        size_t lanes, padded_lanes;
+
+        /// Distance between two consecutive rows, in cells
+        size_t stride;
+
+        boost::shared_ptr<const Topology> topology;
+
+        /// Padded, lane-interleaved densities
+        boost::shared_array<double> hare_current, puma_current;
+        boost::shared_array<double> hare_temp, puma_temp;
+
+        /// Parameters of every lane, in the padded layout
+        std::vector<double> r, a, b, neg_m, k, dt;
+
+        /// Equation parameters and timesteps of the lanes
+        std::vector<step_parameters> parameters;
+
+        /// Kernel used to advance the rows
+        const batch_kernel_isa *kernel;
+
+        /// Threads the rows are spread over, NULL when serial
+        boost::shared_ptr<WorkerPool> workers;
+
+        /// The spans of land the averages are summed over
+        boost::scoped_ptr<LandComponents> components;
+
+        /// Index of the first lane of the cell (i, j)
+        size_t at(size_t i, size_t j) const
+        {
+            return ((j + 1) * stride + i + 1) * padded_lanes;
+        }
+
+        void check_lane(size_t lane) const;
+        void step_rows(size_t j_begin, size_t j_end);
+
+    public:
+        /** \brief Creates the batch with every lane holding
+         *      the default parameters and empty densities
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param lanes number of simulations in the batch
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         *  \exception IllegalValue if lanes is 0 or the topology
+         *      does not describe the map
+         */
+        BatchSimulator(size_t dim_x, size_t dim_y, bool *land_map, size_t lanes,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+
+        /// Returns the number of lanes
+        size_t get_lanes() { return lanes; }
+
+        /** \brief Sets the equation parameters and the timestep
+         *      of a lane
+         *  \exception IllegalValue if there is no such lane
+         */
+        void set_parameters(size_t lane, const step_parameters &params);
+
+        /// Returns the equation parameters and the timestep of a lane
+        step_parameters get_parameters(size_t lane);
+
+        /** \brief Fills the densities of a lane from an initial
+         *      distribution, like Simulator::initialize
+         *  \exception IllegalValue if there is no such lane or
+         *      the distribution does not fit the map
+         */
+        void initialize(size_t lane, const InitialDistribution &initial);
+
+        /** \brief Overwrites the densities of a lane
+         *  \param lane the lane
+         *  \param state array of size_x * size_y cells laid out
+         *      like Simulator::get_state. Water stays empty.
+         */
+        void set_state(size_t lane, const landscape *state);
+
+        /// Returns a copy of the state of a lane
+        boost::shared_array<landscape> get_state(size_t lane);
+
+        /** \brief Calculates the average densities of a lane over
+         *      all land cells, summed like
+         *      Simulator::get_averages
+         */
+        average_densities get_averages(size_t lane);
+
+        /// Advances every lane by a single step
+        void apply_step();
+
+        /// Advances every lane by a number of steps
+        void apply_steps(size_t steps);
+
+        /** \brief Sets the number of threads the rows are split over
+         *  \exception IllegalValue if threads is 0
+         */
+        void set_threads(size_t threads);
+
+        /** \brief Selects the instruction set used by the kernel
+         *  \param name name of one of available_batch_kernels()
+         *  \exception IllegalValue if it is not available
+         */
+        void set_kernel(std::string name);
+
+        /// Returns the size in X dimension of the simulation area
+        size_t get_size_x() { return size_x; }
+
+        /// Returns the size in Y dimension of the simulation area
+        size_t get_size_y() { return size_y; }
+    };
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef PUMA_Checkpoint_hpp
+#define PUMA_Checkpoint_hpp
+
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_array.hpp>
+
+#include "exceptions.hpp"
+#include "helpers.hpp"
+#include "OutputPipeline.hpp"
+#include "Simulator.hpp"
+
+namespace PUMA {
+
+    /** \brief Header of a checkpoint file
+     *
+     *  It is followed by the size_x * size_y hare densities and
+     *  as many puma densities, as doubles, in the byte order of
+     *  the machine that wrote the file.
+     */
+    struct checkpoint_header {
+        /// "PUMACHK", zero terminated
+        char magic[8];
+
+        /// binary_byte_order as written by the writing machine
+        uint32_t byte_order;
+
+        /// Version of the format, checkpoint_version
+        uint32_t version;
+
+        uint64_t size_x, size_y;
+
+        /// land_hash of the land map the simulation runs on
+        uint64_t land_hash;
+
+        /// Number of steps applied since the initial state
+        uint64_t step;
+
+        /** Seed of the initial densities, 0 if they were seeded
+         *  from the time. The generator is counter based, so
+         *  this is all of its state.
+         */
+        uint64_t seed;
+
+        /// Equation parameters and timestep of the simulation
+        step_parameters parameters;
+
+        /** Step size of the adaptive integrator, which it keeps
+         *  from one time step to the next, 0 for the others
+         */
+        double step_size;
+    };
+
+    /// Magic number of the checkpoint files
+    extern const char checkpoint_magic[8];
+
+    /// Current version of the checkpoint format
+    const uint32_t checkpoint_version = 2;
+
+    /** \brief Hashes the land mask of a state (FNV-1a), so
+     *      that a checkpoint is not resumed on another map
+     *  \param state array of size_x * size_y cells
+     */
+    uint64_t land_hash(const landscape *state, size_t size_x, size_t size_y);
+
+    /// \brief Everything needed to resume a simulation
+    struct checkpoint {
+        size_t size_x, size_y;
+        uint64_t land_hash;
+        uint64_t step;
+        uint64_t seed;
+        step_parameters parameters;
+        double step_size;
+
+        /** The densities, laid out like Simulator::get_state.
+         *  The land map is only stored as its hash, so the cells
+         *  read by read_checkpoint are all marked as water.
+         */
+        boost::shared_array<landscape> state;
+    };
+
+    /** \brief Writes a checkpoint atomically
+     *
+     *  The checkpoint is written into filename.tmp, synced
+     *  to the disk and renamed over filename, so that filename
+     *  always holds a complete checkpoint, even if the program
+     *  is killed while writing.
+     *  \exception FormatError if the file cannot be written
+     */
+    void write_checkpoint(std::string filename, const checkpoint &snapshot);
+
+    /** \brief Reads a checkpoint written by write_checkpoint
+     *  \exception FormatError if the file cannot be read or
+     *      is not a valid checkpoint
+     */
+    checkpoint read_checkpoint(std::string filename);
+
+    /** \brief Writes the checkpoints of a simulation on a
+     *      thread of its own
+     *
+     *  The state is copied into a buffer and written by an
+     *  OutputPipeline, so the simulation only waits if the
+     *  previous checkpoint is still being written. The pipeline
+     *  can be the one writing the output frames, in which case
+     *  a checkpoint only reaches the disk after the frames
+     *  queued before it.
+     */
+    class CheckpointWriter {
+    private:
+        std::string filename;
+        step_parameters parameters;
+        uint64_t seed;
+        size_t size_x, size_y;
+
+        /// The pipeline created when none is shared
+        boost::scoped_ptr<OutputPipeline> own_pipeline;
+        OutputPipeline *pipeline;
+
+        void write(boost::shared_array<landscape> state, size_t step, double step_size);
+
+    public:
+        /** \param filename name of the checkpoint file, replaced
+         *      by every new checkpoint
+         *  \param simulation the checkpointed simulation, giving
+         *      the sizes and parameters
+         *  \param seed seed of its initial densities, 0 if unknown
+         *  \param shared pipeline the checkpoints are queued
+         *      on, a pipeline of their own is created if NULL
+         */
+        CheckpointWriter(std::string filename, Simulator &simulation, uint64_t seed,
+                OutputPipeline *shared = NULL);
+
+        /** \brief Queues a checkpoint of the current state
+         *  \param simulation the checkpointed simulation
+         *  \param step number of steps it has applied
+         *
+         *  Rethrows a FormatError of an earlier checkpoint.
+         */
+        void save(Simulator &simulation, uint64_t step);
+
+        /** \brief Waits until every queued checkpoint is written
+         *
+         *  Rethrows a FormatError of a checkpoint.
+         */
+        void flush();
+    };
+}
+
+#endif
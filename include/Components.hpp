@@ -0,0 +1,68 @@
+#ifndef PUMA_Components_hpp
+#define PUMA_Components_hpp
+
+#include <cstddef>
+#include <vector>
+
+#include "Topology.hpp"
+
+namespace PUMA {
+
+    /** \brief The land of a map split into connected components
+     *
+     *  Two land cells belong to the same component if one can be
+     *  reached from the other through east, west, north and south
+     *  land neighbours, the same neighbours the step looks at, so
+     *  no population ever moves between two components.
+     *
+     *  Every row of land is also cut into spans of consecutive
+     *  land cells, each of which lies within a single component.
+     *  The components are numbered in the order their first cell
+     *  appears in the map, row by row.
+     */
+    class LandComponents {
+    public:
+        /// Consecutive land cells of a row
+        struct span {
+            /// Row of the span and its first and one past last column
+            size_t row, begin, end;
+
+            /// Component the span belongs to
+            size_t component;
+        };
+
+        /// The extent of a component
+        struct component {
+            /** Bounding box of the component, from its first
+             *  row and column to one past the last ones
+             */
+            size_t x0, y0, x1, y1;
+
+            /// Number of land cells
+            size_t cells;
+        };
+
+        /// X and Y sizes of the described map
+        size_t size_x, size_y;
+
+        /// The spans of land, row after row, left to right
+        std::vector<span> spans;
+
+        /// Index of the first span of every row, and the number of spans
+        std::vector<size_t> row_spans;
+
+        /// The components, by their number
+        std::vector<component> components;
+
+        /// Labels the land described by a Topology
+        explicit LandComponents(const Topology &topology);
+
+        /** \brief Component of the cell (i, j)
+         *  \return the number of the component, or
+         *      components.size() for water
+         */
+        size_t at(size_t i, size_t j) const;
+    };
+}
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef PUMA_Compression_hpp
+#define PUMA_Compression_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "Serializer.hpp"
+
+namespace PUMA {
+
+    /** \brief Header starting the files written by
+     *      FrameCompressor
+     *
+     *  It is followed by chunks of frames. A chunk is a
+     *  chunk_header followed by its frames, each of them a
+     *  frame_entry, the packed bytes of the frame and its
+     *  patches. The chunks can be walked through from their
+     *  headers alone, so any frame is found by unpacking at
+     *  most the frames of its own chunk.
+     */
+    struct compressed_header {
+        /// "PUMACMP", zero terminated
+        char magic[8];
+
+        /// binary_byte_order as written by the writing machine
+        uint32_t byte_order;
+
+        /// Version of the format, compressed_version
+        uint32_t version;
+
+        /// Most frames in a chunk
+        uint32_t chunk_frames;
+
+        uint32_t reserved;
+    };
+
+    /** \brief Header of a chunk of compressed frames
+     *
+     *  Written once the chunk is complete, a chunk cut short
+     *  by an interrupted run being left with a zero header.
+     */
+    struct chunk_header {
+        /// "CHNK"
+        char magic[4];
+
+        /// Number of frames in the chunk
+        uint32_t frames;
+
+        /// Bytes of the chunk following this header
+        uint64_t size;
+    };
+
+    /// \brief Header of a frame in a chunk
+    struct frame_entry {
+        /// Where the bytes written for the frame go in the uncompressed output
+        uint64_t offset, length;
+
+        /// Bytes of the packed frame and of its patches, following
+        uint64_t packed_size, patches_size;
+    };
+
+    /** \brief Bytes written by a serializer over those of
+     *      earlier frames, like a frame count in a header
+     *
+     *  The patches of a frame are each this header followed
+     *  by its bytes, in the order they were written.
+     */
+    struct patch_header {
+        uint64_t offset, length;
+    };
+
+    /// Magic number of the files written by FrameCompressor
+    extern const char compressed_magic[8];
+
+    /// Current version of the compressed format
+    const uint32_t compressed_version = 1;
+
+    /// \brief The bytes written for a frame, as seen by the compressor
+    struct written_frame {
+        /// Offset of the bytes appended at the end of the output
+        uint64_t offset;
+        std::vector<char> bytes;
+
+        /// Bytes written before the end of the output, as in a chunk
+        std::vector<char> patches;
+
+        written_frame() : offset(0) {}
+    };
+
+    /** \brief A seekable output buffer in memory, cut into
+     *      the frames written into it
+     *
+     *  Stands for a whole file, of which it only keeps the
+     *  bytes written since the last frame was taken out: the
+     *  ones appended at its end, and those written over the
+     *  earlier ones as patches. Writing anywhere is allowed,
+     *  reading is not.
+     */
+    class FrameBuffer : public std::streambuf {
+    private:
+        /// Offset of the first byte of the frame in the whole output
+        uint64_t start;
+
+        /// Bytes of the frame, its length being the highest written
+        std::vector<char> data;
+        size_t length;
+
+        /// Set while writing over the earlier frames, at position
+        bool patching;
+        uint64_t position;
+        std::vector<char> patches;
+
+        /// Where the header of the current patch is in patches
+        size_t patch_at;
+
+        /// Notes the bytes written through the put area
+        void settle();
+
+        /// Moves the put area to an offset of the frame, growing it
+        void place(size_t offset);
+
+        /// Starts a patch at an offset before the frame
+        void start_patch(uint64_t offset);
+
+        /// Adds bytes to the current patch, up to the frame
+        size_t add_patch(const char *bytes, size_t count);
+
+    protected:
+        int_type overflow(int_type c);
+        std::streamsize xsputn(const char *s, std::streamsize count);
+        pos_type seekoff(off_type offset, std::ios_base::seekdir direction,
+                std::ios_base::openmode which);
+        pos_type seekpos(pos_type offset, std::ios_base::openmode which);
+        int sync();
+
+    public:
+        FrameBuffer();
+
+        /** \brief Takes out the bytes written since the
+         *      previous frame
+         *  \param frame filled with them, its vectors swapped
+         *      with the buffer's, so they can be reused
+         */
+        void take_frame(written_frame &frame);
+    };
+
+    /** \brief Compresses the output of any Serializer on a
+     *      thread of its own
+     *
+     *  Attached to an open output stream, it makes the stream
+     *  write into a FrameBuffer, so that every frame written
+     *  by a serializer is handed to the compressing thread by
+     *  end_frame. The frames go to the file of the stream in
+     *  chunks of up to chunk_frames frames: the first frame
+     *  of a chunk is kept whole, every other one is XORed
+     *  with the end of the frame before it, so that the bytes
+     *  that did not change become zeros. The bytes are then
+     *  split in eight planes by their place in a double, the
+     *  zeros of the high bytes gathering, and the planes are
+     *  run length coded.
+     *
+     *  Flushing the stream does not reach the file, as text
+     *  serializers flush it on every line; flush does. Only
+     *  end_frame and flush block, when the thread is two
+     *  frames behind.
+     */
+    class FrameCompressor {
+    private:
+        /// A frame to compress, or a request to flush
+        struct job {
+            written_frame frame;
+            bool flush;
+
+            explicit job(bool flush = false) : flush(flush) {}
+        };
+
+        std::ofstream &stream;
+        std::filebuf *file;
+        std::streambuf *previous_buffer;
+        FrameBuffer buffer;
+        size_t chunk_frames;
+
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable queued, written;
+        std::deque<job> pending;
+        bool stopping, finished, failed;
+        size_t pushed, done;
+
+        /// Vectors of compressed frames, for the next ones
+        std::vector<std::vector<char> > spare;
+
+        /// The chunk being written, and its first byte in the file
+        size_t chunk_count;
+        std::streamoff chunk_start;
+
+        /// The last frame compressed, and the buffers of the next one
+        std::vector<char> previous, transformed, packed;
+
+        void compressor_loop();
+
+        /// Compresses a frame into the current chunk
+        void add_frame(written_frame &frame);
+
+        /// Completes the current chunk
+        void write_chunk();
+
+        /// Writes to the file
+        void write(const void *bytes, size_t count);
+
+        /// Queues a job, waiting while the thread is behind
+        void push(job &next);
+
+        /// Throws if the thread could not write
+        void check_failure();
+
+    public:
+        /** \brief Starts compressing the output of a stream
+         *  \param stream an output stream open on an empty
+         *      file, which the compressed frames go to
+         *  \param chunk_frames most frames in a chunk, the
+         *      frames found by unpacking at most that many
+         *  \exception IllegalValue if chunk_frames is 0
+         *  \exception FormatError if the stream is not open
+         */
+        FrameCompressor(std::ofstream &stream, size_t chunk_frames);
+
+        /// Finishes, if not done yet, ignoring the errors
+        ~FrameCompressor();
+
+        /** \brief Hands the bytes written since the previous
+         *      call to the compressing thread, as a frame
+         *  \exception FormatError if the file could not be written
+         */
+        void end_frame();
+
+        /** \brief Writes the frames ended so far to the file,
+         *      closing the current chunk
+         *  \exception FormatError if the file could not be written
+         */
+        void flush();
+
+        /** \brief Writes the frames left and gives the stream
+         *      back its own buffer, the file staying open
+         *
+         *  Whatever was written since the last end_frame makes
+         *  a last frame.
+         *  \exception FormatError if the file could not be written
+         */
+        void finish();
+    };
+
+    /** \brief Reads the frames of a file written by
+     *      FrameCompressor
+     *
+     *  The chunks are indexed when it is opened, by their
+     *  headers, a chunk cut short by an interrupted run
+     *  being left out.
+     */
+    class CompressedReader {
+    private:
+        struct chunk_info {
+            /// Offset of the first frame of the chunk
+            uint64_t offset;
+            size_t first_frame, frames;
+        };
+
+        std::ifstream input;
+        std::string filename;
+        std::vector<chunk_info> chunks;
+        size_t frames;
+
+        /** \brief Unpacks the frames of a chunk in turn
+         *  \param visit called with every frame, its bytes
+         *      and its patches, until it returns false
+         */
+        void read_chunk(size_t chunk, const std::function<bool(const frame_entry&,
+                    const std::vector<char>&, const std::vector<char>&)> &visit);
+
+    public:
+        /** \brief Opens and indexes a file
+         *  \exception FormatError if it cannot be read or is
+         *      not a compressed file
+         */
+        CompressedReader(std::string filename);
+
+        size_t get_frames() { return frames; }
+
+        /** \brief Returns the bytes written for a frame, as
+         *      the serializer wrote them
+         *  \param frame number of the frame, from 0
+         *  \param offset set to where they go in the
+         *      uncompressed output, if not NULL
+         *  \exception IllegalValue if there is no such frame
+         *  \exception FormatError if the chunk is damaged
+         */
+        std::vector<char> get_frame(size_t frame, uint64_t *offset = NULL);
+
+        /** \brief Writes the uncompressed output, exactly as
+         *      the serializer would have
+         *  \param output a seekable stream, empty
+         *  \exception FormatError if a chunk is damaged
+         */
+        void decompress(std::ostream &output);
+    };
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef PUMA_Convergence_hpp
+#define PUMA_Convergence_hpp
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "helpers.hpp"
+#include "Statistics.hpp"
+
+namespace PUMA {
+
+    /** \brief Watches the statistics of a simulation for it
+     *      settling into a steady state or a periodic orbit
+     *
+     *  The statistics are sampled at regular intervals, at
+     *  the frames of the solver. A steady state is reached
+     *  when no density of a land cell changed faster than
+     *  steady_tolerance per unit of time during the step
+     *  before the sample, see density_statistics::largest_change.
+     *
+     *  A periodic orbit is found from the time series of the
+     *  mean densities: the maxima of the mean hare density are
+     *  located between the samples by a parabola through the
+     *  three samples around them, and once the last cycles
+     *  periods and the means of both species at the maxima
+     *  agree to period_tolerance, relatively, the orbit is
+     *  considered closed. A damped oscillation keeps failing
+     *  the test on the maxima until it is damped enough to
+     *  count as periodic at the tolerance.
+     */
+    class ConvergenceMonitor {
+    private:
+        /// Maximum of the mean hare density
+        struct peak {
+            double time, hares, pumas;
+        };
+
+        double steady_tolerance, period_tolerance;
+        size_t cycles;
+
+        /// The last three samples, the oldest first
+        double times[3], hares[3], pumas[3];
+        size_t samples;
+
+        std::vector<peak> peaks;
+        convergence_record result;
+
+        /// Whether the last peaks close an orbit
+        bool closes_orbit();
+
+    public:
+        /** \brief Creates a monitor
+         *  \param steady_tolerance largest change of a density
+         *      per unit of time of a steady state, 0 not to
+         *      look for one
+         *  \param period_tolerance relative tolerance of the
+         *      periods and maxima of an orbit, 0 not to look
+         *      for one
+         *  \param cycles number of consecutive periods that have
+         *      to agree
+         */
+        ConvergenceMonitor(double steady_tolerance, double period_tolerance,
+                size_t cycles = 3);
+
+        /** \brief Adds the statistics of a sample
+         *  \param step number of steps from the initial state
+         *  \param dt the timestep, the time being step * dt
+         *  \param statistics statistics collected during the
+         *      last step before the sample
+         *  \return true when convergence is detected by this
+         *      sample, false before and after
+         */
+        bool add(uint64_t step, double dt, const density_statistics &statistics);
+
+        /// Whether convergence was detected
+        bool converged() { return result.reason != NOT_CONVERGED; }
+
+        /// Returns what was detected, its action being left at 0
+        const convergence_record& get_result() { return result; }
+    };
+}
+
+#endif
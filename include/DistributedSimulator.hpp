@@ -0,0 +1,163 @@
+#ifndef PUMA_DistributedSimulator_hpp
+#define PUMA_DistributedSimulator_hpp
+
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+#include "helpers.hpp"
+#include "kernels.hpp"
+#include "Simulator.hpp"
+
+namespace PUMA {
+
+    /** \brief A Simulator splitting the map into 2D blocks,
+     *      each stepped by a process of its own
+     *
+     *  Every rank keeps only its block, padded by a one-cell
+     *  halo, in memory of its own process. The ranks are forked
+     *  by the constructor, the calling process being rank 0 and
+     *  driving the others through commands in a shared memory
+     *  segment, which is also the transport of the halos and
+     *  of the frames.
+     *
+     *  Each step a rank first computes the cells on the edges
+     *  of its block and publishes them, then computes the inside
+     *  while the neighbours pick them up; a single barrier per
+     *  step separates the publishing from the reading of the
+     *  halos. The edges are double buffered by the parity of
+     *  the step, so the next step never overwrites an edge
+     *  still being read.
+     *
+     *  The blocks are only gathered into current_state when
+     *  something reads it, so the frames cost nothing at the
+     *  steps that are not written. The results are bit-identical
+     *  to the ones of the soa engine. set_threads has no effect,
+     *  the ranks being the unit of parallelism.
+     *
+     *  If a rank fails or dies, the others stop and the calls
+     *  to rank 0 throw a SystemError from then on.
+     */
+    class DistributedSimulator : public Simulator {
+    public:
+        /// The part of the map a rank steps
+        struct block {
+            /// First column and row, and sizes of the block
+            size_t x0, y0, width, height;
+
+            /// Ranks of the neighbouring blocks, -1 at the edges of the map
+            int north, south, west, east;
+        };
+
+    private:
+        /// Control block at the start of the shared segment
+        struct control;
+
+        size_t ranks;
+
+        /// Blocks in X and Y dimensions
+        size_t blocks_x, blocks_y;
+
+        std::vector<block> blocks;
+
+        /// The shared segment and its length
+        char *shared;
+        size_t shared_size;
+        control *commands;
+
+        /// Offsets of the edges of every rank in the shared segment
+        std::vector<size_t> edge_offset;
+
+        /// Hare densities of the gathered frame, then the puma ones
+        double *frame;
+
+        /// The processes of ranks 1 and above
+        std::vector<pid_t> children;
+
+        /// Whether current_state holds the state of the blocks
+        bool gathered;
+
+        /// Number of steps done, giving the parity of the edges
+        size_t steps_done;
+
+        /// State of the block of the rank of this process
+        struct local_block;
+        local_block *local;
+
+        const kernel_isa<double> *kernel;
+
+        /// Splits the map into blocks for the ranks
+        void decompose();
+
+        /// Sends a command to the other ranks and executes it as rank 0
+        void execute(int command, size_t steps);
+
+        /// Loop of the ranks other than 0, never returns
+        void serve(size_t rank);
+
+        /// Executes a command as the rank of this process
+        void run_command(size_t rank, int command, size_t steps,
+                const step_parameters &params);
+
+        /// Advances the block of this process by one step
+        void step_block(size_t rank, const step_parameters &params);
+
+        /// Pointer to an edge of a rank, in the given slot
+        double* edge(size_t rank, size_t slot, int side);
+
+        /// Stops the other ranks and releases the shared segment
+        void shutdown();
+
+        /** \brief Waits until every rank reaches this point
+         *
+         *  If a rank failed, rank 0 throws a SystemError and the
+         *  others exit.
+         */
+        void synchronize(size_t rank);
+
+        /// Breaks the barrier, so that no rank waits for this one
+        void fail_ranks();
+
+        /// Whether one of the other ranks has exited
+        bool rank_died();
+
+    protected:
+        void gather_state();
+        void scatter_state();
+        void step();
+        void collecting_step();
+        void refresh_statistics();
+
+    public:
+        /** \brief initializes a simulation instance with some
+         *      input data
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param ranks number of processes the map is split
+         *      between, including the calling one
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         *  \exception IllegalValue if ranks is 0 or the map is
+         *      too small to give every rank a block
+         */
+        DistributedSimulator(size_t dim_x, size_t dim_y, bool *land_map, size_t ranks,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+        ~DistributedSimulator();
+
+        void apply_steps(size_t steps);
+
+        /// Returns the block stepped by a rank
+        const block& get_block(size_t rank) { return blocks.at(rank); }
+
+        /// Returns the number of ranks
+        size_t get_ranks() { return ranks; }
+
+        /// Returns the processes of the ranks 1 and above
+        const std::vector<pid_t>& get_processes() { return children; }
+    };
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef PUMA_Engines_hpp
+#define PUMA_Engines_hpp
+
+#include <list>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+#include "Simulator.hpp"
+#include "Topology.hpp"
+#include "exceptions.hpp"
+
+namespace PUMA {
+
+    /** \brief Tunables of the engines, as given
+     *      on the command line
+     */
+    struct engine_settings {
+        /** Precision the densities are stored and computed in,
+         *  one of double, float or mixed. Only the soa based
+         *  engines support other than double.
+         */
+        std::string precision;
+
+        /// Fraction of land below which auto picks the sparse engine
+        double sparse_threshold;
+
+        /// Size of the tiles of the tiled engine
+        size_t tile_width, tile_height;
+
+        /// Maximal number of steps the tiled engine does at once
+        size_t block_steps;
+
+        /** Number of ensemble members stepped together by a
+         *  BatchSimulator, 1 running each with the engine
+         */
+        size_t batch_lanes;
+
+        /// Number of processes the distributed engine splits the map between
+        size_t ranks;
+
+        /** Time integrator, one of available_integrators. Only
+         *  the soa and auto engines support other than euler,
+         *  in double precision
+         */
+        std::string integrator;
+
+        /// Tolerance of the adaptive integrators
+        double tolerance;
+
+        /** Topology of the land map, shared by all the
+         *  simulations created with these settings. Each
+         *  simulation builds its own if empty
+         */
+        boost::shared_ptr<const Topology> topology;
+
+        engine_settings() : precision("double"), sparse_threshold(0.5),
+            tile_width(512), tile_height(128), block_steps(8),
+            batch_lanes(1), ranks(1), integrator("euler"), tolerance(1e-6) {}
+    };
+
+    /** \brief Describes a stepping engine that can be
+     *      chosen at runtime
+     *
+     *  All the engines compute the same discretization,
+     *  they differ in how the state is laid out in memory
+     *  and traversed.
+     */
+    struct Engine {
+        /// Name of the engine, as given on the command line
+        std::string name;
+
+        /// Human-readable engine description
+        std::string description;
+
+        /// Creates a Simulator instance using this engine
+        Simulator* (*create)(size_t dim_x, size_t dim_y, bool *land_map,
+                const engine_settings &settings);
+    };
+
+    /** \brief Returns the list of available engines,
+     *      the first one being the default
+     */
+    const std::list<Engine>& available_engines();
+
+    /** \brief Creates a Simulator using an engine 
+     *      specified by its name
+     *  \param name engine name
+     *  \param dim_x size in X dimension of the supplied land_map
+     *  \param dim_y size in Y dimension of land_map
+     *  \param land_map a 1D array of X*Y elements specifying
+     *      which tiles are land and which water
+     *  \param settings tunables of the engine
+     *  \exception EngineNotFound when name does not correspond
+     *      to any of the available engines
+     *  \exception IllegalValue when the engine does not support
+     *      the requested precision or integrator
+     *  \return pointer to the created Simulator instance
+     */
+    Simulator* create_simulator(std::string name, 
+            size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings = engine_settings());
+}
+
+#endif
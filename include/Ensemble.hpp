@@ -0,0 +1,134 @@
+#ifndef PUMA_Ensemble_hpp
+#define PUMA_Ensemble_hpp
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "helpers.hpp"
+#include "exceptions.hpp"
+#include "Engines.hpp"
+#include "MapLoader.hpp"
+
+namespace PUMA {
+
+    /// \brief A single simulation of an ensemble
+    struct ensemble_member {
+        /// Equation parameters and timestep
+        step_parameters parameters;
+
+        /// Seed of the random initial densities
+        uint64_t seed;
+    };
+
+    /** \brief Reads the members of an ensemble from a
+     *      sweep specification
+     *
+     *  Every line is either
+     *  - "NAME = VALUES", NAME being one of r, a, b, m, k, l
+     *    and seed, and VALUES a list of numbers or a
+     *    START:STOP:STEP range including STOP. The ensemble
+     *    then holds every combination of the listed values,
+     *    the parameters not listed keeping their defaults.
+     *  - "member NAME=VALUE ...", adding a single member,
+     *    with the parameters not given keeping their defaults.
+     *
+     *  Text from a '#' to the end of the line is ignored.
+     *  The timestep is not swept, as all the members do the
+     *  same steps and are sampled at the same ones.
+     *  \param spec the specification
+     *  \param defaults parameters of the members, unless
+     *      given otherwise
+     *  \param seed seed of the members, unless given otherwise
+     *  \exception IllegalValue if the specification is
+     *      malformed or sweeps the timestep
+     */
+    std::vector<ensemble_member> parse_sweep(std::istream &spec,
+            const step_parameters &defaults, uint64_t seed);
+
+    /** \brief The time series of the average densities
+     *      of every member of an ensemble
+     *
+     *  Stored in binary as a header (the magic "PUMAENS",
+     *  the byte order and version as 32-bit words, then the
+     *  64-bit numbers of members, samples and steps between
+     *  the samples), followed by the parameters and seed of
+     *  every member and then the hare and puma averages of
+     *  every sample of every member, member after member.
+     */
+    struct ensemble_results {
+        /// Number of steps between two samples
+        size_t sample_every;
+
+        std::vector<ensemble_member> members;
+
+        /** The averages of every member, sampled at the
+         *  start and then every sample_every steps
+         */
+        std::vector<std::vector<average_densities> > averages;
+
+        /// Writes the results in binary
+        void write(std::ostream &output) const;
+
+        /** \brief Reads results written by write
+         *  \exception FormatError if the input is not valid
+         */
+        void read(std::istream &input);
+
+        /** \brief Writes the results as a table with a line
+         *      per sample of every member
+         */
+        void write_text(std::ostream &output) const;
+    };
+
+    /** \brief Runs the members of an ensemble in parallel
+     *
+     *  All the members share the land map and its Topology.
+     *  Every thread runs whole members, one at a time and
+     *  each on a single thread. The members are dealt out
+     *  between the threads up front, and a thread running
+     *  out of members steals from the others, so members of
+     *  different cost still keep every thread busy.
+     *
+     *  With settings.batch_lanes above 1, consecutive members
+     *  are grouped into batches stepped together by a
+     *  BatchSimulator, and the batches are dealt out instead.
+     *  The engine is not used then, but the results stay the
+     *  same.
+     */
+    class EnsembleRunner {
+    private:
+        land_map map;
+        std::string engine;
+        engine_settings settings;
+
+    public:
+        /** \param map the land map, shared by all the members
+         *  \param engine name of the engine the members use
+         *  \param settings tunables of the engine
+         *  \exception IllegalValue for the distributed engine,
+         *      which cannot fork its ranks from the threads
+         *      running the members
+         */
+        EnsembleRunner(const land_map &map, std::string engine,
+                const engine_settings &settings);
+
+        /** \brief Runs the members, returning their averages
+         *  \param members the members to run
+         *  \param steps number of steps every member does
+         *  \param sample_every number of steps between
+         *      two samples of the averages
+         *  \param threads number of members run at once
+         *  \exception IllegalValue if sample_every or threads
+         *      is 0, or the engine does not take the settings.
+         *      Batches only support double precision and the
+         *      euler integrator
+         */
+        ensemble_results run(const std::vector<ensemble_member> &members,
+                size_t steps, size_t sample_every, size_t threads);
+    };
+}
+
+#endif
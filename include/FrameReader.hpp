@@ -0,0 +1,84 @@
+#ifndef PUMA_FrameReader_hpp
+#define PUMA_FrameReader_hpp
+
+#include <string>
+#include <boost/shared_array.hpp>
+
+#include "helpers.hpp"
+#include "exceptions.hpp"
+#include "Serializer.hpp"
+
+namespace PUMA {
+
+    /** \brief Gives access to the frames of a file written
+     *      by BinarySerializer
+     *
+     *  The file is mapped into memory as a whole, so opening
+     *  it costs the same whatever its size, and any frame is
+     *  found at a fixed offset without reading the ones
+     *  before it.
+     */
+    class FrameReader {
+    private:
+        const char *data;
+        size_t length;
+        const binary_header *header;
+
+        /// Number of complete frames present in the file
+        size_t frame_count;
+
+        FrameReader(const FrameReader&);
+        FrameReader& operator=(const FrameReader&);
+
+    public:
+        /** \brief Maps a file into memory and checks its header
+         *  \param filename name of the file
+         *  \exception FormatError if the file cannot be opened,
+         *      was not written by BinarySerializer or was written
+         *      on a machine of a different byte order
+         */
+        FrameReader(std::string filename);
+        ~FrameReader();
+
+        size_t get_size_x();
+        size_t get_size_y();
+
+        /** \brief Returns the number of frames in the file
+         *
+         *  Frames cut short by an interrupted simulation
+         *  are not counted.
+         */
+        size_t get_frames();
+
+        /// Returns the parameters of the simulation that wrote the file
+        step_parameters get_parameters();
+
+        /** \brief Returns how the simulation that wrote the
+         *      file converged, NOT_CONVERGED if it did not or
+         *      the file predates the record
+         */
+        convergence_record get_convergence();
+
+        /// Returns the land mask, one byte per cell
+        const unsigned char* get_land();
+
+        /** \brief Returns the hare densities of a frame
+         *  \exception IllegalValue if there is no such frame
+         */
+        const double* get_hares(size_t frame);
+
+        /** \brief Returns the puma densities of a frame
+         *  \exception IllegalValue if there is no such frame
+         */
+        const double* get_pumas(size_t frame);
+
+        /** \brief Returns a frame laid out like
+         *      Simulator::get_state, as expected by
+         *      the serializers
+         *  \exception IllegalValue if there is no such frame
+         */
+        boost::shared_array<landscape> get_state(size_t frame);
+    };
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef PUMA_HaloSimulator_hpp
+#define PUMA_HaloSimulator_hpp
+
+#include "helpers.hpp"
+#include "Simulator.hpp"
+#include <boost/shared_array.hpp>
+
+namespace PUMA {
+
+    /** \brief A Simulator keeping its state surrounded by
+     *      a permanent border of water cells
+     *
+     *  Both states are stored as (size_x + 2) * (size_y + 2)
+     *  grids, the simulation area starting at (1, 1). As the
+     *  border never changes, every neighbour of a simulated
+     *  cell can be read at a fixed offset, without the bounds
+     *  checks done by Simulator::get_cell. The results are
+     *  bit-identical to the ones of the plain Simulator.
+     */
+    class HaloSimulator : public Simulator {
+    protected:
+        /// Padded counterpart of current_state
+        boost::shared_array<landscape> padded_current;
+
+        /// Padded counterpart of temp_state
+        boost::shared_array<landscape> padded_temp;
+
+        /// Distance between two consecutive rows of the padded states
+        size_t stride;
+
+        void gather_state();
+        void scatter_state();
+        void swap_states();
+        void step_rows(size_t j_begin, size_t j_end);
+        void collect_row(size_t j, row_statistics &row,
+                double *span_hares, double *span_pumas);
+
+    public:
+        /** \brief initializes a simulation instance with some
+         *      input data
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         */
+        HaloSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+    };
+}
+
+#endif
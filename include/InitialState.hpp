@@ -0,0 +1,156 @@
+#ifndef PUMA_InitialState_hpp
+#define PUMA_InitialState_hpp
+
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+#include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "helpers.hpp"
+#include "exceptions.hpp"
+
+namespace PUMA {
+
+    /** \brief The Philox4x32-10 counter-based random
+     *      number generator
+     *
+     *  Every counter gives four independent 32-bit numbers
+     *  for a given key, without any state carried from one
+     *  call to the next. Using the index of a cell as the
+     *  counter lets any thread generate any cell, always
+     *  getting the same numbers.
+     *  \param counter the counter, four 32-bit words
+     *  \param key the key, two 32-bit words, usually the seed
+     *  \param out the four generated numbers
+     */
+    inline void philox4x32(const uint32_t counter[4], const uint32_t key[2],
+            uint32_t out[4])
+    {
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+
+        for (int round = 0; round < 10; ++round) {
+            uint64_t product0 = (uint64_t)0xD2511F53 * c0;
+            uint64_t product1 = (uint64_t)0xCD9E8D57 * c2;
+
+            c0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+            c1 = (uint32_t)product1;
+            c2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+            c3 = (uint32_t)product0;
+
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+
+        out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+    }
+
+    /** \brief Turns two 32-bit random numbers into a double
+     *      uniformly distributed in [0, 1)
+     */
+    inline double uniform_double(uint32_t high, uint32_t low)
+    {
+        return ((((uint64_t)high << 32) | low) >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /** \brief A way of choosing the densities the
+     *      simulation starts from
+     *
+     *  Implementations must give every cell a value that
+     *  only depends on its index, so that the map can be
+     *  filled by many threads at once, in any order.
+     */
+    class InitialDistribution {
+    public:
+        virtual ~InitialDistribution() {};
+
+        /** \brief Checks if the distribution can fill
+         *      a map of a given size
+         *  \exception IllegalValue if it cannot
+         */
+        virtual void check(size_t size_x, size_t size_y) const;
+
+        /** \brief Sets the densities of cells [begin, end)
+         *
+         *  Only the land cells are set, the water ones are
+         *  left empty.
+         *  \param state the state, laid out like
+         *      Simulator::get_state, with is_land set
+         */
+        virtual void fill(landscape *state, size_t begin, size_t end) const = 0;
+    };
+
+    /** \brief Densities drawn uniformly from [low, high),
+     *      the hares and pumas of every cell independently
+     */
+    class UniformDistribution : public InitialDistribution {
+    private:
+        uint32_t key[2];
+        double low, high;
+
+    public:
+        /** \param seed seed of the random numbers, the same
+         *      seed giving the same densities
+         *  \param low lower bound of the densities
+         *  \param high upper bound of the densities
+         *  \exception IllegalValue if low is negative or
+         *      larger than high, the densities never being
+         *      negative
+         */
+        UniformDistribution(uint64_t seed, double low = 0.0, double high = 5.0);
+
+        void fill(landscape *state, size_t begin, size_t end) const;
+    };
+
+    /// \brief The same densities in every land cell
+    class ConstantDistribution : public InitialDistribution {
+    private:
+        double hare, puma;
+
+    public:
+        /// \exception IllegalValue if a density is negative
+        ConstantDistribution(double hare, double puma);
+
+        void fill(landscape *state, size_t begin, size_t end) const;
+    };
+
+    /** \brief Densities taken from a frame of a file
+     *      written by the binary output method
+     */
+    class FileDistribution : public InitialDistribution {
+    private:
+        size_t size_x, size_y;
+        boost::shared_array<landscape> frame;
+
+    public:
+        /** \param filename name of the file
+         *  \param frame number of the frame, the last one
+         *      if it is larger than the number of frames
+         *  \exception FormatError if the file cannot be read
+         *  \exception IllegalValue if the file has no frames
+         */
+        FileDistribution(std::string filename, size_t frame);
+
+        void check(size_t size_x, size_t size_y) const;
+        void fill(landscape *state, size_t begin, size_t end) const;
+    };
+
+    /** \brief Creates a distribution from its description,
+     *      as given on the command line
+     *
+     *  The descriptions are
+     *  - uniform[:LOW:HIGH], random densities, 0 to 5 by default
+     *  - constant:HARE:PUMA
+     *  - file:NAME[:FRAME], the last frame by default. NAME
+     *    may hold colons, only a trailing number is a FRAME
+     *  \param description description of the distribution
+     *  \param seed seed used by the random distributions
+     *  \exception IllegalValue if the description is not valid
+     *  \exception FormatError if a file cannot be read
+     */
+    boost::shared_ptr<InitialDistribution> create_distribution(
+            std::string description, uint64_t seed);
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef PUMA_Integrators_hpp
+#define PUMA_Integrators_hpp
+
+#include <cstddef>
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/shared_array.hpp>
+
+#include "helpers.hpp"
+#include "SoASimulator.hpp"
+
+namespace PUMA {
+
+    /** \brief An explicit Runge-Kutta method, given by its
+     *      Butcher tableau
+     *
+     *  Stage i is evaluated at y + h * sum(a[i][j] * K_j). The
+     *  embedded methods also give the weights of the error
+     *  estimate, the difference between the two solutions.
+     */
+    struct integrator {
+        /// Name of the method, as given on the command line
+        std::string name;
+
+        /// Human-readable description
+        std::string description;
+
+        /// Number of stages, at most 4, and order of the solution
+        size_t stages, order;
+
+        double a[4][4];
+
+        /// Weights of the solution
+        double b[4];
+
+        /** Weights of the error estimate, all zero for methods
+         *  without an embedded one
+         */
+        double error[4];
+
+        /// Whether the step size is adapted to a tolerance
+        bool adaptive;
+
+        /** Set if the last stage is evaluated at the solution,
+         *  so it can be reused as the first stage of the next step
+         */
+        bool fsal;
+
+        /** Length of the interval of the negative real axis
+         *  inside the region of absolute stability
+         */
+        double stability;
+    };
+
+    /** \brief Returns the list of available integrators,
+     *      the first one being the default
+     */
+    const std::list<integrator>& available_integrators();
+
+    /** \brief Returns an integrator by its name
+     *  \exception IllegalValue if there is no such integrator
+     */
+    const integrator& choose_integrator(std::string name);
+
+    /** \brief Largest stable timestep of an integrator
+     *
+     *  The equations are linearised around an empty land,
+     *  where the diffusion (at most 8 max(k, l), the spectral
+     *  radius of the 5-point Laplacian) and the puma mortality
+     *  are the fastest decaying modes. Steps longer than this
+     *  make them grow instead, whatever the accuracy wanted.
+     */
+    double stability_limit(const integrator &method, const step_parameters &params);
+
+    /** \brief A SoASimulator advancing the state with any of
+     *      the available_integrators
+     *
+     *  apply_step still advances the simulation by dt. With
+     *  forward Euler, the default, it is the soa engine itself.
+     *  The higher order methods take fewer steps for the same
+     *  accuracy, allowing a larger dt, and the adaptive one
+     *  splits every dt into as many steps as the tolerance
+     *  needs, the step size being carried over from one dt to
+     *  the next. Negative densities are clamped at the end of
+     *  every step, like in the Euler step.
+     *
+     *  The stages are spread over the threads row by row, with
+     *  a synchronisation after every stage.
+     */
+    class IntegratorSimulator : public SoASimulator {
+    protected:
+        const integrator *method;
+
+        /// Derivatives of the stages, hares then pumas
+        std::vector<boost::shared_array<double> > stage_hare, stage_puma;
+
+        /// The state a stage is evaluated at
+        boost::shared_array<double> hare_stage, puma_stage;
+
+        /// Largest error of every row, relative to the tolerance
+        std::vector<double> row_error;
+
+        /// Step size of the adaptive method, 0 before the first step
+        double step_size;
+
+        /// Whether the first stage holds the derivative of the current state
+        bool first_stage_valid;
+
+        /// Parameters the first stage was computed with
+        step_parameters stage_parameters;
+
+        /// Set when a clamp changed the state of the last step
+        bool clamped;
+
+        size_t accepted, rejected;
+
+        /** \brief Computes the derivatives of the rows [j_begin,
+         *      j_end) of a state
+         */
+        void derivatives(const double *hare, const double *puma, double *hare_out,
+                double *puma_out, size_t j_begin, size_t j_end);
+
+        /** \brief Runs a task over all the rows, spread over the
+         *      threads
+         */
+        void for_rows(const WorkerPool::task &work);
+
+        /** \brief Tries a single step of size h
+         *  \return the largest error relative to the tolerance,
+         *      0 for the methods without an error estimate
+         */
+        double try_step(double h);
+
+        /// Makes the state computed by try_step the current one
+        void accept_step();
+
+        void scatter_state();
+        void step();
+        void collecting_step();
+
+    public:
+        /// Tolerance of the adaptive method, absolute and relative
+        double tolerance;
+
+        /** \brief initializes a simulation instance with some
+         *      input data
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         */
+        IntegratorSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+
+        /** \brief Selects the integrator
+         *  \exception IllegalValue if there is no such integrator
+         */
+        void set_integrator(std::string name);
+
+        /// Returns the integrator in use
+        const integrator& get_integrator() { return *method; }
+
+        /// Returns the number of steps accepted and rejected so far
+        size_t get_accepted() { return accepted; }
+        size_t get_rejected() { return rejected; }
+
+        double get_step_size() { return step_size; }
+        void set_step_size(double size) { step_size = size; }
+    };
+}
+
+#endif
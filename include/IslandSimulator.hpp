@@ -0,0 +1,101 @@
+#ifndef PUMA_IslandSimulator_hpp
+#define PUMA_IslandSimulator_hpp
+
+#include <vector>
+
+#include "SoASimulator.hpp"
+
+namespace PUMA {
+
+    /** \brief A SoASimulator stepping every island of the map
+     *      on its own
+     *
+     *  No population ever crosses water, so the connected
+     *  components of the land (see LandComponents) are
+     *  independent problems. Every island gets its own padded
+     *  subgrid, as tight as its bounding box, the land of which
+     *  apply_steps advances by all the steps at once, as a
+     *  single task, apart from a last step collecting the
+     *  statistics when they are tracked.
+     *  The islands are handed to the threads largest first and
+     *  never wait for each other, the only synchronisation being
+     *  the end of apply_steps.
+     *
+     *  After every apply_steps the islands are copied back into
+     *  the arrays of the SoASimulator, which is what the
+     *  serializers and the statistics read. The results are
+     *  bit-identical to the ones of the other engines.
+     */
+    template <class Precision>
+    class BasicIslandSimulator : public BasicSoASimulator<Precision> {
+    protected:
+        typedef typename BasicSoASimulator<Precision>::storage storage;
+
+        /// The subgrid of a single island
+        struct island {
+            /// Bounding box of the island in the padded arrays of the map
+            size_t x0, y0, width, height;
+
+            /// Distance between two consecutive rows, width + 2
+            size_t stride;
+
+            /// Number of land cells
+            size_t land_cells;
+
+            /** Descriptions of the cells, the ones belonging to
+             *  other islands in the bounding box being water
+             */
+            std::vector<unsigned char> cells;
+
+            /// Padded densities, the current state being number current
+            std::vector<storage> hare[2], puma[2];
+            int current;
+
+            /// Indices of the spans of the island in the LandComponents
+            std::vector<size_t> spans;
+
+            /// Index of the cell (x, y) of the padded map in the subgrid
+            size_t at(size_t x, size_t y) const
+            {
+                return (y - y0 + 1) * stride + x - x0 + 1;
+            }
+        };
+
+        /// The islands, largest first
+        std::vector<island> islands;
+
+        /// Advances an island by steps steps and copies it back
+        void advance_island(island &land, size_t steps);
+
+        /// Advances every island, spreading them over the threads
+        void advance(size_t steps);
+
+        void scatter_state();
+        void step();
+        void collecting_step();
+
+    public:
+        /** \brief initializes a simulation instance with some
+         *      input data
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         */
+        BasicIslandSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+
+        void apply_steps(size_t steps);
+
+        /// Returns the number of islands
+        size_t get_islands() { return islands.size(); }
+    };
+
+    /// The double precision island engine
+    typedef BasicIslandSimulator<double_precision> IslandSimulator;
+}
+
+#endif
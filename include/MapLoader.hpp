@@ -0,0 +1,48 @@
+#ifndef PUMA_MapLoader_hpp
+#define PUMA_MapLoader_hpp
+
+#include <cstddef>
+#include <string>
+#include <boost/shared_array.hpp>
+
+#include "exceptions.hpp"
+
+namespace PUMA {
+
+    /** \brief A land map, as read from a file
+     *
+     *  land holds size_x * size_y cells, row after row,
+     *  true meaning land.
+     */
+    struct land_map {
+        size_t size_x, size_y;
+        boost::shared_array<bool> land;
+    };
+
+    /** \brief Reads a land map from memory
+     *
+     *  The format is recognised from the first bytes:
+     *  - P1 to P6 are the plain and raw PBM, PGM and PPM
+     *    images. Dark pixels, less than half of the maximal
+     *    value bright, are land and light ones water, so that
+     *    black is land in the bitmaps too.
+     *  - anything else is read as a .dat file, the X and Y
+     *    sizes followed by X * Y numbers, non-zero meaning land.
+     *  \param data the contents of the file
+     *  \param length size of data in bytes
+     *  \exception FormatError if the contents are malformed
+     *      or end before all the cells are read
+     */
+    land_map parse_land_map(const char *data, size_t length);
+
+    /** \brief Maps a file into memory and reads
+     *      the land map from it
+     *
+     *  See parse_land_map for the supported formats.
+     *  \exception FormatError if the file cannot be read
+     *      or is malformed
+     */
+    land_map load_land_map(std::string filename);
+}
+
+#endif
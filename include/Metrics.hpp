@@ -0,0 +1,241 @@
+#ifndef PUMA_Metrics_hpp
+#define PUMA_Metrics_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "exceptions.hpp"
+
+namespace PUMA {
+
+    /** \brief The phases of a run timed by ScopedTimer
+     *
+     *  The phases may nest, a step including the reductions
+     *  and the halo exchanges done during it, so every one
+     *  counts the whole time spent in it.
+     */
+    enum metric_phase {
+        /// Advancing the simulation, as seen by the solver
+        PHASE_STEP,
+        /// Exchanging the halos between the blocks of a map
+        PHASE_HALO,
+        /// Collecting and combining the statistics
+        PHASE_REDUCTION,
+        /// Turning a frame into the output format
+        PHASE_SERIALIZATION,
+        /// Opening and closing the output files
+        PHASE_FILES,
+        /// Writing a checkpoint
+        PHASE_CHECKPOINT,
+        /// Waiting for the output thread to free a buffer
+        PHASE_OUTPUT_STALL,
+        /// Compressing the frames of the output
+        PHASE_COMPRESSION,
+        PHASE_COUNT
+    };
+
+    /// \brief Events counted by count_metric
+    enum metric_counter {
+        COUNTER_STEPS,
+        COUNTER_FRAMES,
+        COUNTER_CHECKPOINTS,
+        COUNTER_COUNT
+    };
+
+    /// Name of a phase in the reports, like "step"
+    const char* metric_phase_name(metric_phase phase);
+
+    /// Name of a counter in the reports, like "steps"
+    const char* metric_counter_name(metric_counter counter);
+
+    /** \brief Reads the time stamp counter, or a nanosecond
+     *      clock where there is none
+     */
+    inline uint64_t read_ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    /** \brief The metrics of a single thread
+     *
+     *  Only the thread owning them writes them, so they are
+     *  updated with plain relaxed loads and stores, and read
+     *  by the reports while the thread goes on.
+     */
+    struct thread_metrics {
+        /// Number of the thread, in the order they first recorded something
+        size_t thread;
+
+        std::atomic<uint64_t> ticks[PHASE_COUNT], calls[PHASE_COUNT];
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+
+        /// The metrics of the thread registered before
+        thread_metrics *next;
+
+        /// Adds to one of the values
+        static void add(std::atomic<uint64_t> &value, uint64_t amount)
+        {
+            value.store(value.load(std::memory_order_relaxed) + amount,
+                    std::memory_order_relaxed);
+        }
+    };
+
+    /// Whether the metrics are recorded
+    extern std::atomic<bool> metrics_on;
+
+    /** \brief Starts or stops recording the metrics
+     *
+     *  Nothing is recorded before, so that the timers cost a
+     *  single test when nobody looks at them. The rate of the
+     *  time stamp counter is measured from the time enabled.
+     */
+    void enable_metrics(bool enable);
+
+    /// Returns the metrics of the calling thread, registering them on the first call
+    thread_metrics& local_metrics();
+
+    /// Counts amount events of a kind
+    inline void count_metric(metric_counter counter, uint64_t amount = 1)
+    {
+        if (!metrics_on.load(std::memory_order_relaxed)) return;
+        thread_metrics::add(local_metrics().counters[counter], amount);
+    }
+
+    /** \brief Adds the time from its construction to its
+     *      destruction to a phase of the calling thread
+     */
+    class ScopedTimer {
+    private:
+        metric_phase phase;
+        uint64_t start;
+
+    public:
+        ScopedTimer(metric_phase phase) : phase(phase),
+            start(metrics_on.load(std::memory_order_relaxed) ? read_ticks() : 0) {}
+
+        ~ScopedTimer()
+        {
+            if (start == 0) return;
+
+            thread_metrics &metrics = local_metrics();
+            thread_metrics::add(metrics.ticks[phase], read_ticks() - start);
+            thread_metrics::add(metrics.calls[phase], 1);
+        }
+    };
+
+    /// \brief The metrics of a thread, or their sum, at some time
+    struct metric_totals {
+        size_t thread;
+
+        /// Seconds spent in every phase
+        double seconds[PHASE_COUNT];
+
+        uint64_t calls[PHASE_COUNT];
+        uint64_t counters[COUNTER_COUNT];
+    };
+
+    /// \brief All the metrics at some time
+    struct metrics_snapshot {
+        /// Seconds since the metrics were enabled
+        double elapsed;
+
+        /// Steps per second since the previous snapshot, and overall
+        double steps_per_second, average_steps_per_second;
+
+        /// Whether it is the last snapshot of the run
+        bool final;
+
+        /// Sums over all the threads
+        metric_totals total;
+
+        /// Every thread that recorded something, in the order they started
+        std::vector<metric_totals> threads;
+    };
+
+    /** \brief Sums the metrics of all the threads, without
+     *      stopping them
+     *
+     *  steps_per_second is left at the average, the reporter
+     *  knowing the snapshot before.
+     */
+    metrics_snapshot take_metrics_snapshot();
+
+    /// Writes a snapshot as a JSON object
+    void write_metrics_json(std::ostream &output, const metrics_snapshot &snapshot);
+
+    /// Writes a snapshot in the text format of Prometheus
+    void write_metrics_prometheus(std::ostream &output, const metrics_snapshot &snapshot);
+
+    /** \brief Publishes snapshots of the metrics while a run
+     *      goes on
+     *
+     *  A target of the form unix:PATH makes a UNIX socket
+     *  listening at PATH, every client connecting to it being
+     *  sent the latest snapshot; anything else is a file,
+     *  replaced by every new snapshot, so that it always
+     *  holds a complete one. A snapshot is taken every
+     *  interval seconds by a thread of its own, and a final
+     *  one by finish or the destructor.
+     */
+    class MetricsReporter {
+    private:
+        std::string target, format;
+        double interval;
+
+        /// Listening socket, -1 when writing to a file
+        int listener;
+
+        /// The latest snapshot, formatted
+        std::string latest;
+        uint64_t last_steps;
+        double last_elapsed;
+
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable wake;
+        bool stopping, finished;
+
+        /// Takes a snapshot, formats it and publishes it
+        void publish(bool final);
+
+        void reporter_loop();
+
+    public:
+        /** \brief Starts reporting, enabling the metrics
+         *  \param target file name, or unix:PATH for a socket
+         *  \param format json or prometheus
+         *  \param interval seconds between two snapshots
+         *  \exception IllegalValue if the format is unknown or
+         *      the interval not positive
+         *  \exception SystemError if the socket cannot be made
+         */
+        MetricsReporter(std::string target, std::string format, double interval);
+
+        /// Publishes the final snapshot, if not done yet
+        ~MetricsReporter();
+
+        /** \brief Stops the periodic snapshots and publishes
+         *      the final one, to a socket only if a client is
+         *      already waiting for it
+         */
+        void finish();
+    };
+}
+
+#endif
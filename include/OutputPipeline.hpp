@@ -0,0 +1,127 @@
+#ifndef PUMA_OutputPipeline_hpp
+#define PUMA_OutputPipeline_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/shared_array.hpp>
+
+#include "helpers.hpp"
+#include "Simulator.hpp"
+
+namespace PUMA {
+
+    /** \brief Writes the output frames on a thread of its own,
+     *      while the simulation keeps stepping
+     *
+     *  Every frame is copied into one of a fixed number of
+     *  preallocated buffers and queued for the writer thread.
+     *  When all the buffers are waiting to be written, push
+     *  blocks until the writer frees one, so a simulation
+     *  producing frames faster than they can be written is
+     *  slowed down to the speed of the output instead of
+     *  running out of memory. The time spent blocked that way
+     *  is reported by blocked_time.
+     *
+     *  The frames are written in the order they were pushed.
+     */
+    class OutputPipeline {
+    public:
+        /** \brief Writes a single frame
+         *  \param state snapshot of the state, size_x * size_y
+         *      cells laid out like Simulator::get_state
+         *  \param frame number of the frame, counting from 0
+         */
+        typedef std::function<void(boost::shared_array<landscape> state,
+                size_t frame)> writer;
+
+    private:
+        struct queued_frame {
+            boost::shared_array<landscape> state;
+            size_t frame;
+
+            /// Writer of this frame, the default one if empty
+            writer write;
+        };
+
+        size_t cells;
+        writer write;
+        std::thread thread;
+        std::mutex lock;
+
+        /// Signals the writer that a frame was queued
+        std::condition_variable queued;
+
+        /// Signals push and flush that a frame was written
+        std::condition_variable written;
+
+        /// Frames waiting to be written
+        std::deque<queued_frame> pending;
+
+        /// Buffers not holding any frame
+        std::vector<boost::shared_array<landscape> > free_buffers;
+
+        /// Set while the writer is busy with a frame
+        bool writing;
+
+        bool stopping;
+
+        /// The first exception thrown by the writer
+        std::exception_ptr failure;
+
+        long blocked;
+
+        void writer_loop();
+
+        /// Rethrows an exception of the writer in the calling thread
+        void check_failure();
+
+    public:
+        /** \brief Starts the writer thread
+         *  \param size_x X dimension of the frames
+         *  \param size_y Y dimension of the frames
+         *  \param buffers number of frames that can be held
+         *      at once, at least 1
+         *  \param write function writing the frames, called
+         *      from the writer thread only
+         *  \exception IllegalValue if buffers is 0
+         */
+        OutputPipeline(size_t size_x, size_t size_y, size_t buffers, writer write);
+
+        /// Writes the remaining frames and stops the writer thread
+        ~OutputPipeline();
+
+        /** \brief Queues the current state of a simulation
+         *      to be written
+         *
+         *  Blocks while every buffer is in use. An exception
+         *  thrown by the writer is rethrown here.
+         */
+        void push(Simulator &simulation, size_t frame);
+
+        /** \brief Queues the current state of a simulation to be
+         *      written by another writer than the default one
+         *
+         *  It is still written after everything pushed before
+         *  it, which lets snapshots of other kinds be kept in
+         *  order with the frames.
+         */
+        void push(Simulator &simulation, size_t frame, const writer &write);
+
+        /** \brief Waits until every queued frame is written
+         *
+         *  An exception thrown by the writer is rethrown here.
+         */
+        void flush();
+
+        /// Microseconds push spent waiting for a free buffer
+        long blocked_time();
+    };
+}
+
+#endif
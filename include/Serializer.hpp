@@ -1,16 +1,199 @@
 #ifndef PUMA_Serializer_hpp
 #define PUMA_Serializer_hpp
 
+#include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <list>
+#include <ostream>
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include <boost/shared_array.hpp>
 
 #include "helpers.hpp"
 #include "exceptions.hpp"
+#include "TextFormat.hpp"
 
 namespace PUMA {
 
+    /** \brief A read-only view of a grid of cells, as handed
+     *      to the serializers
+     *
+     *  It only points to the cells, which stay owned by
+     *  whoever made the view. Cell (i, j) is at
+     *  cells[j * stride + i], so that a view may also cover a
+     *  part of a wider grid.
+     */
+    class GridView {
+    private:
+        const landscape *cells;
+        size_t size_x, size_y, stride;
+
+    public:
+        /** \param cells the first cell of the grid
+         *  \param size_x X dimension of the grid
+         *  \param size_y Y dimension of the grid
+         *  \param stride cells between two rows, size_x if 0
+         */
+        GridView(const landscape *cells, size_t size_x, size_t size_y,
+                size_t stride = 0) :
+            cells(cells), size_x(size_x), size_y(size_y),
+            stride(stride == 0 ? size_x : stride) {}
+
+        size_t get_size_x() const { return size_x; }
+        size_t get_size_y() const { return size_y; }
+        size_t get_stride() const { return stride; }
+
+        const landscape& at(size_t i, size_t j) const { return cells[j * stride + i]; }
+
+        /// The first cell of row j
+        const landscape* row(size_t j) const { return cells + j * stride; }
+
+        double hare_density(size_t i, size_t j) const { return at(i, j).hare_density; }
+        double puma_density(size_t i, size_t j) const { return at(i, j).puma_density; }
+        bool is_land(size_t i, size_t j) const { return at(i, j).is_land; }
+    };
+
+    /** \brief A buffered output of bytes, which the
+     *      serializers write to
+     *
+     *  The bytes are gathered in a buffer and handed to the
+     *  destination in blocks by write_out, so that writing a
+     *  line of text costs a copy and no call into a stream,
+     *  let alone a flush. The destination is never flushed by
+     *  the sink itself. Subclasses decide what it is, and have
+     *  to call flush in their destructors.
+     *
+     *  Numbers are written as an std::ostream with the default
+     *  flags and the same precision writes them, see
+     *  format_real.
+     */
+    class ByteSink {
+    private:
+        std::vector<char> buffer;
+        size_t capacity, used;
+        int precision;
+
+        /// Writes what does not fit in the buffer
+        void write_slow(const char *bytes, size_t count);
+
+        /** Empties the buffer, growing it if it cannot hold
+         *  count bytes and still write out blocks of capacity
+         */
+        void make_room(size_t count);
+
+    protected:
+        /// Writes bytes to the destination
+        virtual void write_out(const char *bytes, size_t count) = 0;
+
+        /// Position of the destination, -1 if it cannot tell
+        virtual std::streamoff tell_out() = 0;
+
+        /// Moves the destination to a position
+        virtual void seek_out(std::streamoff position) = 0;
+
+    public:
+        /// \param capacity bytes gathered before writing them out
+        explicit ByteSink(size_t capacity = 64 * 1024);
+        virtual ~ByteSink() {}
+
+        /// Whether the bytes go anywhere
+        virtual bool is_open() = 0;
+
+        void write(const void *bytes, size_t count)
+        {
+            if (count <= buffer.size() - used) {
+                memcpy(&buffer[used], bytes, count);
+                used += count;
+            } else {
+                write_slow(static_cast<const char*>(bytes), count);
+            }
+        }
+
+        void put(char c)
+        {
+            if (used == buffer.size()) flush();
+            buffer[used++] = c;
+        }
+
+        ByteSink& operator<<(char c) { put(c); return *this; }
+        ByteSink& operator<<(const char *text) { write(text, strlen(text)); return *this; }
+        ByteSink& operator<<(const std::string &text)
+        {
+            write(text.data(), text.size());
+            return *this;
+        }
+
+        ByteSink& operator<<(int value) { return *this << (long long)value; }
+        ByteSink& operator<<(long value) { return *this << (long long)value; }
+        ByteSink& operator<<(long long value)
+        {
+            commit(format_integer(value, reserve(max_number_length)));
+            return *this;
+        }
+        ByteSink& operator<<(unsigned value) { return *this << (unsigned long long)value; }
+        ByteSink& operator<<(unsigned long value) { return *this << (unsigned long long)value; }
+        ByteSink& operator<<(unsigned long long value)
+        {
+            commit(format_integer(value, reserve(max_number_length)));
+            return *this;
+        }
+        ByteSink& operator<<(double value)
+        {
+            commit(format_real(value, precision, reserve(max_number_length)));
+            return *this;
+        }
+
+        /// Significant digits of the doubles written, 6 by default
+        void set_precision(int digits) { precision = digits; }
+        int get_precision() { return precision; }
+
+        /** \brief Room for count bytes in the buffer, which
+         *      are written there directly and kept by commit
+         */
+        char* reserve(size_t count)
+        {
+            if (count > buffer.size() - used) make_room(count);
+            return &buffer[used];
+        }
+
+        /// Keeps the bytes written from reserve up to end
+        void commit(char *end) { used = end - &buffer[0]; }
+
+        /// Position of the next byte written, -1 if the destination cannot tell
+        std::streamoff tell();
+
+        /// Writes out the buffer and moves to a position
+        void seek(std::streamoff position);
+
+        /// Writes out the buffer
+        void flush();
+    };
+
+    /** \brief A ByteSink writing to an std::ostream, which
+     *      may be a file stream or NULL
+     *
+     *  Nothing is written without a stream; with a file
+     *  stream the sink is open if the file is.
+     */
+    class StreamSink : public ByteSink {
+    private:
+        std::ostream *stream;
+        std::ofstream *file;
+
+    protected:
+        void write_out(const char *bytes, size_t count);
+        std::streamoff tell_out();
+        void seek_out(std::streamoff position);
+
+    public:
+        explicit StreamSink(std::ostream *stream, size_t capacity = 64 * 1024);
+        ~StreamSink() { flush(); }
+
+        bool is_open();
+    };
+
     /** \brief A scaffold class to build serializers from. 
      *
      *  Any serializer that is used by the Simulator 
@@ -23,6 +206,12 @@ namespace PUMA {
     class Serializer {
 
     protected:
+        /// Significant digits of the densities in text
+        int digits;
+
+        /// Formats the rows of the text formats
+        RowFormatter rows;
+
         /** \brief Function used to remove an instance pointer
          *      from the list of output methods.
          *  \param instance_pointer pointer to a Serializer
@@ -31,6 +220,8 @@ namespace PUMA {
         void remove_instance(Serializer *instance_pointer);
 
     public:
+        Serializer() : digits(6) {}
+
         /** List containing currently available
          *  output methods.
          */
@@ -55,27 +246,79 @@ namespace PUMA {
         /// A suggested extension for a given serializer
         std::string extension;
 
+        /** Extension of the auxiliary output, for the
+         *  serializers writing something else there. Empty if
+         *  it is the same as the main one; otherwise the
+         *  auxiliary output is named after the main one unless
+         *  given.
+         */
+        std::string aux_extension;
+
         /// Output value scaling
         double scale;
 
         // If set files splitting will be forced
         bool force_files_split;
 
+        /** Equation parameters and timestep of the simulation
+         *  being serialized, for the formats recording them.
+         *  Set before the first frame is written.
+         */
+        step_parameters parameters;
+
+        /** How the simulation converged, for the formats
+         *  recording it. Set before the frame of the step it
+         *  was detected at is written, zero before.
+         */
+        convergence_record convergence;
+
+        /** \brief Sets the significant digits of the densities
+         *      written by the text formats, 6 by default as
+         *      with std::ostream
+         *  \exception IllegalValue unless between 1 and 17
+         */
+        void set_digits(int digits);
+
+        int get_digits() { return digits; }
+
+        /** \brief Sets the number of threads formatting the
+         *      rows of the text formats, 1 by default
+         *  \exception IllegalValue if threads is 0
+         */
+        void set_format_threads(size_t threads) { rows.set_threads(threads); }
+
+        size_t get_format_threads() { return rows.get_threads(); }
+
+        /** \brief Writes the puma/hare densities to
+         *      the specified output(s)
+         *  \param state the simulation state that will be
+         *      serialized
+         *  \param output the output to which densities of
+         *      hares will go
+         *  \param aux_output the output to which densities of
+         *      pumas will go, by the serializers using it
+         */
+        virtual void serialize(const GridView &state, ByteSink &output,
+                ByteSink &aux_output) = 0;
+
         /** \brief Writes the puma/hare densities to
          *      the specified output stream(s)
+         *
+         *  Adapts the streams and the state for the serialize
+         *  above, writing out what it wrote before returning.
          *  \param output_hares a pointer to an output stream
          *      to which densities of hares will go
          *  \param output_pumas a pointer to an output stream
-         *      to which densities of pumas will go
+         *      to which densities of pumas will go, may be NULL
          *  \param current_state contains the simulation state
          *      that will be serialized
          *  \param size_x X dimension of current_state
          *  \param size_y Y dimension of current_state
          */      
-        virtual void serialize(std::ofstream *output_hares, 
+        void serialize(std::ofstream *output_hares, 
                 std::ofstream *output_pumas, 
-                boost::shared_array<landscape> current_state,
-                size_t size_x, size_t size_y) = 0;
+                const boost::shared_array<landscape> &current_state,
+                size_t size_x, size_t size_y);
 
     };
 
@@ -88,10 +331,9 @@ namespace PUMA {
         GnuplotSerializer();
         ~GnuplotSerializer() { remove_instance(this); };
 
-        void serialize(std::ofstream *output_hares, 
-                std::ofstream *output_pumas, 
-                boost::shared_array<landscape> current_state,
-                size_t size_x, size_t size_y);
+        void serialize(const GridView &state, ByteSink &output_hares,
+                ByteSink &output_pumas);
+        using Serializer::serialize;
     };
 
     /** \brief Outputs to a VMD compatible XYZ file format. 
@@ -106,20 +348,52 @@ namespace PUMA {
         ~VMDSerializer() { remove_instance(this); };
 
         /** \brief Writes the puma/hare densities to
+         *      the specified output
+         *  \param state the simulation state that will be
+         *      serialized
+         *  \param output the output to which the densities
+         *      will go
+         *  \param nothing the unneeded second output
+         */      
+        void serialize(const GridView &state, ByteSink &output,
+                ByteSink &nothing);
+        using Serializer::serialize;
+    };
+
+    /** \brief Outputs to a VMD compatible DCD trajectory,
+     *      with the atoms of the vmd serializer
+     *
+     *  DCD only holds coordinates, so the atoms are described
+     *  once in an XYZ structure file written to the auxiliary
+     *  output, which VMD loads the trajectory into:
+     *
+     *      vmd output.xyz -dcd output.dcd
+     *
+     *  The plane of land and water and the hares and pumas
+     *  of the water never move, so they are written as the
+     *  fixed atoms of the DCD format: only the first frame
+     *  holds them, every later one only holding the hares
+     *  and pumas of the land, as floats.
+     */
+    class DCDSerializer : public Serializer {
+
+    public:
+        DCDSerializer();
+        ~DCDSerializer() { remove_instance(this); };
+
+        /** \brief Appends the puma/hare densities to
          *      the specified output stream
-         *  \param output_hares a pointer to an output stream
-         *      to which densities of hares will go
-         *  \param nothing an unused pointer to the second,
-         *      unneeded output stream
-         *  \param current_state contains the simulation state
-         *      that will be serialized
-         *  \param size_x X dimension of current_state
-         *  \param size_y Y dimension of current_state
+         *  \param state the simulation state that will be
+         *      serialized
+         *  \param output the output the trajectory is written
+         *      to. It has to be seekable, as the frame count in
+         *      the header is updated after every frame
+         *  \param structure the output the XYZ structure is
+         *      written to with the first frame, if open
          */      
-        void serialize(std::ofstream *output, 
-                std::ofstream *nothing, 
-                boost::shared_array<landscape> current_state,
-                size_t size_x, size_t size_y);
+        void serialize(const GridView &state, ByteSink &output,
+                ByteSink &structure);
+        using Serializer::serialize;
     };
 
     /// \brief Outputs to a PlainPPM format
@@ -138,21 +412,111 @@ namespace PUMA {
         ~PlainPPMSerializer() { remove_instance(this); };
 
         /** \brief Writes the puma/hare densities to
+         *      the specified output
+         *  \param state the simulation state that will be
+         *      serialized
+         *  \param output the output to which the densities
+         *      will go
+         *  \param nothing the unneeded second output
+         */      
+        void serialize(const GridView &state, ByteSink &output,
+                ByteSink &nothing);
+        using Serializer::serialize;
+    };
+
+    /** \brief The header of the files written by
+     *      BinarySerializer
+     *
+     *  It is followed by the land mask, one byte per cell
+     *  laid out like Simulator::get_state, and then by the
+     *  frames. Frame n starts at frames_offset + n * frame_size
+     *  and holds the size_x * size_y hare densities followed by
+     *  as many puma densities, as doubles. Everything is in the
+     *  byte order of the machine that wrote the file, which is
+     *  recorded in byte_order.
+     */
+    struct binary_header {
+        /// "PUMAFRM", zero terminated
+        char magic[8];
+
+        /// binary_byte_order as written by the writing machine
+        uint32_t byte_order;
+
+        /// Version of the format, binary_version
+        uint32_t version;
+
+        uint64_t size_x, size_y;
+
+        /// Offset of the land mask from the beginning of the file
+        uint64_t mask_offset;
+
+        /// Offset of the first frame, aligned to a page
+        uint64_t frames_offset;
+
+        /// Distance between two frames, aligned to a cache line
+        uint64_t frame_size;
+
+        /// Number of complete frames, updated after every frame
+        uint64_t frame_count;
+
+        /// Equation parameters and timestep of the simulation
+        step_parameters parameters;
+
+        /// Convergence of the simulation, zero until detected. Since version 2
+        convergence_record convergence;
+    };
+
+    /// Magic number of the files written by BinarySerializer
+    extern const char binary_magic[8];
+
+    /// Value of binary_header::byte_order
+    const uint32_t binary_byte_order = 0x01020304;
+
+    /// Current version of the BinarySerializer format
+    const uint32_t binary_version = 2;
+
+    /// Size of the header of the files of version 1, without the convergence
+    const size_t binary_header_v1_size = offsetof(binary_header, convergence);
+
+    /** \brief Outputs to an indexed binary container,
+     *      see binary_header
+     *
+     *  The header and the land mask are written when the
+     *  output stream is empty, every later call only appends
+     *  the raw densities. As the frames have a fixed size any
+     *  of them can be read without parsing the others, see
+     *  FrameReader. The pumas-convert tool turns the files
+     *  into the other formats.
+     */
+    class BinarySerializer : public Serializer {
+
+    public:
+        BinarySerializer();
+        ~BinarySerializer() { remove_instance(this); };
+
+        /** \brief Appends the puma/hare densities to
          *      the specified output stream
-         *  \param output_hares a pointer to an output stream
-         *      to which densities of hares will go
-         *  \param nothing an unused pointer to the second,
-         *      unneeded output stream
-         *  \param current_state contains the simulation state
-         *      that will be serialized
-         *  \param size_x X dimension of current_state
-         *  \param size_y Y dimension of current_state
+         *  \param state the simulation state that will be
+         *      serialized
+         *  \param output the output the container is written
+         *      to. It has to be seekable, as the frame count in
+         *      the header is updated after every frame
+         *  \param nothing the unneeded second output
          */      
-        void serialize(std::ofstream *output, 
-                std::ofstream *nothing, 
-                boost::shared_array<landscape> current_state,
-                size_t size_x, size_t size_y);
+        void serialize(const GridView &state, ByteSink &output,
+                ByteSink &nothing);
+        using Serializer::serialize;
     };
+
+    /** \brief Drops the frames of a binary container past
+     *      a given number, so that a resumed simulation can
+     *      append the following ones
+     *  \param filename name of the container. Nothing is done
+     *      if it does not exist
+     *  \param frames number of frames to keep
+     *  \exception FormatError if it is not a binary container
+     */
+    void truncate_binary_frames(std::string filename, size_t frames);
 }
 
 #endif
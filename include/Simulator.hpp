@@ -2,13 +2,22 @@
 #define PUMA_Simulator_hpp
 
 #include "helpers.hpp"
+#include "Components.hpp"
 #include "Serializer.hpp"
+#include "Statistics.hpp"
+#include "WorkerPool.hpp"
+#include "Topology.hpp"
 #include <fstream>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
 #include <boost/shared_array.hpp>
+#include <boost/shared_ptr.hpp>
 #include <time.h>
 
 namespace PUMA {
 
+    class InitialDistribution;
+
     /** \brief Predator-Prey simulation
      *
      *  The Simulator class simulates a 
@@ -36,6 +45,12 @@ namespace PUMA {
         /// X and Y sizes of the simulation area
         size_t size_x, size_y;
 
+        /** Land cells and their land neighbours, built once
+         *  from the land map and used by the stepping kernels
+         *  instead of looking at the neighbours every step
+         */
+        boost::shared_ptr<const Topology> topology;
+
         /** \brief A proxy function enabling easy implementation
          *      of boundary conditions
          *  \param x X coordinate of requested cell
@@ -53,6 +68,115 @@ namespace PUMA {
          */
         landscape* halo_cell;
 
+        /** \brief Copies the engine specific representation
+         *      of the simulation into current_state
+         *
+         *  Engines that keep the densities in a layout of
+         *  their own override it, so that everything reading
+         *  current_state (averages, serializers) sees
+         *  up-to-date values. Does nothing by default.
+         */
+        virtual void gather_state() {};
+
+        /** \brief Reloads the engine specific representation
+         *      from current_state
+         *
+         *  The counterpart of gather_state, called after
+         *  current_state has been modified from the outside.
+         *  Does nothing by default.
+         */
+        virtual void scatter_state() {};
+
+        /** \brief Makes the current state the one the next
+         *      step is computed from
+         *
+         *  Called once at the beginning of every apply_step,
+         *  engines with their own layout swap their own arrays.
+         */
+        virtual void swap_states();
+
+        /** \brief Computes rows [j_begin, j_end) of the
+         *      next state
+         *
+         *  Called from many threads at once for distinct bands
+         *  of rows, so it may only write to its own rows of the
+         *  current state.
+         */
+        virtual void step_rows(size_t j_begin, size_t j_end);
+
+        /** Threads the rows are spread over, NULL when the
+         *  simulation is stepped serially
+         */
+        boost::shared_ptr<WorkerPool> workers;
+
+        /** \brief Applies the next time step, without
+         *      collecting any statistics
+         *
+         *  Swaps the states and spreads step_rows over the
+         *  workers. Engines that split the work differently
+         *  override it.
+         */
+        virtual void step();
+
+        /** \brief Applies the next time step, collecting the
+         *      statistics of every row into rows, span_hares
+         *      and span_pumas
+         *
+         *  By default every row is collected right after
+         *  step_rows computed it, by the same thread.
+         */
+        virtual void collecting_step();
+
+        /** \brief Collects the moments of row j of the current
+         *      state, and the sums of its spans of land
+         *
+         *  Reads the engine specific representation, so that
+         *  it can be called right after the row was computed,
+         *  while it is still in the cache. The span sums are
+         *  stored at the indices of the spans in components.
+         *  When changes_known is set the temporary state of the
+         *  engine holds the state before the last step, and the
+         *  largest change of the row is taken as well.
+         */
+        virtual void collect_row(size_t j, row_statistics &row,
+                double *span_hares, double *span_pumas);
+
+        /// Whether collect_row can take the changes of the last step
+        bool changes_known;
+
+        /// Whether apply_step collects the statistics
+        bool tracking;
+
+        /// Whether the collected statistics describe the current state
+        bool statistics_fresh;
+
+        /// The land of the map, built on the first use
+        boost::scoped_ptr<LandComponents> components;
+
+        /// Moments of every row of the current state
+        std::vector<row_statistics> rows;
+
+        /// Densities summed over every span of components
+        std::vector<double> span_hares, span_pumas;
+
+        /// Builds components and the buffers of the statistics
+        void prepare_statistics();
+
+        /// Collects the statistics of the rows [j_begin, j_end)
+        void collect_rows(size_t j_begin, size_t j_end);
+
+        /** Collects the statistics of all the rows with their
+         *  changes, for the engines that step on their own and
+         *  leave the previous state in their temporary one
+         */
+        void collect_changed_rows();
+
+        /** Collects the statistics of all the rows unless they
+         *  are fresh, engines whose collect_row needs some
+         *  preparation override it
+         */
+        virtual void refresh_statistics();
+
     public:
         /** \brief initializes a simulation instance with some
          *      input data
@@ -60,9 +184,13 @@ namespace PUMA {
          *  \param dim_y size in Y dimension of land_map
          *  \param land_map a 1D array of X*Y elements specifying
          *      which tiles are land and which water
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
          */
-        Simulator(size_t dim_x, size_t dim_y, bool *land_map);
-        ~Simulator();
+        Simulator(size_t dim_x, size_t dim_y, bool *land_map,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+        virtual ~Simulator();
 
         /// Birth rate of hares
         double r;
@@ -88,14 +216,74 @@ namespace PUMA {
          */
         average_densities get_averages();
 
+        /** \brief Computes the mean, extrema, variance and
+         *      total of both densities over the land, and the
+         *      totals of every connected land component
+         *
+         *  When the statistics are tracked and the last change
+         *  of the state was a step, they were collected during
+         *  that step and this costs no pass over the state.
+         *  The result does not depend on the engine, nor on
+         *  the number of threads, only on the state.
+         */
+        density_statistics get_statistics();
+
+        /** \brief Makes every step collect the statistics
+         *
+         *  Each row is summed right after it was computed, by
+         *  the thread that computed it, so that get_statistics
+         *  and get_averages need no pass over the state of
+         *  their own. apply_steps only collects them during its
+         *  last step.
+         *  \param enable whether to track them
+         */
+        void track_statistics(bool enable);
+
         /** \brief Applies the next time step to the Simulation.
          *
          *  Based on a discretization of two coupled 
          *  partial differential equations linking pumas and hares 
          *  in a predator prey model that includes diffusion over some 
          *  landscape. 
+         *
+         *  The rows are split between the threads set with
+         *  set_threads. Every cell only depends on the last
+         *  state, so the result does not depend on the number
+         *  of threads.
+         */
+        void apply_step();
+
+        /** \brief Applies a number of time steps at once
+         *  \param steps the number of steps to apply
+         *
+         *  Equivalent to calling apply_step steps times, which
+         *  is what it does by default, tracking the statistics
+         *  only in the last step. Engines that can advance
+         *  many steps at once more efficiently override it.
+         */
+        virtual void apply_steps(size_t steps);
+
+        /** \brief Returns the step size an adaptive integrator
+         *      carries from one time step to the next, 0 for the
+         *      engines without one
+         */
+        virtual double get_step_size() { return 0.0; }
+
+        /** \brief Resumes an adaptive integrator with a step size
+         *      returned by get_step_size, ignored by the engines
+         *      without one
+         */
+        virtual void set_step_size(double) {}
+
+        /** \brief Sets the number of threads apply_step uses
+         *  \param threads number of threads, 1 meaning serial
+         *      execution
+         *  \exception IllegalValue if threads is 0
          */
-        virtual void apply_step();
+        void set_threads(size_t threads);
+
+        /// Returns the number of threads apply_step uses
+        size_t get_threads();
 
         /** If set its value is used as a pointer to currently
          *  used serializer class
@@ -109,6 +297,44 @@ namespace PUMA {
          *      second output stream
          */
         virtual void serialize(std::ofstream *main_output, std::ofstream *aux_output=NULL);
+
+        /** \brief provides access to the current state,
+         *      regardless of the engine used
+         *  \return a pointer to the current state
+         *
+         *  \warning the pointer becomes invalid after
+         *      apply_step is ran!
+         */
+        boost::shared_array<landscape> get_state();
+
+        /** \brief overwrites the puma and hare densities
+         *      of the simulation
+         *  \param state array of size_x * size_y cells
+         *      laid out like current_state. Only the densities
+         *      are copied, the land map stays untouched.
+         */
+        void set_state(const landscape *state);
+
+        /** \brief Replaces the densities with the ones of an
+         *      initial distribution
+         *
+         *  The simulation starts from random densities seeded
+         *  from the time. This gives a state that only depends
+         *  on the distribution, filled by the threads set with
+         *  set_threads.
+         *  \exception IllegalValue if the distribution does not
+         *      fit the map
+         */
+        void initialize(const InitialDistribution &initial);
+
+        /// Returns the equation parameters and the timestep
+        step_parameters get_parameters();
+
+        /// Returns the size in X dimension of the simulation area
+        size_t get_size_x() { return size_x; }
+
+        /// Returns the size in Y dimension of the simulation area
+        size_t get_size_y() { return size_y; }
     };
 
     /** \brief Used for tests to provide a more
@@ -0,0 +1,81 @@
+#ifndef PUMA_SoASimulator_hpp
+#define PUMA_SoASimulator_hpp
+
+#include "helpers.hpp"
+#include "kernels.hpp"
+#include "Simulator.hpp"
+#include <boost/shared_array.hpp>
+
+namespace PUMA {
+
+    /** \brief A Simulator keeping its state as a structure
+     *      of arrays, stepped by vectorised kernels
+     *
+     *  Hare and puma densities are stored in separate contiguous
+     *  arrays, padded by a one-cell water border like in
+     *  HaloSimulator. The land mask and land neighbour counts
+     *  are read from the Topology. The step is done row by row by the
+     *  widest kernel the CPU supports (see kernels.hpp).
+     *
+     *  Precision is one of double_precision, single_precision
+     *  or mixed_precision. The first gives results bit-identical
+     *  to the ones of the plain Simulator, the other two halve
+     *  the memory taken and streamed per cell.
+     */
+    template <class Precision>
+    class BasicSoASimulator : public Simulator {
+    protected:
+        /// The type the densities are stored as
+        typedef typename Precision::storage storage;
+
+        /// Padded hare densities of the current state
+        boost::shared_array<storage> hare_current;
+
+        /// Padded puma densities of the current state
+        boost::shared_array<storage> puma_current;
+
+        /// Padded hare densities of the temporary state
+        boost::shared_array<storage> hare_temp;
+
+        /// Padded puma densities of the temporary state
+        boost::shared_array<storage> puma_temp;
+
+        /// Distance between two consecutive rows of the padded arrays
+        size_t stride;
+
+        /// Kernel used to advance the rows
+        const kernel_isa<storage> *kernel;
+
+        void gather_state();
+        void scatter_state();
+        void swap_states();
+        void step_rows(size_t j_begin, size_t j_end);
+        void collect_row(size_t j, row_statistics &row,
+                double *span_hares, double *span_pumas);
+
+    public:
+        /** \brief initializes a simulation instance with some
+         *      input data
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         */
+        BasicSoASimulator(size_t dim_x, size_t dim_y, bool *land_map,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+
+        /** \brief Selects the instruction set used by the kernel
+         *  \param name name of one of available_kernels()
+         *  \exception IllegalValue if it is not available
+         */
+        void set_kernel(std::string name);
+    };
+
+    /// The double precision SoA engine
+    typedef BasicSoASimulator<double_precision> SoASimulator;
+}
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef PUMA_SparseSimulator_hpp
+#define PUMA_SparseSimulator_hpp
+
+#include <vector>
+
+#include "SoASimulator.hpp"
+
+namespace PUMA {
+
+    /** \brief A SoASimulator stepping only the land cells
+     *
+     *  The land is split into spans of consecutive land cells
+     *  when the simulation is created, and only these spans are
+     *  handed to the kernel, so a step costs time proportional
+     *  to the land area rather than the area of the map. Water
+     *  cells are never written and stay empty, the full grid is
+     *  still available to the serializers through current_state.
+     *
+     *  When threads are used the land cells, not the rows, are
+     *  split evenly between them, as the land is rarely spread
+     *  evenly over the map.
+     */
+    template <class Precision>
+    class BasicSparseSimulator : public BasicSoASimulator<Precision> {
+    protected:
+        /// Index of the first cell of every span in the padded arrays
+        std::vector<size_t> span_start;
+
+        /** Number of land cells before every span, with the
+         *  total number of land cells at the end
+         */
+        std::vector<size_t> span_offset;
+
+        /// Index of the first span of every row, and the number of spans
+        std::vector<size_t> row_span;
+
+        void step_rows(size_t j_begin, size_t j_end);
+
+        /** Splits the land cells evenly between the threads,
+         *  the rows are only used when statistics are tracked
+         */
+        void step();
+
+        /** \brief Steps the land cells from first to last,
+         *      counting in the order they appear in the map
+         */
+        void step_cells(size_t first, size_t last);
+
+    public:
+        /** \brief initializes a simulation instance with some
+         *      input data
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         */
+        BasicSparseSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+    };
+
+    /// The double precision sparse engine
+    typedef BasicSparseSimulator<double_precision> SparseSimulator;
+}
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef PUMA_Statistics_hpp
+#define PUMA_Statistics_hpp
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "Components.hpp"
+
+namespace PUMA {
+
+    /** \brief Summary of the densities of one species over
+     *      the land cells
+     */
+    struct density_summary {
+        double mean, min, max;
+
+        /// Population variance, divided by the number of cells
+        double variance;
+
+        /// Sum of the densities of all the cells
+        double total;
+    };
+
+    /** \brief Statistics of a state of a simulation, see
+     *      Simulator::get_statistics
+     */
+    struct density_statistics {
+        /// Number of land cells the statistics are taken over
+        size_t land_cells;
+
+        density_summary hares, pumas;
+
+        /** Largest change of a density of a land cell during
+         *  the step that led to the state, negative when the
+         *  statistics were not collected during a step
+         */
+        double largest_change;
+
+        /** Total densities of every connected land component,
+         *  numbered like in LandComponents. Empty unless the
+         *  sums of the spans were given to combine_rows
+         */
+        std::vector<double> region_hares, region_pumas;
+    };
+
+    /** \brief Mergeable moments of a set of densities
+     *
+     *  The runs are summed pairwise and their squared
+     *  deviations taken from their own mean, in a second pass
+     *  over a run that is still in the cache. Moments of two
+     *  sets are merged with the formula of Chan et al., which
+     *  keeps the variance accurate when the mean is large.
+     */
+    struct density_moments {
+        size_t cells;
+        double total, min, max;
+
+        /// Sum of the squared deviations from the mean
+        double squares;
+
+        density_moments() : cells(0), total(0.0),
+            min(std::numeric_limits<double>::infinity()),
+            max(-std::numeric_limits<double>::infinity()), squares(0.0) {}
+
+        /** \brief Adds count densities, found every step
+         *      elements from values
+         */
+        template <typename T>
+        void add_run(const T *values, size_t count, size_t step);
+
+        /// Merges the moments of another set
+        void merge(const density_moments &other);
+
+        /// Summary of the densities added so far
+        density_summary summary() const;
+    };
+
+    /// \brief Moments of the densities of a single row
+    struct row_statistics {
+        density_moments hares, pumas;
+
+        /// Largest change of a density in the row, negative if unknown
+        double change;
+
+        row_statistics() : change(-1.0) {}
+    };
+
+    /** \brief Pairwise sum of count values found every step
+     *      elements, with the deviations from shift squared if
+     *      squared is set
+     */
+    template <typename T>
+    double pairwise_sum(const T *values, size_t count, size_t step,
+            bool squared = false, double shift = 0.0)
+    {
+        if (count <= 16) {
+            double sum = 0.0;
+            for (size_t index = 0; index < count; ++index) {
+                double value = values[index * step];
+                if (squared) value = (value - shift) * (value - shift);
+                sum += value;
+            }
+            return sum;
+        }
+
+        size_t half = count / 2;
+        return pairwise_sum(values, half, step, squared, shift)
+            + pairwise_sum(values + half * step, count - half, step, squared, shift);
+    }
+
+    template <typename T>
+    void density_moments::add_run(const T *values, size_t count, size_t step)
+    {
+        if (count == 0) return;
+
+        density_moments run;
+        run.cells = count;
+        run.total = pairwise_sum(values, count, step);
+        for (size_t index = 0; index < count; ++index) {
+            double value = values[index * step];
+            if (value < run.min) run.min = value;
+            if (value > run.max) run.max = value;
+        }
+        run.squares = pairwise_sum(values, count, step, true, run.total / count);
+        merge(run);
+    }
+
+    /** \brief Largest absolute difference between count
+     *      values and their previous ones, both found every step
+     *      elements
+     */
+    template <typename T>
+    double largest_change(const T *values, const T *previous, size_t count, size_t step)
+    {
+        double largest = 0.0;
+        for (size_t index = 0; index < count * step; index += step) {
+            double change = std::fabs(double(values[index]) - double(previous[index]));
+            if (change > largest) largest = change;
+        }
+        return largest;
+    }
+
+    /** \brief Collects the moments of a row of a state
+     *
+     *  hares and pumas point at the densities of the first
+     *  cell of row j, the next cells being found every step
+     *  elements. The sums of every span of the row are stored
+     *  at the index of the span in span_hares and span_pumas,
+     *  unless they are NULL. previous_hares and previous_pumas
+     *  point at the same row of the state before the last
+     *  step, if the largest change of the row is wanted.
+     */
+    template <typename T>
+    void collect_row(const LandComponents &components, size_t j,
+            const T *hares, const T *pumas, size_t step, row_statistics &row,
+            double *span_hares = NULL, double *span_pumas = NULL,
+            const T *previous_hares = NULL, const T *previous_pumas = NULL)
+    {
+        row = row_statistics();
+        if (previous_hares != NULL) row.change = 0.0;
+
+        for (size_t index = components.row_spans[j];
+                index < components.row_spans[j + 1]; ++index) {
+            const LandComponents::span &land = components.spans[index];
+            size_t count = land.end - land.begin;
+
+            double hares_before = row.hares.total, pumas_before = row.pumas.total;
+            row.hares.add_run(hares + land.begin * step, count, step);
+            row.pumas.add_run(pumas + land.begin * step, count, step);
+
+            if (span_hares != NULL) {
+                span_hares[index] = row.hares.total - hares_before;
+                span_pumas[index] = row.pumas.total - pumas_before;
+            }
+
+            if (previous_hares != NULL) {
+                size_t first = land.begin * step;
+                row.change = std::max(row.change, std::max(
+                            largest_change(hares + first, previous_hares + first, count, step),
+                            largest_change(pumas + first, previous_pumas + first, count, step)));
+            }
+        }
+    }
+
+    /** \brief Combines the moments of all the rows, and the
+     *      sums of the spans into sums of the components
+     *
+     *  The rows are merged pairwise, and the spans are summed
+     *  with Kahan's compensated summation, so the result only
+     *  depends on the state, not on how it was stepped.
+     *  \param rows moments of every row
+     *  \param components the components of the map
+     *  \param span_hares sums of every span, or NULL if the
+     *      sums of the components are not wanted
+     *  \param span_pumas the same for pumas
+     */
+    density_statistics combine_rows(const std::vector<row_statistics> &rows,
+            const LandComponents &components,
+            const double *span_hares = NULL, const double *span_pumas = NULL);
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef PUMA_TextFormat_hpp
+#define PUMA_TextFormat_hpp
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+
+#include "exceptions.hpp"
+
+namespace PUMA {
+
+    class ByteSink;
+    class WorkerPool;
+
+    /// Most bytes written by format_integer and format_real
+    const size_t max_number_length = 32;
+
+    /** \brief Writes an integer in decimal
+     *  \return the end of the text
+     */
+    char* format_integer(unsigned long long value, char *text);
+
+    /// \overload
+    char* format_integer(long long value, char *text);
+
+    /** \brief Writes a double as printf does with %.*g, and
+     *      so as an std::ostream with its default flags
+     *
+     *  The digits are those of the value scaled by a power
+     *  of ten a double holds exactly, which are the correctly
+     *  rounded ones unless the scaled value is within its
+     *  rounding error of halfway between two integers. Only
+     *  these, the values out of the range of the powers and
+     *  the precisions over 15 go through snprintf, so that
+     *  the text is always the one printf writes.
+     *  \param value the number written
+     *  \param precision significant digits, the 6 of the
+     *      streams by default
+     *  \param text room for max_number_length bytes
+     *  \return the end of the text
+     */
+    char* format_real(double value, int precision, char *text);
+
+    /** \brief Formats the rows of a grid into text on
+     *      several threads, writing them in order
+     *
+     *  Every row is formatted straight into a buffer big
+     *  enough for its longest text: with a single thread the
+     *  buffer of the sink, otherwise one of its own, kept
+     *  from frame to frame. The rows are then formatted in
+     *  blocks, every thread taking a band of each block,
+     *  before the block is written out.
+     */
+    class RowFormatter {
+    public:
+        /** \brief Formats a row into text, with room for the
+         *      bytes given to write, and returns its end
+         */
+        typedef std::function<char*(size_t row, char *text)> row_task;
+
+    private:
+        boost::scoped_ptr<WorkerPool> workers;
+
+        /// Text of every row of a block
+        std::vector<std::vector<char> > texts;
+        std::vector<size_t> lengths;
+
+    public:
+        RowFormatter();
+        ~RowFormatter();
+
+        /** \brief Sets the number of threads formatting the rows
+         *  \exception IllegalValue if threads is 0
+         */
+        void set_threads(size_t threads);
+
+        size_t get_threads();
+
+        /** \brief Formats rows [0, count) into output
+         *  \param output where the text goes
+         *  \param count number of rows
+         *  \param row_bytes most bytes the text of a row takes
+         *  \param format formats a single row
+         */
+        void write(ByteSink &output, size_t count, size_t row_bytes,
+                const row_task &format);
+    };
+}
+
+#endif
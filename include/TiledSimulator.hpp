@@ -0,0 +1,67 @@
+#ifndef PUMA_TiledSimulator_hpp
+#define PUMA_TiledSimulator_hpp
+
+#include "SoASimulator.hpp"
+
+namespace PUMA {
+
+    /** \brief A SoASimulator advancing the map tile by tile,
+     *      many steps at a time
+     *
+     *  apply_steps copies every tile, together with a ghost
+     *  zone as wide as the number of steps done at once, into
+     *  small buffers that stay in cache, advances them there
+     *  and writes back only the inside of the tile. The ghost
+     *  zone shrinks by one cell every step, so that the inside
+     *  ends up exactly where a step-by-step run would have
+     *  put it, at the price of some recomputation at the edges.
+     *
+     *  The whole state is then only streamed through memory
+     *  once every block_steps steps, instead of every step,
+     *  which is what limits the other engines on maps
+     *  larger than the caches.
+     */
+    template <class Precision>
+    class BasicTiledSimulator : public BasicSoASimulator<Precision> {
+    protected:
+        typedef typename BasicSoASimulator<Precision>::storage storage;
+
+        /** \brief Advances the tiles [first, last) by depth
+         *      steps, from the current into the temporary state
+         */
+        void advance_tiles(size_t first, size_t last, size_t depth);
+
+        /// Number of tiles in X and Y dimensions
+        size_t tiles_x, tiles_y;
+
+    public:
+        /// Width of a tile, without the ghost zone
+        size_t tile_width;
+
+        /// Height of a tile, without the ghost zone
+        size_t tile_height;
+
+        /// Maximal number of steps a tile is advanced by at once
+        size_t block_steps;
+
+        /** \brief initializes a simulation instance with some
+         *      input data
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         *  \param topology the Topology of land_map, when it is
+         *      shared with other simulations of the same map.
+         *      Built from land_map if empty
+         */
+        BasicTiledSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+                boost::shared_ptr<const Topology> topology = boost::shared_ptr<const Topology>());
+
+        void apply_steps(size_t steps);
+    };
+
+    /// The double precision tiled engine
+    typedef BasicTiledSimulator<double_precision> TiledSimulator;
+}
+
+#endif
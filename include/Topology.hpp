@@ -0,0 +1,70 @@
+#ifndef PUMA_Topology_hpp
+#define PUMA_Topology_hpp
+
+#include <cstddef>
+#include <boost/shared_array.hpp>
+
+namespace PUMA {
+
+    /** \brief The static part of the simulation: which cells
+     *      are land and which of their neighbours are too
+     *
+     *  The land map never changes once a Simulator is created,
+     *  so all of this is computed once. Every cell is described
+     *  by a single byte:
+     *
+     *  - bits 0-3: which of the east, west, south and north
+     *      neighbours are land,
+     *  - bits 4-6: how many of them are land,
+     *  - bit 7: whether the cell itself is land.
+     *
+     *  The table is padded by a one-cell water border, so that
+     *  the cell (i, j) is found at (j + 1) * stride + i + 1, the
+     *  same layout the padded engines use for their states.
+     */
+    class Topology {
+    public:
+        static const unsigned char EAST = 1 << 0;
+        static const unsigned char WEST = 1 << 1;
+        static const unsigned char SOUTH = 1 << 2;
+        static const unsigned char NORTH = 1 << 3;
+        static const unsigned char LAND = 1 << 7;
+
+        /// Shift of the land neighbour count
+        static const int COUNT_SHIFT = 4;
+
+        /// X and Y sizes of the described area, without the border
+        size_t size_x, size_y;
+
+        /// Distance between two consecutive rows of cells
+        size_t stride;
+
+        /// Number of land cells
+        size_t land_cells;
+
+        /// The (size_x + 2) * (size_y + 2) cell descriptions
+        boost::shared_array<unsigned char> cells;
+
+        /** \brief Builds the table for a given land map
+         *  \param dim_x size in X dimension of the supplied land_map
+         *  \param dim_y size in Y dimension of land_map
+         *  \param land_map a 1D array of X*Y elements specifying
+         *      which tiles are land and which water
+         */
+        Topology(size_t dim_x, size_t dim_y, const bool *land_map);
+
+        /// Description of the cell (i, j)
+        unsigned char at(size_t i, size_t j) const
+        {
+            return cells[(j + 1) * stride + i + 1];
+        }
+
+        /// Number of land neighbours of a described cell
+        static unsigned int neighbours(unsigned char cell)
+        {
+            return (cell >> COUNT_SHIFT) & 7;
+        }
+    };
+}
+
+#endif
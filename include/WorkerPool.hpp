@@ -0,0 +1,82 @@
+#ifndef PUMA_WorkerPool_hpp
+#define PUMA_WorkerPool_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace PUMA {
+
+    /** \brief A persistent pool of threads splitting a range
+     *      of rows into contiguous bands
+     *
+     *  The threads are created once and wait for work in
+     *  between the calls to run, so nothing is spawned per
+     *  timestep. The calling thread takes the first band
+     *  itself. The bands only depend on the number of rows
+     *  and threads, so a given row is always processed by
+     *  the same thread.
+     */
+    class WorkerPool {
+    public:
+        /// Work done on rows [begin, end)
+        typedef std::function<void(size_t begin, size_t end)> task;
+
+    private:
+        std::vector<std::thread> threads;
+        std::mutex lock;
+
+        /// Signals the workers that a new task is available
+        std::condition_variable start;
+
+        /// Signals the caller that all the bands are done
+        std::condition_variable done;
+
+        /// Incremented every time a new task is started
+        size_t generation;
+
+        /// Number of workers that still have not finished
+        size_t running;
+
+        bool stopping;
+        const task *current_task;
+        size_t current_count;
+
+        /// The first exception thrown by a band of the current task
+        std::exception_ptr failure;
+
+        /// Runs a band, keeping the exception it may throw
+        void run_band(const task &work, size_t begin, size_t end);
+
+        /// Bounds of the band number 'band' out of 'count' rows
+        void band(size_t band, size_t count, size_t *begin, size_t *end);
+
+        void worker(size_t band);
+
+    public:
+        /** \brief Creates the pool
+         *  \param size total number of threads taking
+         *      part in the computation, including the caller
+         */
+        WorkerPool(size_t size);
+        ~WorkerPool();
+
+        /// Number of threads taking part in the computation
+        size_t size();
+
+        /** \brief Splits rows [0, count) into bands and runs
+         *      the task on them in parallel
+         *
+         *  Returns once every band is finished, which is the
+         *  only synchronisation point. An exception thrown by
+         *  a band is rethrown here, after all of them finished.
+         */
+        void run(const task &work, size_t count);
+    };
+}
+
+#endif
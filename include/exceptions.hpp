@@ -39,6 +39,30 @@ namespace PUMA {
         SerializerNotFound() : Exception() {};
     };
 
+    /** \brief thrown if the requested stepping
+     *      engine cannot be found
+     */
+    struct EngineNotFound : public Exception {
+        EngineNotFound(std::string msg) : Exception(msg) {};
+        EngineNotFound() : Exception() {};
+    };
+
+    /** \brief thrown when a file cannot be read
+     *      or is not in the expected format
+     */
+    struct FormatError : public Exception {
+        FormatError(std::string msg) : Exception(msg) {};
+        FormatError() : Exception() {};
+    };
+
+    /** \brief thrown when the system refuses to give
+     *      a resource, like memory or a process
+     */
+    struct SystemError : public Exception {
+        SystemError(std::string msg) : Exception(msg) {};
+        SystemError() : Exception() {};
+    };
+
     /** \brief thrown if a non-main function wants
      *      to terminate program execution.
      *
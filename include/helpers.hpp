@@ -2,6 +2,7 @@
 #define PUMA_helpers_h
 
 #include <utility>
+#include <stdint.h>
 #include <sys/time.h>
 #include <iostream>
 
@@ -20,6 +21,38 @@ namespace PUMA {
         bool is_land;
     };
 
+    /** \brief The equation parameters and the timestep,
+     *      as needed by the stepping kernels and the
+     *      serializers recording them
+     */
+    struct step_parameters {
+        double r, a, b, m, k, l, dt;
+    };
+
+    /// What a ConvergenceMonitor found the simulation settled into
+    enum convergence_reason {
+        NOT_CONVERGED = 0,
+        STEADY_STATE = 1,
+        PERIODIC_ORBIT = 2
+    };
+
+    /** \brief When and how a simulation converged, as
+     *      recorded by the serializers
+     */
+    struct convergence_record {
+        /// A convergence_reason
+        uint32_t reason;
+
+        /// What the solver did then: 1 if the run ended, 2 if the output was thinned
+        uint32_t action;
+
+        /// Number of steps from the initial state when it was detected
+        uint64_t step;
+
+        /// Period of the orbit in units of time, 0 for a steady state
+        double period;
+    };
+
     /** \brief Structure containing RGB colours
      *
      *  Useful structure when converting data to colours
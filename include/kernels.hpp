@@ -0,0 +1,342 @@
+#ifndef PUMA_kernels_hpp
+#define PUMA_kernels_hpp
+
+#include <cstddef>
+#include <list>
+#include <string>
+
+#include "exceptions.hpp"
+#include "helpers.hpp"
+#include "Topology.hpp"
+
+namespace PUMA {
+
+    /** \brief Densities stored and computed as doubles,
+     *      the precision of the plain Simulator
+     */
+    struct double_precision {
+        typedef double storage;
+        static std::string name() { return "double"; }
+    };
+
+    /// \brief Densities stored and computed as floats
+    struct single_precision {
+        typedef float storage;
+        static std::string name() { return "float"; }
+    };
+
+    /** \brief Densities stored as floats, but every step
+     *      computed in double precision
+     */
+    struct mixed_precision {
+        typedef float storage;
+        static std::string name() { return "mixed"; }
+    };
+
+    /** \brief Describes a kernel compiled for a given
+     *      instruction set
+     *
+     *  T is the type the densities are stored as.
+     */
+    template <typename T>
+    struct kernel_isa {
+        /** \brief A kernel advancing a run of consecutive cells
+         *      of a structure-of-arrays state by one step
+         *
+         *  All the pointers point at the first cell of the run,
+         *  the neighbours are found at -1, +1, -stride and +stride.
+         *  \param hare hare densities of the last state
+         *  \param puma puma densities of the last state
+         *  \param cells descriptions of the cells, see Topology
+         *  \param hare_out hare densities of the new state
+         *  \param puma_out puma densities of the new state
+         *  \param count number of cells in the run
+         *  \param stride distance between two consecutive rows
+         *  \param params the equation parameters
+         */
+        typedef void (*step_kernel)(const T *hare, const T *puma,
+                const unsigned char *cells, T *hare_out, T *puma_out,
+                size_t count, size_t stride, const step_parameters &params);
+
+        /// Name of the instruction set
+        std::string name;
+
+        /// Cells updated by a single instruction
+        size_t width;
+
+        /// Set if the CPU we are running on can execute it
+        bool (*supported)();
+
+        /// The kernel itself
+        step_kernel step;
+    };
+
+    /** \brief Returns the list of kernels compiled for
+     *      a given precision, the widest first
+     */
+    template <class Precision>
+    const std::list<kernel_isa<typename Precision::storage> >& available_kernels();
+
+    template <>
+    const std::list<kernel_isa<double> >& available_kernels<double_precision>();
+    template <>
+    const std::list<kernel_isa<float> >& available_kernels<single_precision>();
+    template <>
+    const std::list<kernel_isa<float> >& available_kernels<mixed_precision>();
+
+    /** \brief Picks the widest kernel of a given precision
+     *      the CPU supports
+     *
+     *  The choice can be overriden by setting the PUMA_ISA
+     *  environment variable to a name of one of the kernels.
+     */
+    template <class Precision>
+    const kernel_isa<typename Precision::storage>& best_kernel();
+
+    /** \brief Returns a kernel of a given precision specified
+     *      by the name of its instruction set
+     *  \exception IllegalValue when there is no such kernel
+     *      or it cannot run on this CPU
+     */
+    template <class Precision>
+    const kernel_isa<typename Precision::storage>& choose_kernel(std::string name);
+
+    /** \brief The step kernel written against a small set of
+     *      vector operations
+     *
+     *  Ops provides the storage type, the vector type used for
+     *  the arithmetic, its width and the load, store, set1, add,
+     *  sub, mul and max operations, as well as load_cells, which
+     *  expands the cell descriptions into land neighbour counts
+     *  and a 1.0/0.0 land mask. Water cells are computed as well
+     *  and zeroed by multiplying with the land mask, so there are
+     *  no branches in the loop. The operations are done in the
+     *  same order as in Simulator::apply_step, which keeps the
+     *  results bit-identical for every vector width.
+     */
+    template <class Ops, class Tail>
+    void step_run(const typename Ops::storage *hare, const typename Ops::storage *puma,
+            const unsigned char *cells,
+            typename Ops::storage *hare_out, typename Ops::storage *puma_out,
+            size_t count, size_t stride, const step_parameters &params)
+    {
+        typedef typename Ops::vec vec;
+        vec r = Ops::set1(params.r), a = Ops::set1(params.a),
+            b = Ops::set1(params.b), m = Ops::set1(-params.m),
+            k = Ops::set1(params.k), dt = Ops::set1(params.dt),
+            zero = Ops::set1(0.0);
+
+        size_t i = 0;
+        for (; i + Ops::width <= count; i += Ops::width) {
+            vec h = Ops::load(hare + i), p = Ops::load(puma + i);
+            vec n, mask;
+            Ops::load_cells(cells + i, &n, &mask);
+
+            vec hare_sum = Ops::add(Ops::add(Ops::add(
+                            Ops::load(hare + i - 1), Ops::load(hare + i + 1)),
+                        Ops::load(hare + i - stride)), Ops::load(hare + i + stride));
+            vec puma_sum = Ops::add(Ops::add(Ops::add(
+                            Ops::load(puma + i - 1), Ops::load(puma + i + 1)),
+                        Ops::load(puma + i - stride)), Ops::load(puma + i + stride));
+
+            vec new_hare = Ops::add(h, Ops::mul(dt, Ops::add(
+                            Ops::sub(Ops::mul(r, h), Ops::mul(Ops::mul(a, h), p)),
+                            Ops::mul(k, Ops::sub(hare_sum, Ops::mul(n, h))))));
+            vec new_puma = Ops::add(p, Ops::mul(dt, Ops::add(
+                            Ops::add(Ops::mul(m, p), Ops::mul(Ops::mul(b, p), h)),
+                            Ops::mul(k, Ops::sub(puma_sum, Ops::mul(n, p))))));
+
+            // forces positive densities and keeps the water empty
+            Ops::store(hare_out + i, Ops::mul(mask, Ops::max(zero, new_hare)));
+            Ops::store(puma_out + i, Ops::mul(mask, Ops::max(zero, new_puma)));
+        }
+
+        if (i < count) {
+            step_run<Tail, Tail>(hare + i, puma + i, cells + i,
+                    hare_out + i, puma_out + i, count - i, stride, params);
+        }
+    }
+
+    /** \brief Equation parameters of every lane of a batch
+     *
+     *  Each pointer points at one value per lane. The puma
+     *  mortality is stored negated, which is how the step
+     *  uses it.
+     */
+    struct batch_parameters {
+        const double *r, *a, *b, *neg_m, *k, *dt;
+    };
+
+    /** \brief Describes a batch kernel compiled for a given
+     *      instruction set
+     *
+     *  The batch kernels step many simulations of the same
+     *  map at once, each in its own lane. The densities of
+     *  all the lanes of a cell are stored next to each other,
+     *  so the lanes are the vectorised dimension.
+     */
+    struct batch_kernel_isa {
+        /** \brief A kernel advancing a run of consecutive cells
+         *      of a lane-interleaved state by one step
+         *
+         *  The pointers point at the first lane of the first cell
+         *  of the run, the lanes of the neighbours are found at
+         *  -lanes, +lanes, -stride * lanes and +stride * lanes.
+         *  \param hare hare densities of the last state
+         *  \param puma puma densities of the last state
+         *  \param cells descriptions of the cells, see Topology
+         *  \param hare_out hare densities of the new state
+         *  \param puma_out puma densities of the new state
+         *  \param count number of cells in the run
+         *  \param stride distance between two consecutive rows,
+         *      in cells
+         *  \param lanes number of lanes, a multiple of the width
+         *  \param params the equation parameters of every lane
+         */
+        typedef void (*step_kernel)(const double *hare, const double *puma,
+                const unsigned char *cells, double *hare_out, double *puma_out,
+                size_t count, size_t stride, size_t lanes,
+                const batch_parameters &params);
+
+        /// Name of the instruction set
+        std::string name;
+
+        /// Lanes updated by a single instruction
+        size_t width;
+
+        /// Set if the CPU we are running on can execute it
+        bool (*supported)();
+
+        /// The kernel itself
+        step_kernel step;
+    };
+
+    /** \brief Returns the list of batch kernels, the widest first
+     */
+    const std::list<batch_kernel_isa>& available_batch_kernels();
+
+    /** \brief Picks the widest batch kernel the CPU supports,
+     *      honouring PUMA_ISA like best_kernel
+     */
+    const batch_kernel_isa& best_batch_kernel();
+
+    /** \brief Returns the batch kernel of a given instruction set
+     *  \exception IllegalValue when there is no such kernel
+     *      or it cannot run on this CPU
+     */
+    const batch_kernel_isa& choose_batch_kernel(std::string name);
+
+    /** \brief The parameters of a block of Ops::width lanes,
+     *      as used by batch_step_block
+     */
+    template <class Ops>
+    struct batch_block {
+        typename Ops::vec r, a, b, m, k, dt;
+
+        batch_block(const batch_parameters &params, size_t lane) :
+            r(Ops::load(params.r + lane)), a(Ops::load(params.a + lane)),
+            b(Ops::load(params.b + lane)), m(Ops::load(params.neg_m + lane)),
+            k(Ops::load(params.k + lane)), dt(Ops::load(params.dt + lane)) {}
+    };
+
+    /** \brief Advances a block of lanes of a single cell, with
+     *      the operations of step_run in the same order
+     */
+    template <class Ops>
+    inline void batch_step_block(const double *hare, const double *puma,
+            double *hare_out, double *puma_out, size_t lanes, size_t row,
+            typename Ops::vec n, typename Ops::vec mask,
+            const batch_block<Ops> &c)
+    {
+        typedef typename Ops::vec vec;
+        vec zero = Ops::set1(0.0);
+        vec h = Ops::load(hare), p = Ops::load(puma);
+
+        vec hare_sum = Ops::add(Ops::add(Ops::add(
+                        Ops::load(hare - lanes), Ops::load(hare + lanes)),
+                    Ops::load(hare - row)), Ops::load(hare + row));
+        vec puma_sum = Ops::add(Ops::add(Ops::add(
+                        Ops::load(puma - lanes), Ops::load(puma + lanes)),
+                    Ops::load(puma - row)), Ops::load(puma + row));
+
+        vec new_hare = Ops::add(h, Ops::mul(c.dt, Ops::add(
+                        Ops::sub(Ops::mul(c.r, h), Ops::mul(Ops::mul(c.a, h), p)),
+                        Ops::mul(c.k, Ops::sub(hare_sum, Ops::mul(n, h))))));
+        vec new_puma = Ops::add(p, Ops::mul(c.dt, Ops::add(
+                        Ops::add(Ops::mul(c.m, p), Ops::mul(Ops::mul(c.b, p), h)),
+                        Ops::mul(c.k, Ops::sub(puma_sum, Ops::mul(n, p))))));
+
+        Ops::store(hare_out, Ops::mul(mask, Ops::max(zero, new_hare)));
+        Ops::store(puma_out, Ops::mul(mask, Ops::max(zero, new_puma)));
+    }
+
+    /** \brief The batch kernel written against the operations
+     *      of step_run
+     *
+     *  Every lane is computed with the same operations in the
+     *  same order as step_run, so each of them is bit-identical
+     *  to a single simulation with its parameters. The neighbour
+     *  count and land mask are expanded once per cell for all
+     *  the lanes, and water is cleared with the mask like in
+     *  step_run. When the lanes fit a single vector, their
+     *  parameters are kept in registers for the whole run.
+     */
+    template <class Ops>
+    void batch_step_run(const double *hare, const double *puma,
+            const unsigned char *cells, double *hare_out, double *puma_out,
+            size_t count, size_t stride, size_t lanes,
+            const batch_parameters &params)
+    {
+        typedef typename Ops::vec vec;
+        size_t row = stride * lanes;
+
+        if (lanes == Ops::width) {
+            batch_block<Ops> block(params, 0);
+            for (size_t i = 0; i < count; ++i) {
+                size_t at = i * Ops::width;
+                batch_step_block<Ops>(hare + at, puma + at, hare_out + at, puma_out + at,
+                        Ops::width, row, Ops::set1((cells[i] >> Topology::COUNT_SHIFT) & 7),
+                        Ops::set1(cells[i] >> 7), block);
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            vec n = Ops::set1((cells[i] >> Topology::COUNT_SHIFT) & 7);
+            vec mask = Ops::set1(cells[i] >> 7);
+            for (size_t lane = 0; lane < lanes; lane += Ops::width) {
+                size_t at = i * lanes + lane;
+                batch_step_block<Ops>(hare + at, puma + at, hare_out + at, puma_out + at,
+                        lanes, row, n, mask, batch_block<Ops>(params, lane));
+            }
+        }
+    }
+
+    /** \brief Vector operations on single numbers, used for the
+     *      remainders
+     *
+     *  The densities are stored as S and computed as C.
+     */
+    template <typename S, typename C>
+    struct scalar_ops {
+        typedef S storage;
+        typedef C vec;
+        static const size_t width = 1;
+
+        static vec load(const S *p) { return *p; }
+        static void store(S *p, vec v) { *p = v; }
+        static vec set1(double x) { return x; }
+        static vec add(vec x, vec y) { return x + y; }
+        static vec sub(vec x, vec y) { return x - y; }
+        static vec mul(vec x, vec y) { return x * y; }
+        static vec max(vec x, vec y) { return x > y ? x : y; }
+
+        static void load_cells(const unsigned char *cells, vec *count, vec *land)
+        {
+            *count = (*cells >> Topology::COUNT_SHIFT) & 7;
+            *land = (*cells & Topology::LAND) ? 1.0 : 0.0;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,202 @@
+#include "BatchSimulator.hpp"
+#include "exceptions.hpp"
+#include "InitialState.hpp"
+#include "Statistics.hpp"
+
+#include <functional>
+#include <sstream>
+
+namespace PUMA {
+
+    /** The lanes are padded for the widest kernel compiled,
+     *  so that set_kernel can switch to any of them later on
+     */
+    BatchSimulator::BatchSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+            size_t lanes, boost::shared_ptr<const Topology> topology) :
+        size_x(dim_x), size_y(dim_y), lanes(lanes), stride(dim_x + 2),
+        topology(topology), kernel(&best_batch_kernel())
+    {
+        if (lanes == 0)
+            throw IllegalValue("A batch needs at least one lane");
+
+        if (!topology) {
+            this->topology.reset(new Topology(dim_x, dim_y, land_map));
+        } else if (topology->size_x != dim_x || topology->size_y != dim_y) {
+            throw IllegalValue("The topology does not describe the land map");
+        }
+
+        size_t width = available_batch_kernels().front().width;
+        padded_lanes = (lanes + width - 1) / width * width;
+
+        // The border and water stay empty for the whole simulation
+        size_t padded_size = (dim_x + 2) * (dim_y + 2) * padded_lanes;
+        hare_current.reset(new double[padded_size]());
+        puma_current.reset(new double[padded_size]());
+        hare_temp.reset(new double[padded_size]());
+        puma_temp.reset(new double[padded_size]());
+
+        r.assign(padded_lanes, 0.0);
+        a.assign(padded_lanes, 0.0);
+        b.assign(padded_lanes, 0.0);
+        neg_m.assign(padded_lanes, 0.0);
+        k.assign(padded_lanes, 0.0);
+        dt.assign(padded_lanes, 0.0);
+
+        // The defaults of Simulator
+        step_parameters defaults = {0.08, 0.04, 0.02, 0.06, 0.2, 0.2, 0.01};
+        parameters.assign(lanes, defaults);
+        for (size_t lane = 0; lane < lanes; ++lane)
+            set_parameters(lane, defaults);
+    }
+
+    void BatchSimulator::check_lane(size_t lane) const
+    {
+        if (lane >= lanes) {
+            std::ostringstream message;
+            message << "There is no lane " << lane << " in a batch of " << lanes;
+            throw IllegalValue(message.str());
+        }
+    }
+
+    void BatchSimulator::set_parameters(size_t lane, const step_parameters &params)
+    {
+        check_lane(lane);
+        if (params.dt < 1e-15) {
+            throw IllegalValue("The step should be non-zero "
+                    "and bigger than the accuracy of a double");
+        }
+
+        parameters[lane] = params;
+        r[lane] = params.r;
+        a[lane] = params.a;
+        b[lane] = params.b;
+        neg_m[lane] = -params.m;
+        k[lane] = params.k;
+        dt[lane] = params.dt;
+    }
+
+    step_parameters BatchSimulator::get_parameters(size_t lane)
+    {
+        check_lane(lane);
+        return parameters[lane];
+    }
+
+    /** The distribution fills an unpadded state first, split
+     *  between the threads like in Simulator::initialize. It
+     *  only fills the cells marked as land.
+     */
+    void BatchSimulator::initialize(size_t lane, const InitialDistribution &initial)
+    {
+        check_lane(lane);
+        initial.check(size_x, size_y);
+
+        boost::shared_array<landscape> state(new landscape[size_x * size_y]);
+        for (size_t j = 0; j < size_y; ++j) {
+            for (size_t i = 0; i < size_x; ++i)
+                state[j * size_x + i].is_land = topology->at(i, j) & Topology::LAND;
+        }
+
+        landscape *cells = state.get();
+        size_t width = size_x;
+        WorkerPool::task fill = [&initial, cells, width](size_t j_begin, size_t j_end) {
+            initial.fill(cells, j_begin * width, j_end * width);
+        };
+
+        if (workers) workers->run(fill, size_y);
+        else fill(0, size_y);
+
+        set_state(lane, cells);
+    }
+
+    void BatchSimulator::set_state(size_t lane, const landscape *state)
+    {
+        check_lane(lane);
+        for (size_t j = 0; j < size_y; ++j) {
+            for (size_t i = 0; i < size_x; ++i) {
+                size_t index = at(i, j) + lane;
+                bool is_land = topology->at(i, j) & Topology::LAND;
+
+                hare_current[index] = is_land ? state[j * size_x + i].hare_density : 0.0;
+                puma_current[index] = is_land ? state[j * size_x + i].puma_density : 0.0;
+            }
+        }
+    }
+
+    boost::shared_array<landscape> BatchSimulator::get_state(size_t lane)
+    {
+        check_lane(lane);
+        boost::shared_array<landscape> state(new landscape[size_x * size_y]);
+        for (size_t j = 0; j < size_y; ++j) {
+            for (size_t i = 0; i < size_x; ++i) {
+                landscape &cell = state[j * size_x + i];
+                cell.hare_density = hare_current[at(i, j) + lane];
+                cell.puma_density = puma_current[at(i, j) + lane];
+                cell.is_land = topology->at(i, j) & Topology::LAND;
+            }
+        }
+        return state;
+    }
+
+    average_densities BatchSimulator::get_averages(size_t lane)
+    {
+        check_lane(lane);
+        if (!components) components.reset(new LandComponents(*topology));
+
+        std::vector<row_statistics> rows(size_y);
+        for (size_t j = 0; j < size_y; ++j) {
+            collect_row(*components, j, &hare_current[at(0, j) + lane],
+                    &puma_current[at(0, j) + lane], padded_lanes, rows[j]);
+        }
+        density_statistics statistics = combine_rows(rows, *components);
+
+        average_densities av;
+        av.first = statistics.hares.total / (double) statistics.land_cells;
+        av.second = statistics.pumas.total / (double) statistics.land_cells;
+        return av;
+    }
+
+    void BatchSimulator::step_rows(size_t j_begin, size_t j_end)
+    {
+        batch_parameters params = {&r[0], &a[0], &b[0], &neg_m[0], &k[0], &dt[0]};
+        for (size_t j = j_begin; j < j_end; ++j) {
+            size_t row = (j + 1) * stride + 1;
+            kernel->step(&hare_temp[row * padded_lanes], &puma_temp[row * padded_lanes],
+                    &topology->cells[row],
+                    &hare_current[row * padded_lanes], &puma_current[row * padded_lanes],
+                    size_x, stride, padded_lanes, params);
+        }
+    }
+
+    void BatchSimulator::apply_step()
+    {
+        hare_temp.swap(hare_current);
+        puma_temp.swap(puma_current);
+
+        if (workers) {
+            workers->run(std::bind(&BatchSimulator::step_rows, this,
+                        std::placeholders::_1, std::placeholders::_2), size_y);
+        } else {
+            step_rows(0, size_y);
+        }
+    }
+
+    void BatchSimulator::apply_steps(size_t steps)
+    {
+        for (size_t step = 0; step < steps; ++step)
+            apply_step();
+    }
+
+    void BatchSimulator::set_threads(size_t threads)
+    {
+        if (threads == 0)
+            throw IllegalValue("At least one thread is needed");
+
+        if (threads == 1) workers.reset();
+        else workers.reset(new WorkerPool(threads));
+    }
+
+    void BatchSimulator::set_kernel(std::string name)
+    {
+        kernel = &choose_batch_kernel(name);
+    }
+}
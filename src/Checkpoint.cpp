@@ -0,0 +1,179 @@
+#include "Checkpoint.hpp"
+#include "Metrics.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace PUMA {
+
+    const char checkpoint_magic[8] = "PUMACHK";
+
+    uint64_t land_hash(const landscape *state, size_t size_x, size_t size_y)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        uint64_t sizes[2] = {size_x, size_y};
+        const unsigned char *bytes = reinterpret_cast<const unsigned char*>(sizes);
+        for (size_t index = 0; index < sizeof(sizes); ++index)
+            hash = (hash ^ bytes[index]) * 1099511628211ULL;
+
+        for (size_t index = 0; index < size_x * size_y; ++index)
+            hash = (hash ^ (state[index].is_land ? 1 : 0)) * 1099511628211ULL;
+        return hash;
+    }
+
+    /// Writes the whole buffer, retrying after interruptions
+    static bool write_all(int descriptor, const char *data, size_t length)
+    {
+        while (length > 0) {
+            ssize_t written = ::write(descriptor, data, length);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            data += written;
+            length -= written;
+        }
+        return true;
+    }
+
+    void write_checkpoint(std::string filename, const checkpoint &snapshot)
+    {
+        ScopedTimer timer(PHASE_CHECKPOINT);
+        count_metric(COUNTER_CHECKPOINTS);
+        size_t cells = snapshot.size_x * snapshot.size_y;
+
+        checkpoint_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+        header.byte_order = binary_byte_order;
+        header.version = checkpoint_version;
+        header.size_x = snapshot.size_x;
+        header.size_y = snapshot.size_y;
+        header.land_hash = snapshot.land_hash;
+        header.step = snapshot.step;
+        header.seed = snapshot.seed;
+        header.parameters = snapshot.parameters;
+        header.step_size = snapshot.step_size;
+
+        std::vector<double> densities(2 * cells);
+        for (size_t index = 0; index < cells; ++index) {
+            densities[index] = snapshot.state[index].hare_density;
+            densities[cells + index] = snapshot.state[index].puma_density;
+        }
+
+        std::string temporary = filename + ".tmp";
+        int descriptor = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (descriptor < 0)
+            throw FormatError("Could not create " + temporary);
+
+        bool written = write_all(descriptor, reinterpret_cast<const char*>(&header),
+                sizeof(header)) && write_all(descriptor,
+                    reinterpret_cast<const char*>(&densities[0]),
+                    densities.size() * sizeof(double));
+
+        // The data has to be on the disk before the rename makes it visible
+        written = written && fsync(descriptor) == 0;
+        if (close(descriptor) != 0 || !written) {
+            unlink(temporary.c_str());
+            throw FormatError("Could not write " + temporary);
+        }
+
+        if (rename(temporary.c_str(), filename.c_str()) != 0) {
+            unlink(temporary.c_str());
+            throw FormatError("Could not replace " + filename);
+        }
+    }
+
+    checkpoint read_checkpoint(std::string filename)
+    {
+        std::ifstream input(filename.c_str(), std::ios::binary);
+        if (!input)
+            throw FormatError("Could not open " + filename);
+
+        checkpoint_header header;
+        input.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!input || memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0 ||
+                header.version != checkpoint_version)
+            throw FormatError(filename + " is not a checkpoint");
+        if (header.byte_order != binary_byte_order)
+            throw FormatError(filename + " was written with a different byte order");
+
+        checkpoint snapshot;
+        snapshot.size_x = header.size_x;
+        snapshot.size_y = header.size_y;
+        snapshot.land_hash = header.land_hash;
+        snapshot.step = header.step;
+        snapshot.seed = header.seed;
+        snapshot.parameters = header.parameters;
+        snapshot.step_size = header.step_size;
+
+        size_t cells = snapshot.size_x * snapshot.size_y;
+        std::vector<double> densities(2 * cells);
+        input.read(reinterpret_cast<char*>(&densities[0]), densities.size() * sizeof(double));
+        if (!input || input.gcount() != (std::streamsize)(densities.size() * sizeof(double)))
+            throw FormatError(filename + " is truncated or corrupted");
+
+        snapshot.state.reset(new landscape[cells]);
+        for (size_t index = 0; index < cells; ++index) {
+            snapshot.state[index].hare_density = densities[index];
+            snapshot.state[index].puma_density = densities[cells + index];
+            snapshot.state[index].is_land = false;
+        }
+        return snapshot;
+    }
+
+    /* ****             CheckpointWriter            **** */
+
+    /** A single buffer is enough for a pipeline of its own,
+     *  as the checkpoints are far apart compared to the time
+     *  it takes to write one. Its default writer is never
+     *  used, save giving every checkpoint the step size it
+     *  was taken with.
+     */
+    CheckpointWriter::CheckpointWriter(std::string filename, Simulator &simulation,
+            uint64_t seed, OutputPipeline *shared) :
+        filename(filename), parameters(simulation.get_parameters()), seed(seed),
+        size_x(simulation.get_size_x()), size_y(simulation.get_size_y()),
+        pipeline(shared)
+    {
+        if (!pipeline) {
+            own_pipeline.reset(new OutputPipeline(size_x, size_y, 1,
+                        std::bind(&CheckpointWriter::write, this,
+                            std::placeholders::_1, std::placeholders::_2, 0.0)));
+            pipeline = own_pipeline.get();
+        }
+    }
+
+    void CheckpointWriter::write(boost::shared_array<landscape> state, size_t step,
+            double step_size)
+    {
+        checkpoint snapshot;
+        snapshot.size_x = size_x;
+        snapshot.size_y = size_y;
+        snapshot.land_hash = land_hash(state.get(), size_x, size_y);
+        snapshot.step = step;
+        snapshot.seed = seed;
+        snapshot.parameters = parameters;
+        snapshot.step_size = step_size;
+        snapshot.state = state;
+        write_checkpoint(filename, snapshot);
+    }
+
+    void CheckpointWriter::save(Simulator &simulation, uint64_t step)
+    {
+        // Taken now, the simulation goes on while the checkpoint is written
+        pipeline->push(simulation, step, std::bind(&CheckpointWriter::write, this,
+                    std::placeholders::_1, std::placeholders::_2,
+                    simulation.get_step_size()));
+    }
+
+    void CheckpointWriter::flush()
+    {
+        pipeline->flush();
+    }
+}
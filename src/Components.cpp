@@ -0,0 +1,92 @@
+#include "Components.hpp"
+
+#include <algorithm>
+
+namespace PUMA {
+
+    /// Root of a span in a union-find forest, halving the paths
+    static size_t find_root(std::vector<size_t> &parent, size_t span)
+    {
+        while (parent[span] != span) {
+            parent[span] = parent[parent[span]];
+            span = parent[span];
+        }
+        return span;
+    }
+
+    /** The spans of every row are joined to the overlapping
+     *  spans of the row above, which is all it takes to connect
+     *  the cells, as every span is connected on its own
+     */
+    LandComponents::LandComponents(const Topology &topology) :
+        size_x(topology.size_x), size_y(topology.size_y)
+    {
+        for (size_t j = 0; j < size_y; ++j) {
+            row_spans.push_back(spans.size());
+
+            for (size_t i = 0; i < size_x; ++i) {
+                if (!(topology.at(i, j) & Topology::LAND)) continue;
+
+                span next = {j, i, i, 0};
+                while (i < size_x && (topology.at(i, j) & Topology::LAND))
+                    ++i;
+                next.end = i;
+                spans.push_back(next);
+            }
+        }
+        row_spans.push_back(spans.size());
+
+        std::vector<size_t> parent(spans.size());
+        for (size_t index = 0; index < spans.size(); ++index)
+            parent[index] = index;
+
+        for (size_t j = 1; j < size_y; ++j) {
+            size_t above = row_spans[j - 1], above_end = row_spans[j];
+            for (size_t index = row_spans[j]; index < row_spans[j + 1]; ++index) {
+                // Spans of the row above entirely on the left cannot overlap later ones
+                while (above < above_end && spans[above].end <= spans[index].begin)
+                    ++above;
+
+                for (size_t other = above; other < above_end &&
+                        spans[other].begin < spans[index].end; ++other) {
+                    size_t a = find_root(parent, index), b = find_root(parent, other);
+                    if (a != b) parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+
+        // The roots are the first spans of their components
+        std::vector<size_t> number(spans.size());
+        for (size_t index = 0; index < spans.size(); ++index) {
+            size_t root = find_root(parent, index);
+            span &current = spans[index];
+
+            if (root == index) {
+                number[index] = components.size();
+                component extent = {current.begin, current.row,
+                    current.end, current.row + 1, 0};
+                components.push_back(extent);
+            }
+
+            current.component = number[root];
+            component &extent = components[current.component];
+            extent.x0 = std::min(extent.x0, current.begin);
+            extent.x1 = std::max(extent.x1, current.end);
+            extent.y1 = current.row + 1;
+            extent.cells += current.end - current.begin;
+        }
+    }
+
+    size_t LandComponents::at(size_t i, size_t j) const
+    {
+        std::vector<span>::const_iterator first = spans.begin() + row_spans[j],
+            last = spans.begin() + row_spans[j + 1];
+
+        // The first span ending after i
+        std::vector<span>::const_iterator found = std::upper_bound(first, last, i,
+                [](size_t column, const span &candidate) { return column < candidate.end; });
+
+        if (found == last || found->begin > i) return components.size();
+        return found->component;
+    }
+}
@@ -0,0 +1,542 @@
+#include "Compression.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace PUMA {
+
+    const char compressed_magic[8] = "PUMACMP";
+
+    /* ****             FrameBuffer                 **** */
+
+    FrameBuffer::FrameBuffer() :
+        start(0), length(0), patching(false), position(0), patch_at(0)
+    {
+        place(0);
+    }
+
+    void FrameBuffer::settle()
+    {
+        if (patching || pbase() == NULL) return;
+
+        size_t at = pptr() - &data[0];
+        if (at > length) length = at;
+    }
+
+    void FrameBuffer::place(size_t offset)
+    {
+        patching = false;
+
+        if (offset >= data.size())
+            data.resize(std::max(2 * data.size(), offset + 4096));
+
+        // A gap left by a seek past the end reads as zeros, like in a file
+        if (offset > length) {
+            std::fill(data.begin() + length, data.begin() + offset, 0);
+            length = offset;
+        }
+        setp(&data[0] + offset, &data[0] + data.size());
+    }
+
+    void FrameBuffer::start_patch(uint64_t offset)
+    {
+        settle();
+        patching = true;
+        position = offset;
+        setp(NULL, NULL);
+
+        patch_header header = {offset, 0};
+        patch_at = patches.size();
+        patches.insert(patches.end(), reinterpret_cast<const char*>(&header),
+                reinterpret_cast<const char*>(&header) + sizeof(header));
+    }
+
+    size_t FrameBuffer::add_patch(const char *bytes, size_t count)
+    {
+        count = std::min<uint64_t>(count, start - position);
+        patches.insert(patches.end(), bytes, bytes + count);
+        position += count;
+
+        patch_header header;
+        memcpy(&header, &patches[patch_at], sizeof(header));
+        header.length += count;
+        memcpy(&patches[patch_at], &header, sizeof(header));
+
+        if (position == start) place(0);
+        return count;
+    }
+
+    FrameBuffer::int_type FrameBuffer::overflow(int_type c)
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+
+        char byte = traits_type::to_char_type(c);
+        if (patching) {
+            add_patch(&byte, 1);
+            return c;
+        }
+
+        size_t at = pptr() - &data[0];
+        settle();
+        place(at);
+        *pptr() = byte;
+        pbump(1);
+        return c;
+    }
+
+    std::streamsize FrameBuffer::xsputn(const char *s, std::streamsize count)
+    {
+        if (!patching) return std::streambuf::xsputn(s, count);
+
+        std::streamsize added = add_patch(s, count);
+        if (added < count) added += std::streambuf::xsputn(s + added, count - added);
+        return added;
+    }
+
+    FrameBuffer::pos_type FrameBuffer::seekoff(off_type offset,
+            std::ios_base::seekdir direction, std::ios_base::openmode which)
+    {
+        if (!(which & std::ios_base::out)) return pos_type(off_type(-1));
+
+        settle();
+        uint64_t current = patching ? position : start + (pptr() - &data[0]);
+        uint64_t base = direction == std::ios_base::beg ? 0 :
+            direction == std::ios_base::cur ? current : start + length;
+        return seekpos(pos_type(off_type(base + offset)), which);
+    }
+
+    FrameBuffer::pos_type FrameBuffer::seekpos(pos_type offset, std::ios_base::openmode which)
+    {
+        if (!(which & std::ios_base::out) || off_type(offset) < 0)
+            return pos_type(off_type(-1));
+
+        settle();
+        uint64_t target = off_type(offset);
+        if (target >= start) place(target - start);
+        else if (!patching || position != target) start_patch(target);
+        return offset;
+    }
+
+    int FrameBuffer::sync()
+    {
+        settle();
+        return 0;
+    }
+
+    void FrameBuffer::take_frame(written_frame &frame)
+    {
+        settle();
+        frame.offset = start;
+        frame.bytes.swap(data);
+        frame.bytes.resize(length);
+        frame.patches.swap(patches);
+        patches.clear();
+
+        start += length;
+        length = 0;
+        setp(NULL, NULL);
+        place(0);
+    }
+
+    /* ****             packing                     **** */
+
+    /** Runs of 3 to 130 equal bytes are coded as a byte of
+     *  125 + the length and the byte repeated, up to 128
+     *  other bytes as a byte of their number - 1 and the
+     *  bytes themselves
+     */
+    static void pack_bytes(const char *bytes, size_t count, std::vector<char> &packed)
+    {
+        size_t index = 0;
+        while (index < count) {
+            size_t run = 1;
+            while (index + run < count && run < 130 && bytes[index + run] == bytes[index])
+                ++run;
+            if (run >= 3) {
+                packed.push_back(char(125 + run));
+                packed.push_back(bytes[index]);
+                index += run;
+                continue;
+            }
+
+            size_t begin = index;
+            while (index < count && index - begin < 128) {
+                if (index + 2 < count && bytes[index] == bytes[index + 1] &&
+                        bytes[index] == bytes[index + 2])
+                    break;
+                ++index;
+            }
+            packed.push_back(char(index - begin - 1));
+            packed.insert(packed.end(), bytes + begin, bytes + index);
+        }
+    }
+
+    /// Unpacks exactly count bytes, false if the packed bytes do not make them
+    static bool unpack_bytes(const std::vector<char> &packed, char *bytes, size_t count)
+    {
+        size_t in = 0, out = 0;
+        while (in < packed.size()) {
+            unsigned char code = packed[in++];
+            if (code >= 128) {
+                size_t run = code - 125;
+                if (in == packed.size() || out + run > count) return false;
+                memset(bytes + out, packed[in++], run);
+                out += run;
+            } else {
+                size_t literal = code + 1;
+                if (in + literal > packed.size() || out + literal > count) return false;
+                memcpy(bytes + out, &packed[in], literal);
+                in += literal;
+                out += literal;
+            }
+        }
+        return out == count;
+    }
+
+    /* ****             FrameCompressor             **** */
+
+    FrameCompressor::FrameCompressor(std::ofstream &stream, size_t chunk_frames) :
+        stream(stream), file(stream.rdbuf()), chunk_frames(chunk_frames),
+        stopping(false), finished(false), failed(false), pushed(0), done(0),
+        chunk_count(0), chunk_start(0)
+    {
+        if (chunk_frames == 0)
+            throw IllegalValue("A chunk needs at least one frame");
+        if (!stream.is_open())
+            throw FormatError("The compressed output is not open");
+
+        compressed_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, compressed_magic, sizeof(header.magic));
+        header.byte_order = binary_byte_order;
+        header.version = compressed_version;
+        header.chunk_frames = chunk_frames;
+        write(&header, sizeof(header));
+
+        previous_buffer = static_cast<std::ostream&>(stream).rdbuf(&buffer);
+        thread = std::thread(&FrameCompressor::compressor_loop, this);
+    }
+
+    FrameCompressor::~FrameCompressor()
+    {
+        try {
+            finish();
+        } catch (FormatError&) {}
+    }
+
+    void FrameCompressor::write(const void *bytes, size_t count)
+    {
+        if (file->sputn(reinterpret_cast<const char*>(bytes), count) != std::streamsize(count))
+            throw FormatError("Could not write the compressed output");
+    }
+
+    /** Keeps going after a failure only to empty the queue,
+     *  so that nobody waits on it forever
+     */
+    void FrameCompressor::compressor_loop()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        for (;;) {
+            while (!stopping && pending.empty())
+                queued.wait(guard);
+            if (pending.empty()) return;
+
+            job next;
+            std::swap(next, pending.front());
+            pending.pop_front();
+
+            if (!failed) {
+                guard.unlock();
+                try {
+                    if (next.flush) {
+                        write_chunk();
+                        if (file->pubsync() != 0)
+                            throw FormatError("Could not write the compressed output");
+                    } else {
+                        add_frame(next.frame);
+                        if (chunk_count == chunk_frames) write_chunk();
+                    }
+                } catch (FormatError&) {
+                    guard.lock();
+                    failed = true;
+                    guard.unlock();
+                }
+                guard.lock();
+            }
+
+            // The frame before the one compressed is left for the next frames
+            ++done;
+            if (spare.size() < 2 && next.frame.bytes.capacity() > 0) {
+                spare.push_back(std::vector<char>());
+                spare.back().swap(next.frame.bytes);
+            }
+            written.notify_all();
+        }
+    }
+
+    /** The frame is XORed with the end of the one before,
+     *  which lines up the fixed size frames following a
+     *  header, and split into the planes of the bytes of
+     *  every double in one pass
+     */
+    void FrameCompressor::add_frame(written_frame &frame)
+    {
+        ScopedTimer timer(PHASE_COMPRESSION);
+
+        if (chunk_count == 0) {
+            chunk_header header;
+            memset(&header, 0, sizeof(header));
+            chunk_start = file->pubseekoff(0, std::ios_base::cur, std::ios_base::out);
+            write(&header, sizeof(header));
+            previous.clear();
+        }
+
+        size_t length = frame.bytes.size();
+        size_t shift = previous.size() >= length ? previous.size() - length : 0;
+        size_t missing = previous.size() >= length ? 0 : length - previous.size();
+
+        transformed.resize(length);
+        size_t out = 0;
+        for (size_t plane = 0; plane < 8; ++plane) {
+            for (size_t index = plane; index < length; index += 8) {
+                char reference = index < missing ? 0 : previous[index + shift - missing];
+                transformed[out++] = frame.bytes[index] ^ reference;
+            }
+        }
+
+        packed.clear();
+        pack_bytes(length > 0 ? &transformed[0] : NULL, length, packed);
+
+        frame_entry entry;
+        entry.offset = frame.offset;
+        entry.length = length;
+        entry.packed_size = packed.size();
+        entry.patches_size = frame.patches.size();
+        write(&entry, sizeof(entry));
+        if (!packed.empty()) write(&packed[0], packed.size());
+        if (!frame.patches.empty()) write(&frame.patches[0], frame.patches.size());
+
+        previous.swap(frame.bytes);
+        ++chunk_count;
+    }
+
+    void FrameCompressor::write_chunk()
+    {
+        if (chunk_count == 0) return;
+
+        std::streamoff end = file->pubseekoff(0, std::ios_base::cur, std::ios_base::out);
+        chunk_header header;
+        memcpy(header.magic, "CHNK", sizeof(header.magic));
+        header.frames = chunk_count;
+        header.size = end - chunk_start - sizeof(header);
+
+        if (file->pubseekpos(chunk_start, std::ios_base::out) != chunk_start)
+            throw FormatError("Could not write the compressed output");
+        write(&header, sizeof(header));
+        if (file->pubseekpos(end, std::ios_base::out) != end)
+            throw FormatError("Could not write the compressed output");
+        chunk_count = 0;
+    }
+
+    void FrameCompressor::check_failure()
+    {
+        if (failed) throw FormatError("Could not write the compressed output");
+    }
+
+    void FrameCompressor::push(job &next)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        check_failure();
+
+        if (pushed - done >= 2) {
+            ScopedTimer timer(PHASE_OUTPUT_STALL);
+            while (pushed - done >= 2)
+                written.wait(guard);
+        }
+
+        pending.push_back(job());
+        std::swap(pending.back(), next);
+        ++pushed;
+        queued.notify_one();
+    }
+
+    void FrameCompressor::end_frame()
+    {
+        job next(false);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if (!spare.empty()) {
+                next.frame.bytes.swap(spare.back());
+                spare.pop_back();
+            }
+        }
+
+        buffer.take_frame(next.frame);
+        push(next);
+    }
+
+    void FrameCompressor::flush()
+    {
+        job next(true);
+        push(next);
+
+        std::unique_lock<std::mutex> guard(lock);
+        while (done < pushed)
+            written.wait(guard);
+        check_failure();
+    }
+
+    /** The last jobs are queued without waiting, so that
+     *  the thread is always joined
+     */
+    void FrameCompressor::finish()
+    {
+        if (finished) return;
+        finished = true;
+
+        stream.flush();
+        job last(false), closing(true);
+        buffer.take_frame(last.frame);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            if (!last.frame.bytes.empty() || !last.frame.patches.empty()) {
+                pending.push_back(last);
+                ++pushed;
+            }
+            pending.push_back(closing);
+            ++pushed;
+            stopping = true;
+        }
+        queued.notify_one();
+        thread.join();
+
+        static_cast<std::ostream&>(stream).rdbuf(previous_buffer);
+        check_failure();
+    }
+
+    /* ****             CompressedReader            **** */
+
+    CompressedReader::CompressedReader(std::string filename) :
+        input(filename.c_str(), std::ios::binary), filename(filename), frames(0)
+    {
+        compressed_header header;
+        input.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!input)
+            throw FormatError("Could not read " + filename);
+        if (memcmp(header.magic, compressed_magic, sizeof(header.magic)) != 0)
+            throw FormatError(filename + " is not a compressed output");
+        if (header.byte_order != binary_byte_order)
+            throw FormatError(filename + " was written with a different byte order");
+        if (header.version != compressed_version)
+            throw FormatError(filename + " has an unknown version");
+
+        input.seekg(0, std::ios::end);
+        uint64_t file_length = input.tellg();
+
+        // A chunk cut short has a zero header, or ends past the file
+        uint64_t offset = sizeof(header);
+        for (;;) {
+            chunk_header chunk;
+            input.seekg(offset);
+            input.read(reinterpret_cast<char*>(&chunk), sizeof(chunk));
+            if (!input || memcmp(chunk.magic, "CHNK", sizeof(chunk.magic)) != 0 ||
+                    offset + sizeof(chunk) + chunk.size > file_length)
+                break;
+
+            chunk_info info = {offset + sizeof(chunk), frames, chunk.frames};
+            chunks.push_back(info);
+            frames += chunk.frames;
+            offset += sizeof(chunk) + chunk.size;
+        }
+        input.clear();
+    }
+
+    void CompressedReader::read_chunk(size_t chunk, const std::function<bool(
+                const frame_entry&, const std::vector<char>&, const std::vector<char>&)> &visit)
+    {
+        std::vector<char> previous, bytes, packed, transformed, patches;
+        input.seekg(chunks[chunk].offset);
+
+        for (size_t frame = 0; frame < chunks[chunk].frames; ++frame) {
+            frame_entry entry;
+            input.read(reinterpret_cast<char*>(&entry), sizeof(entry));
+            packed.resize(entry.packed_size);
+            transformed.resize(entry.length);
+            patches.resize(entry.patches_size);
+            if (!input.read(packed.data(), packed.size()) ||
+                    !input.read(patches.data(), patches.size()) ||
+                    !unpack_bytes(packed, transformed.data(), transformed.size()))
+                throw FormatError(filename + " has a damaged chunk");
+
+            size_t length = entry.length;
+            size_t shift = previous.size() >= length ? previous.size() - length : 0;
+            size_t missing = previous.size() >= length ? 0 : length - previous.size();
+
+            bytes.resize(length);
+            size_t in = 0;
+            for (size_t plane = 0; plane < 8; ++plane) {
+                for (size_t index = plane; index < length; index += 8) {
+                    char reference = index < missing ? 0 : previous[index + shift - missing];
+                    bytes[index] = transformed[in++] ^ reference;
+                }
+            }
+
+            if (!visit(entry, bytes, patches)) return;
+            previous.swap(bytes);
+        }
+    }
+
+    std::vector<char> CompressedReader::get_frame(size_t frame, uint64_t *offset)
+    {
+        if (frame >= frames)
+            throw IllegalValue("There is no such frame in " + filename);
+
+        size_t chunk = 0;
+        while (chunk + 1 < chunks.size() && chunks[chunk + 1].first_frame <= frame)
+            ++chunk;
+
+        std::vector<char> result;
+        size_t remaining = frame - chunks[chunk].first_frame;
+        read_chunk(chunk, [&](const frame_entry &entry, const std::vector<char> &bytes,
+                    const std::vector<char>&) {
+                if (remaining-- > 0) return true;
+                result = bytes;
+                if (offset != NULL) *offset = entry.offset;
+                return false;
+            });
+        return result;
+    }
+
+    /** The patches of a frame only write over the frames
+     *  before it, so they are applied right after it
+     */
+    void CompressedReader::decompress(std::ostream &output)
+    {
+        for (size_t chunk = 0; chunk < chunks.size(); ++chunk) {
+            read_chunk(chunk, [&](const frame_entry &entry, const std::vector<char> &bytes,
+                        const std::vector<char> &patches) {
+                    output.seekp(entry.offset);
+                    output.write(bytes.data(), bytes.size());
+
+                    size_t at = 0;
+                    while (at + sizeof(patch_header) <= patches.size()) {
+                        patch_header patch;
+                        memcpy(&patch, &patches[at], sizeof(patch));
+                        at += sizeof(patch);
+                        if (at + patch.length > patches.size())
+                            throw FormatError(filename + " has a damaged chunk");
+                        output.seekp(patch.offset);
+                        output.write(&patches[at], patch.length);
+                        at += patch.length;
+                    }
+                    output.seekp(0, std::ios::end);
+                    return true;
+                });
+        }
+        if (!output)
+            throw FormatError("Could not write the decompressed output");
+    }
+}
@@ -0,0 +1,86 @@
+#include "Convergence.hpp"
+
+#include <cmath>
+
+namespace PUMA {
+
+    ConvergenceMonitor::ConvergenceMonitor(double steady_tolerance,
+            double period_tolerance, size_t cycles) :
+        steady_tolerance(steady_tolerance), period_tolerance(period_tolerance),
+        cycles(cycles > 0 ? cycles : 1), samples(0)
+    {
+        result.reason = NOT_CONVERGED;
+        result.action = 0;
+        result.step = 0;
+        result.period = 0.0;
+    }
+
+    bool ConvergenceMonitor::closes_orbit()
+    {
+        if (peaks.size() < cycles + 1) return false;
+
+        const peak &last = peaks.back();
+        double period = (last.time - peaks[peaks.size() - cycles - 1].time) / cycles;
+        if (!(period > 0.0)) return false;
+
+        for (size_t index = peaks.size() - cycles; index < peaks.size(); ++index) {
+            const peak &before = peaks[index - 1], &current = peaks[index];
+            if (std::fabs(current.time - before.time - period) > period_tolerance * period)
+                return false;
+            if (std::fabs(before.hares - last.hares) > period_tolerance * std::fabs(last.hares) ||
+                    std::fabs(before.pumas - last.pumas) > period_tolerance * std::fabs(last.pumas))
+                return false;
+        }
+
+        result.period = period;
+        return true;
+    }
+
+    bool ConvergenceMonitor::add(uint64_t step, double dt, const density_statistics &statistics)
+    {
+        if (converged()) return false;
+
+        if (steady_tolerance > 0.0 && statistics.largest_change >= 0.0 &&
+                statistics.largest_change <= steady_tolerance * dt) {
+            result.reason = STEADY_STATE;
+            result.step = step;
+            return true;
+        }
+
+        if (period_tolerance <= 0.0) return false;
+
+        if (samples == 3) {
+            for (int index = 0; index < 2; ++index) {
+                times[index] = times[index + 1];
+                hares[index] = hares[index + 1];
+                pumas[index] = pumas[index + 1];
+            }
+            --samples;
+        }
+        times[samples] = step * dt;
+        hares[samples] = statistics.hares.mean;
+        pumas[samples] = statistics.pumas.mean;
+        if (++samples < 3) return false;
+
+        // The middle sample is a maximum, refined by a parabola through the three
+        if (!(hares[1] > hares[0] && hares[1] >= hares[2])) return false;
+
+        double curvature = hares[0] - 2 * hares[1] + hares[2];
+        double offset = curvature != 0.0 ? 0.5 * (hares[0] - hares[2]) / curvature : 0.0;
+        double spacing = times[2] - times[1];
+
+        peak maximum;
+        maximum.time = times[1] + offset * spacing;
+        maximum.hares = hares[1] - 0.25 * (hares[0] - hares[2]) * offset;
+        maximum.pumas = pumas[1] + 0.5 * offset * (pumas[2] - pumas[0])
+            + 0.5 * offset * offset * (pumas[0] - 2 * pumas[1] + pumas[2]);
+        peaks.push_back(maximum);
+        if (peaks.size() > cycles + 1) peaks.erase(peaks.begin());
+
+        if (!closes_orbit()) return false;
+
+        result.reason = PERIODIC_ORBIT;
+        result.step = step;
+        return true;
+    }
+}
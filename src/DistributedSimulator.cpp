@@ -0,0 +1,511 @@
+#include "DistributedSimulator.hpp"
+#include "exceptions.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace PUMA {
+
+    /// Commands rank 0 sends to the others
+    enum { STEP, GATHER, SCATTER, STOP };
+
+    /// Sides of a block, in the order its edges are stored
+    enum { NORTH, SOUTH, WEST, EAST };
+
+    /** The ranks meet at a barrier of their own rather than
+     *  a pthread one, as it has to be broken when a rank fails:
+     *  every rank waiting at it or reaching it then gives up
+     *  instead of waiting forever for the failed one. The ranks
+     *  only sleep on semaphores, which unlike the mutexes and
+     *  condition variables are left usable by a process dying
+     *  while waiting on them.
+     */
+    struct DistributedSimulator::control {
+        /// Ranks at the barrier, and number of barriers passed
+        std::atomic<size_t> waiting, generation;
+
+        /// Set once a rank failed, for good
+        std::atomic<int> broken;
+
+        /** Opened by the last rank reaching the barrier, by the
+         *  parity of the generation, so that a rank already at
+         *  the next barrier cannot take the place of a rank still
+         *  leaving this one
+         */
+        sem_t gates[2];
+
+        int command;
+        size_t steps;
+        step_parameters params;
+    };
+
+    /** The padded densities of a block, the halo holding the
+     *  edges of the neighbours, or water at the edges of the map
+     */
+    struct DistributedSimulator::local_block {
+        size_t stride;
+        std::vector<unsigned char> cells;
+        std::vector<double> hare[2], puma[2];
+        int current;
+    };
+
+    /** Ranks 1 and above are forked here, before rank 0 has
+     *  allocated its own block, so every process only ever
+     *  touches the memory of its block
+     */
+    DistributedSimulator::DistributedSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+            size_t ranks, boost::shared_ptr<const Topology> topology) :
+        Simulator(dim_x, dim_y, land_map, topology), ranks(ranks),
+        shared(NULL), shared_size(0), commands(NULL), frame(NULL),
+        gathered(true), steps_done(0), local(NULL),
+        kernel(&best_kernel<double_precision>())
+    {
+        temp_state.reset();
+        decompose();
+
+        // The control block, the two slots of edges of every rank, then the frame
+        size_t offset = (sizeof(control) + 63) / 64 * 64;
+        for (size_t rank = 0; rank < ranks; ++rank) {
+            edge_offset.push_back(offset);
+            offset += 2 * 2 * (2 * blocks[rank].width + 2 * blocks[rank].height) * sizeof(double);
+        }
+        size_t frame_offset = offset;
+        shared_size = frame_offset + 2 * size_x * size_y * sizeof(double);
+
+        void *segment = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (segment == MAP_FAILED)
+            throw SystemError("Could not map the memory shared by the ranks");
+        shared = static_cast<char*>(segment);
+        frame = reinterpret_cast<double*>(shared + frame_offset);
+
+        commands = new (shared) control();
+        for (int parity = 0; parity < 2; ++parity)
+            sem_init(&commands->gates[parity], 1, 0);
+
+        pid_t parent = getpid();
+        for (size_t rank = 1; rank < ranks; ++rank) {
+            pid_t child = fork();
+            if (child == 0) {
+                // The rank would wait forever for a dead rank 0
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                if (getppid() != parent) _exit(1);
+                try {
+                    serve(rank);
+                } catch (...) {
+                }
+                // The other ranks would wait for this one forever
+                fail_ranks();
+                _exit(1);
+            }
+
+            if (child < 0) {
+                // The barrier can no longer be passed, the children are killed
+                for (size_t index = 0; index < children.size(); ++index) {
+                    kill(children[index], SIGKILL);
+                    waitpid(children[index], NULL, 0);
+                }
+                children.clear();
+                for (int parity = 0; parity < 2; ++parity)
+                    sem_destroy(&commands->gates[parity]);
+                munmap(shared, shared_size);
+                throw SystemError("Could not start the ranks");
+            }
+            children.push_back(child);
+        }
+
+        local = new local_block;
+        try {
+            scatter_state();
+        } catch (...) {
+            shutdown();
+            delete local;
+            throw;
+        }
+    }
+
+    DistributedSimulator::~DistributedSimulator()
+    {
+        shutdown();
+        delete local;
+    }
+
+    void DistributedSimulator::shutdown()
+    {
+        if (!shared) return;
+
+        try {
+            execute(STOP, 0);
+        } catch (SystemError&) {
+            // The ranks still running may be in the middle of a command
+            for (size_t index = 0; index < children.size(); ++index)
+                kill(children[index], SIGKILL);
+        }
+        for (size_t index = 0; index < children.size(); ++index)
+            waitpid(children[index], NULL, 0);
+
+        for (int parity = 0; parity < 2; ++parity)
+            sem_destroy(&commands->gates[parity]);
+        munmap(shared, shared_size);
+        shared = NULL;
+    }
+
+    bool DistributedSimulator::rank_died()
+    {
+        for (size_t index = 0; index < children.size(); ++index) {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_PID, children[index], &info, WEXITED | WNOHANG | WNOWAIT) == 0 &&
+                    info.si_pid != 0)
+                return true;
+        }
+        return false;
+    }
+
+    /// Opens both gates to every rank, which then see the barrier broken
+    void DistributedSimulator::fail_ranks()
+    {
+        commands->broken = 1;
+        for (int parity = 0; parity < 2; ++parity) {
+            for (size_t rank = 0; rank < ranks; ++rank)
+                sem_post(&commands->gates[parity]);
+        }
+    }
+
+    /** Rank 0 only waits a tenth of a second at a time, looking
+     *  in between for ranks that died without breaking the
+     *  barrier, killed for instance
+     */
+    void DistributedSimulator::synchronize(size_t rank)
+    {
+        // The generation only changes once this rank has arrived
+        sem_t *gate = &commands->gates[commands->generation % 2];
+        if (!commands->broken && ++commands->waiting == ranks) {
+            commands->waiting = 0;
+            ++commands->generation;
+            for (size_t other = 1; other < ranks; ++other)
+                sem_post(gate);
+            return;
+        }
+
+        while (!commands->broken) {
+            if (rank != 0) {
+                if (sem_wait(gate) == 0) break;
+                continue;
+            }
+
+            timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 100000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_nsec -= 1000000000;
+                ++deadline.tv_sec;
+            }
+            if (sem_timedwait(gate, &deadline) == 0) break;
+            if (errno == ETIMEDOUT && rank_died()) fail_ranks();
+        }
+
+        if (!commands->broken) return;
+        if (rank != 0) _exit(1);
+        throw SystemError("A rank of the distributed engine failed");
+    }
+
+    /** Picks the grid of blocks with the shortest edges, so
+     *  that the least data goes through the halos
+     */
+    void DistributedSimulator::decompose()
+    {
+        if (ranks == 0)
+            throw IllegalValue("At least one rank is needed");
+
+        blocks_x = 0;
+        size_t best = 0;
+        for (size_t x = 1; x <= ranks; ++x) {
+            size_t y = ranks / x;
+            if (x * y != ranks || x > size_x || y > size_y) continue;
+
+            size_t edges = x * size_y + y * size_x;
+            if (blocks_x == 0 || edges < best) {
+                blocks_x = x;
+                best = edges;
+            }
+        }
+        if (blocks_x == 0)
+            throw IllegalValue("The map is too small to be split between the ranks");
+        blocks_y = ranks / blocks_x;
+
+        for (size_t y = 0; y < blocks_y; ++y) {
+            for (size_t x = 0; x < blocks_x; ++x) {
+                block next;
+                next.x0 = x * (size_x / blocks_x) + std::min(x, size_x % blocks_x);
+                next.width = size_x / blocks_x + (x < size_x % blocks_x ? 1 : 0);
+                next.y0 = y * (size_y / blocks_y) + std::min(y, size_y % blocks_y);
+                next.height = size_y / blocks_y + (y < size_y % blocks_y ? 1 : 0);
+
+                next.north = y > 0 ? (y - 1) * blocks_x + x : -1;
+                next.south = y + 1 < blocks_y ? (y + 1) * blocks_x + x : -1;
+                next.west = x > 0 ? y * blocks_x + x - 1 : -1;
+                next.east = x + 1 < blocks_x ? y * blocks_x + x + 1 : -1;
+                blocks.push_back(next);
+            }
+        }
+    }
+
+    /** The hare densities of the edge are followed by the
+     *  puma ones
+     */
+    double* DistributedSimulator::edge(size_t rank, size_t slot, int side)
+    {
+        size_t width = blocks[rank].width, height = blocks[rank].height;
+        size_t sides[4] = {0, 2 * width, 4 * width, 4 * width + 2 * height};
+
+        double *first = reinterpret_cast<double*>(shared + edge_offset[rank]);
+        return first + slot * 2 * (2 * width + 2 * height) + sides[side];
+    }
+
+    void DistributedSimulator::serve(size_t rank)
+    {
+        local = new local_block;
+        while (true) {
+            synchronize(rank);
+            if (commands->command == STOP) _exit(0);
+
+            // Rank 0 may post the next command while this one finishes
+            step_parameters params = commands->params;
+            run_command(rank, commands->command, commands->steps, params);
+        }
+    }
+
+    void DistributedSimulator::execute(int command, size_t steps)
+    {
+        commands->command = command;
+        commands->steps = steps;
+        commands->params = get_parameters();
+        synchronize(0);
+        if (command == STOP) return;
+
+        try {
+            run_command(0, command, steps, commands->params);
+        } catch (...) {
+            fail_ranks();
+            throw;
+        }
+    }
+
+    /** Gathering and scattering end with a barrier, so that
+     *  rank 0 can use the frame as soon as they return
+     */
+    void DistributedSimulator::run_command(size_t rank, int command, size_t steps,
+            const step_parameters &params)
+    {
+        const block &area = blocks[rank];
+        local_block &state = *local;
+
+        if (command == STEP) {
+            for (size_t step = 0; step < steps; ++step)
+                step_block(rank, params);
+        } else if (command == GATHER) {
+            for (size_t j = 0; j < area.height; ++j) {
+                size_t from = (j + 1) * state.stride + 1;
+                size_t to = (area.y0 + j) * size_x + area.x0;
+                memcpy(&frame[to], &state.hare[state.current][from], area.width * sizeof(double));
+                memcpy(&frame[size_x * size_y + to], &state.puma[state.current][from],
+                        area.width * sizeof(double));
+            }
+            synchronize(rank);
+        } else if (command == SCATTER) {
+            // The block is built on the first scatter, by the process owning it
+            size_t padded_size = (area.width + 2) * (area.height + 2);
+            if (state.cells.empty()) {
+                state.stride = area.width + 2;
+                state.current = 0;
+                state.cells.resize(padded_size);
+                for (size_t y = 0; y < area.height + 2; ++y) {
+                    memcpy(&state.cells[y * state.stride],
+                            &topology->cells[(area.y0 + y) * topology->stride + area.x0],
+                            state.stride);
+                }
+            }
+            for (int buffer = 0; buffer < 2; ++buffer) {
+                state.hare[buffer].assign(padded_size, 0.0);
+                state.puma[buffer].assign(padded_size, 0.0);
+            }
+
+            // The halo is read straight from the frame, water staying empty
+            for (size_t y = 0; y < area.height + 2; ++y) {
+                for (size_t x = 0; x < area.width + 2; ++x) {
+                    size_t index = y * state.stride + x;
+                    if (!(state.cells[index] & Topology::LAND)) continue;
+
+                    size_t cell = (area.y0 + y - 1) * size_x + area.x0 + x - 1;
+                    state.hare[state.current][index] = frame[cell];
+                    state.puma[state.current][index] = frame[size_x * size_y + cell];
+                }
+            }
+            synchronize(rank);
+        }
+    }
+
+    /** The edges are computed and published first, the inside
+     *  of the block being computed while the neighbours are
+     *  still busy with theirs
+     */
+    void DistributedSimulator::step_block(size_t rank, const step_parameters &params)
+    {
+        const block &area = blocks[rank];
+        local_block &state = *local;
+        size_t width = area.width, height = area.height, stride = state.stride;
+        int last = state.current, next = 1 - state.current;
+
+        auto run = [&](size_t x, size_t y, size_t count) {
+            size_t index = y * stride + x;
+            kernel->step(&state.hare[last][index], &state.puma[last][index],
+                    &state.cells[index], &state.hare[next][index], &state.puma[next][index],
+                    count, stride, params);
+        };
+
+        run(1, 1, width);
+        if (height > 1) run(1, height, width);
+        for (size_t y = 2; y < height; ++y) {
+            run(1, y, 1);
+            if (width > 1) run(width, y, 1);
+        }
+
+        size_t slot = steps_done % 2;
+        {
+            ScopedTimer timer(PHASE_HALO);
+            const double *hare = &state.hare[next][0], *puma = &state.puma[next][0];
+            double *north = edge(rank, slot, NORTH), *south = edge(rank, slot, SOUTH);
+            double *west = edge(rank, slot, WEST), *east = edge(rank, slot, EAST);
+            memcpy(north, hare + stride + 1, width * sizeof(double));
+            memcpy(north + width, puma + stride + 1, width * sizeof(double));
+            memcpy(south, hare + height * stride + 1, width * sizeof(double));
+            memcpy(south + width, puma + height * stride + 1, width * sizeof(double));
+            for (size_t y = 1; y <= height; ++y) {
+                west[y - 1] = hare[y * stride + 1];
+                west[height + y - 1] = puma[y * stride + 1];
+                east[y - 1] = hare[y * stride + width];
+                east[height + y - 1] = puma[y * stride + width];
+            }
+        }
+
+        if (width > 2) {
+            for (size_t y = 2; y < height; ++y)
+                run(2, y, width - 2);
+        }
+
+        ScopedTimer timer(PHASE_HALO);
+        synchronize(rank);
+
+        double *hare_out = &state.hare[next][0], *puma_out = &state.puma[next][0];
+        if (area.north >= 0) {
+            const double *from = edge(area.north, slot, SOUTH);
+            memcpy(hare_out + 1, from, width * sizeof(double));
+            memcpy(puma_out + 1, from + width, width * sizeof(double));
+        }
+        if (area.south >= 0) {
+            const double *from = edge(area.south, slot, NORTH);
+            memcpy(hare_out + (height + 1) * stride + 1, from, width * sizeof(double));
+            memcpy(puma_out + (height + 1) * stride + 1, from + width, width * sizeof(double));
+        }
+        if (area.west >= 0) {
+            const double *from = edge(area.west, slot, EAST);
+            for (size_t y = 1; y <= height; ++y) {
+                hare_out[y * stride] = from[y - 1];
+                puma_out[y * stride] = from[height + y - 1];
+            }
+        }
+        if (area.east >= 0) {
+            const double *from = edge(area.east, slot, WEST);
+            for (size_t y = 1; y <= height; ++y) {
+                hare_out[y * stride + width + 1] = from[y - 1];
+                puma_out[y * stride + width + 1] = from[height + y - 1];
+            }
+        }
+
+        state.current = next;
+        ++steps_done;
+    }
+
+    void DistributedSimulator::gather_state()
+    {
+        if (gathered) return;
+
+        execute(GATHER, 0);
+        for (size_t index = 0; index < size_x * size_y; ++index) {
+            current_state[index].hare_density = frame[index];
+            current_state[index].puma_density = frame[size_x * size_y + index];
+        }
+        gathered = true;
+    }
+
+    void DistributedSimulator::scatter_state()
+    {
+        for (size_t index = 0; index < size_x * size_y; ++index) {
+            frame[index] = current_state[index].hare_density;
+            frame[size_x * size_y + index] = current_state[index].puma_density;
+        }
+        execute(SCATTER, 0);
+        gathered = true;
+    }
+
+    /** The blocks are no longer gathered even if the step
+     *  fails, so that nothing reads the state from then on
+     */
+    void DistributedSimulator::step()
+    {
+        gathered = false;
+        execute(STEP, 1);
+    }
+
+    void DistributedSimulator::apply_steps(size_t steps)
+    {
+        if (steps == 0) return;
+
+        statistics_fresh = false;
+        if (!tracking) {
+            gathered = false;
+            execute(STEP, steps);
+            return;
+        }
+
+        if (steps > 1) {
+            gathered = false;
+            execute(STEP, steps - 1);
+        }
+        apply_step();
+    }
+
+    /** The statistics are collected from the gathered frames
+     *  before and after the step
+     */
+    void DistributedSimulator::collecting_step()
+    {
+        // Only the steps collecting the statistics need a previous state
+        if (!temp_state) temp_state.reset(new landscape[size_x * size_y]);
+        gather_state();
+        std::copy(current_state.get(), current_state.get() + size_x * size_y,
+                temp_state.get());
+
+        step();
+        gather_state();
+        collect_changed_rows();
+    }
+
+    void DistributedSimulator::refresh_statistics()
+    {
+        if (!statistics_fresh) gather_state();
+        Simulator::refresh_statistics();
+    }
+}
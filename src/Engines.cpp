@@ -0,0 +1,177 @@
+#include "Engines.hpp"
+#include "DistributedSimulator.hpp"
+#include "HaloSimulator.hpp"
+#include "Integrators.hpp"
+#include "IslandSimulator.hpp"
+#include "SoASimulator.hpp"
+#include "SparseSimulator.hpp"
+#include "TiledSimulator.hpp"
+
+namespace PUMA {
+
+    /// Creates engines that only compute in double precision
+    template <typename T>
+    Simulator* create_engine(size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings)
+    {
+        if (settings.precision != "double")
+            throw IllegalValue("Precision " + settings.precision
+                    + " is not supported by this engine");
+        return new T(dim_x, dim_y, land_map, settings.topology);
+    }
+
+    /// Creates the template T of an engine in the requested precision
+    template <template <class> class T>
+    Simulator* create_basic(size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings)
+    {
+        if (settings.precision == double_precision::name())
+            return new T<double_precision>(dim_x, dim_y, land_map, settings.topology);
+        if (settings.precision == single_precision::name())
+            return new T<single_precision>(dim_x, dim_y, land_map, settings.topology);
+        if (settings.precision == mixed_precision::name())
+            return new T<mixed_precision>(dim_x, dim_y, land_map, settings.topology);
+
+        throw IllegalValue("Precision " + settings.precision + " is not known");
+    }
+
+    template <class Precision>
+    Simulator* create_tiled(size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings)
+    {
+        BasicTiledSimulator<Precision> *simulator =
+            new BasicTiledSimulator<Precision>(dim_x, dim_y, land_map,
+                    settings.topology);
+        simulator->tile_width = settings.tile_width;
+        simulator->tile_height = settings.tile_height;
+        simulator->block_steps = settings.block_steps;
+        return simulator;
+    }
+
+    Simulator* create_tiled(size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings)
+    {
+        if (settings.precision == double_precision::name())
+            return create_tiled<double_precision>(dim_x, dim_y, land_map, settings);
+        if (settings.precision == single_precision::name())
+            return create_tiled<single_precision>(dim_x, dim_y, land_map, settings);
+        if (settings.precision == mixed_precision::name())
+            return create_tiled<mixed_precision>(dim_x, dim_y, land_map, settings);
+
+        throw IllegalValue("Precision " + settings.precision + " is not known");
+    }
+
+    Simulator* create_distributed(size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings)
+    {
+        if (settings.precision != "double")
+            throw IllegalValue("Precision " + settings.precision
+                    + " is not supported by this engine");
+        return new DistributedSimulator(dim_x, dim_y, land_map, settings.ranks,
+                settings.topology);
+    }
+
+    /** Uses the sparse engine on maps with little land
+     *  and the dense one otherwise
+     */
+    Simulator* create_auto(size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings)
+    {
+        size_t land_cells = 0;
+        for (size_t index = 0; index < dim_x * dim_y; ++index)
+            if (land_map[index]) ++land_cells;
+
+        if (land_cells < settings.sparse_threshold * dim_x * dim_y)
+            return create_basic<BasicSparseSimulator>(dim_x, dim_y, land_map, settings);
+        else
+            return create_basic<BasicSoASimulator>(dim_x, dim_y, land_map, settings);
+    }
+
+    const std::list<Engine>& available_engines()
+    {
+        static std::list<Engine> engines;
+
+        if (engines.empty()) {
+            Engine automatic = {"auto",
+                "Picks sparse on maps with less land than the sparse "
+                "threshold and soa otherwise",
+                create_auto};
+            engines.push_back(automatic);
+
+            Engine reference = {"reference",
+                "The original implementation, looking up every "
+                "neighbour through a bounds-checked accessor",
+                create_engine<Simulator>};
+            engines.push_back(reference);
+
+            Engine halo = {"halo",
+                "Keeps the state surrounded by a border of water cells, "
+                "so that neighbours are read without any checks",
+                create_engine<HaloSimulator>};
+            engines.push_back(halo);
+
+            Engine soa = {"soa",
+                "Keeps hares, pumas and the land mask in separate arrays, "
+                "stepped by SIMD kernels (AVX2/SSE2, see PUMA_ISA)",
+                create_basic<BasicSoASimulator>};
+            engines.push_back(soa);
+
+            Engine sparse = {"sparse",
+                "Steps only the spans of land cells with the soa kernels, "
+                "taking time proportional to the land area",
+                create_basic<BasicSparseSimulator>};
+            engines.push_back(sparse);
+
+            Engine tiled = {"tiled",
+                "Advances cache-sized tiles of the soa state many steps "
+                "at a time, for maps larger than the caches",
+                create_tiled};
+            engines.push_back(tiled);
+
+            Engine islands = {"islands",
+                "Steps every island of the map in a subgrid of its own, "
+                "the islands being spread over the threads",
+                create_basic<BasicIslandSimulator>};
+            engines.push_back(islands);
+
+            Engine distributed = {"distributed",
+                "Splits the map into blocks stepped by separate processes, "
+                "exchanging their edges through shared memory (see --ranks)",
+                create_distributed};
+            engines.push_back(distributed);
+        }
+
+        return engines;
+    }
+
+    Simulator* create_simulator(std::string name, 
+            size_t dim_x, size_t dim_y, bool *land_map,
+            const engine_settings &settings)
+    {
+        const std::list<Engine> &engines = available_engines();
+        for (std::list<Engine>::const_iterator it = engines.begin();
+                it != engines.end(); ++it) {
+            if (it->name != name) continue;
+            if (settings.integrator == "euler")
+                return it->create(dim_x, dim_y, land_map, settings);
+
+            // The other integrators work on the soa layout
+            if ((name != "soa" && name != "auto") || settings.precision != "double") {
+                throw IllegalValue("Integrator " + settings.integrator
+                        + " is only supported by the soa engine in double precision");
+            }
+            IntegratorSimulator *simulator = new IntegratorSimulator(dim_x, dim_y,
+                    land_map, settings.topology);
+            try {
+                simulator->set_integrator(settings.integrator);
+            } catch (...) {
+                delete simulator;
+                throw;
+            }
+            simulator->tolerance = settings.tolerance;
+            return simulator;
+        }
+
+        throw EngineNotFound("Engine " + name + " is not found");
+    }
+}
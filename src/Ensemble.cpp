@@ -0,0 +1,373 @@
+#include "Ensemble.hpp"
+#include "BatchSimulator.hpp"
+#include "InitialState.hpp"
+#include "Topology.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <boost/scoped_ptr.hpp>
+
+namespace PUMA {
+
+    /* ****             parse_sweep                 **** */
+
+    /// Sets a parameter given by its name
+    static void set_parameter(ensemble_member &member, std::string name, double value)
+    {
+        if (name == "r") member.parameters.r = value;
+        else if (name == "a") member.parameters.a = value;
+        else if (name == "b") member.parameters.b = value;
+        else if (name == "m") member.parameters.m = value;
+        else if (name == "k") member.parameters.k = value;
+        else if (name == "l") member.parameters.l = value;
+        else if (name == "dt")
+            throw IllegalValue("The timestep is shared by all the members, set it with --dt");
+        else if (name == "seed") member.seed = (uint64_t)value;
+        else throw IllegalValue("Unknown sweep parameter " + name);
+    }
+
+    static double parse_value(std::string text)
+    {
+        std::istringstream stream(text);
+        double value;
+        if (!(stream >> value) || !stream.eof())
+            throw IllegalValue("Invalid sweep value " + text);
+        return value;
+    }
+
+    /// Expands a START:STOP:STEP range, or reads a single value
+    static void parse_values(std::string text, std::vector<double> &values)
+    {
+        size_t first = text.find(':');
+        if (first == std::string::npos) {
+            values.push_back(parse_value(text));
+            return;
+        }
+
+        size_t second = text.find(':', first + 1);
+        if (second == std::string::npos)
+            throw IllegalValue("Invalid sweep range " + text);
+
+        double start = parse_value(text.substr(0, first));
+        double stop = parse_value(text.substr(first + 1, second - first - 1));
+        double step = parse_value(text.substr(second + 1));
+        if (step <= 0.0 || stop < start)
+            throw IllegalValue("Invalid sweep range " + text);
+
+        // Computed from the index, so that the rounding does not accumulate
+        size_t count = (size_t)std::floor((stop - start) / step + 1e-9) + 1;
+        for (size_t i = 0; i < count; ++i)
+            values.push_back(start + i * step);
+    }
+
+    std::vector<ensemble_member> parse_sweep(std::istream &spec,
+            const step_parameters &defaults, uint64_t seed)
+    {
+        ensemble_member base;
+        base.parameters = defaults;
+        base.seed = seed;
+
+        std::vector<std::string> names;
+        std::vector<std::vector<double> > grid;
+        std::vector<ensemble_member> members;
+
+        std::string line;
+        while (std::getline(spec, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream words(line);
+            std::string word;
+            if (!(words >> word)) continue;
+
+            if (word == "member") {
+                ensemble_member member = base;
+                while (words >> word) {
+                    size_t equals = word.find('=');
+                    if (equals == std::string::npos)
+                        throw IllegalValue("Invalid sweep member " + line);
+                    set_parameter(member, word.substr(0, equals),
+                            parse_value(word.substr(equals + 1)));
+                }
+                members.push_back(member);
+                continue;
+            }
+
+            std::string equals;
+            if (!(words >> equals) || equals != "=")
+                throw IllegalValue("Invalid sweep line " + line);
+
+            ensemble_member check = base;
+            set_parameter(check, word, 0.0);
+
+            std::vector<double> values;
+            while (words >> equals)
+                parse_values(equals, values);
+            if (values.empty())
+                throw IllegalValue("No values given for " + word);
+
+            names.push_back(word);
+            grid.push_back(values);
+        }
+
+        // Every combination of the grid, the last parameter changing fastest
+        if (!grid.empty()) {
+            std::vector<size_t> position(grid.size(), 0);
+            for (;;) {
+                ensemble_member member = base;
+                for (size_t i = 0; i < grid.size(); ++i)
+                    set_parameter(member, names[i], grid[i][position[i]]);
+                members.push_back(member);
+
+                size_t i = grid.size();
+                while (i > 0 && ++position[i - 1] == grid[i - 1].size())
+                    position[--i] = 0;
+                if (i == 0) break;
+            }
+        }
+
+        return members;
+    }
+
+    /* ****             ensemble_results            **** */
+
+    static const char ensemble_magic[8] = "PUMAENS";
+    static const uint32_t ensemble_byte_order = 0x01020304;
+    static const uint32_t ensemble_version = 1;
+
+    template <typename T>
+    static void write_raw(std::ostream &output, const T &value)
+    {
+        output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static void read_raw(std::istream &input, T &value)
+    {
+        if (!input.read(reinterpret_cast<char*>(&value), sizeof(value)))
+            throw FormatError("The ensemble results are truncated");
+    }
+
+    void ensemble_results::write(std::ostream &output) const
+    {
+        uint64_t samples = averages.empty() ? 0 : averages[0].size();
+
+        output.write(ensemble_magic, sizeof(ensemble_magic));
+        write_raw(output, ensemble_byte_order);
+        write_raw(output, ensemble_version);
+        write_raw(output, (uint64_t)members.size());
+        write_raw(output, samples);
+        write_raw(output, (uint64_t)sample_every);
+
+        for (size_t member = 0; member < members.size(); ++member) {
+            write_raw(output, members[member].parameters);
+            write_raw(output, members[member].seed);
+        }
+
+        for (size_t member = 0; member < averages.size(); ++member) {
+            for (size_t sample = 0; sample < averages[member].size(); ++sample) {
+                write_raw(output, averages[member][sample].first);
+                write_raw(output, averages[member][sample].second);
+            }
+        }
+    }
+
+    void ensemble_results::read(std::istream &input)
+    {
+        char magic[8];
+        uint32_t byte_order, version;
+        uint64_t member_count, samples, every;
+
+        if (!input.read(magic, sizeof(magic)) ||
+                memcmp(magic, ensemble_magic, sizeof(magic)) != 0)
+            throw FormatError("Not an ensemble results file");
+        read_raw(input, byte_order);
+        read_raw(input, version);
+        if (byte_order != ensemble_byte_order || version != ensemble_version)
+            throw FormatError("Unsupported ensemble results file");
+
+        read_raw(input, member_count);
+        read_raw(input, samples);
+        read_raw(input, every);
+        sample_every = every;
+
+        members.resize(member_count);
+        for (size_t member = 0; member < member_count; ++member) {
+            read_raw(input, members[member].parameters);
+            read_raw(input, members[member].seed);
+        }
+
+        averages.assign(member_count, std::vector<average_densities>(samples));
+        for (size_t member = 0; member < member_count; ++member) {
+            for (size_t sample = 0; sample < samples; ++sample) {
+                read_raw(input, averages[member][sample].first);
+                read_raw(input, averages[member][sample].second);
+            }
+        }
+    }
+
+    void ensemble_results::write_text(std::ostream &output) const
+    {
+        output << "# member seed r a b m k l dt step hares pumas\n";
+        output << std::setprecision(10);
+
+        for (size_t member = 0; member < averages.size(); ++member) {
+            const step_parameters &p = members[member].parameters;
+            for (size_t sample = 0; sample < averages[member].size(); ++sample) {
+                output << member << " " << members[member].seed << " "
+                    << p.r << " " << p.a << " " << p.b << " " << p.m << " "
+                    << p.k << " " << p.l << " " << p.dt << " "
+                    << sample * sample_every << " "
+                    << averages[member][sample].first << " "
+                    << averages[member][sample].second << "\n";
+            }
+        }
+    }
+
+    /* ****             EnsembleRunner              **** */
+
+    EnsembleRunner::EnsembleRunner(const land_map &map, std::string engine,
+            const engine_settings &settings) :
+        map(map), engine(engine), settings(settings)
+    {
+        // Its ranks would be forked from the threads running the members
+        if (engine == "distributed")
+            throw IllegalValue("The members of an ensemble cannot use the distributed engine");
+
+        if (!this->settings.topology) {
+            this->settings.topology.reset(new Topology(map.size_x, map.size_y,
+                        map.land.get()));
+        }
+    }
+
+    /// The batches of members not yet started by a thread
+    struct member_queue {
+        std::mutex lock;
+        std::deque<size_t> members;
+    };
+
+    ensemble_results EnsembleRunner::run(const std::vector<ensemble_member> &members,
+            size_t steps, size_t sample_every, size_t threads)
+    {
+        if (sample_every == 0)
+            throw IllegalValue("The averages have to be sampled every step or less often");
+        if (threads == 0)
+            throw IllegalValue("At least one thread is needed");
+
+        ensemble_results results;
+        results.sample_every = sample_every;
+        results.members = members;
+        results.averages.assign(members.size(),
+                std::vector<average_densities>(steps / sample_every + 1));
+
+        size_t batch_lanes = settings.batch_lanes > 1 ? settings.batch_lanes : 1;
+        if (batch_lanes > 1 && settings.precision != "double")
+            throw IllegalValue("Batches of members are only computed in double precision");
+        if (batch_lanes > 1 && settings.integrator != "euler")
+            throw IllegalValue("Batches of members are only computed with the euler integrator");
+        size_t batches = (members.size() + batch_lanes - 1) / batch_lanes;
+
+        // Neighbouring members usually cost the same, so they are dealt round robin
+        std::vector<member_queue> queues(threads);
+        for (size_t batch = 0; batch < batches; ++batch)
+            queues[batch % threads].members.push_back(batch);
+
+        std::mutex failure_lock;
+        std::exception_ptr failure;
+
+        /* A thread takes its own members from the front and
+         * steals from the back of the others, so the thieves
+         * and the owner rarely want the same member
+         */
+        auto next_batch = [&](size_t thread, size_t *batch) {
+            for (size_t i = 0; i < threads; ++i) {
+                member_queue &queue = queues[(thread + i) % threads];
+                std::unique_lock<std::mutex> guard(queue.lock);
+                if (queue.members.empty()) continue;
+
+                if (i == 0) {
+                    *batch = queue.members.front();
+                    queue.members.pop_front();
+                } else {
+                    *batch = queue.members.back();
+                    queue.members.pop_back();
+                }
+                return true;
+            }
+            return false;
+        };
+
+        auto run_member = [&](size_t member) {
+            const step_parameters &p = members[member].parameters;
+            boost::scoped_ptr<Simulator> simulation(create_simulator(engine,
+                        map.size_x, map.size_y, map.land.get(), settings));
+            simulation->r = p.r;
+            simulation->a = p.a;
+            simulation->b = p.b;
+            simulation->m = p.m;
+            simulation->k = p.k;
+            simulation->l = p.l;
+            simulation->dt = p.dt;
+            simulation->initialize(UniformDistribution(members[member].seed));
+
+            // Every sample ends with a step that sums the state on the way
+            simulation->track_statistics(true);
+
+            std::vector<average_densities> &averages = results.averages[member];
+            averages[0] = simulation->get_averages();
+            for (size_t sample = 1; sample < averages.size(); ++sample) {
+                simulation->apply_steps(sample_every);
+                averages[sample] = simulation->get_averages();
+            }
+        };
+
+        auto run_batch = [&](size_t first, size_t last) {
+            BatchSimulator simulation(map.size_x, map.size_y, map.land.get(),
+                    last - first, settings.topology);
+            for (size_t member = first; member < last; ++member) {
+                simulation.set_parameters(member - first, members[member].parameters);
+                simulation.initialize(member - first,
+                        UniformDistribution(members[member].seed));
+            }
+
+            size_t samples = steps / sample_every + 1;
+            for (size_t sample = 0; sample < samples; ++sample) {
+                if (sample > 0) simulation.apply_steps(sample_every);
+                for (size_t member = first; member < last; ++member) {
+                    results.averages[member][sample] =
+                        simulation.get_averages(member - first);
+                }
+            }
+        };
+
+        auto worker = [&](size_t thread) {
+            size_t batch;
+            while (next_batch(thread, &batch)) {
+                try {
+                    size_t first = batch * batch_lanes;
+                    size_t last = std::min(first + batch_lanes, members.size());
+                    if (batch_lanes == 1) run_member(first);
+                    else run_batch(first, last);
+                } catch (...) {
+                    std::unique_lock<std::mutex> guard(failure_lock);
+                    if (!failure) failure = std::current_exception();
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t thread = 1; thread < threads; ++thread)
+            workers.push_back(std::thread(worker, thread));
+        worker(0);
+        for (size_t thread = 0; thread < workers.size(); ++thread)
+            workers[thread].join();
+
+        if (failure) std::rethrow_exception(failure);
+        return results;
+    }
+}
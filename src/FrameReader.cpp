@@ -0,0 +1,123 @@
+#include "FrameReader.hpp"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PUMA {
+
+    FrameReader::FrameReader(std::string filename) :
+        data(NULL), length(0), header(NULL), frame_count(0)
+    {
+        int descriptor = open(filename.c_str(), O_RDONLY);
+        if (descriptor < 0)
+            throw FormatError("Could not open " + filename);
+
+        struct stat status;
+        if (fstat(descriptor, &status) < 0 || (size_t)status.st_size < binary_header_v1_size) {
+            close(descriptor);
+            throw FormatError(filename + " is not a binary frames file");
+        }
+
+        length = status.st_size;
+        void *mapped = mmap(NULL, length, PROT_READ, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+        if (mapped == MAP_FAILED)
+            throw FormatError("Could not map " + filename + " into memory");
+
+        data = static_cast<const char*>(mapped);
+        header = reinterpret_cast<const binary_header*>(data);
+
+        // Files of version 1 only lack the convergence
+        if (memcmp(header->magic, binary_magic, sizeof(header->magic)) != 0 ||
+                header->version < 1 || header->version > binary_version) {
+            munmap(const_cast<char*>(data), length);
+            throw FormatError(filename + " is not a binary frames file");
+        }
+        if (header->byte_order != binary_byte_order) {
+            munmap(const_cast<char*>(data), length);
+            throw FormatError(filename + " was written with a different byte order");
+        }
+
+        size_t cells = header->size_x * header->size_y;
+        if (header->mask_offset + cells > length || header->frames_offset > length ||
+                header->frame_size < 2 * cells * sizeof(double)) {
+            munmap(const_cast<char*>(data), length);
+            throw FormatError(filename + " is truncated or corrupted");
+        }
+
+        // A frame being written when the simulation stopped is ignored
+        frame_count = header->frame_count;
+        if (header->frame_size > 0 &&
+                frame_count > (length - header->frames_offset) / header->frame_size)
+            frame_count = (length - header->frames_offset) / header->frame_size;
+    }
+
+    FrameReader::~FrameReader()
+    {
+        munmap(const_cast<char*>(data), length);
+    }
+
+    size_t FrameReader::get_size_x()
+    {
+        return header->size_x;
+    }
+
+    size_t FrameReader::get_size_y()
+    {
+        return header->size_y;
+    }
+
+    size_t FrameReader::get_frames()
+    {
+        return frame_count;
+    }
+
+    step_parameters FrameReader::get_parameters()
+    {
+        return header->parameters;
+    }
+
+    convergence_record FrameReader::get_convergence()
+    {
+        convergence_record none = {NOT_CONVERGED, 0, 0, 0.0};
+        return header->version >= 2 ? header->convergence : none;
+    }
+
+    const unsigned char* FrameReader::get_land()
+    {
+        return reinterpret_cast<const unsigned char*>(data + header->mask_offset);
+    }
+
+    const double* FrameReader::get_hares(size_t frame)
+    {
+        if (frame >= frame_count)
+            throw IllegalValue("There is no such frame in the file");
+
+        return reinterpret_cast<const double*>(data + header->frames_offset
+                + frame * header->frame_size);
+    }
+
+    const double* FrameReader::get_pumas(size_t frame)
+    {
+        return get_hares(frame) + header->size_x * header->size_y;
+    }
+
+    boost::shared_array<landscape> FrameReader::get_state(size_t frame)
+    {
+        size_t cells = header->size_x * header->size_y;
+        const double *hares = get_hares(frame), *pumas = get_pumas(frame);
+        const unsigned char *land = get_land();
+
+        boost::shared_array<landscape> state(new landscape[cells]);
+        for (size_t index = 0; index < cells; ++index) {
+            state[index].hare_density = hares[index];
+            state[index].puma_density = pumas[index];
+            state[index].is_land = land[index];
+        }
+
+        return state;
+    }
+}
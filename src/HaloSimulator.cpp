@@ -0,0 +1,123 @@
+#include "HaloSimulator.hpp"
+
+namespace PUMA {
+
+    /** Builds the padded states on top of the state initialized
+     *  by the Simulator constructor. The unpadded temp_state is
+     *  not used by this engine, so its memory is released.
+     */
+    HaloSimulator::HaloSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+            boost::shared_ptr<const Topology> topology) :
+        Simulator(dim_x, dim_y, land_map, topology), stride(dim_x + 2)
+    {
+        temp_state.reset();
+
+        size_t padded_size = (dim_x + 2) * (dim_y + 2);
+        padded_current.reset(new landscape[padded_size]);
+        padded_temp.reset(new landscape[padded_size]);
+
+        // Everything starts as water, the land is copied over afterwards
+        for (size_t index = 0; index < padded_size; ++index) {
+            padded_current[index].hare_density = 0.0;
+            padded_current[index].puma_density = 0.0;
+            padded_current[index].is_land = false;
+            padded_temp[index] = padded_current[index];
+        }
+
+        for (size_t j = 0; j < dim_y; ++j) {
+            for (size_t i = 0; i < dim_x; ++i) {
+                size_t index = (j + 1) * stride + i + 1;
+                padded_current[index].is_land = land_map[j * dim_x + i];
+                padded_temp[index].is_land = land_map[j * dim_x + i];
+            }
+        }
+
+        scatter_state();
+    }
+
+    /** The same discretization as Simulator::apply_step, with the
+     *  operations kept in the same order so that the rounding
+     *  is identical. Water cells are computed too and then
+     *  discarded, which keeps the inner loop free of branches.
+     */
+    void HaloSimulator::swap_states()
+    {
+        padded_temp.swap(padded_current);
+    }
+
+    void HaloSimulator::step_rows(size_t j_begin, size_t j_end)
+    {
+        const landscape *last = padded_temp.get();
+        landscape *next = padded_current.get();
+        const unsigned char *cells = topology->cells.get();
+
+        for (size_t j = j_begin; j < j_end; ++j) {
+            size_t row = (j + 1) * stride + 1;
+
+            for (size_t i = 0; i < size_x; ++i) {
+                const landscape &cell = last[row + i];
+                const landscape &west = last[row + i - 1];
+                const landscape &east = last[row + i + 1];
+                const landscape &north = last[row + i - stride];
+                const landscape &south = last[row + i + stride];
+
+                unsigned char description = cells[row + i];
+                unsigned int nLand = Topology::neighbours(description);
+                bool is_land = description & Topology::LAND;
+
+                double hare = cell.hare_density
+                    + dt * (r * cell.hare_density
+                            - a * cell.hare_density * cell.puma_density
+                            + k * ((west.hare_density + east.hare_density
+                                    + north.hare_density + south.hare_density)
+                                - nLand * cell.hare_density));
+
+                double puma = cell.puma_density
+                    + dt * (- m * cell.puma_density
+                            + b * cell.puma_density * cell.hare_density
+                            + k * ((west.puma_density + east.puma_density
+                                    + north.puma_density + south.puma_density)
+                                - nLand * cell.puma_density));
+
+                // forces positive densities and keeps the water empty
+                hare = hare < 0.0 ? 0.0 : hare;
+                puma = puma < 0.0 ? 0.0 : puma;
+                next[row + i].hare_density = is_land ? hare : 0.0;
+                next[row + i].puma_density = is_land ? puma : 0.0;
+            }
+        }
+    }
+
+    void HaloSimulator::collect_row(size_t j, row_statistics &row,
+            double *span_hares, double *span_pumas)
+    {
+        const landscape *first = &padded_current[(j + 1) * stride + 1];
+        const landscape *previous = &padded_temp[(j + 1) * stride + 1];
+        PUMA::collect_row(*components, j, &first->hare_density, &first->puma_density,
+                sizeof(landscape) / sizeof(double), row, span_hares, span_pumas,
+                changes_known ? &previous->hare_density : NULL,
+                changes_known ? &previous->puma_density : NULL);
+    }
+
+    void HaloSimulator::gather_state()
+    {
+        for (size_t j = 0; j < size_y; ++j) {
+            for (size_t i = 0; i < size_x; ++i) {
+                const landscape &cell = padded_current[(j + 1) * stride + i + 1];
+                current_state[j * size_x + i].hare_density = cell.hare_density;
+                current_state[j * size_x + i].puma_density = cell.puma_density;
+            }
+        }
+    }
+
+    void HaloSimulator::scatter_state()
+    {
+        for (size_t j = 0; j < size_y; ++j) {
+            for (size_t i = 0; i < size_x; ++i) {
+                landscape &cell = padded_current[(j + 1) * stride + i + 1];
+                cell.hare_density = current_state[j * size_x + i].hare_density;
+                cell.puma_density = current_state[j * size_x + i].puma_density;
+            }
+        }
+    }
+}
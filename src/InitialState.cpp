@@ -0,0 +1,147 @@
+#include "InitialState.hpp"
+#include "FrameReader.hpp"
+
+#include <sstream>
+#include <vector>
+
+namespace PUMA {
+
+    void InitialDistribution::check(size_t size_x, size_t size_y) const
+    {
+        ignore(size_x);
+        ignore(size_y);
+    }
+
+    /* ****             UniformDistribution         **** */
+
+    UniformDistribution::UniformDistribution(uint64_t seed, double low, double high) :
+        low(low), high(high)
+    {
+        if (!(low >= 0.0 && low <= high))
+            throw IllegalValue("A uniform distribution needs 0 <= LOW <= HIGH");
+
+        key[0] = (uint32_t)seed;
+        key[1] = (uint32_t)(seed >> 32);
+    }
+
+    /** A single Philox call gives both densities of a cell,
+     *  the 64-bit cell index being the counter
+     */
+    void UniformDistribution::fill(landscape *state, size_t begin, size_t end) const
+    {
+        for (size_t index = begin; index < end; ++index) {
+            if (!state[index].is_land) {
+                state[index].hare_density = state[index].puma_density = 0.0;
+                continue;
+            }
+
+            uint32_t counter[4] = {(uint32_t)index, (uint32_t)((uint64_t)index >> 32), 0, 0};
+            uint32_t random[4];
+            philox4x32(counter, key, random);
+
+            state[index].hare_density = low + (high - low) * uniform_double(random[0], random[1]);
+            state[index].puma_density = low + (high - low) * uniform_double(random[2], random[3]);
+        }
+    }
+
+    /* ****             ConstantDistribution        **** */
+
+    ConstantDistribution::ConstantDistribution(double hare, double puma) :
+        hare(hare), puma(puma)
+    {
+        if (!(hare >= 0.0 && puma >= 0.0))
+            throw IllegalValue("The densities of a constant distribution cannot be negative");
+    }
+
+    void ConstantDistribution::fill(landscape *state, size_t begin, size_t end) const
+    {
+        for (size_t index = begin; index < end; ++index) {
+            bool is_land = state[index].is_land;
+            state[index].hare_density = is_land ? hare : 0.0;
+            state[index].puma_density = is_land ? puma : 0.0;
+        }
+    }
+
+    /* ****             FileDistribution            **** */
+
+    FileDistribution::FileDistribution(std::string filename, size_t frame)
+    {
+        FrameReader reader(filename);
+        if (reader.get_frames() == 0)
+            throw IllegalValue(filename + " holds no frames");
+
+        if (frame >= reader.get_frames()) frame = reader.get_frames() - 1;
+        size_x = reader.get_size_x();
+        size_y = reader.get_size_y();
+        this->frame = reader.get_state(frame);
+    }
+
+    void FileDistribution::check(size_t size_x, size_t size_y) const
+    {
+        if (size_x != this->size_x || size_y != this->size_y)
+            throw IllegalValue("The initial state does not have the size of the map");
+    }
+
+    void FileDistribution::fill(landscape *state, size_t begin, size_t end) const
+    {
+        for (size_t index = begin; index < end; ++index) {
+            bool is_land = state[index].is_land;
+            state[index].hare_density = is_land ? frame[index].hare_density : 0.0;
+            state[index].puma_density = is_land ? frame[index].puma_density : 0.0;
+        }
+    }
+
+    /// Splits a description into its colon separated parts
+    static std::vector<std::string> split_description(std::string description)
+    {
+        std::vector<std::string> parts;
+        std::istringstream stream(description);
+        std::string part;
+        while (std::getline(stream, part, ':'))
+            parts.push_back(part);
+        return parts;
+    }
+
+    /// Reads a number of a description
+    template <typename T>
+    static T parse_number(std::string text, std::string description)
+    {
+        std::istringstream stream(text);
+        T value;
+        if (!(stream >> value) || !stream.eof())
+            throw IllegalValue("Invalid initial distribution " + description);
+        return value;
+    }
+
+    boost::shared_ptr<InitialDistribution> create_distribution(
+            std::string description, uint64_t seed)
+    {
+        std::vector<std::string> parts = split_description(description);
+        typedef boost::shared_ptr<InitialDistribution> pointer;
+
+        if (parts.size() == 1 && parts[0] == "uniform") {
+            return pointer(new UniformDistribution(seed));
+        } else if (parts.size() == 3 && parts[0] == "uniform") {
+            return pointer(new UniformDistribution(seed,
+                        parse_number<double>(parts[1], description),
+                        parse_number<double>(parts[2], description)));
+        } else if (parts.size() == 3 && parts[0] == "constant") {
+            return pointer(new ConstantDistribution(
+                        parse_number<double>(parts[1], description),
+                        parse_number<double>(parts[2], description)));
+        } else if (parts.size() >= 2 && parts[0] == "file") {
+            // The name is all the rest, but for a trailing frame number
+            std::string name = description.substr(5);
+            size_t frame = (size_t)-1, colon = name.rfind(':');
+            if (colon != std::string::npos && colon + 1 < name.size() &&
+                    name.find_first_not_of("0123456789", colon + 1) == std::string::npos) {
+                frame = parse_number<size_t>(name.substr(colon + 1), description);
+                name.erase(colon);
+            }
+            if (!name.empty())
+                return pointer(new FileDistribution(name, frame));
+        }
+
+        throw IllegalValue("Invalid initial distribution " + description);
+    }
+}
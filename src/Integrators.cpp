@@ -0,0 +1,310 @@
+#include "Integrators.hpp"
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+namespace PUMA {
+
+    const std::list<integrator>& available_integrators()
+    {
+        static std::list<integrator> integrators;
+
+        if (integrators.empty()) {
+            integrator euler = {"euler",
+                "Forward Euler, first order, the original scheme",
+                1, 1, {{0}}, {1}, {0}, false, false, 2.0};
+            integrators.push_back(euler);
+
+            integrator heun = {"heun",
+                "Heun's method, a second order Runge-Kutta method",
+                2, 2, {{0}, {1}}, {0.5, 0.5}, {0}, false, false, 2.0};
+            integrators.push_back(heun);
+
+            integrator rk4 = {"rk4",
+                "The classical fourth order Runge-Kutta method",
+                4, 4, {{0}, {0.5}, {0, 0.5}, {0, 0, 1}},
+                {1.0 / 6, 1.0 / 3, 1.0 / 3, 1.0 / 6}, {0}, false, false, 2.785};
+            integrators.push_back(rk4);
+
+            integrator rk23 = {"rk23",
+                "Bogacki-Shampine 3(2) pair, adapting the step size "
+                "to the tolerance",
+                4, 3, {{0}, {0.5}, {0, 0.75}, {2.0 / 9, 1.0 / 3, 4.0 / 9}},
+                {2.0 / 9, 1.0 / 3, 4.0 / 9, 0},
+                {-5.0 / 72, 1.0 / 12, 1.0 / 9, -1.0 / 8}, true, true, 2.512};
+            integrators.push_back(rk23);
+        }
+
+        return integrators;
+    }
+
+    const integrator& choose_integrator(std::string name)
+    {
+        const std::list<integrator> &integrators = available_integrators();
+        for (std::list<integrator>::const_iterator it = integrators.begin();
+                it != integrators.end(); ++it) {
+            if (it->name == name) return *it;
+        }
+
+        throw IllegalValue("Integrator " + name + " is not known");
+    }
+
+    double stability_limit(const integrator &method, const step_parameters &params)
+    {
+        double fastest = 8 * std::max(params.k, params.l) + params.m;
+        if (fastest <= 0.0) return std::numeric_limits<double>::infinity();
+        return method.stability / fastest;
+    }
+
+    /* ****             IntegratorSimulator             **** */
+
+    IntegratorSimulator::IntegratorSimulator(size_t dim_x, size_t dim_y, bool *land_map,
+            boost::shared_ptr<const Topology> topology) :
+        SoASimulator(dim_x, dim_y, land_map, topology), method(&available_integrators().front()),
+        row_error(dim_y), step_size(0.0), first_stage_valid(false), clamped(false),
+        accepted(0), rejected(0), tolerance(1e-6)
+    {
+    }
+
+    /** The buffers of the stages are only allocated for the
+     *  methods that need them
+     */
+    void IntegratorSimulator::set_integrator(std::string name)
+    {
+        method = &choose_integrator(name);
+        accepted = rejected = 0;
+        step_size = 0.0;
+        first_stage_valid = false;
+        if (method->name == "euler") return;
+
+        size_t padded_size = stride * (size_y + 2);
+        while (stage_hare.size() < method->stages) {
+            stage_hare.push_back(boost::shared_array<double>(new double[padded_size]()));
+            stage_puma.push_back(boost::shared_array<double>(new double[padded_size]()));
+        }
+        if (!hare_stage) {
+            hare_stage.reset(new double[padded_size]());
+            puma_stage.reset(new double[padded_size]());
+        }
+    }
+
+    /** The same right-hand side as the Euler kernels, with the
+     *  neighbours summed in the same order
+     */
+    void IntegratorSimulator::derivatives(const double *hare, const double *puma,
+            double *hare_out, double *puma_out, size_t j_begin, size_t j_end)
+    {
+        const unsigned char *cells = topology->cells.get();
+        for (size_t j = j_begin; j < j_end; ++j) {
+            size_t row = (j + 1) * stride + 1;
+            for (size_t index = row; index < row + size_x; ++index) {
+                if (!(cells[index] & Topology::LAND)) {
+                    hare_out[index] = puma_out[index] = 0.0;
+                    continue;
+                }
+
+                double n = Topology::neighbours(cells[index]);
+                double h = hare[index], p = puma[index];
+                double hares = (hare[index - 1] + hare[index + 1])
+                    + hare[index - stride] + hare[index + stride];
+                double pumas = (puma[index - 1] + puma[index + 1])
+                    + puma[index - stride] + puma[index + stride];
+
+                hare_out[index] = (r * h - (a * h) * p) + k * (hares - n * h);
+                puma_out[index] = (-m * p + (b * p) * h) + k * (pumas - n * p);
+            }
+        }
+    }
+
+    void IntegratorSimulator::for_rows(const WorkerPool::task &work)
+    {
+        if (workers) workers->run(work, size_y);
+        else work(0, size_y);
+    }
+
+    /** The solution goes to the temporary arrays, which only
+     *  become the current ones once accept_step is called
+     */
+    double IntegratorSimulator::try_step(double h)
+    {
+        size_t stages = method->stages;
+        const double *hare = hare_current.get(), *puma = puma_current.get();
+
+        // y + h * sum(weights[j] * K_j) over the rows, the zero weights skipped
+        auto combine = [this, h, hare, puma](const double *weights, size_t count,
+                double *hare_out, double *puma_out, size_t j_begin, size_t j_end) {
+            for (size_t j = j_begin; j < j_end; ++j) {
+                size_t row = (j + 1) * stride + 1;
+                for (size_t index = row; index < row + size_x; ++index) {
+                    double hares = 0.0, pumas = 0.0;
+                    for (size_t stage = 0; stage < count; ++stage) {
+                        if (weights[stage] == 0.0) continue;
+                        hares += weights[stage] * stage_hare[stage][index];
+                        pumas += weights[stage] * stage_puma[stage][index];
+                    }
+                    hare_out[index] = hare[index] + h * hares;
+                    puma_out[index] = puma[index] + h * pumas;
+                }
+            }
+        };
+
+        if (!first_stage_valid) {
+            for_rows([this, hare, puma](size_t j_begin, size_t j_end) {
+                derivatives(hare, puma, stage_hare[0].get(), stage_puma[0].get(),
+                        j_begin, j_end);
+            });
+            first_stage_valid = true;
+            stage_parameters = get_parameters();
+        }
+
+        for (size_t stage = 1; stage < stages; ++stage) {
+            for_rows([&](size_t j_begin, size_t j_end) {
+                combine(method->a[stage], stage, hare_stage.get(), puma_stage.get(),
+                        j_begin, j_end);
+            });
+            for_rows([&](size_t j_begin, size_t j_end) {
+                derivatives(hare_stage.get(), puma_stage.get(),
+                        stage_hare[stage].get(), stage_puma[stage].get(), j_begin, j_end);
+            });
+        }
+
+        std::vector<char> row_clamped(size_y, 0);
+        for_rows([&](size_t j_begin, size_t j_end) {
+            combine(method->b, stages, hare_temp.get(), puma_temp.get(), j_begin, j_end);
+
+            for (size_t j = j_begin; j < j_end; ++j) {
+                size_t row = (j + 1) * stride + 1;
+                double largest = 0.0;
+                for (size_t index = row; index < row + size_x; ++index) {
+                    if (method->adaptive) {
+                        double hares = 0.0, pumas = 0.0;
+                        for (size_t stage = 0; stage < stages; ++stage) {
+                            hares += method->error[stage] * stage_hare[stage][index];
+                            pumas += method->error[stage] * stage_puma[stage][index];
+                        }
+                        double scale_hare = tolerance * (1.0 + std::max(std::fabs(hare[index]),
+                                    std::fabs(hare_temp[index])));
+                        double scale_puma = tolerance * (1.0 + std::max(std::fabs(puma[index]),
+                                    std::fabs(puma_temp[index])));
+                        largest = std::max(largest, std::max(std::fabs(h * hares) / scale_hare,
+                                    std::fabs(h * pumas) / scale_puma));
+                    }
+
+                    // forces positive densities
+                    if (hare_temp[index] < 0.0) {
+                        hare_temp[index] = 0.0;
+                        row_clamped[j] = 1;
+                    }
+                    if (puma_temp[index] < 0.0) {
+                        puma_temp[index] = 0.0;
+                        row_clamped[j] = 1;
+                    }
+                }
+                row_error[j] = largest;
+            }
+        });
+
+        clamped = std::find(row_clamped.begin(), row_clamped.end(), 1) != row_clamped.end();
+        return size_y > 0 ? *std::max_element(row_error.begin(), row_error.end()) : 0.0;
+    }
+
+    /** The last stage of a FSAL method was evaluated at the
+     *  solution, unless a density had to be clamped
+     */
+    void IntegratorSimulator::accept_step()
+    {
+        hare_temp.swap(hare_current);
+        puma_temp.swap(puma_current);
+        ++accepted;
+
+        if (method->fsal && !clamped) {
+            stage_hare[0].swap(stage_hare[method->stages - 1]);
+            stage_puma[0].swap(stage_puma[method->stages - 1]);
+        } else {
+            first_stage_valid = false;
+        }
+    }
+
+    void IntegratorSimulator::scatter_state()
+    {
+        SoASimulator::scatter_state();
+        first_stage_valid = false;
+    }
+
+    /// Whether two sets of parameters give the same derivatives
+    static bool same_equations(const step_parameters &first, const step_parameters &second)
+    {
+        return first.r == second.r && first.a == second.a && first.b == second.b
+            && first.m == second.m && first.k == second.k && first.l == second.l;
+    }
+
+    /** The derivatives of the last step are only reused if
+     *  the parameters did not change in between
+     */
+    void IntegratorSimulator::step()
+    {
+        if (method->name == "euler") {
+            SoASimulator::step();
+            return;
+        }
+
+        if (!same_equations(stage_parameters, get_parameters()))
+            first_stage_valid = false;
+        if (!method->adaptive) {
+            try_step(dt);
+            accept_step();
+            return;
+        }
+
+        double limit = 0.9 * stability_limit(*method, get_parameters());
+        if (step_size == 0.0) step_size = std::min(dt, limit);
+
+        double done = 0.0;
+        while (done < dt) {
+            double h = std::min(step_size, dt - done);
+            bool last = h >= dt - done;
+
+            double error = try_step(h);
+            double factor = error > 0.0 ?
+                0.9 * std::pow(error, -1.0 / method->order) : 5.0;
+            factor = std::min(5.0, std::max(0.2, factor));
+
+            if (error <= 1.0) {
+                accept_step();
+                done = last ? dt : done + h;
+
+                // A step cut short by the end of dt says little about the next one
+                if (!(last && h < step_size && factor > 1.0))
+                    step_size = std::min(h * factor, limit);
+            } else {
+                ++rejected;
+                step_size = h * factor;
+                if (step_size < dt * 1e-12)
+                    throw IllegalValue("The tolerance of the integrator cannot be met");
+            }
+        }
+    }
+
+    /** The statistics are collected once the whole dt is
+     *  done, against the state before it
+     */
+    void IntegratorSimulator::collecting_step()
+    {
+        if (method->name == "euler") {
+            SoASimulator::collecting_step();
+            return;
+        }
+
+        size_t padded_size = stride * (size_y + 2);
+        std::vector<double> hare_before(&hare_current[0], &hare_current[0] + padded_size);
+        std::vector<double> puma_before(&puma_current[0], &puma_current[0] + padded_size);
+
+        step();
+        std::copy(hare_before.begin(), hare_before.end(), &hare_temp[0]);
+        std::copy(puma_before.begin(), puma_before.end(), &puma_temp[0]);
+        collect_changed_rows();
+    }
+}
@@ -0,0 +1,181 @@
+#include "IslandSimulator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace PUMA {
+
+    /** The islands are cut out of the components used for the
+     *  statistics, so the labelling is only done once
+     */
+    template <class Precision>
+    BasicIslandSimulator<Precision>::BasicIslandSimulator(size_t dim_x, size_t dim_y,
+            bool *land_map, boost::shared_ptr<const Topology> topology) :
+        BasicSoASimulator<Precision>(dim_x, dim_y, land_map, topology)
+    {
+        this->prepare_statistics();
+        const LandComponents &components = *this->components;
+
+        islands.resize(components.components.size());
+        for (size_t number = 0; number < islands.size(); ++number) {
+            const LandComponents::component &extent = components.components[number];
+            island &land = islands[number];
+            land.x0 = extent.x0;
+            land.y0 = extent.y0;
+            land.width = extent.x1 - extent.x0;
+            land.height = extent.y1 - extent.y0;
+            land.stride = land.width + 2;
+            land.land_cells = extent.cells;
+            land.current = 0;
+
+            // Everything starts as water, the island is copied over afterwards
+            size_t padded_size = land.stride * (land.height + 2);
+            land.cells.assign(padded_size, 0);
+            for (int buffer = 0; buffer < 2; ++buffer) {
+                land.hare[buffer].assign(padded_size, 0.0);
+                land.puma[buffer].assign(padded_size, 0.0);
+            }
+        }
+
+        /* Land neighbours of a cell always belong to its island,
+         * so the descriptions can be copied as they are
+         */
+        for (size_t index = 0; index < components.spans.size(); ++index) {
+            const LandComponents::span &span = components.spans[index];
+            island &land = islands[span.component];
+            land.spans.push_back(index);
+            memcpy(&land.cells[land.at(span.begin, span.row)],
+                    &this->topology->cells[(span.row + 1) * this->stride + span.begin + 1],
+                    span.end - span.begin);
+        }
+
+        // The largest islands are started first, so that they do not finish last
+        std::stable_sort(islands.begin(), islands.end(),
+                [](const island &first, const island &second) {
+                    return first.land_cells > second.land_cells;
+                });
+
+        scatter_state();
+    }
+
+    /** Loads the arrays of the SoASimulator, and the islands
+     *  from them
+     */
+    template <class Precision>
+    void BasicIslandSimulator<Precision>::scatter_state()
+    {
+        BasicSoASimulator<Precision>::scatter_state();
+
+        const LandComponents &components = *this->components;
+        for (size_t number = 0; number < islands.size(); ++number) {
+            island &land = islands[number];
+            for (size_t index = 0; index < land.spans.size(); ++index) {
+                const LandComponents::span &span = components.spans[land.spans[index]];
+                size_t from = (span.row + 1) * this->stride + span.begin + 1;
+                size_t to = land.at(span.begin, span.row);
+                size_t count = span.end - span.begin;
+                memcpy(&land.hare[land.current][to], &this->hare_current[from],
+                        count * sizeof(storage));
+                memcpy(&land.puma[land.current][to], &this->puma_current[from],
+                        count * sizeof(storage));
+            }
+        }
+    }
+
+    template <class Precision>
+    void BasicIslandSimulator<Precision>::advance_island(island &land, size_t steps)
+    {
+        step_parameters params = this->get_parameters();
+        const LandComponents &components = *this->components;
+
+        for (size_t step = 0; step < steps; ++step) {
+            const std::vector<storage> &last_hare = land.hare[land.current];
+            const std::vector<storage> &last_puma = land.puma[land.current];
+            std::vector<storage> &next_hare = land.hare[1 - land.current];
+            std::vector<storage> &next_puma = land.puma[1 - land.current];
+
+            // Only the land is stepped, the water stays empty in both buffers
+            for (size_t index = 0; index < land.spans.size(); ++index) {
+                const LandComponents::span &span = components.spans[land.spans[index]];
+                size_t first = land.at(span.begin, span.row);
+                this->kernel->step(&last_hare[first], &last_puma[first], &land.cells[first],
+                        &next_hare[first], &next_puma[first], span.end - span.begin,
+                        land.stride, params);
+            }
+            land.current = 1 - land.current;
+        }
+
+        // Islands never share a cell, so they can all be copied back at once
+        for (size_t index = 0; index < land.spans.size(); ++index) {
+            const LandComponents::span &span = components.spans[land.spans[index]];
+            size_t from = land.at(span.begin, span.row);
+            size_t to = (span.row + 1) * this->stride + span.begin + 1;
+            size_t count = span.end - span.begin;
+            memcpy(&this->hare_current[to], &land.hare[land.current][from],
+                    count * sizeof(storage));
+            memcpy(&this->puma_current[to], &land.puma[land.current][from],
+                    count * sizeof(storage));
+        }
+    }
+
+    /** Every thread takes the next island not taken yet, until
+     *  there are none left
+     */
+    template <class Precision>
+    void BasicIslandSimulator<Precision>::advance(size_t steps)
+    {
+        std::atomic<size_t> next(0);
+        WorkerPool::task work = [this, &next, steps](size_t, size_t) {
+            size_t number;
+            while ((number = next++) < islands.size())
+                advance_island(islands[number], steps);
+        };
+
+        if (this->workers) this->workers->run(work, this->workers->size());
+        else work(0, 1);
+    }
+
+    template <class Precision>
+    void BasicIslandSimulator<Precision>::apply_steps(size_t steps)
+    {
+        if (steps == 0) return;
+
+        this->statistics_fresh = false;
+        if (!this->tracking) {
+            advance(steps);
+            return;
+        }
+
+        if (steps > 1) advance(steps - 1);
+        this->apply_step();
+    }
+
+    template <class Precision>
+    void BasicIslandSimulator<Precision>::step()
+    {
+        advance(1);
+    }
+
+    /** The rows cross many islands, so they are collected
+     *  from the arrays of the SoASimulator once all the
+     *  islands are copied back, the previous state being kept
+     *  in its temporary arrays for the changes
+     */
+    template <class Precision>
+    void BasicIslandSimulator<Precision>::collecting_step()
+    {
+        size_t padded_size = this->stride * (this->size_y + 2);
+        std::copy(&this->hare_current[0], &this->hare_current[0] + padded_size,
+                &this->hare_temp[0]);
+        std::copy(&this->puma_current[0], &this->puma_current[0] + padded_size,
+                &this->puma_temp[0]);
+
+        advance(1);
+        this->collect_changed_rows();
+    }
+
+    template class BasicIslandSimulator<double_precision>;
+    template class BasicIslandSimulator<single_precision>;
+    template class BasicIslandSimulator<mixed_precision>;
+}
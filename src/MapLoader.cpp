@@ -0,0 +1,239 @@
+#include "MapLoader.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace PUMA {
+
+    /** Splits the text parts of the files into numbers.
+     *  Comments, which only the PNM headers may contain,
+     *  run from a '#' to the end of the line.
+     */
+    struct map_tokenizer {
+        const char *position, *end;
+
+        map_tokenizer(const char *data, size_t length) :
+            position(data), end(data + length) {}
+
+        static bool is_space(char c)
+        {
+            return c == ' ' || c == '\n' || c == '\r' || c == '\t'
+                || c == '\v' || c == '\f';
+        }
+
+        void skip_space()
+        {
+            while (position < end) {
+                if (is_space(*position)) {
+                    ++position;
+                } else if (*position == '#') {
+                    while (position < end && *position != '\n') ++position;
+                } else {
+                    break;
+                }
+            }
+        }
+
+        size_t number()
+        {
+            skip_space();
+            if (position == end)
+                throw FormatError("The map ends before all the cells are read");
+            if (*position < '0' || *position > '9')
+                throw FormatError("Unexpected character in the map");
+
+            size_t value = 0;
+            while (position < end && *position >= '0' && *position <= '9')
+                value = value * 10 + (*position++ - '0');
+            return value;
+        }
+    };
+
+    /// Allocates the cells of a map of a given size
+    static land_map make_map(size_t size_x, size_t size_y)
+    {
+        if (size_x == 0 || size_y == 0)
+            throw FormatError("The map has to have at least one cell");
+
+        land_map map;
+        map.size_x = size_x;
+        map.size_y = size_y;
+        map.land.reset(new bool[size_x * size_y]);
+        return map;
+    }
+
+    /** The cells are almost always single digits separated
+     *  by single spaces, which are read without going through
+     *  the tokenizer
+     */
+    static land_map parse_dat(map_tokenizer &tokens)
+    {
+        size_t size_x = tokens.number();
+        size_t size_y = tokens.number();
+        land_map map = make_map(size_x, size_y);
+
+        bool *land = map.land.get();
+        const char *position = tokens.position, *end = tokens.end;
+        for (size_t index = 0; index < size_x * size_y; ++index) {
+            if (end - position >= 3 && position[0] == ' ' && (position[1] == '0' || 
+                        position[1] == '1') && map_tokenizer::is_space(position[2])) {
+                land[index] = position[1] == '1';
+                position += 2;
+                continue;
+            }
+
+            tokens.position = position;
+            land[index] = tokens.number() != 0;
+            position = tokens.position;
+        }
+
+        return map;
+    }
+
+    /// Reads the raster of P1, P2 and P3 images
+    static void parse_plain_pnm(map_tokenizer &tokens, land_map &map,
+            size_t samples, size_t maxval)
+    {
+        for (size_t index = 0; index < map.size_x * map.size_y; ++index) {
+            size_t sum = 0;
+            for (size_t sample = 0; sample < samples; ++sample) {
+                size_t value = tokens.number();
+                if (value > maxval)
+                    throw FormatError("A pixel is brighter than the maximal value");
+                sum += value;
+            }
+            map.land[index] = 2 * sum < samples * maxval;
+        }
+    }
+
+    /// Reads the raster of P5 and P6 images
+    static void parse_raw_pnm(map_tokenizer &tokens, land_map &map,
+            size_t samples, size_t maxval)
+    {
+        size_t cells = map.size_x * map.size_y;
+        size_t width = maxval < 256 ? 1 : 2;
+        if ((size_t)(tokens.end - tokens.position) < cells * samples * width)
+            throw FormatError("The map ends before all the cells are read");
+
+        const unsigned char *raster =
+            reinterpret_cast<const unsigned char*>(tokens.position);
+
+        // The common grey byte per pixel case, kept simple enough to vectorise
+        if (samples == 1 && width == 1) {
+            bool *land = map.land.get();
+            for (size_t index = 0; index < cells; ++index)
+                land[index] = 2 * raster[index] < maxval;
+            return;
+        }
+
+        for (size_t index = 0; index < cells; ++index) {
+            size_t sum = 0;
+            for (size_t sample = 0; sample < samples; ++sample) {
+                // Two byte samples are big-endian
+                sum += width == 1 ? raster[0] : raster[0] << 8 | raster[1];
+                raster += width;
+            }
+            map.land[index] = 2 * sum < samples * maxval;
+        }
+    }
+
+    /// Reads the raster of P4 images, their rows padded to whole bytes
+    static void parse_raw_pbm(map_tokenizer &tokens, land_map &map)
+    {
+        size_t row_bytes = (map.size_x + 7) / 8;
+        if ((size_t)(tokens.end - tokens.position) < row_bytes * map.size_y)
+            throw FormatError("The map ends before all the cells are read");
+
+        const unsigned char *raster =
+            reinterpret_cast<const unsigned char*>(tokens.position);
+        for (size_t j = 0; j < map.size_y; ++j) {
+            for (size_t i = 0; i < map.size_x; ++i) {
+                // Set bits are black
+                map.land[j * map.size_x + i] = (raster[i / 8] >> (7 - i % 8)) & 1;
+            }
+            raster += row_bytes;
+        }
+    }
+
+    static land_map parse_pnm(map_tokenizer &tokens, char kind)
+    {
+        size_t size_x = tokens.number();
+        size_t size_y = tokens.number();
+
+        bool bitmap = kind == '1' || kind == '4';
+        size_t maxval = bitmap ? 1 : tokens.number();
+        size_t samples = kind == '3' || kind == '6' ? 3 : 1;
+        if (maxval == 0 || maxval > 65535)
+            throw FormatError("The maximal value of the image is out of range");
+
+        land_map map = make_map(size_x, size_y);
+
+        if (kind == '1') {
+            // The bits may not be separated in the plain bitmaps
+            for (size_t index = 0; index < size_x * size_y; ++index) {
+                tokens.skip_space();
+                if (tokens.position == tokens.end)
+                    throw FormatError("The map ends before all the cells are read");
+                if (*tokens.position != '0' && *tokens.position != '1')
+                    throw FormatError("Unexpected character in the map");
+                map.land[index] = *tokens.position++ == '1';
+            }
+        } else if (kind == '2' || kind == '3') {
+            parse_plain_pnm(tokens, map, samples, maxval);
+        } else {
+            // A single whitespace character separates the header from the raster
+            if (tokens.position == tokens.end || !map_tokenizer::is_space(*tokens.position))
+                throw FormatError("Malformed image header");
+            ++tokens.position;
+
+            if (kind == '4') parse_raw_pbm(tokens, map);
+            else parse_raw_pnm(tokens, map, samples, maxval);
+        }
+
+        return map;
+    }
+
+    land_map parse_land_map(const char *data, size_t length)
+    {
+        map_tokenizer tokens(data, length);
+
+        if (length >= 2 && data[0] == 'P' && data[1] >= '1' && data[1] <= '6') {
+            tokens.position += 2;
+            return parse_pnm(tokens, data[1]);
+        }
+
+        return parse_dat(tokens);
+    }
+
+    land_map load_land_map(std::string filename)
+    {
+        int descriptor = open(filename.c_str(), O_RDONLY);
+        if (descriptor < 0)
+            throw FormatError("Could not open " + filename);
+
+        struct stat status;
+        if (fstat(descriptor, &status) < 0 || status.st_size == 0) {
+            close(descriptor);
+            throw FormatError(filename + " is empty");
+        }
+
+        size_t length = status.st_size;
+        // The whole file is read anyway, so it is mapped in one go
+        void *mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                descriptor, 0);
+        close(descriptor);
+        if (mapped == MAP_FAILED)
+            throw FormatError("Could not map " + filename + " into memory");
+
+        try {
+            land_map map = parse_land_map(static_cast<const char*>(mapped), length);
+            munmap(mapped, length);
+            return map;
+        } catch (FormatError &e) {
+            munmap(mapped, length);
+            throw FormatError(filename + ": " + e.what());
+        }
+    }
+}
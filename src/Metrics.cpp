@@ -0,0 +1,332 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace PUMA {
+
+    std::atomic<bool> metrics_on(false);
+
+    /// The metrics of all the threads, the latest first
+    static std::atomic<thread_metrics*> all_metrics(NULL);
+    static std::atomic<size_t> registered_threads(0);
+
+    /// Ticks and time when the metrics were enabled
+    static uint64_t start_ticks;
+    static std::chrono::steady_clock::time_point start_time;
+
+    const char* metric_phase_name(metric_phase phase)
+    {
+        static const char *names[PHASE_COUNT] = {"step", "halo", "reduction",
+            "serialization", "files", "checkpoint", "output_stall",
+            "compression"};
+        return names[phase];
+    }
+
+    const char* metric_counter_name(metric_counter counter)
+    {
+        static const char *names[COUNTER_COUNT] = {"steps", "frames", "checkpoints"};
+        return names[counter];
+    }
+
+    void enable_metrics(bool enable)
+    {
+        if (enable && !metrics_on.load()) {
+            start_time = std::chrono::steady_clock::now();
+            start_ticks = read_ticks();
+        }
+        metrics_on.store(enable);
+    }
+
+    /** The metrics of a thread are pushed on the list with a
+     *  compare and swap and never freed, so that the reports
+     *  can walk it without any lock
+     */
+    thread_metrics& local_metrics()
+    {
+        static thread_local thread_metrics *metrics = NULL;
+        if (metrics != NULL) return *metrics;
+
+        metrics = new thread_metrics();
+        metrics->thread = registered_threads.fetch_add(1);
+        for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+            metrics->ticks[phase].store(0);
+            metrics->calls[phase].store(0);
+        }
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter)
+            metrics->counters[counter].store(0);
+
+        metrics->next = all_metrics.load();
+        while (!all_metrics.compare_exchange_weak(metrics->next, metrics)) {}
+        return *metrics;
+    }
+
+    metrics_snapshot take_metrics_snapshot()
+    {
+        metrics_snapshot snapshot;
+        double elapsed = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start_time).count();
+        uint64_t ticks = read_ticks() - start_ticks;
+        double ticks_per_second = elapsed > 0.0 && ticks > 0 ? ticks / elapsed : 1e9;
+
+        snapshot.elapsed = elapsed;
+        snapshot.final = false;
+        memset(&snapshot.total, 0, sizeof(snapshot.total));
+        for (thread_metrics *metrics = all_metrics.load(); metrics != NULL;
+                metrics = metrics->next) {
+            metric_totals totals;
+            totals.thread = metrics->thread;
+            for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+                totals.seconds[phase] = metrics->ticks[phase].load(std::memory_order_relaxed)
+                    / ticks_per_second;
+                totals.calls[phase] = metrics->calls[phase].load(std::memory_order_relaxed);
+                snapshot.total.seconds[phase] += totals.seconds[phase];
+                snapshot.total.calls[phase] += totals.calls[phase];
+            }
+            for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+                totals.counters[counter] =
+                    metrics->counters[counter].load(std::memory_order_relaxed);
+                snapshot.total.counters[counter] += totals.counters[counter];
+            }
+            snapshot.threads.push_back(totals);
+        }
+
+        std::sort(snapshot.threads.begin(), snapshot.threads.end(),
+                [](const metric_totals &first, const metric_totals &second) {
+                    return first.thread < second.thread;
+                });
+        snapshot.average_steps_per_second = elapsed > 0.0 ?
+            snapshot.total.counters[COUNTER_STEPS] / elapsed : 0.0;
+        snapshot.steps_per_second = snapshot.average_steps_per_second;
+        return snapshot;
+    }
+
+    /// Writes the phases and counters of a thread as JSON members
+    static void write_totals_json(std::ostream &output, const metric_totals &totals)
+    {
+        output << "\"phases\": {";
+        for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+            output << (phase > 0 ? ", " : "") << "\""
+                << metric_phase_name(metric_phase(phase)) << "\": {\"seconds\": "
+                << totals.seconds[phase] << ", \"calls\": " << totals.calls[phase] << "}";
+        }
+        output << "}, \"counters\": {";
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+            output << (counter > 0 ? ", " : "") << "\""
+                << metric_counter_name(metric_counter(counter)) << "\": "
+                << totals.counters[counter];
+        }
+        output << "}";
+    }
+
+    void write_metrics_json(std::ostream &output, const metrics_snapshot &snapshot)
+    {
+        output << "{\"elapsed\": " << snapshot.elapsed
+            << ", \"final\": " << (snapshot.final ? "true" : "false")
+            << ", \"steps_per_second\": " << snapshot.steps_per_second
+            << ", \"average_steps_per_second\": " << snapshot.average_steps_per_second
+            << ", \"io_stall_seconds\": " << snapshot.total.seconds[PHASE_OUTPUT_STALL]
+            << ", ";
+        write_totals_json(output, snapshot.total);
+        output << ", \"threads\": [";
+        for (size_t index = 0; index < snapshot.threads.size(); ++index) {
+            output << (index > 0 ? ", " : "") << "{\"thread\": "
+                << snapshot.threads[index].thread << ", ";
+            write_totals_json(output, snapshot.threads[index]);
+            output << "}";
+        }
+        output << "]}\n";
+    }
+
+    void write_metrics_prometheus(std::ostream &output, const metrics_snapshot &snapshot)
+    {
+        output << "# HELP pumas_elapsed_seconds Time since the run started.\n"
+            << "# TYPE pumas_elapsed_seconds gauge\n"
+            << "pumas_elapsed_seconds " << snapshot.elapsed << "\n"
+            << "# HELP pumas_steps_per_second Steps per second since the last snapshot.\n"
+            << "# TYPE pumas_steps_per_second gauge\n"
+            << "pumas_steps_per_second " << snapshot.steps_per_second << "\n"
+            << "# HELP pumas_average_steps_per_second Steps per second since the start.\n"
+            << "# TYPE pumas_average_steps_per_second gauge\n"
+            << "pumas_average_steps_per_second " << snapshot.average_steps_per_second << "\n";
+
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+            const char *name = metric_counter_name(metric_counter(counter));
+            output << "# HELP pumas_" << name << "_total Number of " << name << " so far.\n"
+                << "# TYPE pumas_" << name << "_total counter\n"
+                << "pumas_" << name << "_total " << snapshot.total.counters[counter] << "\n";
+        }
+
+        output << "# HELP pumas_phase_seconds_total Time spent in every phase, by thread.\n"
+            << "# TYPE pumas_phase_seconds_total counter\n";
+        for (size_t index = 0; index < snapshot.threads.size(); ++index) {
+            const metric_totals &totals = snapshot.threads[index];
+            for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+                if (totals.calls[phase] == 0) continue;
+                output << "pumas_phase_seconds_total{phase=\""
+                    << metric_phase_name(metric_phase(phase)) << "\",thread=\""
+                    << totals.thread << "\"} " << totals.seconds[phase] << "\n";
+            }
+        }
+
+        output << "# HELP pumas_phase_calls_total Number of times every phase was entered, by thread.\n"
+            << "# TYPE pumas_phase_calls_total counter\n";
+        for (size_t index = 0; index < snapshot.threads.size(); ++index) {
+            const metric_totals &totals = snapshot.threads[index];
+            for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+                if (totals.calls[phase] == 0) continue;
+                output << "pumas_phase_calls_total{phase=\""
+                    << metric_phase_name(metric_phase(phase)) << "\",thread=\""
+                    << totals.thread << "\"} " << totals.calls[phase] << "\n";
+            }
+        }
+    }
+
+    /* ****             MetricsReporter             **** */
+
+    MetricsReporter::MetricsReporter(std::string target, std::string format,
+            double interval) :
+        target(target), format(format), interval(interval), listener(-1),
+        last_steps(0), last_elapsed(0.0), stopping(false), finished(false)
+    {
+        if (format != "json" && format != "prometheus")
+            throw IllegalValue("Unknown metrics format " + format);
+        if (!(interval > 0.0))
+            throw IllegalValue("The metrics need a positive interval");
+
+        if (this->target.compare(0, 5, "unix:") == 0) {
+            this->target = this->target.substr(5);
+
+            sockaddr_un address;
+            memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (this->target.length() >= sizeof(address.sun_path))
+                throw IllegalValue("Socket path " + this->target + " is too long");
+            strcpy(address.sun_path, this->target.c_str());
+
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            unlink(this->target.c_str());
+            if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) < 0 ||
+                    listen(listener, 8) < 0) {
+                std::string error = strerror(errno);
+                if (listener >= 0) close(listener);
+                throw SystemError("Could not listen at " + this->target + ": " + error);
+            }
+        }
+
+        enable_metrics(true);
+        publish(false);
+        thread = std::thread(&MetricsReporter::reporter_loop, this);
+    }
+
+    MetricsReporter::~MetricsReporter()
+    {
+        finish();
+    }
+
+    /** Files are replaced by a rename, so that a reader never
+     *  sees half a snapshot
+     */
+    void MetricsReporter::publish(bool final)
+    {
+        metrics_snapshot snapshot = take_metrics_snapshot();
+        snapshot.final = final;
+
+        uint64_t steps = snapshot.total.counters[COUNTER_STEPS];
+        if (snapshot.elapsed > last_elapsed) {
+            snapshot.steps_per_second = (steps - last_steps)
+                / (snapshot.elapsed - last_elapsed);
+        }
+        last_steps = steps;
+        last_elapsed = snapshot.elapsed;
+
+        std::ostringstream formatted;
+        if (format == "json") write_metrics_json(formatted, snapshot);
+        else write_metrics_prometheus(formatted, snapshot);
+
+        std::unique_lock<std::mutex> guard(lock);
+        latest = formatted.str();
+        if (listener >= 0) return;
+
+        std::string temporary = target + ".tmp";
+        std::ofstream output(temporary.c_str());
+        output << latest;
+        output.close();
+        if (output) rename(temporary.c_str(), target.c_str());
+    }
+
+    void MetricsReporter::reporter_loop()
+    {
+        typedef std::chrono::steady_clock clock;
+        clock::time_point next = clock::now() + std::chrono::microseconds(long(interval * 1e6));
+
+        std::unique_lock<std::mutex> guard(lock);
+        while (!stopping) {
+            if (listener < 0) {
+                wake.wait_until(guard, next);
+            } else {
+                // Polls the socket in short slices, to notice stopping
+                guard.unlock();
+                pollfd waiting = {listener, POLLIN, 0};
+                long until_next = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        next - clock::now()).count();
+                if (poll(&waiting, 1, std::max(0L, std::min(until_next, 100L))) > 0) {
+                    int client = accept(listener, NULL, NULL);
+                    if (client >= 0) {
+                        guard.lock();
+                        std::string message = latest;
+                        guard.unlock();
+                        for (size_t sent = 0; sent < message.length(); ) {
+                            ssize_t count = send(client, message.data() + sent,
+                                    message.length() - sent, MSG_NOSIGNAL);
+                            if (count <= 0) break;
+                            sent += count;
+                        }
+                        close(client);
+                    }
+                }
+                guard.lock();
+            }
+            if (stopping || clock::now() < next) continue;
+
+            guard.unlock();
+            publish(false);
+            guard.lock();
+            next = clock::now() + std::chrono::microseconds(long(interval * 1e6));
+        }
+    }
+
+    void MetricsReporter::finish()
+    {
+        if (finished) return;
+        finished = true;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+
+        publish(true);
+        if (listener >= 0) {
+            pollfd waiting = {listener, POLLIN, 0};
+            while (poll(&waiting, 1, 0) > 0) {
+                int client = accept(listener, NULL, NULL);
+                if (client < 0) break;
+                send(client, latest.data(), latest.length(), MSG_NOSIGNAL);
+                close(client);
+            }
+            close(listener);
+            unlink(target.c_str());
+        }
+    }
+}
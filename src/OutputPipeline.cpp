@@ -0,0 +1,127 @@
+#include "OutputPipeline.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+
+namespace PUMA {
+
+    OutputPipeline::OutputPipeline(size_t size_x, size_t size_y, size_t buffers,
+            writer write) :
+        cells(size_x * size_y), write(write), writing(false),
+        stopping(false), blocked(0)
+    {
+        if (buffers == 0)
+            throw IllegalValue("At least one output buffer is needed");
+
+        for (size_t i = 0; i < buffers; ++i)
+            free_buffers.push_back(boost::shared_array<landscape>(new landscape[cells]));
+
+        thread = std::thread(&OutputPipeline::writer_loop, this);
+    }
+
+    OutputPipeline::~OutputPipeline()
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+        }
+        queued.notify_one();
+        thread.join();
+    }
+
+    /** Keeps writing after a failure only to release the
+     *  buffers, so that nobody waits on them forever
+     */
+    void OutputPipeline::writer_loop()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        for (;;) {
+            while (!stopping && pending.empty())
+                queued.wait(guard);
+            if (pending.empty()) return;
+
+            queued_frame next = pending.front();
+            pending.pop_front();
+            writing = true;
+
+            if (!failure) {
+                guard.unlock();
+                try {
+                    if (next.write) next.write(next.state, next.frame);
+                    else write(next.state, next.frame);
+                } catch (...) {
+                    guard.lock();
+                    failure = std::current_exception();
+                    guard.unlock();
+                }
+                guard.lock();
+            }
+
+            writing = false;
+            free_buffers.push_back(next.state);
+            written.notify_all();
+        }
+    }
+
+    void OutputPipeline::check_failure()
+    {
+        if (failure) {
+            std::exception_ptr thrown = failure;
+            failure = std::exception_ptr();
+            std::rethrow_exception(thrown);
+        }
+    }
+
+    void OutputPipeline::push(Simulator &simulation, size_t frame)
+    {
+        push(simulation, frame, writer());
+    }
+
+    void OutputPipeline::push(Simulator &simulation, size_t frame, const writer &write)
+    {
+        boost::shared_array<landscape> buffer;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            check_failure();
+
+            if (free_buffers.empty()) {
+                ScopedTimer timer(PHASE_OUTPUT_STALL);
+                long start = get_time_micro_s();
+                while (free_buffers.empty())
+                    written.wait(guard);
+                blocked += get_time_micro_s() - start;
+                check_failure();
+            }
+
+            buffer = free_buffers.back();
+            free_buffers.pop_back();
+        }
+
+        // The copy is done outside of the lock, the buffer being ours
+        boost::shared_array<landscape> state = simulation.get_state();
+        std::copy(state.get(), state.get() + cells, buffer.get());
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            queued_frame next = {buffer, frame, write};
+            pending.push_back(next);
+        }
+        queued.notify_one();
+    }
+
+    void OutputPipeline::flush()
+    {
+        ScopedTimer timer(PHASE_OUTPUT_STALL);
+        std::unique_lock<std::mutex> guard(lock);
+        while (!pending.empty() || writing)
+            written.wait(guard);
+        check_failure();
+    }
+
+    long OutputPipeline::blocked_time()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        return blocked;
+    }
+}
@@ -4,10 +4,84 @@
 #include "exceptions.hpp"
 
 #include <boost/shared_array.hpp>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <unistd.h>
+#include <vector>
 
 namespace PUMA {
 
+    /* ****             ByteSink                    **** */
+
+    ByteSink::ByteSink(size_t capacity) :
+        buffer(capacity > 0 ? capacity : 1), capacity(buffer.size()), used(0), precision(6)
+    {
+    }
+
+    void ByteSink::write_slow(const char *bytes, size_t count)
+    {
+        flush();
+        if (count < buffer.size()) {
+            memcpy(&buffer[0], bytes, count);
+            used = count;
+        } else {
+            write_out(bytes, count);
+        }
+    }
+
+    void ByteSink::make_room(size_t count)
+    {
+        flush();
+        if (count > buffer.size()) buffer.resize(count + capacity);
+    }
+
+    std::streamoff ByteSink::tell()
+    {
+        std::streamoff position = tell_out();
+        return position < 0 ? position : position + (std::streamoff)used;
+    }
+
+    void ByteSink::seek(std::streamoff position)
+    {
+        flush();
+        seek_out(position);
+    }
+
+    void ByteSink::flush()
+    {
+        if (used == 0) return;
+        write_out(&buffer[0], used);
+        used = 0;
+    }
+
+    /* ****             StreamSink                  **** */
+
+    StreamSink::StreamSink(std::ostream *stream, size_t capacity) :
+        ByteSink(capacity), stream(stream), file(dynamic_cast<std::ofstream*>(stream))
+    {
+    }
+
+    void StreamSink::write_out(const char *bytes, size_t count)
+    {
+        if (stream != NULL) stream->write(bytes, count);
+    }
+
+    std::streamoff StreamSink::tell_out()
+    {
+        return stream != NULL ? (std::streamoff)stream->tellp() : -1;
+    }
+
+    void StreamSink::seek_out(std::streamoff position)
+    {
+        if (stream != NULL) stream->seekp(position);
+    }
+
+    bool StreamSink::is_open()
+    {
+        return file != NULL ? file->is_open() : stream != NULL;
+    }
+
     /* ****             Serializer                  **** */
 
     std::list<Serializer*> Serializer::output_methods;
@@ -30,6 +104,21 @@ namespace PUMA {
             throw SerializerNotFound("Serializer " + name + " is not found");
         }
 
+    void Serializer::set_digits(int digits)
+    {
+        if (digits < 1 || digits > 17)
+            throw IllegalValue("The densities are written with 1 to 17 digits");
+        this->digits = digits;
+    }
+
+    void Serializer::serialize(std::ofstream *output_hares, 
+            std::ofstream *output_pumas, const boost::shared_array<landscape> &current_state,
+            size_t size_x, size_t size_y)
+    {
+        StreamSink hares(output_hares), pumas(output_pumas);
+        serialize(GridView(current_state.get(), size_x, size_y), hares, pumas);
+    }
+
     /* ****             GnuplotSerializer           **** */
 
     GnuplotSerializer::GnuplotSerializer()
@@ -41,28 +130,70 @@ namespace PUMA {
     }
 
 
-    void GnuplotSerializer::serialize(std::ofstream *output_hares, 
-            std::ofstream *output_pumas, boost::shared_array<landscape> current_state,
-            size_t size_x, size_t size_y)
+    void GnuplotSerializer::serialize(const GridView &state, 
+            ByteSink &output_hares, ByteSink &output_pumas)
     {
-        for (int j = 0; (unsigned)j < size_y; ++j) {
-            for (int i = 0; (unsigned)i < size_x; ++i) {
-                size_t index = j * size_x + i;
-
-                *output_hares << current_state[index].hare_density << " ";
-                *output_pumas << current_state[index].puma_density << " ";
-            }
-            *output_hares << std::endl;
-            *output_pumas << std::endl;
-        }  
-        *output_hares << std::endl;
-        *output_pumas << std::endl;
+        size_t size_x = state.get_size_x();
+        size_t row_bytes = size_x * (max_number_length + 1) + 1;
+
+        for (int species = 0; species < 2; ++species) {
+            rows.write(species == 0 ? output_hares : output_pumas, state.get_size_y(),
+                    row_bytes, [&](size_t j, char *text) {
+                const landscape *row = state.row(j);
+                for (size_t i = 0; i < size_x; ++i) {
+                    text = format_real(species == 0 ? row[i].hare_density :
+                            row[i].puma_density, digits, text);
+                    *text++ = ' ';
+                }
+                *text++ = '\n';
+                return text;
+            });
+        }
+        output_hares << '\n';
+        output_pumas << '\n';
     }
 
     GnuplotSerializer gnuplot_serializer_instance;
 
     /* ****             VMDSerializer               **** */
 
+    /** \brief Writes the hare, the puma and the plane atoms of
+     *      every cell, as lines of an XYZ file
+     */
+    static void write_xyz_atoms(const GridView &state, ByteSink &output,
+            RowFormatter &rows, int digits, double scale)
+    {
+        // Every line is a letter, two integers and a real
+        size_t row_bytes = state.get_size_x() * 3 * (3 * max_number_length + 4);
+
+        rows.write(output, state.get_size_y(), row_bytes, [&](size_t j, char *text) {
+            const landscape *row = state.row(j);
+            char y[max_number_length];
+            size_t y_length = format_integer((unsigned long long)j, y) - y;
+
+            for (size_t i = 0; i < state.get_size_x(); ++i) {
+                char x[max_number_length];
+                size_t x_length = format_integer((unsigned long long)i, x) - x;
+
+                for (int atom = 0; atom < 3; ++atom) {
+                    *text++ = atom == 0 ? 'S' : atom == 1 ? 'H' : row[i].is_land ? 'C' : 'O';
+                    *text++ = ' ';
+                    memcpy(text, x, x_length);
+                    text += x_length;
+                    *text++ = ' ';
+                    memcpy(text, y, y_length);
+                    text += y_length;
+                    *text++ = ' ';
+                    if (atom == 2) *text++ = '0';
+                    else text = format_real((atom == 0 ? row[i].hare_density :
+                                row[i].puma_density) * scale, digits, text);
+                    *text++ = '\n';
+                }
+            }
+            return text;
+        });
+    }
+
     VMDSerializer::VMDSerializer()
     {
         name = "vmd";
@@ -73,9 +204,8 @@ namespace PUMA {
         Serializer::output_methods.push_back(this);
     }
 
-    void VMDSerializer::serialize(std::ofstream *output, 
-            std::ofstream *nothing, boost::shared_array<landscape> current_state,
-            size_t size_x, size_t size_y)
+    void VMDSerializer::serialize(const GridView &state, 
+            ByteSink &output, ByteSink &nothing)
     {
         ignore(nothing);
 
@@ -88,26 +218,149 @@ namespace PUMA {
          * pumas as hydrogen, land as carbon and water as
          * oxygen.
          */
-        *output << 3 * size_x * size_y - 1<< std::endl;
-        for (int j = 0; (unsigned)j < size_y; ++j) {
-            for (int i = 0; (unsigned)i < size_x; ++i) {
-                size_t index = j * size_x + i;
+        output << 3 * state.get_size_x() * state.get_size_y() - 1 << '\n';
+        write_xyz_atoms(state, output, rows, digits, scale);
+    }
 
-                *output << "S " << i << " " << j << " " << 
-                    current_state[index].hare_density * scale << std::endl;
-                *output << "H " << i << " " << j << " " <<
-                    current_state[index].puma_density * scale << std::endl;
+    VMDSerializer vmd_serializer_instance;
 
-                if (current_state[index].is_land) *output << "C ";
-                else *output << "O ";
+    /* ****             DCDSerializer               **** */
 
-                *output << i << " " << j << " 0" << std::endl;
+    DCDSerializer::DCDSerializer()
+    {
+        name = "dcd";
+        description = "Outputs to a VMD compatible DCD trajectory, holding "
+            "only the densities of the land after the first frame, "
+            "with the atoms described by an XYZ structure in the "
+            "auxiliary output, named after the main one by default";
+        extension = "dcd";
+        aux_extension = "xyz";
+        scale = 10.0;
+        force_files_split = false;
+
+        Serializer::output_methods.push_back(this);
+    }
 
+    /// Writes a Fortran unformatted record, framed by its length
+    static void write_dcd_record(ByteSink &output, const void *data, int32_t length)
+    {
+        output.write(&length, sizeof(length));
+        output.write(data, length);
+        output.write(&length, sizeof(length));
+    }
+
+    /** The atoms are those of the vmd serializer, a hare, a
+     *  puma and the plane for every cell, the first frame
+     *  holding all of them and the later ones only the free
+     *  atoms, listed in the header. The sizes of both kinds of
+     *  frames are fixed, so the number of frames follows from
+     *  the length of the file.
+     */
+    void DCDSerializer::serialize(const GridView &state, 
+            ByteSink &output, ByteSink &structure)
+    {
+        size_t size_x = state.get_size_x(), size_y = state.get_size_y();
+        size_t cells = size_x * size_y;
+        int32_t atoms = 3 * cells;
+
+        std::vector<int32_t> free_atoms;
+        for (size_t index = 0; index < cells; ++index) {
+            if (!state.is_land(index % size_x, index / size_x)) continue;
+            free_atoms.push_back(3 * index + 1);
+            free_atoms.push_back(3 * index + 2);
+        }
+        int32_t moving = free_atoms.size();
+
+        const int titles = 2;
+        std::streamoff header_size = (4 + 84 + 4) + (4 + 4 + 80 * titles + 4) +
+            (4 + 4 + 4) + (4 + 4 * moving + 4);
+        std::streamoff first_frame_size = 3 * (4 + 4 * atoms + 4);
+        std::streamoff frame_size = 3 * (4 + 4 * moving + 4);
+
+        int32_t control[21];
+        memset(control, 0, sizeof(control));
+        memcpy(&control[0], "CORD", 4);
+
+        std::streamoff position = output.tell();
+        if (position <= 0) {
+            /* DELTA is the timestep, NSAVC the steps between two
+             * frames, which are not known here and left at 1
+             */
+            float delta = parameters.dt;
+            control[3] = 1;
+            control[9] = atoms - moving;
+            memcpy(&control[10], &delta, sizeof(delta));
+            control[20] = 24;
+            write_dcd_record(output, control, sizeof(control));
+
+            // The titles are 80 characters, blank padded and not terminated
+            const char *lines[titles] = {"PUMA hares (S), pumas (H), land (C) and water (O)",
+                "densities scaled along z, see the .xyz structure"};
+            char title[4 + 80 * titles];
+            int32_t count = titles;
+            memcpy(title, &count, sizeof(count));
+            for (int line = 0; line < titles; ++line) {
+                char padded[80 + 1];
+                snprintf(padded, sizeof(padded), "%-80s", lines[line]);
+                memcpy(title + 4 + 80 * line, padded, 80);
+            }
+            write_dcd_record(output, title, sizeof(title));
+            write_dcd_record(output, &atoms, sizeof(atoms));
+            write_dcd_record(output, free_atoms.empty() ? NULL : &free_atoms[0],
+                    4 * moving);
+
+            std::vector<float> x(atoms), y(atoms), z(atoms);
+            for (size_t j = 0; j < size_y; ++j) {
+                for (size_t i = 0; i < size_x; ++i) {
+                    size_t index = j * size_x + i;
+                    for (int atom = 0; atom < 3; ++atom) {
+                        x[3 * index + atom] = i;
+                        y[3 * index + atom] = j;
+                    }
+                    z[3 * index] = state.hare_density(i, j) * scale;
+                    z[3 * index + 1] = state.puma_density(i, j) * scale;
+                    z[3 * index + 2] = 0.0f;
+                }
+            }
+            write_dcd_record(output, &x[0], 4 * atoms);
+            write_dcd_record(output, &y[0], 4 * atoms);
+            write_dcd_record(output, &z[0], 4 * atoms);
+
+            if (structure.is_open()) {
+                structure << atoms << '\n' << "PUMA landscape\n";
+                write_xyz_atoms(state, structure, rows, digits, scale);
+                structure.flush();
+            }
+            position = header_size + first_frame_size;
+        } else {
+            std::vector<float> x(moving), y(moving), z(moving);
+            for (int32_t atom = 0; atom < moving; ++atom) {
+                size_t index = (free_atoms[atom] - 1) / 3;
+                x[atom] = index % size_x;
+                y[atom] = index / size_x;
+                const landscape &cell = state.at(index % size_x, index / size_x);
+                z[atom] = (free_atoms[atom] % 3 == 1 ? cell.hare_density :
+                        cell.puma_density) * scale;
             }
+            write_dcd_record(output, x.empty() ? NULL : &x[0], 4 * moving);
+            write_dcd_record(output, y.empty() ? NULL : &y[0], 4 * moving);
+            write_dcd_record(output, z.empty() ? NULL : &z[0], 4 * moving);
+            position += frame_size;
         }
+
+        /* NSET, the frame count, and NSTEP, the last step, are
+         * rewritten after every frame so that the file stays
+         * readable. With ISTART 0 and NSAVC 1, NSTEP is NSET.
+         */
+        int32_t frames = 1 + (position - header_size - first_frame_size) / frame_size;
+        output.seek(4 + 4 * 1);
+        output.write(&frames, sizeof(frames));
+        output.seek(4 + 4 * 4);
+        output.write(&frames, sizeof(frames));
+        output.seek(position);
     }
 
-    VMDSerializer vmd_serializer_instance;
+    DCDSerializer dcd_serializer_instance;
 
     /* ****             PlainPPMSerializer               **** */
 
@@ -181,41 +434,149 @@ namespace PUMA {
         return RGB;
     }
 
-    void PlainPPMSerializer::serialize(std::ofstream *output, 
-            std::ofstream *nothing, boost::shared_array<landscape> current_state,
-            size_t size_x, size_t size_y)
+    void PlainPPMSerializer::serialize(const GridView &state, 
+            ByteSink &output, ByteSink &nothing)
     {
         ignore(nothing);
-        rgb colours;
 
         //PlainPPM magic number
-        *output << "P3" << std::endl;
+        output << "P3\n";
 
         // width and height
-        *output << size_x << " " << size_y << std::endl;
+        output << state.get_size_x() << ' ' << state.get_size_y() << '\n';
         // MaxVal so that each sample is 1 byte.
-        *output << 255 << std::endl;
+        output << 255 << '\n';
 
         // raster where we have one value per line to respect the character limit per line
-        for (int j = 0; (unsigned)j < size_y; ++j) {
-            for (int i = 0; (unsigned)i < size_x; ++i) {
-                size_t index = j * size_x + i;
-
-                if (!current_state[index].is_land) {
+        size_t row_bytes = state.get_size_x() * (3 * max_number_length + 3);
+        rows.write(output, state.get_size_y(), row_bytes, [&](size_t j, char *text) {
+            const landscape *row = state.row(j);
+            for (size_t i = 0; i < state.get_size_x(); ++i) {
+                rgb colours;
+                if (!row[i].is_land) {
                     colours.r = 0; 
                     colours.g = 0;
                     colours.b = 250;
                 }
                 else {
-                    colours = densitiesToRGB(current_state[index].hare_density, current_state[index].puma_density);
+                    colours = densitiesToRGB(row[i].hare_density, row[i].puma_density);
                 }
-                *output << colours.r << " " << colours.g << " " << colours.b << std::endl;
+                // The samples are integers, whatever the digits of the densities
+                text = format_integer((long long)colours.r, text);
+                *text++ = ' ';
+                text = format_integer((long long)colours.g, text);
+                *text++ = ' ';
+                text = format_integer((long long)colours.b, text);
+                *text++ = '\n';
             }
-        }
+            return text;
+        });
     }
 
     PlainPPMSerializer plainppm_serializer_instance;
 
+    /* ****             BinarySerializer               **** */
+
+    const char binary_magic[8] = "PUMAFRM";
+
+    BinarySerializer::BinarySerializer()
+    {
+        name = "binary";
+        description = "Outputs to an indexed binary container, "
+            "holding the land mask once and the raw densities "
+            "of every frame. See pumas-convert";
+        extension = "pumas";
+        scale = 1.0;
+        force_files_split = false;
+
+        Serializer::output_methods.push_back(this);
+    }
+
+    void BinarySerializer::serialize(const GridView &state, 
+            ByteSink &output, ByteSink &nothing)
+    {
+        ignore(nothing);
+        size_t size_x = state.get_size_x(), size_y = state.get_size_y();
+        size_t cells = size_x * size_y;
+
+        binary_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, binary_magic, sizeof(header.magic));
+        header.byte_order = binary_byte_order;
+        header.version = binary_version;
+        header.size_x = size_x;
+        header.size_y = size_y;
+        header.mask_offset = sizeof(binary_header);
+        header.frames_offset = (header.mask_offset + cells + 4095) / 4096 * 4096;
+        header.frame_size = (2 * cells * sizeof(double) + 63) / 64 * 64;
+        header.parameters = parameters;
+        header.convergence = convergence;
+
+        // The header and the land mask start every file
+        std::streamoff position = output.tell();
+        if (position <= 0) {
+            std::vector<char> start(header.frames_offset, 0);
+            for (size_t j = 0; j < size_y; ++j)
+                for (size_t i = 0; i < size_x; ++i)
+                    start[header.mask_offset + j * size_x + i] = state.is_land(i, j);
+
+            output.write(&start[0], start.size());
+            position = header.frames_offset;
+        }
+
+        std::vector<double> frame(header.frame_size / sizeof(double), 0.0);
+        for (size_t j = 0; j < size_y; ++j) {
+            const landscape *row = state.row(j);
+            for (size_t i = 0; i < size_x; ++i) {
+                frame[j * size_x + i] = row[i].hare_density;
+                frame[cells + j * size_x + i] = row[i].puma_density;
+            }
+        }
+        output.write(&frame[0], header.frame_size);
+
+        /* Rewriting the header after the frame keeps the file
+         * readable even if the simulation is interrupted
+         */
+        header.frame_count = (position - header.frames_offset) / header.frame_size + 1;
+        std::streamoff end = output.tell();
+        output.seek(0);
+        output.write(&header, sizeof(header));
+        output.seek(end);
+    }
+
+    BinarySerializer binary_serializer_instance;
+
+    void truncate_binary_frames(std::string filename, size_t frames)
+    {
+        std::ifstream input(filename.c_str(), std::ios::binary);
+        if (!input) return;
+
+        binary_header header;
+        input.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!input) {
+            // Killed before the first frame was complete
+            input.close();
+            if (truncate(filename.c_str(), 0) != 0)
+                throw FormatError("Could not truncate " + filename);
+            return;
+        }
+        if (memcmp(header.magic, binary_magic, sizeof(header.magic)) != 0 ||
+                header.version != binary_version || header.byte_order != binary_byte_order)
+            throw FormatError(filename + " is not a binary frames file");
+        input.seekg(0, std::ios::end);
+        uint64_t length = input.tellg();
+        input.close();
+
+        // Never extends the file, if frames are missing they stay so
+        uint64_t complete = length > header.frames_offset && header.frame_size > 0 ?
+            (length - header.frames_offset) / header.frame_size : 0;
+        if (frames > complete) frames = complete;
+
+        length = frames > 0 ? header.frames_offset + frames * header.frame_size : 0;
+        if (truncate(filename.c_str(), length) != 0)
+            throw FormatError("Could not truncate " + filename);
+    }
+
 }
 
 
@@ -1,11 +1,12 @@
 #include "Simulator.hpp"
 #include "exceptions.hpp"
+#include "InitialState.hpp"
+#include "Metrics.hpp"
+#include <functional>
 #include <iostream>
 
 #include <sys/time.h>
 
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_real_distribution.hpp>
 
 namespace PUMA {
 
@@ -24,18 +25,17 @@ namespace PUMA {
      *
      * \param dt defines the time stepsize used in the simulation.
      **/
-    Simulator::Simulator(size_t dim_x, size_t dim_y, bool *land_map) : 
-        size_x(dim_x), size_y(dim_y)
+    Simulator::Simulator(size_t dim_x, size_t dim_y, bool *land_map,
+            boost::shared_ptr<const Topology> topology) : 
+        size_x(dim_x), size_y(dim_y), topology(topology),
+        changes_known(false), tracking(false), statistics_fresh(false)
     {
-        /* Using Mersenne-Twister as the random number generator
-         * as it has much better statistics than plain
-         * linear congruential bit that comes with gcc
+        /* Seeding from the time, initialize can be used
+         * afterwards for a reproducible state
          */
         timeval tv;
         gettimeofday(&tv, NULL);
-        boost::mt19937 rng;
-        boost::random::uniform_real_distribution<> random_data(0, 5);
-        rng.seed(1000000 * tv.tv_sec + tv.tv_usec);
+        UniformDistribution random_data(1000000 * tv.tv_sec + tv.tv_usec);
 
         current_serializer = NULL;
         dt = 0.01;
@@ -51,6 +51,12 @@ namespace PUMA {
         r = 0.08; a = 0.04; b = 0.02;
         m = 0.06; k = 0.2; l = 0.2;
 
+        if (!topology) {
+            this->topology.reset(new Topology(dim_x, dim_y, land_map));
+        } else if (topology->size_x != dim_x || topology->size_y != dim_y) {
+            throw IllegalValue("The topology does not describe the land map");
+        }
+
         /* Allocating the memory for the halo cell, 
          * so that we don't do a terrible amount of mallocks
          * later on in the program
@@ -74,18 +80,11 @@ namespace PUMA {
                 current_state[index].is_land = land_map[index];
                 temp_state[index].is_land = land_map[index];
 
-                if (current_state[index].is_land) {
-                    current_state[index].hare_density = random_data(rng);
-                    current_state[index].puma_density = random_data(rng);
-                } else {
-                    current_state[index].hare_density = 0.0;
-                    current_state[index].puma_density = 0.0;
-                }
-
                 temp_state[index].hare_density = 0.0;
                 temp_state[index].puma_density = 0.0;
             }
         }
+        random_data.fill(current_state.get(), 0, dim_x * dim_y);
     }
 
     /** Removes the data structures that cannot
@@ -97,63 +96,193 @@ namespace PUMA {
     }
 
     /** Determines average values of hare and puma densities
-     *  accross all land cells.
+     *  accross all land cells, from the same sums as
+     *  get_statistics
      */
     average_densities Simulator::get_averages() 
     {
+        refresh_statistics();
+
+        ScopedTimer timer(PHASE_REDUCTION);
+        density_statistics statistics = combine_rows(rows, *components);
+
         average_densities av;
-        av.first = 0.0;
-        av.second = 0.0;
-        size_t landcells = 0;
+        av.first = statistics.hares.total / (double) statistics.land_cells;
+        av.second = statistics.pumas.total / (double) statistics.land_cells;
+        return av;
+    }
 
-        for (int j = 0; (unsigned)j < size_y; ++j) {
-            for (int i = 0; (unsigned)i < size_x; ++i) {
-                size_t index = j * size_x + i;
-                if (current_state[index].is_land) {
-                    ++landcells;
-                    av.first += current_state[index].hare_density;
-                    av.second += current_state[index].puma_density;
-                }
-            }
+    density_statistics Simulator::get_statistics()
+    {
+        refresh_statistics();
+
+        ScopedTimer timer(PHASE_REDUCTION);
+        return combine_rows(rows, *components, &span_hares[0], &span_pumas[0]);
+    }
+
+    void Simulator::track_statistics(bool enable)
+    {
+        tracking = enable;
+        statistics_fresh = false;
+        if (tracking) prepare_statistics();
+    }
+
+    void Simulator::prepare_statistics()
+    {
+        if (components) return;
+
+        components.reset(new LandComponents(*topology));
+        rows.resize(size_y);
+
+        // Never empty, so that the first element can be taken
+        span_hares.resize(components->spans.size() + 1);
+        span_pumas.resize(components->spans.size() + 1);
+    }
+
+    /** Only the statistics collected by a step are kept, as
+     *  nothing tells when the state is changed from outside
+     */
+    void Simulator::refresh_statistics()
+    {
+        if (statistics_fresh) return;
+
+        ScopedTimer timer(PHASE_REDUCTION);
+        changes_known = false;
+        prepare_statistics();
+        if (workers) {
+            workers->run(std::bind(&Simulator::collect_rows, this,
+                        std::placeholders::_1, std::placeholders::_2), size_y);
+        } else {
+            collect_rows(0, size_y);
         }
+    }
 
-        av.first = av.first / (double) landcells;
-        av.second = av.second / (double) landcells;
-        return av;
+    void Simulator::collect_rows(size_t j_begin, size_t j_end)
+    {
+        for (size_t j = j_begin; j < j_end; ++j)
+            collect_row(j, rows[j], &span_hares[0], &span_pumas[0]);
+    }
+
+    void Simulator::collect_changed_rows()
+    {
+        ScopedTimer timer(PHASE_REDUCTION);
+        changes_known = true;
+        if (workers) {
+            workers->run(std::bind(&Simulator::collect_rows, this,
+                        std::placeholders::_1, std::placeholders::_2), size_y);
+        } else {
+            collect_rows(0, size_y);
+        }
     }
 
-    /// Applies a step in the simulation 
+    void Simulator::collect_row(size_t j, row_statistics &row,
+            double *span_hares, double *span_pumas)
+    {
+        const landscape *first = &current_state[j * size_x];
+        const landscape *previous = &temp_state[j * size_x];
+        PUMA::collect_row(*components, j, &first->hare_density, &first->puma_density,
+                sizeof(landscape) / sizeof(double), row, span_hares, span_pumas,
+                changes_known ? &previous->hare_density : NULL,
+                changes_known ? &previous->puma_density : NULL);
+    }
+
+    /** Applies a step in the simulation. When the statistics
+     *  are tracked every row is collected as soon as it is
+     *  computed, which only reads the rows just written.
+     */
     void Simulator::apply_step() 
+    {
+        if (!tracking) {
+            statistics_fresh = false;
+            step();
+            return;
+        }
+
+        collecting_step();
+        statistics_fresh = true;
+    }
+
+    void Simulator::collecting_step()
+    {
+        swap_states();
+        changes_known = true;
+
+        WorkerPool::task band = [this](size_t j_begin, size_t j_end) {
+            for (size_t j = j_begin; j < j_end; ++j) {
+                step_rows(j, j + 1);
+                collect_row(j, rows[j], &span_hares[0], &span_pumas[0]);
+            }
+        };
+
+        if (workers) workers->run(band, size_y);
+        else band(0, size_y);
+    }
+
+    void Simulator::apply_steps(size_t steps)
+    {
+        if (steps == 0) return;
+
+        statistics_fresh = false;
+        for (size_t count = 1; count < steps; ++count)
+            step();
+        apply_step();
+    }
+
+    void Simulator::step()
+    {
+        swap_states();
+
+        if (workers) {
+            workers->run(std::bind(&Simulator::step_rows, this,
+                        std::placeholders::_1, std::placeholders::_2), size_y);
+        } else {
+            step_rows(0, size_y);
+        }
+    }
+
+    void Simulator::swap_states()
     {
         // specifies last state
         temp_state.swap(current_state);
-        
+    }
+
+    void Simulator::step_rows(size_t j_begin, size_t j_end)
+    {
         /* applies step of the differential equation 
          * which  models the process
          */
-        for (int j = 0; (unsigned)j < size_y; ++j) {
+        const unsigned char *cells = topology->cells.get();
+        const landscape *last = temp_state.get();
+
+        for (int j = j_begin; (unsigned)j < j_end; ++j) {
             for (int i = 0; (unsigned)i < size_x; ++i) {
                 size_t index = j * size_x + i;
+                unsigned char cell = cells[(j + 1) * topology->stride + i + 1];
 
-                if (current_state[index].is_land) {
-                    size_t nLand = get_cell(i + 1, j)->is_land + 
-                        get_cell(i - 1, j)->is_land +
-                        get_cell(i, j + 1)->is_land +
-                        get_cell(i, j - 1)->is_land;
-
-                    current_state[index].hare_density = get_cell(i, j)->hare_density
-                        + dt * (r * get_cell(i, j)->hare_density
-                                - a * get_cell(i, j)->hare_density * get_cell(i,j)->puma_density
-                                + k * ((get_cell(i - 1, j)->hare_density + get_cell(i + 1, j)->hare_density
-                                        + get_cell(i, j - 1)->hare_density + get_cell(i,j + 1)->hare_density)
-                                    - nLand * get_cell(i, j)->hare_density));
-
-                    current_state[index].puma_density = get_cell(i, j)->puma_density
-                        + dt * (- m * get_cell(i, j)->puma_density
-                                + b * get_cell(i, j)->puma_density * get_cell(i, j)->hare_density
-                                + k * ((get_cell(i - 1, j)->puma_density + get_cell(i + 1, j)->puma_density
-                                        + get_cell(i, j - 1)->puma_density + get_cell(i, j + 1)->puma_density)
-                                    - nLand * get_cell(i, j)->puma_density));
+                if (cell & Topology::LAND) {
+                    /* Neighbours outside of the map or on water 
+                     * are read as empty cells
+                     */
+                    const landscape *here = &last[index];
+                    const landscape *east = (cell & Topology::EAST) ? &last[index + 1] : halo_cell;
+                    const landscape *west = (cell & Topology::WEST) ? &last[index - 1] : halo_cell;
+                    const landscape *south = (cell & Topology::SOUTH) ? &last[index + size_x] : halo_cell;
+                    const landscape *north = (cell & Topology::NORTH) ? &last[index - size_x] : halo_cell;
+                    unsigned int nLand = Topology::neighbours(cell);
+
+                    current_state[index].hare_density = here->hare_density
+                        + dt * (r * here->hare_density
+                                - a * here->hare_density * here->puma_density
+                                + k * ((west->hare_density + east->hare_density
+                                        + north->hare_density + south->hare_density)
+                                    - nLand * here->hare_density));
+
+                    current_state[index].puma_density = here->puma_density
+                        + dt * (- m * here->puma_density
+                                + b * here->puma_density * here->hare_density
+                                + k * ((west->puma_density + east->puma_density
+                                        + north->puma_density + south->puma_density)
+                                    - nLand * here->puma_density));
 
                     // forces positive densities
                     if (current_state[index].hare_density < 0.0) current_state[index].hare_density = 0.0;
@@ -176,15 +305,75 @@ namespace PUMA {
     /// Applies serialization of data to output files
     void Simulator::serialize(std::ofstream *main_output, std::ofstream *aux_output)
     {
+        gather_state();
+
         if (current_serializer == NULL) {
+            Serializer::output_methods.front()->parameters = get_parameters();
             Serializer::output_methods.front()->serialize(main_output, 
                     aux_output, current_state, size_x, size_y);
         } else {
+            current_serializer->parameters = get_parameters();
             current_serializer->serialize(main_output, aux_output, 
                     current_state, size_x, size_y);
         }
     }
 
+    void Simulator::set_threads(size_t threads)
+    {
+        if (threads == 0)
+            throw IllegalValue("At least one thread is needed");
+
+        if (threads == 1) workers.reset();
+        else workers.reset(new WorkerPool(threads));
+    }
+
+    size_t Simulator::get_threads()
+    {
+        return workers ? workers->size() : 1;
+    }
+
+    step_parameters Simulator::get_parameters()
+    {
+        step_parameters params = {r, a, b, m, k, l, dt};
+        return params;
+    }
+
+    /** The rows are split between the threads like
+     *  in apply_step
+     */
+    void Simulator::initialize(const InitialDistribution &initial)
+    {
+        initial.check(size_x, size_y);
+
+        landscape *state = current_state.get();
+        size_t width = size_x;
+        WorkerPool::task fill = [&initial, state, width](size_t j_begin, size_t j_end) {
+            initial.fill(state, j_begin * width, j_end * width);
+        };
+
+        if (workers) workers->run(fill, size_y);
+        else fill(0, size_y);
+
+        scatter_state();
+        statistics_fresh = false;
+    }
+
+    boost::shared_array<landscape> Simulator::get_state()
+    {
+        gather_state();
+        return current_state;
+    }
+
+    void Simulator::set_state(const landscape *state)
+    {
+        for (size_t index = 0; index < size_x * size_y; ++index) {
+            current_state[index].hare_density = state[index].hare_density;
+            current_state[index].puma_density = state[index].puma_density;
+        }
+        scatter_state();
+        statistics_fresh = false;
+    }
+
     /*****          TestSimulator           *****/
     void TestSimulator::set_densities_const(double hare, double puma, size_t x_dim, size_t y_dim)
     {
@@ -0,0 +1,100 @@
+#include "SoASimulator.hpp"
+
+namespace PUMA {
+
+    /** Splits the state initialized by the Simulator constructor
+     *  into separate arrays. The unpadded temp_state is not used
+     *  by this engine, so its memory is released.
+     */
+    template <class Precision>
+    BasicSoASimulator<Precision>::BasicSoASimulator(size_t dim_x, size_t dim_y,
+            bool *land_map, boost::shared_ptr<const Topology> topology) :
+        Simulator(dim_x, dim_y, land_map, topology), stride(dim_x + 2),
+        kernel(&best_kernel<Precision>())
+    {
+        temp_state.reset();
+
+        size_t padded_size = (dim_x + 2) * (dim_y + 2);
+        hare_current.reset(new storage[padded_size]);
+        puma_current.reset(new storage[padded_size]);
+        hare_temp.reset(new storage[padded_size]);
+        puma_temp.reset(new storage[padded_size]);
+
+        // The border stays empty for the whole simulation
+        for (size_t index = 0; index < padded_size; ++index) {
+            hare_current[index] = puma_current[index] = 0.0;
+            hare_temp[index] = puma_temp[index] = 0.0;
+        }
+
+        scatter_state();
+    }
+
+    template <class Precision>
+    void BasicSoASimulator<Precision>::swap_states()
+    {
+        hare_temp.swap(hare_current);
+        puma_temp.swap(puma_current);
+    }
+
+    template <class Precision>
+    void BasicSoASimulator<Precision>::step_rows(size_t j_begin, size_t j_end)
+    {
+        step_parameters params = get_parameters();
+        for (size_t j = j_begin + 1; j <= j_end; ++j) {
+            size_t row = j * stride + 1;
+            kernel->step(&hare_temp[row], &puma_temp[row], &topology->cells[row],
+                    &hare_current[row], &puma_current[row],
+                    size_x, stride, params);
+        }
+    }
+
+    template <class Precision>
+    void BasicSoASimulator<Precision>::collect_row(size_t j, row_statistics &row,
+            double *span_hares, double *span_pumas)
+    {
+        size_t first = (j + 1) * stride + 1;
+        bool changes = this->changes_known;
+        PUMA::collect_row(*this->components, j, &hare_current[first], &puma_current[first],
+                1, row, span_hares, span_pumas, changes ? &hare_temp[first] : NULL,
+                changes ? &puma_temp[first] : NULL);
+    }
+
+    template <class Precision>
+    void BasicSoASimulator<Precision>::set_kernel(std::string name)
+    {
+        kernel = &choose_kernel<Precision>(name);
+    }
+
+    template <class Precision>
+    void BasicSoASimulator<Precision>::gather_state()
+    {
+        for (size_t j = 0; j < size_y; ++j) {
+            for (size_t i = 0; i < size_x; ++i) {
+                size_t index = (j + 1) * stride + i + 1;
+                current_state[j * size_x + i].hare_density = hare_current[index];
+                current_state[j * size_x + i].puma_density = puma_current[index];
+            }
+        }
+    }
+
+    /** Water cells are always loaded as empty, as engines
+     *  stepping only the land never overwrite them
+     */
+    template <class Precision>
+    void BasicSoASimulator<Precision>::scatter_state()
+    {
+        for (size_t j = 0; j < size_y; ++j) {
+            for (size_t i = 0; i < size_x; ++i) {
+                size_t index = (j + 1) * stride + i + 1;
+                bool is_land = topology->cells[index] & Topology::LAND;
+
+                hare_current[index] = is_land ? current_state[j * size_x + i].hare_density : 0.0;
+                puma_current[index] = is_land ? current_state[j * size_x + i].puma_density : 0.0;
+            }
+        }
+    }
+
+    template class BasicSoASimulator<double_precision>;
+    template class BasicSoASimulator<single_precision>;
+    template class BasicSoASimulator<mixed_precision>;
+}
@@ -0,0 +1,84 @@
+#include "SparseSimulator.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace PUMA {
+
+    template <class Precision>
+    BasicSparseSimulator<Precision>::BasicSparseSimulator(size_t dim_x, size_t dim_y,
+            bool *land_map, boost::shared_ptr<const Topology> topology) :
+        BasicSoASimulator<Precision>(dim_x, dim_y, land_map, topology)
+    {
+        const unsigned char *cells = this->topology->cells.get();
+        size_t land_cells = 0;
+
+        for (size_t j = 1; j <= dim_y; ++j) {
+            row_span.push_back(span_start.size());
+
+            for (size_t i = 1; i <= dim_x; ++i) {
+                size_t index = j * this->stride + i;
+                if (!(cells[index] & Topology::LAND)) continue;
+
+                // A new span starts wherever the cell on the left is water
+                if (i == 1 || !(cells[index - 1] & Topology::LAND)) {
+                    span_start.push_back(index);
+                    span_offset.push_back(land_cells);
+                }
+                ++land_cells;
+            }
+        }
+        row_span.push_back(span_start.size());
+        span_offset.push_back(land_cells);
+    }
+
+    template <class Precision>
+    void BasicSparseSimulator<Precision>::step()
+    {
+        this->swap_states();
+
+        size_t land_cells = span_offset.back();
+        if (this->workers) {
+            this->workers->run(std::bind(&BasicSparseSimulator::step_cells, this,
+                        std::placeholders::_1, std::placeholders::_2), land_cells);
+        } else {
+            step_cells(0, land_cells);
+        }
+    }
+
+    template <class Precision>
+    void BasicSparseSimulator<Precision>::step_rows(size_t j_begin, size_t j_end)
+    {
+        step_cells(span_offset[row_span[j_begin]], span_offset[row_span[j_end]]);
+    }
+
+    template <class Precision>
+    void BasicSparseSimulator<Precision>::step_cells(size_t first, size_t last)
+    {
+        if (first >= last) return;
+
+        step_parameters params = this->get_parameters();
+
+        // The last span starting at or before the first cell
+        size_t span = std::upper_bound(span_offset.begin(), span_offset.end(), first)
+            - span_offset.begin() - 1;
+
+        while (first < last) {
+            size_t skip = first - span_offset[span];
+            size_t count = std::min(span_offset[span + 1], last) - first;
+            size_t index = span_start[span] + skip;
+
+            this->kernel->step(&this->hare_temp[index], &this->puma_temp[index],
+                    &this->topology->cells[index],
+                    &this->hare_current[index], &this->puma_current[index],
+                    count, this->stride, params);
+
+            first += count;
+            ++span;
+        }
+    }
+
+    template class BasicSparseSimulator<double_precision>;
+    template class BasicSparseSimulator<single_precision>;
+    template class BasicSparseSimulator<mixed_precision>;
+}
@@ -0,0 +1,89 @@
+#include "Statistics.hpp"
+
+#include <algorithm>
+
+namespace PUMA {
+
+    void density_moments::merge(const density_moments &other)
+    {
+        if (other.cells == 0) return;
+        if (cells == 0) {
+            *this = other;
+            return;
+        }
+
+        double together = cells + other.cells;
+        double delta = other.total / other.cells - total / cells;
+        squares += other.squares + delta * delta * (double(cells) * other.cells / together);
+        total += other.total;
+        cells += other.cells;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+
+    density_summary density_moments::summary() const
+    {
+        density_summary result = {0.0, 0.0, 0.0, 0.0, total};
+        if (cells > 0) {
+            result.mean = total / cells;
+            result.min = min;
+            result.max = max;
+            result.variance = squares / cells;
+        }
+        return result;
+    }
+
+    /// Merges the moments of the rows [first, last) pairwise
+    static row_statistics merge_rows(const std::vector<row_statistics> &rows,
+            size_t first, size_t last)
+    {
+        if (last - first == 1) return rows[first];
+
+        size_t middle = first + (last - first) / 2;
+        row_statistics merged = merge_rows(rows, first, middle);
+        row_statistics second = merge_rows(rows, middle, last);
+        merged.hares.merge(second.hares);
+        merged.pumas.merge(second.pumas);
+        merged.change = std::max(merged.change, second.change);
+        return merged;
+    }
+
+    /// Adds value to sum, keeping the lost low order bits in compensation
+    static void kahan_add(double &sum, double &compensation, double value)
+    {
+        double corrected = value - compensation;
+        double next = sum + corrected;
+        compensation = (next - sum) - corrected;
+        sum = next;
+    }
+
+    density_statistics combine_rows(const std::vector<row_statistics> &rows,
+            const LandComponents &components,
+            const double *span_hares, const double *span_pumas)
+    {
+        row_statistics merged;
+        if (!rows.empty()) merged = merge_rows(rows, 0, rows.size());
+
+        density_statistics result;
+        result.land_cells = merged.hares.cells;
+        result.hares = merged.hares.summary();
+        result.pumas = merged.pumas.summary();
+        result.largest_change = merged.change;
+
+        if (span_hares != NULL) {
+            size_t count = components.components.size();
+            result.region_hares.assign(count, 0.0);
+            result.region_pumas.assign(count, 0.0);
+
+            std::vector<double> hares_compensation(count, 0.0), pumas_compensation(count, 0.0);
+            for (size_t index = 0; index < components.spans.size(); ++index) {
+                size_t component = components.spans[index].component;
+                kahan_add(result.region_hares[component], hares_compensation[component],
+                        span_hares[index]);
+                kahan_add(result.region_pumas[component], pumas_compensation[component],
+                        span_pumas[index]);
+            }
+        }
+        return result;
+    }
+}
@@ -0,0 +1,206 @@
+#include "TextFormat.hpp"
+
+#include "Serializer.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace PUMA {
+
+    /// "00" to "99", two digits at a time
+    static const char digit_pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    /// The powers of ten a double holds exactly
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    /// Precisions written without snprintf, their digits fitting a double
+    static const int fast_precision = 15;
+
+    char* format_integer(unsigned long long value, char *text)
+    {
+        char digits[20];
+        char *first = digits + sizeof(digits);
+        while (value >= 100) {
+            first -= 2;
+            memcpy(first, &digit_pairs[2 * (value % 100)], 2);
+            value /= 100;
+        }
+        if (value >= 10) {
+            first -= 2;
+            memcpy(first, &digit_pairs[2 * value], 2);
+        } else {
+            *--first = '0' + value;
+        }
+
+        size_t length = digits + sizeof(digits) - first;
+        memcpy(text, first, length);
+        return text + length;
+    }
+
+    char* format_integer(long long value, char *text)
+    {
+        if (value >= 0)
+            return format_integer((unsigned long long)value, text);
+
+        // Negated as unsigned, so that the smallest value stays right
+        *text = '-';
+        return format_integer(0ULL - (unsigned long long)value, text + 1);
+    }
+
+    static char* format_printf(double value, int precision, char *text)
+    {
+        return text + snprintf(text, max_number_length, "%.*g", precision, value);
+    }
+
+    /** The value is scaled so that its integer part has as
+     *  many digits as asked for, the exponent found from the
+     *  logarithm being corrected when the rounding gives one
+     *  digit more or less. Then the %g style is chosen by the
+     *  exponent and the trailing zeros of the fraction go.
+     */
+    char* format_real(double value, int precision, char *text)
+    {
+        if (precision < 1 || precision > fast_precision || !std::isfinite(value))
+            return format_printf(value, precision, text);
+
+        char *end = text;
+        if (std::signbit(value)) *end++ = '-';
+        if (value == 0.0) {
+            *end++ = '0';
+            return end;
+        }
+
+        double magnitude = std::fabs(value);
+        int exponent = (int)std::floor(std::log10(magnitude));
+        double upper = powers_of_ten[precision], lower = powers_of_ten[precision - 1];
+
+        unsigned long long digits = 0;
+        for (int attempt = 0; ; ++attempt) {
+            int shift = precision - 1 - exponent;
+            if (attempt == 3 || shift > 22 || shift < -22)
+                return format_printf(value, precision, text);
+
+            // A single rounding, within half an ulp of the exact value
+            double scaled = shift >= 0 ? magnitude * powers_of_ten[shift] :
+                magnitude / powers_of_ten[-shift];
+            double whole = std::floor(scaled), fraction = scaled - whole;
+            if (std::fabs(fraction - 0.5) < 4.0 * DBL_EPSILON * scaled)
+                return format_printf(value, precision, text);
+
+            if (scaled > upper - 0.5) {
+                ++exponent;
+            } else if (scaled < lower - 0.5) {
+                --exponent;
+            } else {
+                digits = (unsigned long long)whole + (fraction > 0.5 ? 1 : 0);
+                break;
+            }
+        }
+
+        char significant[fast_precision];
+        for (int digit = precision - 1; digit >= 0; --digit) {
+            significant[digit] = '0' + digits % 10;
+            digits /= 10;
+        }
+        int count = precision;
+        while (count > 1 && significant[count - 1] == '0')
+            --count;
+
+        if (exponent < -4 || exponent >= precision) {
+            *end++ = significant[0];
+            if (count > 1) {
+                *end++ = '.';
+                memcpy(end, significant + 1, count - 1);
+                end += count - 1;
+            }
+            *end++ = 'e';
+            *end++ = exponent < 0 ? '-' : '+';
+            int shown = exponent < 0 ? -exponent : exponent;
+            if (shown < 10) *end++ = '0';
+            return format_integer((unsigned long long)shown, end);
+        } else if (exponent >= 0) {
+            memcpy(end, significant, exponent + 1);
+            end += exponent + 1;
+            if (count > exponent + 1) {
+                *end++ = '.';
+                memcpy(end, significant + exponent + 1, count - exponent - 1);
+                end += count - exponent - 1;
+            }
+        } else {
+            *end++ = '0';
+            *end++ = '.';
+            memset(end, '0', -exponent - 1);
+            end += -exponent - 1;
+            memcpy(end, significant, count);
+            end += count;
+        }
+        return end;
+    }
+
+    /* ****             RowFormatter                **** */
+
+    RowFormatter::RowFormatter()
+    {
+    }
+
+    RowFormatter::~RowFormatter()
+    {
+    }
+
+    void RowFormatter::set_threads(size_t threads)
+    {
+        if (threads == 0)
+            throw IllegalValue("At least one thread is needed");
+
+        if (threads == 1) workers.reset();
+        else workers.reset(new WorkerPool(threads));
+    }
+
+    size_t RowFormatter::get_threads()
+    {
+        return workers ? workers->size() : 1;
+    }
+
+    void RowFormatter::write(ByteSink &output, size_t count, size_t row_bytes,
+            const row_task &format)
+    {
+        if (!workers) {
+            for (size_t row = 0; row < count; ++row)
+                output.commit(format(row, output.reserve(row_bytes)));
+            return;
+        }
+
+        // A few rows for every thread, and about a megabyte
+        size_t block = std::max(4 * workers->size(),
+                (size_t)(1 << 20) / std::max(row_bytes, (size_t)1));
+        if (block > count) block = count;
+        if (texts.size() < block) {
+            texts.resize(block);
+            lengths.resize(block);
+        }
+
+        for (size_t first = 0; first < count; first += block) {
+            size_t rows = std::min(block, count - first);
+            WorkerPool::task band = [&](size_t begin, size_t end) {
+                for (size_t row = begin; row < end; ++row) {
+                    std::vector<char> &text = texts[row];
+                    if (text.size() < row_bytes) text.resize(row_bytes);
+                    lengths[row] = format(first + row, &text[0]) - &text[0];
+                }
+            };
+            workers->run(band, rows);
+
+            for (size_t row = 0; row < rows; ++row)
+                output.write(&texts[row][0], lengths[row]);
+        }
+    }
+}
@@ -0,0 +1,152 @@
+#include "TiledSimulator.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+namespace PUMA {
+
+    template <class Precision>
+    BasicTiledSimulator<Precision>::BasicTiledSimulator(size_t dim_x, size_t dim_y,
+            bool *land_map, boost::shared_ptr<const Topology> topology) :
+        BasicSoASimulator<Precision>(dim_x, dim_y, land_map, topology), tiles_x(0), tiles_y(0),
+        tile_width(512), tile_height(128), block_steps(8)
+    {
+    }
+
+    /** The tiles are never all in the cache at the same time,
+     *  so when the statistics are tracked the last step is done
+     *  row by row, collecting them on the way
+     */
+    template <class Precision>
+    void BasicTiledSimulator<Precision>::apply_steps(size_t steps)
+    {
+        if (block_steps < 2 || tile_width == 0 || tile_height == 0 || steps == 0) {
+            Simulator::apply_steps(steps);
+            return;
+        }
+
+        tiles_x = (this->size_x + tile_width - 1) / tile_width;
+        tiles_y = (this->size_y + tile_height - 1) / tile_height;
+
+        this->statistics_fresh = false;
+        bool collect = this->tracking;
+        if (collect) --steps;
+
+        while (steps > 0) {
+            size_t depth = std::min(steps, block_steps);
+
+            // A single step gains nothing from the tiling
+            if (depth == 1) {
+                this->step();
+                break;
+            }
+
+            if (this->workers) {
+                this->workers->run(std::bind(&BasicTiledSimulator::advance_tiles, this,
+                            std::placeholders::_1, std::placeholders::_2, depth),
+                        tiles_x * tiles_y);
+            } else {
+                advance_tiles(0, tiles_x * tiles_y, depth);
+            }
+
+            this->hare_temp.swap(this->hare_current);
+            this->puma_temp.swap(this->puma_current);
+            steps -= depth;
+        }
+
+        if (collect) this->apply_step();
+    }
+
+    /** All the coordinates are in the padded arrays, the
+     *  first and last rows and columns being the water border.
+     *  Cells of the border never change, so a ghost zone
+     *  reaching it does not need to shrink on that side.
+     */
+    template <class Precision>
+    void BasicTiledSimulator<Precision>::advance_tiles(size_t first, size_t last, size_t depth)
+    {
+        size_t height = this->size_y + 2;
+        step_parameters params = this->get_parameters();
+
+        size_t buffer_width = std::min(tile_width + 2 * depth, this->stride);
+        size_t buffer_size = buffer_width * std::min(tile_height + 2 * depth, height);
+        std::vector<storage> hare[2], puma[2];
+        std::vector<unsigned char> cells(buffer_size);
+        for (int buffer = 0; buffer < 2; ++buffer) {
+            hare[buffer].resize(buffer_size);
+            puma[buffer].resize(buffer_size);
+        }
+
+        for (size_t tile = first; tile < last; ++tile) {
+            // The inside of the tile
+            size_t y0 = 1 + (tile / tiles_x) * tile_height;
+            size_t y1 = std::min(y0 + tile_height, this->size_y + 1);
+            size_t x0 = 1 + (tile % tiles_x) * tile_width;
+            size_t x1 = std::min(x0 + tile_width, this->size_x + 1);
+
+            // The tile with its ghost zone
+            size_t ghost_y0 = y0 > depth ? y0 - depth : 0;
+            size_t ghost_y1 = std::min(y1 + depth, height);
+            size_t ghost_x0 = x0 > depth ? x0 - depth : 0;
+            size_t ghost_x1 = std::min(x1 + depth, this->stride);
+            size_t width = ghost_x1 - ghost_x0;
+
+            for (size_t y = ghost_y0; y < ghost_y1; ++y) {
+                size_t from = y * this->stride + ghost_x0, to = (y - ghost_y0) * width;
+                memcpy(&hare[0][to], &this->hare_current[from], width * sizeof(storage));
+                memcpy(&puma[0][to], &this->puma_current[from], width * sizeof(storage));
+                memcpy(&cells[to], &this->topology->cells[from], width);
+            }
+
+            /* The second buffer is only read where the first step
+             * wrote, except for the water border of the map
+             */
+            size_t rows = ghost_y1 - ghost_y0;
+            for (size_t y = 0; y < rows; ++y) {
+                if (ghost_x0 == 0) hare[1][y * width] = puma[1][y * width] = 0.0;
+                if (ghost_x1 == this->stride)
+                    hare[1][(y + 1) * width - 1] = puma[1][(y + 1) * width - 1] = 0.0;
+            }
+            if (ghost_y0 == 0) {
+                std::fill(hare[1].begin(), hare[1].begin() + width, 0.0);
+                std::fill(puma[1].begin(), puma[1].begin() + width, 0.0);
+            }
+            if (ghost_y1 == height) {
+                std::fill(hare[1].begin() + (rows - 1) * width, hare[1].begin() + rows * width, 0.0);
+                std::fill(puma[1].begin() + (rows - 1) * width, puma[1].begin() + rows * width, 0.0);
+            }
+
+            for (size_t step = 1; step <= depth; ++step) {
+                const std::vector<storage> &last_hare = hare[(step - 1) % 2];
+                const std::vector<storage> &last_puma = puma[(step - 1) % 2];
+                std::vector<storage> &next_hare = hare[step % 2];
+                std::vector<storage> &next_puma = puma[step % 2];
+
+                // The part of the ghost zone that is still correct
+                size_t from_y = ghost_y0 == 0 ? 1 : ghost_y0 + step;
+                size_t to_y = ghost_y1 == height ? height - 1 : ghost_y1 - step;
+                size_t from_x = ghost_x0 == 0 ? 1 : ghost_x0 + step;
+                size_t to_x = ghost_x1 == this->stride ? this->stride - 1 : ghost_x1 - step;
+
+                for (size_t y = from_y; y < to_y; ++y) {
+                    size_t index = (y - ghost_y0) * width + from_x - ghost_x0;
+                    this->kernel->step(&last_hare[index], &last_puma[index], &cells[index],
+                            &next_hare[index], &next_puma[index],
+                            to_x - from_x, width, params);
+                }
+            }
+
+            for (size_t y = y0; y < y1; ++y) {
+                size_t from = (y - ghost_y0) * width + x0 - ghost_x0, to = y * this->stride + x0;
+                memcpy(&this->hare_temp[to], &hare[depth % 2][from], (x1 - x0) * sizeof(storage));
+                memcpy(&this->puma_temp[to], &puma[depth % 2][from], (x1 - x0) * sizeof(storage));
+            }
+        }
+    }
+
+    template class BasicTiledSimulator<double_precision>;
+    template class BasicTiledSimulator<single_precision>;
+    template class BasicTiledSimulator<mixed_precision>;
+}
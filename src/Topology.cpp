@@ -0,0 +1,47 @@
+#include "Topology.hpp"
+
+namespace PUMA {
+
+    const unsigned char Topology::EAST;
+    const unsigned char Topology::WEST;
+    const unsigned char Topology::SOUTH;
+    const unsigned char Topology::NORTH;
+    const unsigned char Topology::LAND;
+    const int Topology::COUNT_SHIFT;
+
+    Topology::Topology(size_t dim_x, size_t dim_y, const bool *land_map) :
+        size_x(dim_x), size_y(dim_y), stride(dim_x + 2), land_cells(0)
+    {
+        size_t padded_size = (dim_x + 2) * (dim_y + 2);
+        cells.reset(new unsigned char[padded_size]);
+
+        for (size_t index = 0; index < padded_size; ++index)
+            cells[index] = 0;
+
+        for (size_t j = 0; j < dim_y; ++j) {
+            for (size_t i = 0; i < dim_x; ++i) {
+                if (land_map[j * dim_x + i]) {
+                    cells[(j + 1) * stride + i + 1] = LAND;
+                    ++land_cells;
+                }
+            }
+        }
+
+        // The border is water, so no bounds checks are needed here
+        for (size_t j = 1; j <= dim_y; ++j) {
+            for (size_t i = 1; i <= dim_x; ++i) {
+                size_t index = j * stride + i;
+                unsigned char mask = 0;
+
+                if (cells[index + 1] & LAND) mask |= EAST;
+                if (cells[index - 1] & LAND) mask |= WEST;
+                if (cells[index + stride] & LAND) mask |= SOUTH;
+                if (cells[index - stride] & LAND) mask |= NORTH;
+
+                unsigned char count = (mask & 1) + ((mask >> 1) & 1) +
+                    ((mask >> 2) & 1) + ((mask >> 3) & 1);
+                cells[index] |= mask | (count << COUNT_SHIFT);
+            }
+        }
+    }
+}
@@ -0,0 +1,112 @@
+#include "WorkerPool.hpp"
+
+namespace PUMA {
+
+    WorkerPool::WorkerPool(size_t size) :
+        generation(0), running(0), stopping(false),
+        current_task(NULL), current_count(0)
+    {
+        // The caller is the thread number 0
+        for (size_t i = 1; i < size; ++i)
+            threads.push_back(std::thread(&WorkerPool::worker, this, i));
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            stopping = true;
+        }
+        start.notify_all();
+
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads[i].join();
+    }
+
+    size_t WorkerPool::size()
+    {
+        return threads.size() + 1;
+    }
+
+    /** Spreads the rows as evenly as possible, the first
+     *  count % size() bands getting one row more
+     */
+    void WorkerPool::band(size_t band, size_t count, size_t *begin, size_t *end)
+    {
+        size_t bands = size();
+        size_t rows = count / bands, extra = count % bands;
+
+        *begin = band * rows + (band < extra ? band : extra);
+        *end = *begin + rows + (band < extra ? 1 : 0);
+    }
+
+    void WorkerPool::run_band(const task &work, size_t begin, size_t end)
+    {
+        if (begin >= end) return;
+        try {
+            work(begin, end);
+        } catch (...) {
+            std::unique_lock<std::mutex> guard(lock);
+            if (!failure) failure = std::current_exception();
+        }
+    }
+
+    void WorkerPool::worker(size_t number)
+    {
+        size_t seen = 0;
+
+        for (;;) {
+            const task *work;
+            size_t count;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                while (!stopping && generation == seen)
+                    start.wait(guard);
+                if (stopping) return;
+
+                seen = generation;
+                work = current_task;
+                count = current_count;
+            }
+
+            size_t begin, end;
+            band(number, count, &begin, &end);
+            run_band(*work, begin, end);
+
+            std::unique_lock<std::mutex> guard(lock);
+            if (--running == 0) done.notify_one();
+        }
+    }
+
+    void WorkerPool::run(const task &work, size_t count)
+    {
+        if (threads.empty()) {
+            work(0, count);
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            current_task = &work;
+            current_count = count;
+            running = threads.size();
+            ++generation;
+        }
+        start.notify_all();
+
+        size_t begin, end;
+        band(0, count, &begin, &end);
+        run_band(work, begin, end);
+
+        // The workers use the task until they are all done, even after a failure
+        std::unique_lock<std::mutex> guard(lock);
+        while (running > 0)
+            done.wait(guard);
+
+        if (failure) {
+            std::exception_ptr thrown = failure;
+            failure = std::exception_ptr();
+            std::rethrow_exception(thrown);
+        }
+    }
+}
@@ -0,0 +1,466 @@
+#include "Engines.hpp"
+#include "InitialState.hpp"
+#include "MapLoader.hpp"
+#include "Serializer.hpp"
+#include "Simulator.hpp"
+#include "exceptions.hpp"
+#include "helpers.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+namespace po = boost::program_options;
+
+/// How every measurement is repeated
+struct bench_settings {
+    /// Unmeasured repetitions before the measured ones
+    size_t warmup;
+
+    size_t repetitions;
+
+    /// Shortest time a repetition should take, in seconds
+    double min_time;
+
+    size_t threads;
+
+    /// Largest memory a simulation may take, in bytes
+    double max_memory;
+};
+
+/// A land map to step, shipped or synthetic
+struct bench_map {
+    std::string name;
+    PUMA::land_map map;
+    double land_fraction;
+};
+
+/// Rough memory taken by a simulation per cell, whatever the engine
+const double bytes_per_cell = 100.0;
+
+/** \brief Writes the mean, variance, standard deviation
+ *      and extrema of the rates measured by the repetitions
+ */
+void write_rates(std::ostream &output, const std::vector<double> &rates)
+{
+    double mean = 0.0, variance = 0.0;
+    for (size_t index = 0; index < rates.size(); ++index)
+        mean += rates[index];
+    mean /= rates.size();
+    for (size_t index = 0; index < rates.size(); ++index)
+        variance += (rates[index] - mean) * (rates[index] - mean);
+    variance /= rates.size() > 1 ? rates.size() - 1 : 1;
+
+    output << "{\"mean\": " << mean << ", \"variance\": " << variance
+        << ", \"stddev\": " << std::sqrt(variance)
+        << ", \"min\": " << *std::min_element(rates.begin(), rates.end())
+        << ", \"max\": " << *std::max_element(rates.begin(), rates.end())
+        << ", \"samples\": [";
+    for (size_t index = 0; index < rates.size(); ++index)
+        output << (index > 0 ? ", " : "") << rates[index];
+    output << "]}";
+}
+
+/** \brief Runs a task warmup times, then measures the
+ *      rate of the repetitions
+ *  \param task does the work of a repetition, returning how
+ *      much was done, in cells or bytes
+ *  \return the rates of the measured repetitions, per second
+ */
+template <class Task>
+std::vector<double> measure(const bench_settings &settings, Task task)
+{
+    for (size_t repetition = 0; repetition < settings.warmup; ++repetition)
+        task();
+
+    std::vector<double> rates;
+    for (size_t repetition = 0; repetition < settings.repetitions; ++repetition) {
+        long start = PUMA::get_time_micro_s();
+        double done = task();
+        long elapsed = std::max(PUMA::get_time_micro_s() - start, 1L);
+        rates.push_back(done / (elapsed * 1e-6));
+    }
+    return rates;
+}
+
+/** \brief Number of times something taking once_us
+ *      microseconds has to be done to last min_time
+ */
+size_t calibrate(double min_time, long once_us)
+{
+    double times = std::ceil(min_time / (std::max(once_us, 1L) * 1e-6));
+    return std::max(times, 1.0);
+}
+
+/// Lists the files of a directory with any of the extensions, sorted
+std::vector<std::string> list_maps(std::string directory,
+        const std::vector<std::string> &extensions)
+{
+    std::vector<std::string> names;
+    DIR *listing = opendir(directory.c_str());
+    if (listing == NULL) return names;
+
+    while (dirent *entry = readdir(listing)) {
+        std::string name = entry->d_name;
+        for (size_t index = 0; index < extensions.size(); ++index) {
+            const std::string &extension = extensions[index];
+            if (name.length() > extension.length() &&
+                    name.compare(name.length() - extension.length(),
+                        extension.length(), extension) == 0)
+                names.push_back(name);
+        }
+    }
+    closedir(listing);
+
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+/** \brief Builds a square synthetic map
+ *
+ *  The map is made of blocks of 8 x 8 cells, each being land
+ *  with the probability fraction, so that the land comes in
+ *  spans and islands like in the drawn maps rather than as
+ *  scattered cells.
+ */
+PUMA::land_map synthetic_map(size_t size, double fraction, uint32_t seed)
+{
+    PUMA::land_map map;
+    map.size_x = map.size_y = size;
+    map.land.reset(new bool[size * size]);
+
+    size_t blocks = (size + 7) / 8;
+    std::vector<bool> block_land(blocks * blocks);
+    uint32_t state = seed;
+    for (size_t index = 0; index < block_land.size(); ++index) {
+        // Numerical Recipes' linear congruential generator
+        state = state * 1664525u + 1013904223u;
+        block_land[index] = (state >> 8) * (1.0 / (1 << 24)) < fraction;
+    }
+
+    for (size_t j = 0; j < size; ++j) {
+        for (size_t i = 0; i < size; ++i)
+            map.land[j * size + i] = block_land[(j / 8) * blocks + i / 8];
+    }
+    return map;
+}
+
+double land_fraction(const PUMA::land_map &map)
+{
+    size_t cells = map.size_x * map.size_y, land = 0;
+    for (size_t index = 0; index < cells; ++index)
+        land += map.land[index];
+    return cells > 0 ? double(land) / cells : 0.0;
+}
+
+/// Measures the cells stepped per second by apply_step
+void bench_steps(std::ostream &output, const bench_settings &settings,
+        const std::vector<bench_map> &maps, const std::vector<std::string> &engines)
+{
+    output << "  \"step\": [";
+    bool first = true;
+    for (size_t map_index = 0; map_index < maps.size(); ++map_index) {
+        const bench_map &map = maps[map_index];
+        size_t cells = map.map.size_x * map.map.size_y;
+
+        for (size_t engine_index = 0; engine_index < engines.size(); ++engine_index) {
+            std::cerr << "step " << map.name << " " << engines[engine_index] << "\n";
+            output << (first ? "\n" : ",\n") << "    {\"map\": \"" << map.name
+                << "\", \"size_x\": " << map.map.size_x << ", \"size_y\": "
+                << map.map.size_y << ", \"land_fraction\": " << map.land_fraction
+                << ", \"engine\": \"" << engines[engine_index] << "\", ";
+            first = false;
+
+            if (cells * bytes_per_cell > settings.max_memory) {
+                output << "\"skipped\": \"needs more than the allowed memory\"}";
+                continue;
+            }
+
+            boost::scoped_ptr<PUMA::Simulator> simulation;
+            try {
+                simulation.reset(PUMA::create_simulator(engines[engine_index],
+                            map.map.size_x, map.map.size_y, map.map.land.get(),
+                            PUMA::engine_settings()));
+            } catch (const std::bad_alloc &e) {
+                output << "\"skipped\": \"out of memory\"}";
+                continue;
+            } catch (const PUMA::EngineNotFound &e) {
+                output << "\"skipped\": \"no such engine\"}";
+                continue;
+            } catch (PUMA::IllegalValue &e) {
+                output << "\"skipped\": \"" << e.what() << "\"}";
+                continue;
+            }
+            simulation->initialize(PUMA::UniformDistribution(1));
+            simulation->set_threads(settings.threads);
+
+            long start = PUMA::get_time_micro_s();
+            simulation->apply_step();
+            size_t steps = calibrate(settings.min_time, PUMA::get_time_micro_s() - start);
+
+            std::vector<double> rates = measure(settings, [&]() {
+                for (size_t step = 0; step < steps; ++step)
+                    simulation->apply_step();
+                return double(cells) * steps;
+            });
+
+            output << "\"steps\": " << steps << ", \"cells_per_second\": ";
+            write_rates(output, rates);
+            output << "}";
+        }
+    }
+    output << "\n  ],\n";
+}
+
+/// Measures the bytes written per second by every Serializer
+void bench_serializers(std::ostream &output, const bench_settings &settings,
+        size_t size, std::string scratch)
+{
+    PUMA::land_map map = synthetic_map(size, 0.5, 1);
+    PUMA::Simulator simulation(size, size, map.land.get());
+    simulation.initialize(PUMA::UniformDistribution(1));
+    boost::shared_array<PUMA::landscape> state = simulation.get_state();
+
+    std::string main_fn = scratch + "/pumas-bench-main",
+        aux_fn = scratch + "/pumas-bench-aux";
+
+    output << "  \"serializers\": [";
+    std::list<PUMA::Serializer*>::iterator it;
+    for (it = PUMA::Serializer::output_methods.begin();
+            it != PUMA::Serializer::output_methods.end(); ++it) {
+        PUMA::Serializer *serializer = *it;
+        std::cerr << "serializer " << serializer->name << "\n";
+        serializer->parameters = simulation.get_parameters();
+
+        // Every frame goes to fresh files, like with split files
+        auto write = [&]() {
+            std::ofstream main_output(main_fn.c_str()), aux_output(aux_fn.c_str());
+            serializer->serialize(&main_output, &aux_output, state, size, size);
+            double bytes = double(main_output.tellp()) + double(aux_output.tellp());
+            main_output.close();
+            aux_output.close();
+            return bytes;
+        };
+
+        long start = PUMA::get_time_micro_s();
+        double bytes = write();
+        size_t frames = calibrate(settings.min_time, PUMA::get_time_micro_s() - start);
+
+        std::vector<double> rates = measure(settings, [&]() {
+            double written = 0.0;
+            for (size_t frame = 0; frame < frames; ++frame)
+                written += write();
+            return written;
+        });
+
+        output << (it == PUMA::Serializer::output_methods.begin() ? "\n" : ",\n")
+            << "    {\"name\": \"" << serializer->name << "\", \"size_x\": " << size
+            << ", \"size_y\": " << size << ", \"bytes\": " << bytes
+            << ", \"frames\": " << frames << ", \"bytes_per_second\": ";
+        write_rates(output, rates);
+        output << "}";
+    }
+    output << "\n  ],\n";
+
+    unlink(main_fn.c_str());
+    unlink(aux_fn.c_str());
+}
+
+/// Measures the bytes of the shipped maps read per second
+void bench_loaders(std::ostream &output, const bench_settings &settings,
+        std::string directory, const std::vector<std::string> &names)
+{
+    output << "  \"loaders\": [";
+    for (size_t index = 0; index < names.size(); ++index) {
+        std::string filename = directory + "/" + names[index];
+        std::cerr << "loader " << names[index] << "\n";
+
+        struct stat status;
+        if (stat(filename.c_str(), &status) < 0) continue;
+        double bytes = status.st_size;
+
+        long start = PUMA::get_time_micro_s();
+        PUMA::load_land_map(filename);
+        size_t loads = calibrate(settings.min_time, PUMA::get_time_micro_s() - start);
+
+        std::vector<double> rates = measure(settings, [&]() {
+            for (size_t load = 0; load < loads; ++load)
+                PUMA::load_land_map(filename);
+            return bytes * loads;
+        });
+
+        output << (index > 0 ? ",\n" : "\n") << "    {\"map\": \"" << names[index]
+            << "\", \"bytes\": " << bytes << ", \"loads\": " << loads
+            << ", \"bytes_per_second\": ";
+        write_rates(output, rates);
+        output << "}";
+    }
+    output << "\n  ]\n";
+}
+
+/// Splits a comma separated list
+template <typename T>
+std::vector<T> split_list(std::string list)
+{
+    std::vector<T> values;
+    std::istringstream input(list);
+    std::string item;
+    while (std::getline(input, item, ',')) {
+        if (item.empty()) continue;
+        std::istringstream value(item);
+        T parsed;
+        if (!(value >> parsed)) throw PUMA::IllegalValue("Invalid list item " + item);
+        values.push_back(parsed);
+    }
+    return values;
+}
+
+/** Measures the stepping engines, the serializers and the
+ *  map loader, writing the results as JSON. Every rate is
+ *  measured over repetitions long enough to be timed, after
+ *  a warmup, and reported with its spread.
+ */
+int main(int argc, char *argv[])
+{
+    std::ios_base::sync_with_stdio(0);
+
+    bench_settings settings;
+    std::string maps_directory, engines_list, sizes_list, fractions_list,
+        output_fn, scratch;
+    size_t serializer_size;
+    double max_memory_mb;
+
+    po::options_description opts("Options");
+    opts.add_options()
+        ("help,h", "produce help message")
+        ("output,o", po::value<std::string>(&output_fn),
+         "file the JSON results are written to, the standard output by default")
+        ("maps", po::value<std::string>(&maps_directory)->default_value("../data"),
+         "directory of the shipped maps, stepped and loaded as they are")
+        ("engines", po::value<std::string>(&engines_list)->default_value("all"),
+         "comma separated stepping engines to measure, or all")
+        ("sizes", po::value<std::string>(&sizes_list)->default_value("512,2048,8192"),
+         "comma separated sizes of the square synthetic maps")
+        ("fractions", po::value<std::string>(&fractions_list)->default_value("1,0.5,0.1"),
+         "comma separated land fractions of the synthetic maps")
+        ("serializer-size", po::value<size_t>(&serializer_size)->default_value(1024),
+         "size of the square state written by the serializers")
+        ("warmup", po::value<size_t>(&settings.warmup)->default_value(1),
+         "unmeasured repetitions before the measured ones")
+        ("repetitions,r", po::value<size_t>(&settings.repetitions)->default_value(5),
+         "measured repetitions of every measurement")
+        ("min-time", po::value<double>(&settings.min_time)->default_value(0.2),
+         "shortest time in seconds a repetition lasts, as many steps, "
+         "frames or loads being done as needed")
+        ("threads,t", po::value<size_t>(&settings.threads)->default_value(1),
+         "number of threads the engines use")
+        ("max-memory", po::value<double>(&max_memory_mb)->default_value(0),
+         "maps needing more memory than this many megabytes are skipped, "
+         "by default 80% of the physical memory")
+        ("scratch", po::value<std::string>(&scratch)->default_value("/tmp"),
+         "directory the serializers write to")
+        ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, opts), vm);
+        po::notify(vm);
+    } catch (const po::error &e) {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    if (vm.count("help")) {
+        std::cerr << "Usage: pumas-bench [options]\n" << opts << std::endl;
+        return 0;
+    }
+    if (settings.repetitions == 0) {
+        std::cerr << "At least one repetition is needed\n";
+        return -1;
+    }
+
+    settings.max_memory = max_memory_mb > 0 ? max_memory_mb * 1e6 :
+        0.8 * sysconf(_SC_PHYS_PAGES) * double(sysconf(_SC_PAGESIZE));
+
+    std::vector<std::string> engines;
+    std::vector<size_t> sizes;
+    std::vector<double> fractions;
+    try {
+        if (engines_list == "all") {
+            const std::list<PUMA::Engine> &available = PUMA::available_engines();
+            for (std::list<PUMA::Engine>::const_iterator it = available.begin();
+                    it != available.end(); ++it)
+                engines.push_back(it->name);
+        } else {
+            engines = split_list<std::string>(engines_list);
+        }
+        sizes = split_list<size_t>(sizes_list);
+        fractions = split_list<double>(fractions_list);
+    } catch (PUMA::IllegalValue &e) {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+
+    std::vector<bench_map> maps;
+    std::vector<std::string> dat_maps = list_maps(maps_directory,
+            std::vector<std::string>(1, ".dat"));
+    std::vector<std::string> extensions;
+    extensions.push_back(".dat");
+    extensions.push_back(".pnm");
+    std::vector<std::string> all_maps = list_maps(maps_directory, extensions);
+
+    try {
+        for (size_t index = 0; index < dat_maps.size(); ++index) {
+            bench_map map;
+            map.name = dat_maps[index];
+            map.map = PUMA::load_land_map(maps_directory + "/" + dat_maps[index]);
+            map.land_fraction = land_fraction(map.map);
+            maps.push_back(map);
+        }
+    } catch (PUMA::FormatError &e) {
+        std::cerr << e.what() << "\n";
+        return -1;
+    }
+    for (size_t size = 0; size < sizes.size(); ++size) {
+        for (size_t fraction = 0; fraction < fractions.size(); ++fraction) {
+            std::ostringstream name;
+            name << "synthetic-" << sizes[size] << "-" << fractions[fraction];
+
+            bench_map map;
+            map.name = name.str();
+            map.map = synthetic_map(sizes[size], fractions[fraction], 1);
+            map.land_fraction = land_fraction(map.map);
+            maps.push_back(map);
+        }
+    }
+
+    std::ofstream file;
+    if (vm.count("output")) file.open(output_fn.c_str());
+    std::ostream &output = vm.count("output") ? file : std::cout;
+    output << std::setprecision(9);
+
+    output << "{\n  \"settings\": {\"warmup\": " << settings.warmup
+        << ", \"repetitions\": " << settings.repetitions
+        << ", \"min_time\": " << settings.min_time
+        << ", \"threads\": " << settings.threads << "},\n";
+    bench_steps(output, settings, maps, engines);
+    bench_serializers(output, settings, serializer_size, scratch);
+    bench_loaders(output, settings, maps_directory, all_maps);
+    output << "}\n";
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "Compression.hpp"
+#include "Ensemble.hpp"
+#include "FrameReader.hpp"
+#include "Serializer.hpp"
+#include "exceptions.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+#include <boost/program_options/positional_options.hpp>
+namespace po = boost::program_options;
+
+/** Converts the files written by the binary serializer
+ *  into any of the other output formats, offline. The
+ *  results of an ensemble are printed as a table instead,
+ *  and compressed outputs are decompressed.
+ */
+int main(int argc, char *argv[])
+{
+    std::ios_base::sync_with_stdio(0);
+
+    std::string input_filename, output_fn, aux_output_fn, output_extension,
+        output_method, output_methods_desc = "";
+    size_t first, last, format_threads;
+    int output_digits;
+    bool split_files;
+
+    std::list<PUMA::Serializer*>::iterator it;
+    for (it = PUMA::Serializer::output_methods.begin();
+            it != PUMA::Serializer::output_methods.end(); ++it) {
+        output_methods_desc += (*it)->name + ": \t" + 
+            (*it)->description + "\n\n";
+    }
+
+    po::options_description opts("Options");
+    opts.add_options()
+        ("help,h", "produce help message")
+        ("output,o", 
+         po::value<std::string>(&output_fn)->default_value("output"),
+         "the main output file, or hares output file for methods requiring auxiliary outputs")
+        ("aux,u",
+         po::value<std::string>(&aux_output_fn),
+         "auxiliary output file, ie. puma output file, used by some output methods")
+        ("output-format,f",
+         po::value<std::string>(&output_method)->default_value("vmd"),
+         ("The currently available output methods are: \n" + 
+          output_methods_desc).c_str())
+        ("output-extension,x",
+          po::value<std::string>(&output_extension),
+          "override an output method defined output extension")
+        ("split-files", po::value<bool>(&split_files)->default_value(false),
+         "print each frame in a separate output file. Setting to"
+         " true overrides settings requested by chosen Serializer")
+        ("output-digits", po::value<int>(&output_digits)->default_value(6),
+         "significant digits of the densities written by the text "
+         "output methods, as printf's %g writes them")
+        ("format-threads", po::value<size_t>(&format_threads)->default_value(1),
+         "number of threads formatting the rows of a frame for the "
+         "text output methods")
+        ("first", po::value<size_t>(&first)->default_value(0),
+         "first frame to convert")
+        ("last", po::value<size_t>(&last)->default_value((size_t)-1),
+         "last frame to convert")
+        ;
+
+    po::options_description hidden_opts;
+    hidden_opts.add_options()
+        ("input-file,I", po::value<std::string>(&input_filename),
+         "binary file written by the binary output method, ensemble "
+         "results or a compressed output")
+        ;
+
+    po::options_description cmdline_opts;
+    cmdline_opts.add(opts).add(hidden_opts);
+
+    po::positional_options_description p;
+    p.add("input-file", -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).
+            options(cmdline_opts).positional(p).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        std::cerr << "Usage: pumas-convert [options] input-file\n" << opts << std::endl;
+        return 0;
+    } else if (!vm.count("input-file")) {
+        std::cerr << "You need to provide an input file\n";
+        return -1;
+    }
+
+    try {
+        std::ifstream input(input_filename.c_str(), std::ios::binary);
+        char magic[8] = "";
+        input.read(magic, sizeof(magic));
+        if (std::string(magic, 7) == "PUMAENS") {
+            PUMA::ensemble_results results;
+            input.seekg(0);
+            results.read(input);
+
+            if (vm.count("output") && !vm["output"].defaulted()) {
+                std::ofstream output((output_fn + ".txt").c_str());
+                results.write_text(output);
+            } else {
+                results.write_text(std::cout);
+            }
+            return 0;
+        }
+        if (std::string(magic, 7) == "PUMACMP") {
+            input.close();
+
+            // Named after the compressed file unless given
+            std::string decompressed = output_fn;
+            if (vm["output"].defaulted()) {
+                size_t suffix = input_filename.rfind(".pz");
+                decompressed = suffix != std::string::npos &&
+                    suffix + 3 == input_filename.length() ?
+                    input_filename.substr(0, suffix) : input_filename + ".out";
+            }
+
+            PUMA::CompressedReader reader(input_filename);
+            std::ofstream output(decompressed.c_str(), std::ios::binary);
+            reader.decompress(output);
+            return 0;
+        }
+        input.close();
+
+        PUMA::FrameReader reader(input_filename);
+        PUMA::Serializer *serializer =
+            PUMA::Serializer::choose_output_method(output_method);
+        serializer->parameters = reader.get_parameters();
+        serializer->set_digits(output_digits);
+        serializer->set_format_threads(format_threads);
+
+        if (serializer->force_files_split)
+            split_files = true;
+        if (output_extension.length() == 0)
+            output_extension = serializer->extension;
+
+        std::string aux_extension = output_extension;
+        if (serializer->aux_extension.length() > 0) {
+            aux_extension = serializer->aux_extension;
+            if (aux_output_fn.length() == 0) aux_output_fn = output_fn;
+        }
+
+        std::ofstream output, aux_output;
+        if (!split_files) {
+            output.open(output_fn + '.' + output_extension);
+            if (aux_output_fn.length() > 0) 
+                aux_output.open(aux_output_fn + '.' + aux_extension);
+        }
+
+        size_t frames = reader.get_frames(), digits = 1;
+        for (size_t number = frames; number >= 10; number /= 10)
+            ++digits;
+
+        for (size_t frame = first; frame <= last && frame < frames; ++frame) {
+            boost::shared_array<PUMA::landscape> state = reader.get_state(frame);
+
+            // Numbered the way the solver numbers them
+            if (split_files) {
+                std::ostringstream output_number;
+                output_number.width(digits);
+                output_number << std::setfill('0') << frame;
+
+                output.open(output_fn + output_number.str() + '.' + output_extension);
+                if (aux_output_fn.length() > 0) 
+                    aux_output.open(aux_output_fn + output_number.str() + 
+                            '.' + aux_extension);
+            }
+
+            serializer->serialize(&output, &aux_output, state,
+                    reader.get_size_x(), reader.get_size_y());
+
+            if (split_files) {
+                output.close();
+                if (aux_output_fn.length() > 0)
+                    aux_output.close();
+            }
+        }
+    } catch (PUMA::FormatError& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    } catch (PUMA::IllegalValue& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    } catch (const PUMA::SerializerNotFound& e) {
+        std::cerr << "The serializer you asked for could not be found\n";
+        return -1;
+    }
+
+    return 0;
+}
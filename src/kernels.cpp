@@ -0,0 +1,251 @@
+#include "kernels.hpp"
+#include "helpers.hpp"
+
+#include <cstdlib>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace PUMA {
+
+#if defined(__SSE2__)
+    /// Widens n descriptions of cells to 32-bit integers
+    static __m128i load_cells_epi32(const unsigned char *cells, size_t n)
+    {
+        int packed = 0;
+        for (size_t i = 0; i < n; ++i)
+            packed |= cells[i] << (8 * i);
+
+        __m128i zero = _mm_setzero_si128();
+        return _mm_unpacklo_epi16(_mm_unpacklo_epi8(
+                    _mm_cvtsi32_si128(packed), zero), zero);
+    }
+
+    static __m128i neighbour_count(__m128i cells)
+    {
+        return _mm_and_si128(_mm_srli_epi32(cells, Topology::COUNT_SHIFT),
+                _mm_set1_epi32(7));
+    }
+
+    /// Vector operations on pairs of doubles
+    struct sse2_double_ops {
+        typedef double storage;
+        typedef __m128d vec;
+        static const size_t width = 2;
+
+        static vec load(const double *p) { return _mm_loadu_pd(p); }
+        static void store(double *p, vec v) { _mm_storeu_pd(p, v); }
+        static vec set1(double x) { return _mm_set1_pd(x); }
+        static vec add(vec x, vec y) { return _mm_add_pd(x, y); }
+        static vec sub(vec x, vec y) { return _mm_sub_pd(x, y); }
+        static vec mul(vec x, vec y) { return _mm_mul_pd(x, y); }
+        static vec max(vec x, vec y) { return _mm_max_pd(x, y); }
+
+        static void load_cells(const unsigned char *cells, vec *count, vec *land)
+        {
+            __m128i wide = load_cells_epi32(cells, 2);
+            *count = _mm_cvtepi32_pd(neighbour_count(wide));
+            *land = _mm_cvtepi32_pd(_mm_srli_epi32(wide, 7));
+        }
+    };
+
+    /// Vector operations on pairs of floats, computed as doubles
+    struct sse2_mixed_ops : public sse2_double_ops {
+        typedef float storage;
+
+        static vec load(const float *p)
+        {
+            return _mm_cvtps_pd(_mm_castsi128_ps(
+                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+        }
+
+        static void store(float *p, vec v)
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(p),
+                    _mm_castps_si128(_mm_cvtpd_ps(v)));
+        }
+    };
+
+    /// Vector operations on quadruples of floats
+    struct sse2_float_ops {
+        typedef float storage;
+        typedef __m128 vec;
+        static const size_t width = 4;
+
+        static vec load(const float *p) { return _mm_loadu_ps(p); }
+        static void store(float *p, vec v) { _mm_storeu_ps(p, v); }
+        static vec set1(double x) { return _mm_set1_ps(x); }
+        static vec add(vec x, vec y) { return _mm_add_ps(x, y); }
+        static vec sub(vec x, vec y) { return _mm_sub_ps(x, y); }
+        static vec mul(vec x, vec y) { return _mm_mul_ps(x, y); }
+        static vec max(vec x, vec y) { return _mm_max_ps(x, y); }
+
+        static void load_cells(const unsigned char *cells, vec *count, vec *land)
+        {
+            __m128i wide = load_cells_epi32(cells, 4);
+            *count = _mm_cvtepi32_ps(neighbour_count(wide));
+            *land = _mm_cvtepi32_ps(_mm_srli_epi32(wide, 7));
+        }
+    };
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+    /* Defined in kernels_avx2.cpp, which is the only file
+     * compiled with AVX2 enabled
+     */
+    void step_avx2_double(const double *hare, const double *puma,
+            const unsigned char *cells, double *hare_out, double *puma_out,
+            size_t count, size_t stride, const step_parameters &params);
+    void step_avx2_float(const float *hare, const float *puma,
+            const unsigned char *cells, float *hare_out, float *puma_out,
+            size_t count, size_t stride, const step_parameters &params);
+    void step_avx2_mixed(const float *hare, const float *puma,
+            const unsigned char *cells, float *hare_out, float *puma_out,
+            size_t count, size_t stride, const step_parameters &params);
+    void step_avx2_batch(const double *hare, const double *puma,
+            const unsigned char *cells, double *hare_out, double *puma_out,
+            size_t count, size_t stride, size_t lanes,
+            const batch_parameters &params);
+
+    static bool avx2_supported()
+    {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+
+    static bool always_supported() { return true; }
+
+    /** Fills the list of kernels of a given precision,
+     *  S and C being the storage and computation types
+     */
+    template <typename S, typename C, class SSE2>
+    static void fill_kernels(std::list<kernel_isa<S> > &kernels,
+            typename kernel_isa<S>::step_kernel avx2, size_t avx2_width)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        kernel_isa<S> avx2_isa = {"avx2", avx2_width, avx2_supported, avx2};
+        kernels.push_back(avx2_isa);
+#else
+        ignore(avx2);
+        ignore(avx2_width);
+#endif
+#if defined(__SSE2__)
+        kernel_isa<S> sse2_isa = {"sse2", SSE2::width, always_supported,
+            step_run<SSE2, scalar_ops<S, C> >};
+        kernels.push_back(sse2_isa);
+#endif
+        kernel_isa<S> scalar_isa = {"scalar", 1, always_supported,
+            step_run<scalar_ops<S, C>, scalar_ops<S, C> >};
+        kernels.push_back(scalar_isa);
+    }
+
+    template <>
+    const std::list<kernel_isa<double> >& available_kernels<double_precision>()
+    {
+        static std::list<kernel_isa<double> > kernels;
+        if (kernels.empty())
+            fill_kernels<double, double, sse2_double_ops>(kernels, step_avx2_double, 4);
+        return kernels;
+    }
+
+    template <>
+    const std::list<kernel_isa<float> >& available_kernels<single_precision>()
+    {
+        static std::list<kernel_isa<float> > kernels;
+        if (kernels.empty())
+            fill_kernels<float, float, sse2_float_ops>(kernels, step_avx2_float, 8);
+        return kernels;
+    }
+
+    template <>
+    const std::list<kernel_isa<float> >& available_kernels<mixed_precision>()
+    {
+        static std::list<kernel_isa<float> > kernels;
+        if (kernels.empty())
+            fill_kernels<float, double, sse2_mixed_ops>(kernels, step_avx2_mixed, 4);
+        return kernels;
+    }
+
+    template <class Precision>
+    const kernel_isa<typename Precision::storage>& best_kernel()
+    {
+        const char *requested = getenv("PUMA_ISA");
+        if (requested != NULL) return choose_kernel<Precision>(requested);
+
+        typedef std::list<kernel_isa<typename Precision::storage> > kernel_list;
+        const kernel_list &kernels = available_kernels<Precision>();
+        for (typename kernel_list::const_iterator it = kernels.begin();
+                it != kernels.end(); ++it) {
+            if (it->supported()) return *it;
+        }
+
+        // The scalar kernel is always there
+        return kernels.back();
+    }
+
+    template <class Precision>
+    const kernel_isa<typename Precision::storage>& choose_kernel(std::string name)
+    {
+        typedef std::list<kernel_isa<typename Precision::storage> > kernel_list;
+        const kernel_list &kernels = available_kernels<Precision>();
+        for (typename kernel_list::const_iterator it = kernels.begin();
+                it != kernels.end(); ++it) {
+            if (it->name == name && it->supported()) return *it;
+        }
+
+        throw IllegalValue("Kernel " + name + " is not available on this CPU");
+    }
+
+    const std::list<batch_kernel_isa>& available_batch_kernels()
+    {
+        static std::list<batch_kernel_isa> kernels;
+        if (kernels.empty()) {
+#if defined(__x86_64__) || defined(__i386__)
+            batch_kernel_isa avx2_isa = {"avx2", 4, avx2_supported, step_avx2_batch};
+            kernels.push_back(avx2_isa);
+#endif
+#if defined(__SSE2__)
+            batch_kernel_isa sse2_isa = {"sse2", sse2_double_ops::width, always_supported,
+                batch_step_run<sse2_double_ops>};
+            kernels.push_back(sse2_isa);
+#endif
+            batch_kernel_isa scalar_isa = {"scalar", 1, always_supported,
+                batch_step_run<scalar_ops<double, double> >};
+            kernels.push_back(scalar_isa);
+        }
+        return kernels;
+    }
+
+    const batch_kernel_isa& best_batch_kernel()
+    {
+        const char *requested = getenv("PUMA_ISA");
+        if (requested != NULL) return choose_batch_kernel(requested);
+
+        const std::list<batch_kernel_isa> &kernels = available_batch_kernels();
+        for (std::list<batch_kernel_isa>::const_iterator it = kernels.begin();
+                it != kernels.end(); ++it) {
+            if (it->supported()) return *it;
+        }
+        return kernels.back();
+    }
+
+    const batch_kernel_isa& choose_batch_kernel(std::string name)
+    {
+        const std::list<batch_kernel_isa> &kernels = available_batch_kernels();
+        for (std::list<batch_kernel_isa>::const_iterator it = kernels.begin();
+                it != kernels.end(); ++it) {
+            if (it->name == name && it->supported()) return *it;
+        }
+
+        throw IllegalValue("Kernel " + name + " is not available on this CPU");
+    }
+
+    template const kernel_isa<double>& best_kernel<double_precision>();
+    template const kernel_isa<float>& best_kernel<single_precision>();
+    template const kernel_isa<float>& best_kernel<mixed_precision>();
+    template const kernel_isa<double>& choose_kernel<double_precision>(std::string);
+    template const kernel_isa<float>& choose_kernel<single_precision>(std::string);
+    template const kernel_isa<float>& choose_kernel<mixed_precision>(std::string);
+}
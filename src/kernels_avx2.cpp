@@ -0,0 +1,145 @@
+#include "kernels.hpp"
+
+// Only declared and used by kernels.cpp on these processors
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cstring>
+#include <immintrin.h>
+
+/* This file is compiled with -mavx2, but without -mfma: fusing
+ * the multiplications with additions would change the rounding
+ * and break the bit-identity with the other engines.
+ *
+ * Everything instantiated here lives in an anonymous namespace,
+ * so that no AVX2 encoded copy of a template shared with
+ * kernels.cpp can end up being used on older CPUs.
+ */
+namespace PUMA {
+namespace {
+
+    /// Same as scalar_ops, for this file only
+    template <typename S, typename C>
+    struct tail_ops {
+        typedef S storage;
+        typedef C vec;
+        static const size_t width = 1;
+
+        static vec load(const S *p) { return *p; }
+        static void store(S *p, vec v) { *p = v; }
+        static vec set1(double x) { return x; }
+        static vec add(vec x, vec y) { return x + y; }
+        static vec sub(vec x, vec y) { return x - y; }
+        static vec mul(vec x, vec y) { return x * y; }
+        static vec max(vec x, vec y) { return x > y ? x : y; }
+
+        static void load_cells(const unsigned char *cells, vec *count, vec *land)
+        {
+            *count = (*cells >> Topology::COUNT_SHIFT) & 7;
+            *land = (*cells & Topology::LAND) ? 1.0 : 0.0;
+        }
+    };
+
+    /// Widens four descriptions of cells to 32-bit integers
+    __m128i load_cells_epi32(const unsigned char *cells)
+    {
+        int packed;
+        memcpy(&packed, cells, sizeof(packed));
+        return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed));
+    }
+
+    __m128i neighbour_count(__m128i cells)
+    {
+        return _mm_and_si128(_mm_srli_epi32(cells, Topology::COUNT_SHIFT),
+                _mm_set1_epi32(7));
+    }
+
+    /// Vector operations on quadruples of doubles
+    struct avx2_double_ops {
+        typedef double storage;
+        typedef __m256d vec;
+        static const size_t width = 4;
+
+        static vec load(const double *p) { return _mm256_loadu_pd(p); }
+        static void store(double *p, vec v) { _mm256_storeu_pd(p, v); }
+        static vec set1(double x) { return _mm256_set1_pd(x); }
+        static vec add(vec x, vec y) { return _mm256_add_pd(x, y); }
+        static vec sub(vec x, vec y) { return _mm256_sub_pd(x, y); }
+        static vec mul(vec x, vec y) { return _mm256_mul_pd(x, y); }
+        static vec max(vec x, vec y) { return _mm256_max_pd(x, y); }
+
+        static void load_cells(const unsigned char *cells, vec *count, vec *land)
+        {
+            __m128i wide = load_cells_epi32(cells);
+            *count = _mm256_cvtepi32_pd(neighbour_count(wide));
+            *land = _mm256_cvtepi32_pd(_mm_srli_epi32(wide, 7));
+        }
+    };
+
+    /// Vector operations on quadruples of floats, computed as doubles
+    struct avx2_mixed_ops : public avx2_double_ops {
+        typedef float storage;
+
+        static vec load(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+        static void store(float *p, vec v) { _mm_storeu_ps(p, _mm256_cvtpd_ps(v)); }
+    };
+
+    /// Vector operations on octuples of floats
+    struct avx2_float_ops {
+        typedef float storage;
+        typedef __m256 vec;
+        static const size_t width = 8;
+
+        static vec load(const float *p) { return _mm256_loadu_ps(p); }
+        static void store(float *p, vec v) { _mm256_storeu_ps(p, v); }
+        static vec set1(double x) { return _mm256_set1_ps(x); }
+        static vec add(vec x, vec y) { return _mm256_add_ps(x, y); }
+        static vec sub(vec x, vec y) { return _mm256_sub_ps(x, y); }
+        static vec mul(vec x, vec y) { return _mm256_mul_ps(x, y); }
+        static vec max(vec x, vec y) { return _mm256_max_ps(x, y); }
+
+        static void load_cells(const unsigned char *cells, vec *count, vec *land)
+        {
+            __m256i wide = _mm256_cvtepu8_epi32(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i*>(cells)));
+            *count = _mm256_cvtepi32_ps(_mm256_and_si256(
+                        _mm256_srli_epi32(wide, Topology::COUNT_SHIFT), _mm256_set1_epi32(7)));
+            *land = _mm256_cvtepi32_ps(_mm256_srli_epi32(wide, 7));
+        }
+    };
+}
+
+    void step_avx2_double(const double *hare, const double *puma,
+            const unsigned char *cells, double *hare_out, double *puma_out,
+            size_t count, size_t stride, const step_parameters &params)
+    {
+        step_run<avx2_double_ops, tail_ops<double, double> >(hare, puma, cells,
+                hare_out, puma_out, count, stride, params);
+    }
+
+    void step_avx2_float(const float *hare, const float *puma,
+            const unsigned char *cells, float *hare_out, float *puma_out,
+            size_t count, size_t stride, const step_parameters &params)
+    {
+        step_run<avx2_float_ops, tail_ops<float, float> >(hare, puma, cells,
+                hare_out, puma_out, count, stride, params);
+    }
+
+    void step_avx2_mixed(const float *hare, const float *puma,
+            const unsigned char *cells, float *hare_out, float *puma_out,
+            size_t count, size_t stride, const step_parameters &params)
+    {
+        step_run<avx2_mixed_ops, tail_ops<float, double> >(hare, puma, cells,
+                hare_out, puma_out, count, stride, params);
+    }
+
+    void step_avx2_batch(const double *hare, const double *puma,
+            const unsigned char *cells, double *hare_out, double *puma_out,
+            size_t count, size_t stride, size_t lanes,
+            const batch_parameters &params)
+    {
+        batch_step_run<avx2_double_ops>(hare, puma, cells,
+                hare_out, puma_out, count, stride, lanes, params);
+    }
+}
+
+#endif
@@ -1,13 +1,26 @@
+#include "Checkpoint.hpp"
+#include "Compression.hpp"
+#include "Convergence.hpp"
 #include "Serializer.hpp"
 #include "Simulator.hpp"
+#include "Engines.hpp"
+#include "Ensemble.hpp"
+#include "InitialState.hpp"
+#include "Integrators.hpp"
+#include "MapLoader.hpp"
+#include "Metrics.hpp"
+#include "OutputPipeline.hpp"
 #include "exceptions.hpp"
 #include "helpers.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/variables_map.hpp>
 #include <boost/program_options/parsers.hpp>
@@ -18,30 +31,144 @@ const std::string version = "1.0";
 
 /** \brief Creates a Simulator instance and initializes
  *      it with input data
- *  \param map_input pointer to a stream from which an
- *      input map can be read
+ *  \param map_filename name of a .dat or PNM file
+ *      holding the land map
+ *  \param engine name of the stepping engine to use
+ *  \param settings tunables of the engine
+ *  \exception FormatError if the map cannot be read
  *  \return pointer to the created Simulator instance
  */
-PUMA::Simulator* initialize(std::ifstream *map_input)
+PUMA::Simulator* initialize(std::string map_filename, std::string engine,
+        const PUMA::engine_settings &settings)
 {
-    size_t size_x, size_y;
-    *map_input >> size_x >> size_y;
+    PUMA::land_map map = PUMA::load_land_map(map_filename);
 
-    bool *land_map = new bool[size_x*size_y];
-    for (size_t j = 0; j < size_y; ++j) {
-        for (size_t i = 0; i < size_x; ++i) {
-            *map_input >> land_map[i + size_x * j];
+    return PUMA::create_simulator(engine, map.size_x, map.size_y,
+            map.land.get(), settings);
+}
+
+/** \brief Steps a simulation alongside a double precision
+ *      twin and prints how far they drift apart
+ *  \param simulation the simulation being validated
+ *  \param reference the same simulation in double precision
+ *  \param steps number of steps to compare over
+ *
+ *  Both start from the state of simulation. The largest
+ *  absolute difference of any cell, over all the steps,
+ *  is printed for hares and pumas.
+ */
+void validate_precision(PUMA::Simulator *simulation, PUMA::Simulator *reference,
+        size_t steps)
+{
+    reference->set_state(simulation->get_state().get());
+
+    double hare_divergence = 0.0, puma_divergence = 0.0;
+    for (size_t step = 1; step <= steps; ++step) {
+        simulation->apply_step();
+        reference->apply_step();
+
+        boost::shared_array<PUMA::landscape> state = simulation->get_state(),
+            expected = reference->get_state();
+        for (size_t index = 0; index < simulation->get_size_x() *
+                simulation->get_size_y(); ++index) {
+            hare_divergence = std::max(hare_divergence,
+                    std::fabs(state[index].hare_density - expected[index].hare_density));
+            puma_divergence = std::max(puma_divergence,
+                    std::fabs(state[index].puma_density - expected[index].puma_density));
         }
     }
-    map_input->close();
 
-    PUMA::Simulator *simulation = 
-        new PUMA::Simulator(size_x, size_y, land_map);
-    delete[] land_map;
+    std::cout << "Maximal divergence from double precision over " << steps
+        << " steps: hares " << hare_divergence << ", pumas "
+        << puma_divergence << std::endl;
+}
 
-    return simulation;
+/** \brief Runs every member of a parameter sweep and
+ *      writes their average densities into a file
+ *  \param map_filename name of the file holding the land map
+ *  \param sweep_filename name of the sweep specification,
+ *      see PUMA::parse_sweep
+ *  \param engine name of the stepping engine to use
+ *  \param settings tunables of the engine
+ *  \param vm the parsed options, giving the default
+ *      parameters of the members
+ *  \param threads number of members run at once
+ *  \param results_filename name of the results file
+ */
+void run_ensemble(std::string map_filename, std::string sweep_filename,
+        std::string engine, const PUMA::engine_settings &settings,
+        const po::variables_map &vm, size_t threads, std::string results_filename)
+{
+    std::ifstream spec(sweep_filename);
+    if (!spec) {
+        std::cerr << "Could not open sweep file " << sweep_filename << "!" << std::endl;
+        throw PUMA::ProgramDeathRequest();
+    }
+
+    PUMA::step_parameters defaults = {vm["r"].as<double>(), vm["a"].as<double>(),
+        vm["b"].as<double>(), vm["m"].as<double>(), vm["k"].as<double>(),
+        vm["l"].as<double>(), vm["dt"].as<double>()};
+    uint64_t seed = vm.count("seed") ? vm["seed"].as<uint64_t>() : PUMA::get_time_micro_s();
+    std::vector<PUMA::ensemble_member> members = PUMA::parse_sweep(spec, defaults, seed);
+
+    // Every member has to be within the stability limit, as a single run is
+    const PUMA::integrator &method = PUMA::choose_integrator(settings.integrator);
+    for (size_t member = 0; member < members.size() && !method.adaptive; ++member) {
+        double limit = PUMA::stability_limit(method, members[member].parameters);
+        if (members[member].parameters.dt > limit) {
+            std::ostringstream message;
+            message << "Timestep " << members[member].parameters.dt << " is beyond the stability limit "
+                << limit << " of the " << method.name << " integrator for member "
+                << member;
+            throw PUMA::IllegalValue(message.str());
+        }
+    }
+
+    // As many steps as the main loop of a single simulation does
+    double end_time = vm["end_time"].as<double>();
+    size_t steps = 0;
+    while (steps * defaults.dt < end_time)
+        ++steps;
+    PUMA::EnsembleRunner runner(PUMA::load_land_map(map_filename), engine, settings);
+
+    long start_time = PUMA::get_time_micro_s();
+    PUMA::ensemble_results results = runner.run(members, steps,
+            vm["print-every"].as<size_t>(), threads);
+
+    std::ofstream output(results_filename.c_str(), std::ios::binary);
+    results.write(output);
+
+    std::cout << "Ran " << members.size() << " members in ";
+    PUMA::format_time(PUMA::get_time_micro_s() - start_time);
 }
 
+/// How the solver watches for and reacts to convergence
+struct convergence_options {
+    /// Tolerances of the ConvergenceMonitor, both 0 if none is run
+    double steady_tolerance, period_tolerance;
+    size_t period_cycles;
+
+    /// Frames are only written every thin_factor frames once converged, 0 to stop
+    size_t thin_factor;
+};
+
+/// Whether and how the output is compressed
+struct compression_options {
+    bool enabled;
+
+    /// Most frames in a chunk, see FrameCompressor
+    size_t chunk_frames;
+};
+
+/// Where and how the metrics of the run are published
+struct metrics_options {
+    /// File or unix:PATH socket, empty if the metrics are not recorded
+    std::string target, format;
+
+    /// Seconds between two snapshots
+    double interval;
+};
+
 /** \brief Parses command line and config file params
  *      and sets the required values
  *  \param argc number of command line arguments
@@ -57,6 +184,20 @@ PUMA::Simulator* initialize(std::ifstream *map_input)
  *      file
  *  \param split_files if set to true each new frame will
  *      be printed in a separate file
+ *  \param output_buffers number of frames that can wait
+ *      to be written, 0 meaning the frames are written
+ *      synchronously
+ *  \param checkpoint_fn filename of the checkpoints
+ *  \param checkpoint_every number of steps between two
+ *      checkpoints, 0 meaning none are taken
+ *  \param seed seed of the initial densities, 0 if they
+ *      were seeded from the time
+ *  \param first_step number of steps already applied when
+ *      resuming from a checkpoint, 0 otherwise
+ *  \param convergence how convergence is detected and
+ *      handled
+ *  \param compression whether the output is compressed
+ *  \param metrics where the metrics of the run go
  *  \return pointer to a completely set up Simulator
  *      instance
  */
@@ -64,11 +205,19 @@ PUMA::Simulator* read_params(int argc, char *argv[],
         double *dt, double *end_time,
         size_t *print_every, int *notify_after,
         std::string *output_fn, std::string *aux_output_fn,
-        std::string *output_extension, bool *split_files)
+        std::string *output_extension, bool *split_files,
+        size_t *output_buffers, std::string *checkpoint_fn,
+        size_t *checkpoint_every, uint64_t *seed, size_t *first_step,
+        convergence_options *convergence, compression_options *compression,
+        metrics_options *metrics)
 {
     double r, a, b, m, k, l;
+    size_t threads, validate_steps, format_threads;
+    int output_digits;
+    PUMA::engine_settings settings;
     std::string output_methods_desc="", output_method,
-        input_filename, input_data_filename;
+        input_filename, input_data_filename, engines_desc="", integrators_desc="", engine,
+        initial_distribution, sweep_filename, restart_filename, on_converge;
 
     /* Build an information string for different Serializers
      * from their names and descriptions
@@ -80,6 +229,21 @@ PUMA::Simulator* read_params(int argc, char *argv[],
             (*it)->description + "\n\n";
     }
 
+    // The same for the stepping engines
+    const std::list<PUMA::Engine> &engines = PUMA::available_engines();
+    std::list<PUMA::Engine>::const_iterator engine_it;
+    for (engine_it = engines.begin(); engine_it != engines.end(); ++engine_it) {
+        engines_desc += engine_it->name + ": \t" + 
+            engine_it->description + "\n\n";
+    }
+
+    // And for the integrators
+    const std::list<PUMA::integrator> &integrators = PUMA::available_integrators();
+    for (std::list<PUMA::integrator>::const_iterator it = integrators.begin();
+            it != integrators.end(); ++it) {
+        integrators_desc += it->name + " (" + it->description + "), ";
+    }
+
     /* Define different parameter groups,
      * for decent presentation and easy management
      */
@@ -106,12 +270,72 @@ PUMA::Simulator* read_params(int argc, char *argv[],
         ("output-extension,x",
           po::value<std::string>(output_extension),
           "override an output method defined output extension")
+        ("output-digits", po::value<int>(&output_digits)->default_value(6),
+         "significant digits of the densities written by the text "
+         "output methods, as printf's %g writes them")
+        ("format-threads", po::value<size_t>(&format_threads)->default_value(1),
+         "number of threads formatting the rows of a frame for the "
+         "text output methods")
         ("notify-after,n", po::value<int>(notify_after)->default_value(30), 
          "print progress to stdout every n frames. Set to -1 to "
          "mute progress messages")
         ("split-files", po::value<bool>(split_files)->default_value(false),
          "print each frame in a separate output file. Setting to"
          " true overrides settings requested by chosen Serializer")
+        ("output-buffers", po::value<size_t>(output_buffers)->default_value(2),
+         "number of frames that can wait to be written by a separate "
+         "output thread while the simulation goes on. Set to 0 to "
+         "write the frames synchronously")
+        ("checkpoint-every", po::value<size_t>(checkpoint_every)->default_value(0),
+         "number of steps between two checkpoints of the simulation, "
+         "written in the background. Set to 0 to take none")
+        ("checkpoint", po::value<std::string>(checkpoint_fn),
+         "checkpoint file, replaced by every new checkpoint. "
+         "The main output file with the chk extension by default")
+        ("restart", po::value<std::string>(&restart_filename),
+         "resume the simulation from a checkpoint, with its parameters "
+         "and timestep. The frames are appended to the outputs; the "
+         "binary output is cut back to the checkpoint, other formats "
+         "may repeat the frames written after it")
+        ("steady-tolerance",
+         po::value<double>(&convergence->steady_tolerance)->default_value(0.0),
+         "stop once no density changes faster than this per unit of "
+         "time, checked at every frame. Set to 0 not to check")
+        ("period-tolerance",
+         po::value<double>(&convergence->period_tolerance)->default_value(0.0),
+         "stop once the average densities repeat the same cycle, with "
+         "the periods and the maxima agreeing to this relative "
+         "tolerance. Set to 0 not to check")
+        ("period-cycles",
+         po::value<size_t>(&convergence->period_cycles)->default_value(3),
+         "number of consecutive cycles that have to agree")
+        ("on-converge",
+         po::value<std::string>(&on_converge)->default_value("stop"),
+         "what to do once converged: stop, or thin[:FACTOR] to go on "
+         "writing only every FACTOR-th frame, 10 by default, and no "
+         "more checkpoints. The binary output records which and when")
+        ("compress", po::value<bool>(&compression->enabled)->default_value(false),
+         "compress the output of any output method on a thread of its "
+         "own, adding the pz extension. Every frame is stored as its "
+         "difference to the one before, run length coded. See "
+         "pumas-convert for decompressing")
+        ("compress-chunk",
+         po::value<size_t>(&compression->chunk_frames)->default_value(16),
+         "most frames in a chunk of the compressed output, a frame being "
+         "read by decompressing at most that many")
+        ("metrics", po::value<std::string>(&metrics->target),
+         "record the time spent stepping, exchanging halos, reducing "
+         "the statistics, serializing, compressing, opening files, "
+         "checkpointing and waiting for the output, and publish it with the steps per "
+         "second into this file, replaced by every snapshot, or to every "
+         "client of the UNIX socket given as unix:PATH")
+        ("metrics-format",
+         po::value<std::string>(&metrics->format)->default_value("json"),
+         "format of the metrics: json or prometheus")
+        ("metrics-every",
+         po::value<double>(&metrics->interval)->default_value(1.0),
+         "seconds between two snapshots of the metrics, the last one "
+         "being published when the run ends")
         ;
 
     po::options_description simulation_opts("Simulation options");
@@ -122,10 +346,68 @@ PUMA::Simulator* read_params(int argc, char *argv[],
          "interval between computation steps")
         ("print-every,p", po::value<size_t>(print_every)->default_value(100), 
          "number of iterations between two output frames")
+        ("engine",
+         po::value<std::string>(&engine)->default_value(engines.front().name),
+         ("The currently available stepping engines are: \n" +
+          engines_desc).c_str())
+        ("threads,t", po::value<size_t>(&threads)->default_value(1),
+         "number of threads the rows of the map are split between, or "
+         "the number of ensemble members run at once with --sweep")
+        ("precision",
+         po::value<std::string>(&settings.precision)->default_value("double"),
+         "precision of the densities: double, float (stored and computed "
+         "as floats) or mixed (stored as floats, computed as doubles). "
+         "Only the soa, sparse, tiled and auto engines support float and mixed")
+        ("sweep", po::value<std::string>(&sweep_filename),
+         "run an ensemble of simulations with the parameters listed in "
+         "this file instead of a single one, writing the time series of "
+         "their average densities, sampled every print-every steps, into "
+         "the main output file with the ens extension. See pumas-convert "
+         "for reading it. Not available with the distributed engine")
+        ("validate", po::value<size_t>(&validate_steps)->default_value(0),
+         "step the simulation this many times alongside a double precision "
+         "one, print the largest difference between them and exit")
+        ("sparse-threshold",
+         po::value<double>(&settings.sparse_threshold)->default_value(0.5),
+         "fraction of land cells under which the auto engine "
+         "steps only the land")
+        ("block-steps",
+         po::value<size_t>(&settings.block_steps)->default_value(8),
+         "number of steps the tiled engine advances a tile by at once")
+        ("tile-width",
+         po::value<size_t>(&settings.tile_width)->default_value(512),
+         "width of the tiles used by the tiled engine")
+        ("tile-height",
+         po::value<size_t>(&settings.tile_height)->default_value(128),
+         "height of the tiles used by the tiled engine")
+        ("batch-lanes",
+         po::value<size_t>(&settings.batch_lanes)->default_value(1),
+         "number of members of a --sweep stepped together in a single "
+         "pass over the map, in double precision. With 1 every member "
+         "is run by the chosen engine")
+        ("ranks",
+         po::value<size_t>(&settings.ranks)->default_value(2),
+         "number of processes the distributed engine splits the map "
+         "between, each stepping a block of it")
+        ("integrator",
+         po::value<std::string>(&settings.integrator)->default_value("euler"),
+         ("time integrator: " + integrators_desc + "Only the soa and "
+          "auto engines in double precision support other than euler").c_str())
+        ("tolerance",
+         po::value<double>(&settings.tolerance)->default_value(1e-6),
+         "absolute and relative tolerance of the adaptive integrators")
         ;
 
     po::options_description simulation_params("Simulation parameters");
     simulation_params.add_options()
+        ("seed", po::value<uint64_t>(seed),
+         "seed of the random initial densities. The same seed gives the "
+         "same initial state whatever the engine and number of threads. "
+         "Seeded from the time if not set")
+        ("init", po::value<std::string>(&initial_distribution)->default_value("uniform"),
+         "initial densities: uniform[:LOW:HIGH] for random ones, 0 to 5 "
+         "by default, constant:HARE:PUMA, or file:NAME[:FRAME] to start "
+         "from a frame of a binary output file, the last by default")
         ("r,r", po::value<double>(&r)->default_value(0.08), 
          "birth rate of hares")
         ("a,a", po::value<double>(&a)->default_value(0.04),
@@ -143,7 +425,7 @@ PUMA::Simulator* read_params(int argc, char *argv[],
     po::options_description hidden_opts("Hidden parameters");
     hidden_opts.add_options()
         ("input-file,I", po::value<std::string>(&input_filename),
-         "input file containing a landmap")
+         "input file containing a landmap, in the .dat or any PNM format")
         ;
 
     /* Group the command line options in more
@@ -201,8 +483,15 @@ PUMA::Simulator* read_params(int argc, char *argv[],
         throw PUMA::ProgramDeathRequest();
     }
 
-    std::ifstream input(input_filename);
-    PUMA::Simulator *simulation = initialize(&input);
+    if (vm.count("sweep")) {
+        if (engine == "distributed")
+            throw PUMA::IllegalValue("--sweep does not work with the distributed engine");
+        run_ensemble(input_filename, sweep_filename, engine, settings, vm, threads,
+                *output_fn + ".ens");
+        throw PUMA::ProgramDeathRequest();
+    }
+
+    PUMA::Simulator *simulation = initialize(input_filename, engine, settings);
 
     // Set the equation parameters
     simulation->r = vm["r"].as<double>();
@@ -213,10 +502,99 @@ PUMA::Simulator* read_params(int argc, char *argv[],
     simulation->l = vm["l"].as<double>();
 
     simulation->dt = *dt;
+    simulation->set_threads(threads);
+
+    // The constructor already gave random densities seeded from the time
+    if (!vm.count("seed")) *seed = 0;
+    if (vm.count("seed") || initial_distribution != "uniform") {
+        uint64_t used = vm.count("seed") ? *seed : PUMA::get_time_micro_s();
+        simulation->initialize(*PUMA::create_distribution(initial_distribution, used));
+    }
+
+    if (checkpoint_fn->empty()) *checkpoint_fn = *output_fn + ".chk";
+
+    *first_step = 0;
+    if (vm.count("restart")) {
+        PUMA::checkpoint snapshot = PUMA::read_checkpoint(restart_filename);
+        size_t size_x = simulation->get_size_x(), size_y = simulation->get_size_y();
+        if (snapshot.size_x != size_x || snapshot.size_y != size_y || snapshot.land_hash !=
+                PUMA::land_hash(simulation->get_state().get(), size_x, size_y)) {
+            delete simulation;
+            throw PUMA::IllegalValue(restart_filename + " was taken on a different land map");
+        }
+
+        simulation->set_state(snapshot.state.get());
+        simulation->r = snapshot.parameters.r;
+        simulation->a = snapshot.parameters.a;
+        simulation->b = snapshot.parameters.b;
+        simulation->m = snapshot.parameters.m;
+        simulation->k = snapshot.parameters.k;
+        simulation->l = snapshot.parameters.l;
+        simulation->dt = *dt = snapshot.parameters.dt;
+        simulation->set_step_size(snapshot.step_size);
+        *seed = snapshot.seed;
+        *first_step = snapshot.step;
+    }
+
+    if (on_converge == "stop") {
+        convergence->thin_factor = 0;
+    } else if (on_converge.compare(0, 4, "thin") == 0) {
+        convergence->thin_factor = 10;
+        if (on_converge.length() > 4) {
+            std::istringstream factor(on_converge.substr(5));
+            if (on_converge[4] != ':' || !(factor >> convergence->thin_factor) ||
+                    !factor.eof() || convergence->thin_factor < 2) {
+                delete simulation;
+                throw PUMA::IllegalValue("Invalid --on-converge " + on_converge);
+            }
+        }
+    } else {
+        delete simulation;
+        throw PUMA::IllegalValue("Invalid --on-converge " + on_converge);
+    }
+
+    // The fixed step integrators blow up beyond their stability limit
+    const PUMA::integrator &method = PUMA::choose_integrator(settings.integrator);
+    if (!method.adaptive && simulation->dt > PUMA::stability_limit(method,
+                simulation->get_parameters())) {
+        std::ostringstream message;
+        message << "Timestep " << simulation->dt << " is beyond the stability limit "
+            << PUMA::stability_limit(method, simulation->get_parameters())
+            << " of the " << method.name << " integrator";
+        delete simulation;
+        throw PUMA::IllegalValue(message.str());
+    }
+
+    if (validate_steps > 0) {
+        PUMA::engine_settings double_settings = settings;
+        double_settings.precision = "double";
+
+        boost::scoped_ptr<PUMA::Simulator> reference(
+                initialize(input_filename, engine, double_settings));
+        reference->r = simulation->r;
+        reference->a = simulation->a;
+        reference->b = simulation->b;
+        reference->m = simulation->m;
+        reference->k = simulation->k;
+        reference->l = simulation->l;
+        reference->dt = simulation->dt;
+        reference->set_threads(threads);
+
+        validate_precision(simulation, reference.get(), validate_steps);
+        delete simulation;
+        throw PUMA::ProgramDeathRequest();
+    }
 
     // Bind the current output method
     simulation->current_serializer = 
         PUMA::Serializer::choose_output_method(output_method);
+    try {
+        simulation->current_serializer->set_digits(output_digits);
+        simulation->current_serializer->set_format_threads(format_threads);
+    } catch (PUMA::IllegalValue& e) {
+        delete simulation;
+        throw;
+    }
 
     return simulation;
 }
@@ -231,9 +609,13 @@ int main(int argc, char *argv[])
     // Parameters for the application
     int notify_after;
     bool split_files;
-    size_t print_every;
+    size_t print_every, output_buffers, checkpoint_every, first_step;
+    uint64_t seed;
     double dt, end_time;
-    std::string output_fn, aux_output_fn, output_extension;
+    std::string output_fn, aux_output_fn, output_extension, checkpoint_fn;
+    convergence_options convergence;
+    compression_options compression;
+    metrics_options metrics;
     PUMA::Simulator *simulation = NULL;
 
     /* Initialize the simulation, stopping execution
@@ -242,12 +624,40 @@ int main(int argc, char *argv[])
     try {
         simulation = read_params(argc, argv, &dt, &end_time, 
                 &print_every, &notify_after, &output_fn, &aux_output_fn,
-                &output_extension, &split_files);
+                &output_extension, &split_files, &output_buffers,
+                &checkpoint_fn, &checkpoint_every, &seed, &first_step,
+                &convergence, &compression, &metrics);
     } catch (const PUMA::ProgramDeathRequest& e) {
         return 0;
     } catch (const PUMA::SerializerNotFound& e) {
         std::cerr << "The serializer you asked for could not be found\n";
         return -1;
+    } catch (const PUMA::EngineNotFound& e) {
+        std::cerr << "The engine you asked for could not be found\n";
+        return -1;
+    } catch (PUMA::IllegalValue& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    } catch (PUMA::FormatError& e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    // Started first, so that the output files are timed too
+    boost::scoped_ptr<PUMA::MetricsReporter> reporter;
+    if (!metrics.target.empty()) {
+        try {
+            reporter.reset(new PUMA::MetricsReporter(metrics.target, metrics.format,
+                        metrics.interval));
+        } catch (PUMA::IllegalValue& e) {
+            std::cerr << e.what() << std::endl;
+            delete simulation;
+            return -1;
+        } catch (PUMA::SystemError& e) {
+            std::cerr << e.what() << std::endl;
+            delete simulation;
+            return -1;
+        }
     }
 
     std::ofstream output, aux_output;
@@ -257,67 +667,288 @@ int main(int argc, char *argv[])
     if (output_extension.length() == 0)
         output_extension = simulation->current_serializer->extension;
 
-    if (!split_files) {
-        output.open(output_fn + '.' + output_extension);
-        if (aux_output_fn.length() > 0) 
-            aux_output.open(aux_output_fn + '.' + output_extension);
+    // Some serializers write something else to the auxiliary output
+    std::string aux_extension = output_extension;
+    if (simulation->current_serializer->aux_extension.length() > 0) {
+        aux_extension = simulation->current_serializer->aux_extension;
+        if (aux_output_fn.length() == 0) aux_output_fn = output_fn;
     }
 
-    // Starts Stopwatch
-    long start_time = PUMA::get_time_micro_s();
-
-    // The main loop
-    for (size_t i = 0; i * dt < end_time; ++i) {
-        simulation->apply_step();
-
-        /* Only print a notification message if they are
-         * not turned off. Print a new one every notify_after frames
-         */
-        if (notify_after != -1 && i%(print_every * notify_after) == 0) { 
-            std::cout << i / print_every << " frames had been written\n";
+    // The compressed outputs get an extension of their own
+    if (compression.enabled) {
+        output_extension += ".pz";
+        aux_extension += ".pz";
+    }
 
-            PUMA::average_densities averages = simulation->get_averages();
-            std::cout << "Average hare and puma densities after " << i / print_every 
-                << " frames are " << averages.first << " and " << averages.second
-                << " respectively." << std::endl;
+    /* A resumed simulation keeps the frames written before its
+     * checkpoint, the first iteration it redoes being first_step
+     */
+    std::ios::openmode mode = std::ios::out;
+    if (first_step > 0 && !split_files) {
+        if (compression.enabled) {
+            std::cerr << "A compressed output cannot be appended to, "
+                "use --split-files to resume a compressed run" << std::endl;
+            return -1;
+        }
+        mode |= std::ios::in | std::ios::ate;
+        if (simulation->current_serializer->name == "binary") {
+            try {
+                PUMA::truncate_binary_frames(output_fn + '.' + output_extension,
+                        (first_step - 1 + print_every - 1) / print_every);
+            } catch (PUMA::FormatError& e) {
+                std::cerr << e.what() << std::endl;
+                return -1;
+            }
         }
+    }
 
-        if (i%print_every == 0) {
-            /* If file splitting is requested (either by the user or the
-             * currently used Serializer) pad the consecutive output
-             * files numbers with zeros.
-             *
-             * Otherwise, just serialize into output file(s)
-             */
-            if (split_files) {
-                std::ostringstream output_number;
-                std::string name1;
+    /* When compressing, the serializers write into the
+     * compressors, which write the files
+     */
+    boost::scoped_ptr<PUMA::FrameCompressor> compressed_output, compressed_aux;
+    auto start_compression = [&]() {
+        if (!compression.enabled) return;
+        compressed_output.reset(new PUMA::FrameCompressor(output, compression.chunk_frames));
+        if (aux_output.is_open()) {
+            compressed_aux.reset(new PUMA::FrameCompressor(aux_output,
+                        compression.chunk_frames));
+        }
+    };
+    auto finish_compression = [&]() {
+        if (compressed_output) compressed_output->finish();
+        if (compressed_aux) compressed_aux->finish();
+        compressed_output.reset();
+        compressed_aux.reset();
+    };
 
-                output_number.width(log(end_time/(dt * print_every ))/log(10) + 1);
-                output_number << std::setfill('0') << i / print_every;
+    if (!split_files) {
+        PUMA::ScopedTimer timer(PUMA::PHASE_FILES);
+        output.open(output_fn + '.' + output_extension, mode);
+        if (!output.is_open())
+            output.open(output_fn + '.' + output_extension);
+        if (aux_output_fn.length() > 0) {
+            aux_output.open(aux_output_fn + '.' + aux_extension, mode);
+            if (!aux_output.is_open())
+                aux_output.open(aux_output_fn + '.' + aux_extension);
+        }
+        start_compression();
+    }
 
+    /* Writes a single frame. If file splitting is requested (either
+     * by the user or the currently used Serializer) pad the consecutive
+     * output files numbers with zeros.
+     *
+     * Otherwise, just serialize into output file(s)
+     */
+    PUMA::Serializer *serializer = simulation->current_serializer;
+    serializer->parameters = simulation->get_parameters();
+    serializer->convergence = PUMA::convergence_record();
+    size_t size_x = simulation->get_size_x(), size_y = simulation->get_size_y();
+    auto serialize_frame = [&](boost::shared_array<PUMA::landscape> state) {
+        PUMA::ScopedTimer timer(PUMA::PHASE_SERIALIZATION);
+        serializer->serialize(&output, &aux_output, state, size_x, size_y);
+        if (compressed_output) compressed_output->end_frame();
+        if (compressed_aux) compressed_aux->end_frame();
+    };
+    auto write_frame = [&](boost::shared_array<PUMA::landscape> state, size_t frame) {
+        PUMA::count_metric(PUMA::COUNTER_FRAMES);
+        if (split_files) {
+            std::ostringstream output_number;
+
+            output_number.width(log(end_time/(dt * print_every ))/log(10) + 1);
+            output_number << std::setfill('0') << frame;
+
+            {
+                PUMA::ScopedTimer timer(PUMA::PHASE_FILES);
                 output.open(output_fn + output_number.str() + '.' + output_extension);
                 if (aux_output_fn.length() > 0) 
                     aux_output.open(aux_output_fn + output_number.str() + 
-                            '.' + output_extension);
-                
-                simulation->serialize(&output, &aux_output);
-
-                output.close();
-                if (aux_output_fn.length() > 0)
-                    aux_output.close();
-            } else {
-                simulation->serialize(&output, &aux_output);
+                            '.' + aux_extension);
+            }
+
+            start_compression();
+            serialize_frame(state);
+            finish_compression();
+
+            PUMA::ScopedTimer timer(PUMA::PHASE_FILES);
+            output.close();
+            if (aux_output_fn.length() > 0)
+                aux_output.close();
+        } else {
+            serialize_frame(state);
+
+            // A checkpoint written after this frame may not get ahead of it
+            if (checkpoint_every > 0) {
+                if (compressed_output) compressed_output->flush();
+                if (compressed_aux) compressed_aux->flush();
+                output.flush();
+                aux_output.flush();
             }
         }
+    };
+
+    /* Unless asked not to, the frames are written by a thread of
+     * their own, the simulation only waiting for it when all the
+     * buffers are full
+     */
+    boost::scoped_ptr<PUMA::OutputPipeline> pipeline;
+    if (output_buffers > 0) {
+        pipeline.reset(new PUMA::OutputPipeline(size_x, size_y,
+                    output_buffers, write_frame));
     }
 
-    // Close the output files, if they require closing
-    if (!split_files) {
-        output.close();
-        if (aux_output_fn.length() > 0) aux_output.close();
+    /* The checkpoints go through the output pipeline when there is
+     * one, so that they are written after the frames before them
+     */
+    boost::scoped_ptr<PUMA::CheckpointWriter> checkpoints;
+    if (checkpoint_every > 0) {
+        checkpoints.reset(new PUMA::CheckpointWriter(checkpoint_fn, *simulation,
+                    seed, pipeline.get()));
     }
 
+    /* The errors of the writers, on the threads of the pipelines
+     * too, are rethrown by the calls below
+     */
+    long start_time;
+    try {
+        // The frame of the last iteration before the checkpoint is redone
+        if (first_step > 0 && (first_step - 1) % print_every == 0) {
+            if (pipeline)
+                pipeline->push(*simulation, (first_step - 1) / print_every);
+            else
+                write_frame(simulation->get_state(), (first_step - 1) / print_every);
+        }
+
+        // Starts Stopwatch
+        start_time = PUMA::get_time_micro_s();
+
+        /* The iteration i leaves the simulation i + 1 steps
+         * after the initial state
+         */
+        /* Once the output is thinned the frames written no longer
+         * match what a resumed run expects, so no checkpoints follow
+         */
+        size_t write_every = print_every;
+        auto checkpoint_due = [&](size_t i) {
+            return checkpoint_every > 0 && write_every == print_every &&
+                (i + 1) % checkpoint_every == 0;
+        };
+
+        // The statistics of the frames are watched for convergence
+        boost::scoped_ptr<PUMA::ConvergenceMonitor> monitor;
+        if (convergence.steady_tolerance > 0.0 || convergence.period_tolerance > 0.0) {
+            monitor.reset(new PUMA::ConvergenceMonitor(convergence.steady_tolerance,
+                        convergence.period_tolerance, convergence.period_cycles));
+        }
+
+        // The main loop
+        for (size_t i = first_step; i * dt < end_time; ++i) {
+            /* Nothing looks at the state in between the frames, so all
+             * the steps up to the next frame are applied in one go,
+             * leaving the engine free to reorder the work
+             */
+            size_t steps = 1;
+            while (i % write_every != 0 && !checkpoint_due(i) && (i + 1) * dt < end_time) {
+                ++i;
+                ++steps;
+            }
+
+            /* Only print a notification message if they are
+             * not turned off. Print a new one every notify_after frames,
+             * the averages being summed during the last step
+             */
+            bool notify = notify_after != -1 && i%(print_every * notify_after) == 0;
+            bool watch = monitor && !monitor->converged() && i % print_every == 0;
+            simulation->track_statistics(notify || watch);
+            {
+                PUMA::ScopedTimer timer(PUMA::PHASE_STEP);
+                simulation->apply_steps(steps);
+            }
+            PUMA::count_metric(PUMA::COUNTER_STEPS, steps);
+
+            /* The frame of the step convergence is detected at is the
+             * first to record it, and possibly the last one
+             */
+            bool stop = false;
+            if (watch && monitor->add(i + 1, dt, simulation->get_statistics())) {
+                PUMA::convergence_record record = monitor->get_result();
+                record.action = convergence.thin_factor > 0 ? 2 : 1;
+                stop = convergence.thin_factor == 0;
+
+                if (pipeline) pipeline->flush();
+                serializer->convergence = record;
+
+                if (notify_after != -1) {
+                    if (record.reason == PUMA::STEADY_STATE)
+                        std::cout << "Steady state reached";
+                    else
+                        std::cout << "Periodic orbit of period " << record.period << " reached";
+                    std::cout << " after " << record.step << " steps, "
+                        << (stop ? "stopping" : "thinning the output") << std::endl;
+                }
+            }
+
+            if (notify) { 
+                std::cout << i / print_every << " frames had been written\n";
+
+                PUMA::average_densities averages = simulation->get_averages();
+                std::cout << "Average hare and puma densities after " << i / print_every 
+                    << " frames are " << averages.first << " and " << averages.second
+                    << " respectively." << std::endl;
+            }
+
+            if (i%write_every == 0) {
+                if (pipeline)
+                    pipeline->push(*simulation, i / print_every);
+                else
+                    write_frame(simulation->get_state(), i / print_every);
+            }
+
+            if (checkpoint_due(i))
+                checkpoints->save(*simulation, i + 1);
+
+            if (stop) break;
+            if (serializer->convergence.action == 2)
+                write_every = print_every * convergence.thin_factor;
+        }
+
+        if (checkpoints) {
+            checkpoints->flush();
+            checkpoints.reset();
+        }
+
+        if (pipeline) {
+            pipeline->flush();
+            if (notify_after != -1) {
+                std::cout << "The simulation waited for the output for ";
+                PUMA::format_time(pipeline->blocked_time());
+            }
+            pipeline.reset();
+        }
+
+        // Close the output files, if they require closing
+        if (!split_files) {
+            finish_compression();
+
+            PUMA::ScopedTimer timer(PUMA::PHASE_FILES);
+            output.close();
+            if (aux_output_fn.length() > 0) aux_output.close();
+        }
+    } catch (PUMA::FormatError& e) {
+        std::cerr << e.what() << std::endl;
+        // The checkpoints still queued use the writer, so the pipeline goes first
+        pipeline.reset();
+        delete simulation;
+        return -1;
+    } catch (PUMA::SystemError& e) {
+        std::cerr << e.what() << std::endl;
+        pipeline.reset();
+        delete simulation;
+        return -1;
+    }
+
+    if (reporter) reporter->finish();
+
     // Outputs the total runtime
     PUMA::format_time(PUMA::get_time_micro_s() - start_time); 
 
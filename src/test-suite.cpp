@@ -2,6 +2,39 @@
 #include <boost/test/unit_test.hpp>
 #include <iostream>
 #include <Simulator.hpp>
+#include <HaloSimulator.hpp>
+#include <SoASimulator.hpp>
+#include <SparseSimulator.hpp>
+#include <TiledSimulator.hpp>
+#include <IslandSimulator.hpp>
+#include <DistributedSimulator.hpp>
+#include <Integrators.hpp>
+#include <Convergence.hpp>
+#include <Metrics.hpp>
+#include <Engines.hpp>
+#include <OutputPipeline.hpp>
+#include <FrameReader.hpp>
+#include <MapLoader.hpp>
+#include <InitialState.hpp>
+#include <Ensemble.hpp>
+#include <BatchSimulator.hpp>
+#include <Checkpoint.hpp>
+#include <Compression.hpp>
+#include <TextFormat.hpp>
+#include <Components.hpp>
+#include <Statistics.hpp>
+#include <WorkerPool.hpp>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
 using namespace boost::unit_test;
 using namespace boost;
 using namespace PUMA;
@@ -165,9 +198,1456 @@ BOOST_AUTO_TEST_CASE(check_migration_rate)
     delete[] landmap1;
 }
 
+/** Creates an irregular land map with water on the edges,
+ *  inland lakes and land touching the borders
+ */
+bool* irregular_landmap(size_t size_x, size_t size_y)
+{
+    bool *landmap = new bool[size_x * size_y];
+    for (size_t j = 0; j < size_y; ++j)
+        for (size_t i = 0; i < size_x; ++i)
+            landmap[i + j * size_x] = (i * 7 + j * 3) % 11 != 0 && (i + j) % 13 != 5;
+
+    return landmap;
+}
+
+/** Checks whether two simulations hold exactly
+ *  the same state
+ */
+bool same_state(Simulator &first, Simulator &second, size_t cells)
+{
+    shared_array<landscape> first_state = first.get_state();
+    shared_array<landscape> second_state = second.get_state();
+
+    for (size_t i = 0; i < cells; ++i) {
+        if (first_state[i].hare_density != second_state[i].hare_density ||
+                first_state[i].puma_density != second_state[i].puma_density)
+            return false;
+    }
+    return true;
+}
+
+/** Checks if the neighbours of the cells are
+ *  described correctly by the Topology
+ */
+BOOST_AUTO_TEST_CASE(check_topology)
+{
+    // 1 1 0
+    // 0 1 1
+    bool landmap1[] = {true, true, false, false, true, true};
+    Topology topology(3, 2, landmap1);
+
+    BOOST_CHECK(topology.land_cells == 4);
+    BOOST_CHECK(topology.at(0, 0) == (Topology::LAND | Topology::EAST | 1 << Topology::COUNT_SHIFT));
+    BOOST_CHECK(topology.at(1, 0) == (Topology::LAND | Topology::WEST | Topology::SOUTH
+                | 2 << Topology::COUNT_SHIFT));
+    BOOST_CHECK(topology.at(2, 0) == (Topology::WEST | Topology::SOUTH | 2 << Topology::COUNT_SHIFT));
+    BOOST_CHECK(topology.at(0, 1) == (Topology::NORTH | Topology::EAST | 2 << Topology::COUNT_SHIFT));
+    BOOST_CHECK(Topology::neighbours(topology.at(1, 1)) == 2);
+    BOOST_CHECK(topology.at(2, 1) == (Topology::LAND | Topology::WEST | 1 << Topology::COUNT_SHIFT));
+}
+
+/** Checks if the halo engine gives results bit-identical
+ *  to the reference implementation
+ */
+BOOST_AUTO_TEST_CASE(check_halo_engine)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+
+    Simulator reference(23, 17, landmap1);
+    HaloSimulator tested(23, 17, landmap1);
+    tested.set_state(reference.get_state().get());
+
+    for (int step = 0; step < 200; ++step) {
+        reference.apply_step();
+        tested.apply_step();
+    }
+    BOOST_CHECK(same_state(reference, tested, 23 * 17));
+
+    delete[] landmap1;
+}
+
+/** Checks if the SoA engine gives results bit-identical
+ *  to the reference implementation with every kernel
+ *  that can run on this CPU
+ */
+BOOST_AUTO_TEST_CASE(check_soa_engine)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+
+    const list<kernel_isa<double> > &kernels = available_kernels<double_precision>();
+    for (list<kernel_isa<double> >::const_iterator it = kernels.begin();
+            it != kernels.end(); ++it) {
+        if (!it->supported()) continue;
+
+        Simulator reference(23, 17, landmap1);
+        SoASimulator tested(23, 17, landmap1);
+        tested.set_kernel(it->name);
+        tested.set_state(reference.get_state().get());
+
+        for (int step = 0; step < 200; ++step) {
+            reference.apply_step();
+            tested.apply_step();
+        }
+        BOOST_CHECK_MESSAGE(same_state(reference, tested, 23 * 17),
+                "kernel " << it->name);
+    }
+
+    delete[] landmap1;
+}
+
+/** Checks if every kernel of the float and mixed precisions
+ *  gives the same results as their scalar kernels, and if
+ *  these stay close to the double precision ones
+ */
+template <class Precision>
+void check_precision(bool *landmap1, double tolerance)
+{
+    const list<kernel_isa<float> > &kernels = available_kernels<Precision>();
+
+    Simulator reference(23, 17, landmap1);
+    BasicSoASimulator<Precision> scalar(23, 17, landmap1);
+    scalar.set_kernel("scalar");
+    scalar.set_state(reference.get_state().get());
+    reference.set_state(scalar.get_state().get());
+
+    for (list<kernel_isa<float> >::const_iterator it = kernels.begin();
+            it != kernels.end(); ++it) {
+        if (!it->supported() || it->name == "scalar") continue;
+
+        BasicSoASimulator<Precision> tested(23, 17, landmap1);
+        tested.set_kernel(it->name);
+        tested.set_state(scalar.get_state().get());
+
+        BasicSoASimulator<Precision> expected(23, 17, landmap1);
+        expected.set_kernel("scalar");
+        expected.set_state(scalar.get_state().get());
+
+        for (int step = 0; step < 200; ++step) {
+            expected.apply_step();
+            tested.apply_step();
+        }
+        BOOST_CHECK_MESSAGE(same_state(expected, tested, 23 * 17),
+                Precision::name() << " kernel " << it->name);
+    }
+
+    for (int step = 0; step < 200; ++step) {
+        reference.apply_step();
+        scalar.apply_step();
+    }
+
+    shared_array<landscape> state = scalar.get_state(), expected = reference.get_state();
+    for (size_t i = 0; i < 23 * 17; ++i) {
+        BOOST_CHECK_SMALL(state[i].hare_density - expected[i].hare_density, tolerance);
+        BOOST_CHECK_SMALL(state[i].puma_density - expected[i].puma_density, tolerance);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(check_float_engines)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+
+    check_precision<single_precision>(landmap1, 1e-4);
+    check_precision<mixed_precision>(landmap1, 1e-5);
+
+    // Only the soa based engines have other precisions
+    engine_settings settings;
+    settings.precision = "float";
+    Simulator *tested = create_simulator("tiled", 23, 17, landmap1, settings);
+    BOOST_CHECK(dynamic_cast<BasicTiledSimulator<single_precision>*>(tested) != NULL);
+    delete tested;
+    BOOST_CHECK_THROW(create_simulator("halo", 23, 17, landmap1, settings), IllegalValue);
+
+    delete[] landmap1;
+}
+
+/** Checks if stepping only the land gives results 
+ *  bit-identical to the reference implementation
+ *  and leaves the water untouched
+ */
+BOOST_AUTO_TEST_CASE(check_sparse_engine)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+
+    Simulator reference(23, 17, landmap1);
+    SparseSimulator tested(23, 17, landmap1);
+    tested.set_state(reference.get_state().get());
+
+    for (int step = 0; step < 200; ++step) {
+        reference.apply_step();
+        tested.apply_step();
+    }
+    BOOST_CHECK(same_state(reference, tested, 23 * 17));
+
+    shared_array<landscape> state = tested.get_state();
+    for (size_t i = 0; i < 23 * 17; ++i) {
+        if (!landmap1[i]) BOOST_CHECK(state[i].hare_density == 0.0);
+    }
+
+    delete[] landmap1;
+}
+
+/** Checks if stepping every island on its own gives results
+ *  bit-identical to the reference implementation, with an
+ *  island lying inside the bounding box of another one
+ */
+BOOST_AUTO_TEST_CASE(check_island_engine)
+{
+    // A ring with an island in its lake, a strip cut in five and a single cell
+    bool landmap1[20 * 14];
+    for (size_t j = 0; j < 14; ++j) {
+        for (size_t i = 0; i < 20; ++i) {
+            bool ring = i >= 1 && i <= 12 && j >= 1 && j <= 10
+                && !(i >= 3 && i <= 10 && j >= 3 && j <= 8);
+            bool lake = i >= 5 && i <= 8 && j >= 5 && j <= 6;
+            bool strip = i >= 15 && i <= 17 && (i + j) % 4 != 0;
+            landmap1[j * 20 + i] = ring || lake || strip || (i == 19 && j == 13);
+        }
+    }
+
+    Simulator reference(20, 14, landmap1);
+    IslandSimulator tested(20, 14, landmap1);
+    BOOST_CHECK(tested.get_islands() == 8);
+    tested.set_state(reference.get_state().get());
+
+    for (int step = 0; step < 60; ++step)
+        reference.apply_step();
+    tested.apply_step();
+    tested.apply_steps(9);
+    tested.set_threads(3);
+    tested.apply_steps(50);
+    BOOST_CHECK(same_state(reference, tested, 20 * 14));
+
+    shared_array<landscape> state = tested.get_state();
+    for (size_t i = 0; i < 20 * 14; ++i) {
+        if (!landmap1[i]) BOOST_CHECK(state[i].hare_density == 0.0);
+    }
+}
+
+/** Checks if splitting the map between processes gives
+ *  results bit-identical to the reference implementation,
+ *  with blocks of uneven sizes, down to a single row
+ */
+BOOST_AUTO_TEST_CASE(check_distributed_engine)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+
+    BOOST_CHECK_THROW(DistributedSimulator(2, 2, landmap1, 5), IllegalValue);
+
+    Simulator reference(23, 17, landmap1);
+    for (size_t ranks = 1; ranks <= 6; ++ranks) {
+        DistributedSimulator tested(23, 17, landmap1, ranks);
+        tested.set_state(reference.get_state().get());
+
+        const DistributedSimulator::block &last = tested.get_block(ranks - 1);
+        BOOST_CHECK(last.x0 + last.width == 23 && last.y0 + last.height == 17);
+
+        Simulator expected(23, 17, landmap1);
+        expected.set_state(reference.get_state().get());
+        for (int step = 0; step < 30; ++step)
+            expected.apply_step();
+
+        tested.apply_step();
+        tested.apply_steps(9);
+        tested.track_statistics(true);
+        tested.apply_steps(20);
+        BOOST_CHECK_MESSAGE(same_state(expected, tested, 23 * 17), ranks << " ranks");
+        BOOST_CHECK(tested.get_averages() == expected.get_averages());
+    }
+
+    Simulator small(4, 2, landmap1);
+    DistributedSimulator thin(4, 2, landmap1, 4);
+    BOOST_CHECK(thin.get_block(3).width == 2 && thin.get_block(3).height == 1);
+    thin.set_state(small.get_state().get());
+    for (int step = 0; step < 10; ++step)
+        small.apply_step();
+    thin.apply_steps(10);
+    BOOST_CHECK(same_state(small, thin, 4 * 2));
+
+    // A rank that dies makes the steps fail instead of waiting for it forever
+    DistributedSimulator failing(23, 17, landmap1, 3);
+    kill(failing.get_processes()[1], SIGKILL);
+    BOOST_CHECK_THROW(failing.apply_steps(5), SystemError);
+    BOOST_CHECK_THROW(failing.get_averages(), SystemError);
+
+    delete[] landmap1;
+}
+
+/// Largest difference between the densities of two simulations
+double largest_difference(Simulator &first, Simulator &second, size_t cells)
+{
+    shared_array<landscape> first_state = first.get_state();
+    shared_array<landscape> second_state = second.get_state();
+
+    double largest = 0.0;
+    for (size_t i = 0; i < cells; ++i) {
+        largest = max(largest, fabs(first_state[i].hare_density
+                    - second_state[i].hare_density));
+        largest = max(largest, fabs(first_state[i].puma_density
+                    - second_state[i].puma_density));
+    }
+    return largest;
+}
+
+/** Checks if the Euler integrator is the soa engine, if
+ *  the higher order ones converge faster as the timestep
+ *  shrinks, and if the adaptive one meets its tolerance
+ */
+BOOST_AUTO_TEST_CASE(check_integrators)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+    Simulator initial(23, 17, landmap1);
+
+    BOOST_CHECK_THROW(choose_integrator("leapfrog"), IllegalValue);
+    step_parameters params = {0.08, 0.04, 0.02, 0.06, 0.2, 0.2, 0.01};
+    BOOST_CHECK_CLOSE(stability_limit(choose_integrator("euler"), params), 2.0 / 1.66, 1e-9);
+    BOOST_CHECK(stability_limit(choose_integrator("rk4"), params)
+            > stability_limit(choose_integrator("heun"), params));
+
+    SoASimulator soa(23, 17, landmap1);
+    IntegratorSimulator euler(23, 17, landmap1);
+    soa.set_state(initial.get_state().get());
+    euler.set_state(initial.get_state().get());
+    soa.apply_steps(20);
+    euler.apply_steps(20);
+    BOOST_CHECK(same_state(soa, euler, 23 * 17));
+
+    // rk4 with a tiny timestep is as good as the exact solution
+    IntegratorSimulator exact(23, 17, landmap1);
+    exact.set_integrator("rk4");
+    exact.dt = 0.005;
+    exact.set_state(initial.get_state().get());
+    exact.apply_steps(400);
+
+    const char *methods[] = {"euler", "heun", "rk4"};
+    double errors[3][2];
+    for (int method = 0; method < 3; ++method) {
+        for (int refined = 0; refined < 2; ++refined) {
+            IntegratorSimulator tested(23, 17, landmap1);
+            tested.set_integrator(methods[method]);
+            tested.dt = refined ? 0.1 : 0.2;
+            tested.set_state(initial.get_state().get());
+            tested.apply_steps(refined ? 20 : 10);
+            errors[method][refined] = largest_difference(exact, tested, 23 * 17);
+        }
+
+        // Halving the timestep divides the error by 2 to the order
+        double order = log2(errors[method][0] / errors[method][1]);
+        BOOST_CHECK_MESSAGE(fabs(order - (method == 2 ? 4 : method + 1)) < 0.3,
+                methods[method] << " converges with order " << order);
+    }
+    BOOST_CHECK(errors[2][0] < errors[1][0] && errors[1][0] < errors[0][0]);
+
+    IntegratorSimulator adaptive(23, 17, landmap1);
+    adaptive.set_integrator("rk23");
+    adaptive.tolerance = 1e-7;
+    adaptive.dt = 1.0;
+    adaptive.set_state(initial.get_state().get());
+    adaptive.track_statistics(true);
+    adaptive.apply_steps(2);
+    BOOST_CHECK(adaptive.get_accepted() > 2);
+    BOOST_CHECK(largest_difference(exact, adaptive, 23 * 17) < 1e-4);
+    BOOST_CHECK_CLOSE(adaptive.get_averages().first, exact.get_averages().first, 1e-4);
+
+    delete[] landmap1;
+}
+
+/** Checks if advancing tiles many steps at once gives
+ *  results bit-identical to the reference implementation,
+ *  with tiles not dividing the map evenly and steps not
+ *  being a multiple of the block size
+ */
+BOOST_AUTO_TEST_CASE(check_tiled_engine)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+
+    Simulator reference(23, 17, landmap1);
+    TiledSimulator tested(23, 17, landmap1);
+    tested.tile_width = 5;
+    tested.tile_height = 4;
+    tested.block_steps = 3;
+    tested.set_state(reference.get_state().get());
+
+    for (int step = 0; step < 100; ++step)
+        reference.apply_step();
+    tested.apply_steps(1);
+    tested.apply_steps(2);
+    tested.apply_steps(97);
+    BOOST_CHECK(same_state(reference, tested, 23 * 17));
+
+    tested.set_threads(3);
+    for (int step = 0; step < 10; ++step)
+        reference.apply_step();
+    tested.apply_steps(10);
+    BOOST_CHECK(same_state(reference, tested, 23 * 17));
+
+    delete[] landmap1;
+}
+
+/** Checks if the auto engine chooses the sparse one
+ *  only on maps with little land
+ */
+BOOST_AUTO_TEST_CASE(check_auto_engine)
+{
+    bool landmap1[100];
+    for (size_t i = 0; i < 100; ++i)
+        landmap1[i] = i < 30;
+
+    Simulator *tested = create_simulator("auto", 10, 10, landmap1);
+    BOOST_CHECK(dynamic_cast<SparseSimulator*>(tested) != NULL);
+    delete tested;
+
+    for (size_t i = 0; i < 100; ++i)
+        landmap1[i] = i < 70;
+
+    tested = create_simulator("auto", 10, 10, landmap1);
+    BOOST_CHECK(dynamic_cast<SparseSimulator*>(tested) == NULL);
+    BOOST_CHECK(dynamic_cast<SoASimulator*>(tested) != NULL);
+    delete tested;
+}
+
+/** Checks if splitting the rows between threads gives
+ *  the same results as the serial execution, for every engine
+ */
+BOOST_AUTO_TEST_CASE(check_threads)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+
+    const list<Engine> &engines = available_engines();
+    for (list<Engine>::const_iterator it = engines.begin();
+            it != engines.end(); ++it) {
+        for (size_t threads = 2; threads <= 5; ++threads) {
+            Simulator *serial = it->create(23, 17, landmap1, engine_settings());
+            Simulator *parallel = it->create(23, 17, landmap1, engine_settings());
+            parallel->set_threads(threads);
+            parallel->set_state(serial->get_state().get());
+
+            for (int step = 0; step < 50; ++step) {
+                serial->apply_step();
+                parallel->apply_step();
+            }
+            BOOST_CHECK_MESSAGE(same_state(*serial, *parallel, 23 * 17),
+                    "engine " << it->name << ", " << threads << " threads");
+
+            delete serial;
+            delete parallel;
+        }
+    }
+
+    // Every band is finished before the exception of one of them is rethrown
+    WorkerPool pool(4);
+    std::atomic<size_t> finished(0);
+    WorkerPool::task failing = [&](size_t begin, size_t end) {
+        if (begin == 0) throw IllegalValue("band 0");
+        this_thread::sleep_for(chrono::milliseconds(20));
+        finished += end - begin;
+    };
+    BOOST_CHECK_THROW(pool.run(failing, 8), IllegalValue);
+    BOOST_CHECK_EQUAL(finished.load(), 6u);
+    pool.run([&](size_t begin, size_t end) { finished += end - begin; }, 8);
+    BOOST_CHECK_EQUAL(finished.load(), 14u);
+
+    delete[] landmap1;
+}
+
 /// Create the test suite itself
 test_suite *init_unit_test_suite(int, char *[])
 {
     framework::master_test_suite().p_name.value = "PUMA unit test";
     return 0;
 }
+
+/** Checks if the output pipeline writes snapshots of
+ *  every frame in order, blocks when out of buffers and
+ *  hands the errors of the writer back
+ */
+BOOST_AUTO_TEST_CASE(check_output_pipeline)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+    Simulator simulation(23, 17, landmap1);
+
+    vector<size_t> frames;
+    vector<double> densities, expected;
+    {
+        OutputPipeline pipeline(23, 17, 1,
+                [&](shared_array<landscape> state, size_t frame) {
+                    this_thread::sleep_for(chrono::milliseconds(20));
+                    frames.push_back(frame);
+                    densities.push_back(state[100].hare_density);
+                });
+
+        for (size_t frame = 0; frame < 5; ++frame) {
+            expected.push_back(simulation.get_state()[100].hare_density);
+            pipeline.push(simulation, frame);
+            simulation.apply_step();
+        }
+        pipeline.flush();
+        BOOST_CHECK(pipeline.blocked_time() > 0);
+    }
+
+    BOOST_CHECK(frames.size() == 5);
+    for (size_t frame = 0; frame < frames.size(); ++frame) {
+        BOOST_CHECK(frames[frame] == frame);
+        BOOST_CHECK(densities[frame] == expected[frame]);
+    }
+
+    OutputPipeline failing(23, 17, 2, [](shared_array<landscape>, size_t) {
+                throw IllegalValue("disk full");
+            });
+    failing.push(simulation, 0);
+    BOOST_CHECK_THROW(failing.flush(), IllegalValue);
+
+    delete[] landmap1;
+}
+
+/** Checks if the frames written by the binary serializer
+ *  are read back exactly, together with the land mask
+ *  and the parameters
+ */
+BOOST_AUTO_TEST_CASE(check_binary_frames)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+    Simulator simulation(23, 17, landmap1);
+    simulation.current_serializer = Serializer::choose_output_method("binary");
+    simulation.dt = 0.005;
+
+    string filename = "check_binary_frames.pumas";
+    vector<shared_array<landscape> > expected;
+    {
+        ofstream output(filename.c_str(), ios::binary);
+        for (int frame = 0; frame < 3; ++frame) {
+            simulation.serialize(&output);
+            shared_array<landscape> state(new landscape[23 * 17]);
+            copy(simulation.get_state().get(), simulation.get_state().get() + 23 * 17, state.get());
+            expected.push_back(state);
+            simulation.apply_step();
+        }
+    }
+
+    {
+        FrameReader reader(filename);
+        BOOST_CHECK(reader.get_size_x() == 23 && reader.get_size_y() == 17);
+        BOOST_CHECK(reader.get_frames() == 3);
+        BOOST_CHECK(reader.get_parameters().dt == 0.005);
+
+        for (size_t frame = 0; frame < 3; ++frame) {
+            shared_array<landscape> state = reader.get_state(frame);
+            for (size_t i = 0; i < 23 * 17; ++i) {
+                BOOST_CHECK(state[i].is_land == landmap1[i]);
+                BOOST_CHECK(state[i].hare_density == expected[frame][i].hare_density);
+                BOOST_CHECK(state[i].puma_density == expected[frame][i].puma_density);
+            }
+        }
+        BOOST_CHECK_THROW(reader.get_hares(3), IllegalValue);
+    }
+    remove(filename.c_str());
+
+    BOOST_CHECK_THROW(FrameReader("no_such_file.pumas"), FormatError);
+
+    delete[] landmap1;
+}
+
+/** Checks if the DCD trajectory holds the whole first
+ *  frame and then only the land densities, with the frame
+ *  count kept in its header
+ */
+BOOST_AUTO_TEST_CASE(check_dcd_frames)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+    Simulator simulation(23, 17, landmap1);
+    simulation.current_serializer = Serializer::choose_output_method("dcd");
+    BOOST_CHECK(simulation.current_serializer->aux_extension == "xyz");
+
+    size_t cells = 23 * 17, land = 0;
+    for (size_t index = 0; index < cells; ++index)
+        land += landmap1[index];
+
+    string filename = "check_dcd_frames.dcd", structure_fn = "check_dcd_frames.xyz";
+    {
+        ofstream output(filename.c_str(), ios::binary), structure(structure_fn.c_str());
+        for (int frame = 0; frame < 3; ++frame) {
+            simulation.apply_step();
+            simulation.serialize(&output, &structure);
+        }
+    }
+
+    ifstream input(filename.c_str(), ios::binary);
+    vector<char> contents((istreambuf_iterator<char>(input)), istreambuf_iterator<char>());
+    const int32_t *words = reinterpret_cast<const int32_t*>(&contents[0]);
+    BOOST_CHECK(words[0] == 84 && memcmp(&words[1], "CORD", 4) == 0);
+    BOOST_CHECK_EQUAL(words[2], 3);
+    BOOST_CHECK(words[3] == 0 && words[4] == 1 && words[5] == 3 && words[6] == 0);
+    BOOST_CHECK_EQUAL(size_t(words[10]), 3 * cells - 2 * land);
+
+    size_t header = 92 + (4 + 4 + 160 + 4) + 12 + (4 + 8 * land + 4);
+    size_t first = 3 * (8 + 12 * cells), later = 3 * (8 + 8 * land);
+    BOOST_CHECK_EQUAL(contents.size(), header + first + 2 * later);
+
+    // The heights of the free atoms of the last frame
+    const float *z = reinterpret_cast<const float*>(&contents[header + first + later
+            + 2 * (8 + 8 * land) + 4]);
+    shared_array<landscape> state = simulation.get_state();
+    size_t atom = 0;
+    for (size_t index = 0; index < cells; ++index) {
+        if (!landmap1[index]) continue;
+        BOOST_CHECK(z[atom++] == float(state[index].hare_density * 10.0));
+        BOOST_CHECK(z[atom++] == float(state[index].puma_density * 10.0));
+    }
+
+    ifstream structure(structure_fn.c_str());
+    size_t atoms = 0, lines = 0;
+    structure >> atoms;
+    for (string line; getline(structure, line); )
+        ++lines;
+    BOOST_CHECK_EQUAL(atoms, 3 * cells);
+    BOOST_CHECK_EQUAL(lines, 3 * cells + 2);
+
+    remove(filename.c_str());
+    remove(structure_fn.c_str());
+    delete[] landmap1;
+}
+
+/** Checks if the compressed outputs decompress to exactly
+ *  what the serializers wrote, and if single frames are
+ *  read back from the middle of a chunk
+ */
+BOOST_AUTO_TEST_CASE(check_compressed_output)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+    const char *methods[] = {"binary", "vmd"};
+
+    for (int method = 0; method < 2; ++method) {
+        Simulator simulation(23, 17, landmap1);
+        simulation.initialize(UniformDistribution(7));
+        simulation.current_serializer = Serializer::choose_output_method(methods[method]);
+
+        string plain_fn = "check_compressed_output", compressed_fn = plain_fn + ".pz",
+            decompressed_fn = plain_fn + ".out";
+        {
+            ofstream plain(plain_fn.c_str(), ios::binary);
+            ofstream compressed(compressed_fn.c_str(), ios::binary);
+            FrameCompressor compressor(compressed, 2);
+            for (int frame = 0; frame < 5; ++frame) {
+                simulation.serialize(&plain);
+                simulation.serialize(&compressed);
+                compressor.end_frame();
+
+                // Closes the second chunk after a single frame
+                if (frame == 2) compressor.flush();
+                simulation.apply_steps(3);
+            }
+            compressor.finish();
+        }
+
+        CompressedReader reader(compressed_fn);
+        BOOST_CHECK_EQUAL(reader.get_frames(), 5u);
+        {
+            ofstream decompressed(decompressed_fn.c_str(), ios::binary);
+            reader.decompress(decompressed);
+        }
+
+        ifstream plain_input(plain_fn.c_str(), ios::binary),
+            decompressed_input(decompressed_fn.c_str(), ios::binary);
+        string expected((istreambuf_iterator<char>(plain_input)), istreambuf_iterator<char>());
+        string written((istreambuf_iterator<char>(decompressed_input)),
+                istreambuf_iterator<char>());
+        BOOST_CHECK_MESSAGE(written == expected, "method " << methods[method]);
+
+        uint64_t offset = 0;
+        vector<char> frame = reader.get_frame(4, &offset);
+        BOOST_CHECK(offset + frame.size() == expected.size());
+        BOOST_CHECK(string(frame.begin(), frame.end()) == expected.substr(offset));
+        BOOST_CHECK_THROW(reader.get_frame(5), IllegalValue);
+
+        ifstream compressed_input(compressed_fn.c_str(), ios::binary | ios::ate);
+        BOOST_CHECK(size_t(compressed_input.tellg()) < expected.size());
+
+        remove(plain_fn.c_str());
+        remove(compressed_fn.c_str());
+        remove(decompressed_fn.c_str());
+    }
+
+    BOOST_CHECK_THROW(CompressedReader("no_such_file.pz"), FormatError);
+
+    delete[] landmap1;
+}
+
+/// A ByteSink keeping what is written, counting the blocks
+class CountingSink : public ByteSink {
+public:
+    string bytes;
+    size_t position, blocks;
+
+    CountingSink(size_t capacity) : ByteSink(capacity), position(0), blocks(0) {}
+    ~CountingSink() { flush(); }
+
+    bool is_open() { return true; }
+
+protected:
+    void write_out(const char *data, size_t count)
+    {
+        bytes.replace(position, min(count, bytes.size() - position), data, count);
+        position += count;
+        ++blocks;
+    }
+    std::streamoff tell_out() { return position; }
+    void seek_out(std::streamoff offset) { position = offset; }
+};
+
+/** Checks if the byte sinks write numbers as the streams do
+ *  and in blocks, and if the serializers read a view of a
+ *  part of a wider grid as they read the grid itself
+ */
+BOOST_AUTO_TEST_CASE(check_grid_view_sinks)
+{
+    const double reals[] = {0.0, -0.0, 1.0, -2.5, 0.1, 1e-5, 123456.5, 1234567.0,
+        6.02214076e23, -1.602e-19, 0.000123456789, 99999.95, HUGE_VAL};
+    const long long integers[] = {0, 7, -42, 1234567890123LL, -9223372036854775807LL - 1};
+
+    ostringstream expected;
+    CountingSink numbers(16);
+    for (size_t n = 0; n < sizeof(reals) / sizeof(reals[0]); ++n) {
+        expected << reals[n] << ' ';
+        numbers << reals[n] << ' ';
+    }
+    for (size_t n = 0; n < sizeof(integers) / sizeof(integers[0]); ++n) {
+        expected << integers[n] << '\n';
+        numbers << integers[n] << '\n';
+    }
+    expected << 18446744073709551615ULL << " end";
+    numbers << 18446744073709551615ULL << " end";
+    numbers.flush();
+    BOOST_CHECK_EQUAL(numbers.bytes, expected.str());
+
+    // Rewriting the beginning, then going on at the end
+    ostringstream stream;
+    {
+        StreamSink sink(&stream);
+        sink << "abcdef";
+        BOOST_CHECK_EQUAL(sink.tell(), 6);
+        sink.seek(2);
+        sink << "XY";
+        sink.seek(6);
+        sink << '!';
+        BOOST_CHECK(sink.is_open());
+    }
+    BOOST_CHECK_EQUAL(stream.str(), "abXYef!");
+    BOOST_CHECK(!StreamSink(NULL).is_open());
+
+    // A 23x17 window at (4, 3) of a 31x25 grid
+    bool *landmap1 = irregular_landmap(31, 25);
+    Simulator simulation(31, 25, landmap1);
+    simulation.initialize(UniformDistribution(7));
+    boost::shared_array<landscape> wide = simulation.get_state();
+    boost::shared_array<landscape> window(new landscape[23 * 17]);
+    for (size_t j = 0; j < 17; ++j)
+        for (size_t i = 0; i < 23; ++i)
+            window[j * 23 + i] = wide[(j + 3) * 31 + i + 4];
+    GridView view(&wide[3 * 31 + 4], 23, 17, 31);
+    BOOST_CHECK_EQUAL(view.get_stride(), 31u);
+    BOOST_CHECK_EQUAL(view.hare_density(5, 2), window[2 * 23 + 5].hare_density);
+
+    const char *methods[] = {"gnuplot", "vmd", "plainppm", "binary"};
+    for (int method = 0; method < 4; ++method) {
+        Serializer *serializer = Serializer::choose_output_method(methods[method]);
+
+        ostringstream dense, dense_aux;
+        {
+            StreamSink output(&dense), aux_output(&dense_aux);
+            serializer->serialize(GridView(window.get(), 23, 17), output, aux_output);
+        }
+
+        CountingSink output(4096), aux_output(4096);
+        serializer->serialize(view, output, aux_output);
+        output.flush();
+        aux_output.flush();
+
+        BOOST_CHECK_MESSAGE(output.bytes == dense.str(), "method " << methods[method]);
+        BOOST_CHECK_MESSAGE(aux_output.bytes == dense_aux.str(), "method " << methods[method]);
+
+        // No flush per line, the buffer only being written when full
+        BOOST_CHECK_MESSAGE(output.blocks <= output.bytes.size() / 4096 + 3,
+                "method " << methods[method] << ", " << output.blocks << " blocks");
+    }
+
+    delete[] landmap1;
+}
+
+/** Checks if the numbers are formatted as printf formats
+ *  them, also around the roundings to fewer digits, and if
+ *  the text serializers write the same with more threads
+ */
+BOOST_AUTO_TEST_CASE(check_text_formatting)
+{
+    mt19937_64 generator(25);
+    uniform_real_distribution<double> mantissa(1.0, 10.0);
+    uniform_int_distribution<int> exponent(-30, 30);
+
+    vector<double> values = {0.0, -0.0, 1.0, 0.5, 0.05, 0.0001, 0.00001, 99999.95,
+        999999.5, 9.9999995, 0.0999995, 0.09999995, 1e15, 1e16, 1e21, 1e22, 1e23,
+        123456789012.0, 4.9e-324, 2.2250738585072014e-308, 1.7976931348623157e308,
+        HUGE_VAL, -HUGE_VAL, NAN};
+    for (int n = 0; n < 20000; ++n) {
+        double value = mantissa(generator) * pow(10.0, exponent(generator));
+        values.push_back(n % 2 ? value : -value);
+        values.push_back(generator() % 1000000 / 2.0);
+        uint64_t bits = generator();
+        double any;
+        memcpy(&any, &bits, sizeof(any));
+        values.push_back(any);
+    }
+
+    size_t mismatches = 0;
+    for (int precision = 1; precision <= 17; ++precision) {
+        for (size_t n = 0; n < values.size(); ++n) {
+            char expected[64], text[max_number_length];
+            snprintf(expected, sizeof(expected), "%.*g", precision, values[n]);
+            string written(text, format_real(values[n], precision, text));
+            if (written != expected && mismatches++ < 10)
+                BOOST_ERROR(expected << " written as " << written);
+        }
+    }
+    BOOST_CHECK_EQUAL(mismatches, 0u);
+
+    const long long integers[] = {0, 9, 10, 99, 100, -7, 1234567890123LL,
+        -9223372036854775807LL - 1};
+    for (size_t n = 0; n < sizeof(integers) / sizeof(integers[0]); ++n) {
+        char expected[32], text[max_number_length];
+        snprintf(expected, sizeof(expected), "%lld", integers[n]);
+        BOOST_CHECK_EQUAL(string(text, format_integer(integers[n], text)), expected);
+    }
+
+    bool *landmap1 = irregular_landmap(23, 17);
+    Simulator simulation(23, 17, landmap1);
+    simulation.initialize(UniformDistribution(7));
+    boost::shared_array<landscape> state = simulation.get_state();
+
+    const char *methods[] = {"gnuplot", "vmd", "plainppm", "dcd"};
+    for (int method = 0; method < 4; ++method) {
+        Serializer *serializer = Serializer::choose_output_method(methods[method]);
+
+        string written[2][2];
+        for (int threads = 1; threads <= 3; threads += 2) {
+            serializer->set_format_threads(threads);
+            ostringstream output, aux_output;
+            {
+                StreamSink main_sink(&output), aux_sink(&aux_output);
+                serializer->serialize(GridView(state.get(), 23, 17), main_sink, aux_sink);
+            }
+            written[threads / 2][0] = output.str();
+            written[threads / 2][1] = aux_output.str();
+        }
+        serializer->set_format_threads(1);
+
+        BOOST_CHECK_MESSAGE(written[0][0] == written[1][0], "method " << methods[method]);
+        BOOST_CHECK_MESSAGE(written[0][1] == written[1][1], "method " << methods[method]);
+    }
+
+    // More digits, as a stream with that precision writes them
+    Serializer *vmd = Serializer::choose_output_method("vmd");
+    vmd->set_digits(9);
+    ostringstream output, expected;
+    {
+        StreamSink sink(&output);
+        vmd->serialize(GridView(state.get(), 23, 17), sink, sink);
+    }
+    vmd->set_digits(6);
+    expected.precision(9);
+    expected << 3 * 23 * 17 - 1 << "\nS 0 0 " << state[0].hare_density * vmd->scale << "\n";
+    BOOST_CHECK_EQUAL(output.str().substr(0, expected.str().size()), expected.str());
+
+    // The PPM samples stay integers with few digits
+    Serializer *plainppm = Serializer::choose_output_method("plainppm");
+    plainppm->set_digits(1);
+    ostringstream ppm;
+    {
+        StreamSink sink(&ppm);
+        plainppm->serialize(GridView(state.get(), 23, 17), sink, sink);
+    }
+    plainppm->set_digits(6);
+    istringstream samples(ppm.str());
+    string magic, sample;
+    samples >> magic;
+    BOOST_CHECK_EQUAL(magic, "P3");
+    size_t count = 0;
+    while (samples >> sample) {
+        ++count;
+        BOOST_CHECK_MESSAGE(sample.find_first_not_of("-0123456789") == string::npos,
+                "sample " << sample);
+    }
+    BOOST_CHECK_EQUAL(count, 3u + 3 * 23 * 17);
+
+    BOOST_CHECK_THROW(vmd->set_digits(0), IllegalValue);
+    BOOST_CHECK_THROW(vmd->set_digits(18), IllegalValue);
+    BOOST_CHECK_THROW(vmd->set_format_threads(0), IllegalValue);
+
+    delete[] landmap1;
+}
+
+/** Checks if the land maps are read the same from
+ *  the .dat files and every PNM format
+ */
+BOOST_AUTO_TEST_CASE(check_map_loader)
+{
+    // 1 0 0
+    // 0 1 1
+    bool expected[] = {true, false, false, false, true, true};
+
+    const char dat[] = "3 2\n1 0 0 \n0 1 1 \n";
+    const char plain_pbm[] = "P1\n# a comment\n3 2\n100\n011\n";
+    const char plain_pgm[] = "P2\n3 2\n255\n0 255 200\n255 10 127\n";
+    const char plain_ppm[] = "P3 3 2 15\n0 0 0  15 15 15  9 9 9\n9 9 9  0 1 2  1 2 3\n";
+    const char raw_pbm[] = "P4\n3 2\n\x80\x60";
+    const char raw_pgm[] = "P5 3 2 255\n\x00\xff\xc8\xff\x0a\x7f";
+    const char raw_pgm16[] = "P5 3 2 1000\n\x00\x00\x03\xe8\x01\xf4\x03\x00\x00\x0a\x01\x00";
+
+    const char *maps[] = {dat, plain_pbm, plain_pgm, plain_ppm, raw_pbm, raw_pgm, raw_pgm16};
+    size_t lengths[] = {sizeof(dat), sizeof(plain_pbm), sizeof(plain_pgm),
+        sizeof(plain_ppm), sizeof(raw_pbm), sizeof(raw_pgm), sizeof(raw_pgm16)};
+
+    for (size_t map = 0; map < 7; ++map) {
+        land_map loaded = parse_land_map(maps[map], lengths[map] - 1);
+        BOOST_CHECK(loaded.size_x == 3 && loaded.size_y == 2);
+        for (size_t i = 0; i < 6; ++i)
+            BOOST_CHECK_MESSAGE(loaded.land[i] == expected[i], "map " << map << " cell " << i);
+    }
+
+    const char truncated[] = "3 2\n1 0 0\n0 1";
+    BOOST_CHECK_THROW(parse_land_map(truncated, sizeof(truncated) - 1), FormatError);
+    const char garbage[] = "P5 3 2 255\n\x00";
+    BOOST_CHECK_THROW(parse_land_map(garbage, sizeof(garbage) - 1), FormatError);
+    BOOST_CHECK_THROW(load_land_map("no_such_map.dat"), FormatError);
+}
+
+/** Checks the Philox generator against the known answers
+ *  of its reference implementation, and if the seeded
+ *  initial state does not depend on the engine or on the
+ *  number of threads
+ */
+BOOST_AUTO_TEST_CASE(check_initial_state)
+{
+    uint32_t zero_counter[4] = {0, 0, 0, 0}, zero_key[2] = {0, 0};
+    uint32_t pi_counter[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+    uint32_t pi_key[2] = {0xa4093822, 0x299f31d0};
+    uint32_t random[4];
+
+    philox4x32(zero_counter, zero_key, random);
+    BOOST_CHECK(random[0] == 0x6627e8d5 && random[1] == 0xe169c58d &&
+            random[2] == 0xbc57ac4c && random[3] == 0x9b00dbd8);
+    philox4x32(pi_counter, pi_key, random);
+    BOOST_CHECK(random[0] == 0xd16cfe09 && random[1] == 0x94fdcceb &&
+            random[2] == 0x5001e420 && random[3] == 0x24126ea1);
+
+    bool *landmap1 = irregular_landmap(23, 17);
+    UniformDistribution uniform(42);
+
+    Simulator serial(23, 17, landmap1);
+    serial.initialize(uniform);
+    shared_array<landscape> state = serial.get_state();
+    for (size_t i = 0; i < 23 * 17; ++i) {
+        if (landmap1[i]) {
+            BOOST_CHECK(state[i].hare_density >= 0.0 && state[i].hare_density < 5.0);
+            BOOST_CHECK(state[i].hare_density != state[i].puma_density);
+        } else {
+            BOOST_CHECK(state[i].hare_density == 0.0 && state[i].puma_density == 0.0);
+        }
+    }
+
+    const list<Engine> &engines = available_engines();
+    for (list<Engine>::const_iterator it = engines.begin();
+            it != engines.end(); ++it) {
+        Simulator *parallel = it->create(23, 17, landmap1, engine_settings());
+        parallel->set_threads(3);
+        parallel->initialize(uniform);
+        BOOST_CHECK_MESSAGE(same_state(serial, *parallel, 23 * 17), "engine " << it->name);
+        delete parallel;
+    }
+
+    serial.initialize(*create_distribution("constant:1.5:0.25", 0));
+    BOOST_CHECK(serial.get_state()[100].hare_density == 1.5);
+    BOOST_CHECK(serial.get_state()[100].puma_density == 0.25);
+    BOOST_CHECK_THROW(create_distribution("constant:1.5", 0), IllegalValue);
+    BOOST_CHECK_THROW(create_distribution("gaussian", 0), IllegalValue);
+
+    // The densities are never negative
+    BOOST_CHECK_THROW(create_distribution("uniform:5:1", 0), IllegalValue);
+    BOOST_CHECK_THROW(create_distribution("uniform:-1:1", 0), IllegalValue);
+    BOOST_CHECK_THROW(create_distribution("constant:1.5:-0.25", 0), IllegalValue);
+
+    // The name of a file may hold colons, a trailing number being the frame
+    string filename = "check:initial.pumas";
+    {
+        Simulator written(23, 17, landmap1);
+        written.current_serializer = Serializer::choose_output_method("binary");
+        ofstream output(filename.c_str(), ios::binary);
+        written.initialize(ConstantDistribution(2.0, 1.0));
+        written.serialize(&output);
+        written.initialize(ConstantDistribution(3.0, 1.0));
+        written.serialize(&output);
+    }
+    serial.initialize(*create_distribution("file:" + filename + ":0", 0));
+    BOOST_CHECK(serial.get_state()[100].hare_density == 2.0);
+    serial.initialize(*create_distribution("file:" + filename, 0));
+    BOOST_CHECK(serial.get_state()[100].hare_density == 3.0);
+    BOOST_CHECK_THROW(create_distribution("file:", 0), IllegalValue);
+    remove(filename.c_str());
+
+    delete[] landmap1;
+}
+
+/** Checks if the sweeps are expanded into the right
+ *  members, and if the ensemble runner gives every member
+ *  the averages of a simulation run on its own, whatever
+ *  the number of threads
+ */
+BOOST_AUTO_TEST_CASE(check_ensemble)
+{
+    step_parameters defaults = {0.08, 0.04, 0.02, 0.06, 0.2, 0.2, 0.01};
+    istringstream spec("# a comment\n"
+            "r = 0.1 0.2\n"
+            "k = 0.1:0.3:0.1 # inclusive\n"
+            "member m=0.5 seed=9\n");
+    vector<ensemble_member> members = parse_sweep(spec, defaults, 3);
+
+    BOOST_REQUIRE(members.size() == 7);
+    BOOST_CHECK(members[0].parameters.m == 0.5 && members[0].seed == 9);
+    BOOST_CHECK(members[1].parameters.r == 0.1 && members[1].parameters.k == 0.1);
+    BOOST_CHECK(members[2].parameters.r == 0.1 && abs(members[2].parameters.k - 0.2) < 1e-15);
+    BOOST_CHECK(members[6].parameters.r == 0.2 && abs(members[6].parameters.k - 0.3) < 1e-15);
+    BOOST_CHECK(members[6].parameters.a == 0.04 && members[6].seed == 3);
+
+    istringstream invalid("q = 1\n");
+    BOOST_CHECK_THROW(parse_sweep(invalid, defaults, 3), IllegalValue);
+
+    // Every member does the same steps, so they share the timestep
+    istringstream swept_dt("dt = 0.01 0.02\n"), member_dt("member r=0.1 dt=0.02\n");
+    BOOST_CHECK_THROW(parse_sweep(swept_dt, defaults, 3), IllegalValue);
+    BOOST_CHECK_THROW(parse_sweep(member_dt, defaults, 3), IllegalValue);
+
+    land_map map;
+    map.size_x = 23;
+    map.size_y = 17;
+    map.land.reset(irregular_landmap(23, 17));
+
+    EnsembleRunner runner(map, "soa", engine_settings());
+    ensemble_results serial = runner.run(members, 20, 5, 1);
+    ensemble_results parallel = runner.run(members, 20, 5, 3);
+
+    for (size_t member = 0; member < members.size(); ++member) {
+        Simulator alone(23, 17, map.land.get());
+        alone.r = members[member].parameters.r;
+        alone.k = members[member].parameters.k;
+        alone.m = members[member].parameters.m;
+        alone.initialize(UniformDistribution(members[member].seed));
+        for (int step = 0; step < 20; ++step)
+            alone.apply_step();
+
+        BOOST_REQUIRE(serial.averages[member].size() == 5);
+        BOOST_CHECK(serial.averages[member][4] == alone.get_averages());
+        BOOST_CHECK(parallel.averages[member] == serial.averages[member]);
+    }
+
+    stringstream stored;
+    serial.write(stored);
+    ensemble_results loaded;
+    loaded.read(stored);
+    BOOST_CHECK(loaded.sample_every == 5 && loaded.members.size() == 7);
+    BOOST_CHECK(loaded.averages == serial.averages);
+
+    BOOST_CHECK_THROW(EnsembleRunner(map, "distributed", engine_settings()), IllegalValue);
+}
+
+/** Checks that every lane of a batch gives exactly the
+ *  results of a Simulator with the same parameters, with
+ *  every kernel, and that batched ensembles do not change
+ */
+BOOST_AUTO_TEST_CASE(check_batch_simulator)
+{
+    bool *land = irregular_landmap(23, 17);
+    const size_t lanes = 5;
+
+    for (const batch_kernel_isa &isa : available_batch_kernels()) {
+        if (!isa.supported()) continue;
+
+        BatchSimulator batch(23, 17, land, lanes);
+        batch.set_kernel(isa.name);
+        batch.set_threads(isa.name == "scalar" ? 1 : 2);
+
+        vector<boost::shared_ptr<Simulator> > alone;
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            step_parameters p = {0.08 + 0.01 * lane, 0.04, 0.02 + 0.005 * lane,
+                0.06, 0.1 + 0.03 * lane, 0.2, 0.01 + 0.002 * lane};
+            batch.set_parameters(lane, p);
+            batch.initialize(lane, UniformDistribution(lane + 1));
+
+            alone.push_back(boost::shared_ptr<Simulator>(new Simulator(23, 17, land)));
+            alone[lane]->r = p.r;
+            alone[lane]->b = p.b;
+            alone[lane]->k = p.k;
+            alone[lane]->dt = p.dt;
+            alone[lane]->initialize(UniformDistribution(lane + 1));
+        }
+
+        batch.apply_steps(30);
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            for (int step = 0; step < 30; ++step)
+                alone[lane]->apply_step();
+
+            shared_array<landscape> expected = alone[lane]->get_state();
+            shared_array<landscape> got = batch.get_state(lane);
+            bool identical = true;
+            for (size_t index = 0; index < 23 * 17; ++index) {
+                identical &= got[index].hare_density == expected[index].hare_density
+                    && got[index].puma_density == expected[index].puma_density
+                    && got[index].is_land == expected[index].is_land;
+            }
+            BOOST_CHECK_MESSAGE(identical, isa.name << " lane " << lane);
+            BOOST_CHECK(batch.get_averages(lane) == alone[lane]->get_averages());
+        }
+    }
+
+    BOOST_CHECK_THROW(BatchSimulator(23, 17, land, 0), IllegalValue);
+    BatchSimulator batch(23, 17, land, 2);
+    BOOST_CHECK_THROW(batch.get_averages(2), IllegalValue);
+
+    land_map map;
+    map.size_x = 23;
+    map.size_y = 17;
+    map.land.reset(land);
+
+    step_parameters defaults = {0.08, 0.04, 0.02, 0.06, 0.2, 0.2, 0.01};
+    istringstream spec("r = 0.05:0.11:0.01\nm = 0.04 0.08\n");
+    vector<ensemble_member> members = parse_sweep(spec, defaults, 7);
+
+    engine_settings batched;
+    batched.batch_lanes = 4;
+    ensemble_results single = EnsembleRunner(map, "soa", engine_settings()).run(members, 20, 5, 2);
+    ensemble_results grouped = EnsembleRunner(map, "soa", batched).run(members, 20, 5, 2);
+    BOOST_CHECK(grouped.averages == single.averages);
+
+    batched.integrator = "rk4";
+    BOOST_CHECK_THROW(EnsembleRunner(map, "soa", batched).run(members, 20, 5, 2), IllegalValue);
+}
+
+/** Checks that a simulation resumed from a checkpoint
+ *  continues bit-exactly, and that checkpoints of another
+ *  map or broken files are told apart
+ */
+BOOST_AUTO_TEST_CASE(check_checkpoint)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+    const char *filename = "test-checkpoint.chk";
+
+    boost::scoped_ptr<Simulator> uninterrupted(create_simulator("tiled", 23, 17, landmap1));
+    uninterrupted->r = 0.1;
+    uninterrupted->dt = 0.02;
+    uninterrupted->initialize(UniformDistribution(11));
+
+    boost::scoped_ptr<Simulator> interrupted(create_simulator("soa", 23, 17, landmap1));
+    interrupted->r = 0.1;
+    interrupted->dt = 0.02;
+    interrupted->initialize(UniformDistribution(11));
+    interrupted->apply_steps(13);
+    {
+        OutputPipeline frames(23, 17, 1, [](shared_array<landscape>, size_t) {});
+        CheckpointWriter writer(filename, *interrupted, 11, &frames);
+        writer.save(*interrupted, 13);
+        writer.flush();
+    }
+    interrupted.reset();
+
+    checkpoint snapshot = read_checkpoint(filename);
+    BOOST_CHECK(snapshot.step == 13 && snapshot.seed == 11);
+    BOOST_CHECK(snapshot.parameters.r == 0.1 && snapshot.parameters.dt == 0.02);
+
+    Simulator resumed(23, 17, landmap1);
+    BOOST_CHECK(snapshot.land_hash == land_hash(resumed.get_state().get(), 23, 17));
+    resumed.set_state(snapshot.state.get());
+    resumed.r = snapshot.parameters.r;
+    resumed.dt = snapshot.parameters.dt;
+    resumed.apply_steps(7);
+    uninterrupted->apply_steps(20);
+
+    shared_array<landscape> expected = uninterrupted->get_state();
+    shared_array<landscape> got = resumed.get_state();
+    bool identical = true;
+    for (size_t index = 0; index < 23 * 17; ++index) {
+        identical &= got[index].hare_density == expected[index].hare_density
+            && got[index].puma_density == expected[index].puma_density;
+    }
+    BOOST_CHECK(identical);
+
+    // The adaptive integrator goes on with the step size it had reached
+    IntegratorSimulator adaptive(23, 17, landmap1);
+    adaptive.set_integrator("rk23");
+    adaptive.tolerance = 1e-7;
+    adaptive.dt = 0.5;
+    adaptive.initialize(UniformDistribution(11));
+    adaptive.apply_steps(3);
+    {
+        CheckpointWriter writer(filename, adaptive, 11);
+        writer.save(adaptive, 3);
+        writer.flush();
+    }
+    adaptive.apply_steps(2);
+
+    checkpoint adaptive_snapshot = read_checkpoint(filename);
+    BOOST_CHECK(adaptive_snapshot.step_size > 0.0);
+    IntegratorSimulator adaptive_resumed(23, 17, landmap1);
+    adaptive_resumed.set_integrator("rk23");
+    adaptive_resumed.tolerance = 1e-7;
+    adaptive_resumed.set_state(adaptive_snapshot.state.get());
+    adaptive_resumed.dt = adaptive_snapshot.parameters.dt;
+    adaptive_resumed.set_step_size(adaptive_snapshot.step_size);
+    adaptive_resumed.apply_steps(2);
+    BOOST_CHECK(largest_difference(adaptive, adaptive_resumed, 23 * 17) == 0.0);
+
+    bool *other = irregular_landmap(23, 17);
+    other[5] = !other[5];
+    Simulator elsewhere(23, 17, other);
+    BOOST_CHECK(snapshot.land_hash != land_hash(elsewhere.get_state().get(), 23, 17));
+
+    {
+        ofstream truncated(filename, ios::binary | ios::trunc);
+        truncated.write("PUMACHK", 8);
+    }
+    BOOST_CHECK_THROW(read_checkpoint(filename), FormatError);
+    remove(filename);
+
+    delete[] landmap1;
+    delete[] other;
+}
+
+/** Checks if the statistics collected during the steps
+ *  match the ones of a separate pass, for every engine,
+ *  and if the land is split into the right components
+ */
+BOOST_AUTO_TEST_CASE(check_statistics)
+{
+    // Two islands and a single cell touching one only by a corner
+    bool landmap1[6 * 4] = {
+        1, 1, 0, 0, 1, 0,
+        0, 1, 0, 1, 1, 0,
+        0, 0, 1, 0, 1, 1,
+        0, 0, 0, 0, 0, 0};
+    Topology topology(6, 4, landmap1);
+    LandComponents components(topology);
+    BOOST_CHECK(components.components.size() == 3);
+    BOOST_CHECK(components.at(1, 1) == 0 && components.at(4, 0) == 1);
+    BOOST_CHECK(components.at(2, 2) == 2 && components.at(2, 0) == 3);
+    BOOST_CHECK(components.components[1].x0 == 3 && components.components[1].x1 == 6);
+    BOOST_CHECK(components.components[1].y0 == 0 && components.components[1].y1 == 3);
+    BOOST_CHECK(components.components[1].cells == 5);
+
+    bool *landmap2 = irregular_landmap(23, 17);
+    Simulator reference(23, 17, landmap2);
+    reference.initialize(UniformDistribution(5));
+    reference.apply_steps(7);
+
+    shared_array<landscape> state = reference.get_state();
+    double hares = 0.0, pumas = 0.0, squares = 0.0;
+    size_t cells = 0;
+    for (size_t index = 0; index < 23 * 17; ++index) {
+        if (!state[index].is_land) continue;
+        hares += state[index].hare_density;
+        pumas += state[index].puma_density;
+        ++cells;
+    }
+    for (size_t index = 0; index < 23 * 17; ++index) {
+        if (!state[index].is_land) continue;
+        double deviation = state[index].hare_density - hares / cells;
+        squares += deviation * deviation;
+    }
+
+    density_statistics expected = reference.get_statistics();
+    BOOST_CHECK(expected.land_cells == cells);
+    BOOST_CHECK(abs(expected.hares.mean - hares / cells) < 1e-12);
+    BOOST_CHECK(abs(expected.pumas.total - pumas) < 1e-10);
+    BOOST_CHECK(abs(expected.hares.variance - squares / cells) < 1e-12);
+
+    double regions = 0.0;
+    for (size_t region = 0; region < expected.region_hares.size(); ++region)
+        regions += expected.region_hares[region];
+    BOOST_CHECK(abs(regions - hares) < 1e-10);
+
+    const list<Engine> &engines = available_engines();
+    for (list<Engine>::const_iterator it = engines.begin();
+            it != engines.end(); ++it) {
+        boost::scoped_ptr<Simulator> tested(it->create(23, 17, landmap2, engine_settings()));
+        tested->initialize(UniformDistribution(5));
+        tested->set_threads(3);
+        tested->track_statistics(true);
+        tested->apply_steps(3);
+        tested->apply_steps(4);
+
+        density_statistics got = tested->get_statistics();
+        BOOST_CHECK_MESSAGE(got.hares.total == expected.hares.total
+                && got.pumas.variance == expected.pumas.variance
+                && got.hares.min == expected.hares.min
+                && got.pumas.max == expected.pumas.max
+                && got.region_pumas == expected.region_pumas, "engine " << it->name);
+        BOOST_CHECK(tested->get_averages() == reference.get_averages());
+    }
+
+    delete[] landmap2;
+}
+
+/** Checks if the largest change of a step is the same
+ *  whatever the engine, and if the ConvergenceMonitor tells
+ *  a steady state and a periodic orbit from a damped one
+ */
+BOOST_AUTO_TEST_CASE(check_convergence)
+{
+    bool *landmap1 = irregular_landmap(23, 17);
+    Simulator reference(23, 17, landmap1);
+    reference.initialize(UniformDistribution(5));
+    reference.apply_steps(6);
+    shared_array<landscape> before = reference.get_state();
+    reference.track_statistics(true);
+    reference.apply_step();
+    shared_array<landscape> after = reference.get_state();
+
+    double largest = 0.0;
+    for (size_t index = 0; index < 23 * 17; ++index) {
+        if (!before[index].is_land) continue;
+        largest = max(largest, fabs(after[index].hare_density - before[index].hare_density));
+        largest = max(largest, fabs(after[index].puma_density - before[index].puma_density));
+    }
+    double expected = reference.get_statistics().largest_change;
+    BOOST_CHECK(expected == largest && expected > 0.0);
+
+    const list<Engine> &engines = available_engines();
+    for (list<Engine>::const_iterator it = engines.begin();
+            it != engines.end(); ++it) {
+        boost::scoped_ptr<Simulator> tested(it->create(23, 17, landmap1, engine_settings()));
+        tested->initialize(UniformDistribution(5));
+        tested->set_threads(3);
+        tested->track_statistics(true);
+        tested->apply_steps(7);
+        BOOST_CHECK_MESSAGE(tested->get_statistics().largest_change == expected,
+                "engine " << it->name);
+
+        // Unknown unless collected during the step
+        tested->track_statistics(false);
+        tested->apply_step();
+        BOOST_CHECK(tested->get_statistics().largest_change < 0.0);
+    }
+
+    engine_settings settings;
+    settings.integrator = "rk4";
+    boost::scoped_ptr<Simulator> integrated(create_simulator("soa", 23, 17, landmap1, settings));
+    integrated->initialize(UniformDistribution(5));
+    integrated->track_statistics(true);
+    integrated->apply_steps(7);
+    BOOST_CHECK_CLOSE(integrated->get_statistics().largest_change, expected, 1.0);
+
+    // The coexistence equilibrium does not move
+    shared_array<landscape> equilibrium = reference.get_state();
+    for (size_t index = 0; index < 23 * 17; ++index) {
+        equilibrium[index].hare_density = reference.m / reference.b;
+        equilibrium[index].puma_density = reference.r / reference.a;
+    }
+    reference.set_state(equilibrium.get());
+    reference.apply_step();
+    BOOST_CHECK(reference.get_statistics().largest_change < 1e-14);
+
+    ConvergenceMonitor steady(1e-6, 0.0);
+    density_statistics statistics = reference.get_statistics();
+    statistics.largest_change = 1e-3;
+    BOOST_CHECK(!steady.add(100, 0.01, statistics));
+    statistics.largest_change = -1.0;
+    BOOST_CHECK(!steady.add(200, 0.01, statistics));
+    statistics.largest_change = 1e-9;
+    BOOST_CHECK(steady.add(300, 0.01, statistics));
+    BOOST_CHECK(steady.get_result().reason == STEADY_STATE && steady.get_result().step == 300);
+    BOOST_CHECK(!steady.add(400, 0.01, statistics));
+
+    // Sampled 37.3 times per period, so that the samples never fall on the maxima
+    ConvergenceMonitor periodic(0.0, 1e-3), damped(0.0, 1e-3);
+    const double period = 37.3, pi = 3.14159265358979323846;
+    for (uint64_t step = 1; step < 400; ++step) {
+        double phase = 2 * pi * step / period;
+        statistics.hares.mean = 2.0 + sin(phase);
+        statistics.pumas.mean = 1.5 + 0.5 * cos(phase - 1.0);
+        if (periodic.add(step, 1.0, statistics)) {
+            BOOST_CHECK(step < 5 * period);
+        }
+
+        statistics.hares.mean = 2.0 + exp(-0.01 * step) * sin(phase);
+        damped.add(step, 1.0, statistics);
+    }
+    BOOST_CHECK(periodic.get_result().reason == PERIODIC_ORBIT);
+    BOOST_CHECK(fabs(periodic.get_result().period - period) < 1e-2 * period);
+    BOOST_CHECK(!damped.converged());
+
+    delete[] landmap1;
+}
+
+BOOST_AUTO_TEST_CASE(check_metrics)
+{
+    enable_metrics(true);
+    metrics_snapshot before = take_metrics_snapshot();
+
+    auto record = []() {
+        {
+            ScopedTimer timer(PHASE_SERIALIZATION);
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        count_metric(COUNTER_FRAMES, 3);
+    };
+    std::thread other(record);
+    record();
+    other.join();
+
+    bool *landmap1 = irregular_landmap(23, 17);
+    Simulator simulation(23, 17, landmap1);
+    simulation.track_statistics(true);
+    simulation.get_statistics();
+
+    metrics_snapshot after = take_metrics_snapshot();
+    BOOST_CHECK_EQUAL(after.total.calls[PHASE_SERIALIZATION] -
+            before.total.calls[PHASE_SERIALIZATION], 2u);
+    BOOST_CHECK_EQUAL(after.total.counters[COUNTER_FRAMES] -
+            before.total.counters[COUNTER_FRAMES], 6u);
+    BOOST_CHECK(after.total.seconds[PHASE_SERIALIZATION] -
+            before.total.seconds[PHASE_SERIALIZATION] > 0.005);
+    BOOST_CHECK(after.total.calls[PHASE_REDUCTION] > before.total.calls[PHASE_REDUCTION]);
+    BOOST_CHECK(after.threads.size() >= 2);
+
+    uint64_t frames = 0;
+    for (size_t index = 0; index < after.threads.size(); ++index)
+        frames += after.threads[index].counters[COUNTER_FRAMES];
+    BOOST_CHECK_EQUAL(frames, after.total.counters[COUNTER_FRAMES]);
+
+    ostringstream json, prometheus;
+    write_metrics_json(json, after);
+    write_metrics_prometheus(prometheus, after);
+    BOOST_CHECK(json.str().find("\"serialization\": {\"seconds\": ") != string::npos);
+    BOOST_CHECK(json.str().find("\"frames\": ") != string::npos);
+    BOOST_CHECK(prometheus.str().find("pumas_phase_calls_total{phase=\"serialization\"")
+            != string::npos);
+    BOOST_CHECK(prometheus.str().find("pumas_frames_total ") != string::npos);
+
+    BOOST_CHECK_THROW(MetricsReporter("metrics-test.json", "xml", 1.0), IllegalValue);
+
+    // Replaced while running, the last snapshot being marked
+    {
+        MetricsReporter reporter("metrics-test.json", "json", 0.01);
+        std::this_thread::sleep_for(std::chrono::milliseconds(30));
+        reporter.finish();
+    }
+    ifstream written("metrics-test.json");
+    string contents((istreambuf_iterator<char>(written)), istreambuf_iterator<char>());
+    BOOST_CHECK(contents.find("\"final\": true") != string::npos);
+    remove("metrics-test.json");
+
+    // Nothing is recorded once disabled
+    enable_metrics(false);
+    {
+        ScopedTimer timer(PHASE_SERIALIZATION);
+    }
+    BOOST_CHECK_EQUAL(take_metrics_snapshot().total.calls[PHASE_SERIALIZATION],
+            after.total.calls[PHASE_SERIALIZATION]);
+
+    delete[] landmap1;
+}